@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include "leveldb/slice.h"
 #include "util/perf_log.h"
 #include "leveldb/persistant_pool.h"
@@ -14,22 +16,98 @@ constexpr size_t nvm_size = 2147483648;
 
 using namespace leveldb;
 
+// Insert and lookup throughput of one node size and slot layout
+template <int kPageSize, bool kSplitLayout>
+static void SweepPoint(bool dram_inner = false) {
+  Random rand(10);
+  BasicFFBtree<kPageSize, kSplitLayout>* tree = new BasicFFBtree<kPageSize, kSplitLayout>;
+  tree->SetDramInnerNodes(dram_inner);
+  std::vector<uint64_t> keys;
+  uint64_t start_us = benchmark::NowMicros();
+  for (uint64_t i = 0; i < N*10; i++) {
+    uint64_t k = rand.Next();
+    keys.push_back(k);
+    tree->Insert(k, (void*)(i + 1));
+  }
+  uint64_t insert_us = benchmark::NowMicros() - start_us;
+  Random lookups(20);
+  start_us = benchmark::NowMicros();
+  for (uint64_t i = 0; i < N*10; i++) {
+    tree->Search(keys[lookups.Uniform(keys.size())]);
+  }
+  uint64_t search_us = benchmark::NowMicros() - start_us;
+  fprintf(stdout, "[BTree] page %4d %-11s%s: insert %.2f Mops/s, search %.2f Mops/s\n",
+          kPageSize, kSplitLayout ? "split" : "interleaved", dram_inner ? " dram inner" : "",
+          N*10.0 / insert_us, N*10.0 / search_us);
+}
+
 int main() {
   Random rand(10);
   nvram::create_pool(nvm_dir, nvm_size);
   FFBtree* tree = new FFBtree;
   // populate index with some data
+  std::vector<uint64_t> keys;
   for (uint64_t i = 0; i < N*50; i++) {
     uint64_t k = rand.Next();
-    tree->Insert(k, &k);
+    keys.push_back(k);
+    tree->Insert(k, (void*)(i + 1));
   }
   uint64_t s = rand.Next();
   // benchmark
   uint64_t start_us = benchmark::NowMicros();
   for (uint64_t i = 0; i < N; i++) {
-    uint64_t k = rand.Next();
-    tree->Insert(s+i, &k);
+    tree->Insert(s+i, (void*)(s+i));
   }
   uint64_t end_us = benchmark::NowMicros();
   fprintf(stdout, "[BTree] micros: %lu\n", end_us - start_us);
+
+  // point lookups of existing keys with each page search kernel
+  const PageSearchMode modes[] = {kScalarPageSearch, kSse42PageSearch, kAvx2PageSearch};
+  for (PageSearchMode mode : modes) {
+    if (!SetPageSearchMode(mode)) continue;
+    Random lookups(20);
+    uint64_t found = 0;
+    start_us = benchmark::NowMicros();
+    for (uint64_t i = 0; i < N*10; i++) {
+      found += tree->Search(keys[lookups.Uniform(keys.size())]) != nullptr;
+    }
+    end_us = benchmark::NowMicros();
+    fprintf(stdout, "[BTree] search %-6s: %.2f Mops/s (%lu found)\n", page_search.name,
+            N*10.0 / (end_us - start_us), found);
+  }
+
+  // ascending lookups, as done by the liveness check of a merge, from the
+  // root and resuming from the previous leaf
+  std::vector<uint64_t> sorted;
+  for (size_t i = 0; i < keys.size(); i += 4) {
+    sorted.push_back(keys[i]);
+  }
+  std::sort(sorted.begin(), sorted.end());
+  start_us = benchmark::NowMicros();
+  for (uint64_t k : sorted) {
+    tree->Search(k);
+  }
+  uint64_t root_us = benchmark::NowMicros() - start_us;
+  void* leaf = nullptr;
+  start_us = benchmark::NowMicros();
+  for (uint64_t k : sorted) {
+    tree->Search(k, &leaf);
+  }
+  uint64_t cursor_us = benchmark::NowMicros() - start_us;
+  fprintf(stdout, "[BTree] sorted search from root: %.2f Mops/s, from previous leaf: %.2f Mops/s\n",
+          sorted.size() * 1.0 / root_us, sorted.size() * 1.0 / cursor_us);
+
+  // node size and layout sweep with the best kernels
+  SetPageSearchMode(kAvx2PageSearch) || SetPageSearchMode(kSse42PageSearch);
+  SweepPoint<256, false>();
+  SweepPoint<256, true>();
+  SweepPoint<512, false>();
+  SweepPoint<512, true>();
+  SweepPoint<1024, false>();
+  SweepPoint<1024, true>();
+  SweepPoint<2048, false>();
+  SweepPoint<2048, true>();
+  SweepPoint<4096, false>();
+  SweepPoint<4096, true>();
+  SweepPoint<512, false>(true);
 }
@@ -10,6 +10,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "util/rate_limiter.h"
 #include "version.h"
 #include "version_edit.h"
 
@@ -21,7 +22,8 @@ Status BuildTable(const std::string& dbname,
                   TableCache* table_cache,
                   Iterator* iter,
                   FileMetaData* meta,
-                  VersionEdit* edit) {
+                  VersionEdit* edit,
+                  RateLimiter* limiter) {
   Status s;
   meta->file_size = 0;
   iter->SeekToFirst();
@@ -33,6 +35,9 @@ Status BuildTable(const std::string& dbname,
     if (!s.ok()) {
       return s;
     }
+    if (limiter != nullptr) {
+      file = limiter->Wrap(file, false);
+    }
     TableBuilder* builder = new TableBuilder(options, file, meta->number);
     meta->smallest.DecodeFrom(iter->key());
     Slice prev_key;
@@ -14,6 +14,7 @@ struct FileMetaData;
 
 class Env;
 class Iterator;
+class RateLimiter;
 class TableCache;
 class VersionEdit;
 class VersionEdit;
@@ -23,13 +24,15 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+// If limiter is non-null, the writes are charged to it without waiting.
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
                          FileMetaData* meta,
-                         VersionEdit* edit);
+                         VersionEdit* edit,
+                         RateLimiter* limiter = nullptr);
 
 }  // namespace leveldb
 
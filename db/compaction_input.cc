@@ -0,0 +1,215 @@
+#include "db/compaction_input.h"
+
+#include "db/dbformat.h"
+#include "db/version_edit.h"
+#include "leveldb/table.h"
+
+namespace leveldb {
+
+// One input table, positioned in one of its data blocks
+struct CompactionInput::Input {
+  Input() : index_iter(nullptr), block_iter(nullptr), block_start(false) { }
+  ~Input() {
+    delete block_iter;
+    delete index_iter;
+  }
+
+  uint64_t number;
+  TableHandle table;     // released after the iterators
+  Iterator* index_iter;  // at the entry of the current block
+  Iterator* block_iter;  // nullptr once the table is done
+  BlockHandle handle;
+  bool block_start;      // block_iter is at the first entry of the block
+};
+
+CompactionInput::CompactionInput(const InternalKeyComparator* icmp, TableCache* table_cache,
+                                 const ReadOptions& options,
+                                 const std::vector<std::shared_ptr<FileMetaData>>& files)
+    : icmp_(icmp),
+      table_cache_(table_cache),
+      options_(options),
+      current_(nullptr) {
+  for (const auto& f : files) {
+    Input* input = new Input;
+    input->number = f->number;
+    inputs_.push_back(input);
+    Status s = table_cache_->GetTable(f->number, f->file_size, &input->table);
+    if (!s.ok()) {
+      if (status_.ok()) status_ = s;
+      continue;
+    }
+    input->index_iter = input->table.table_->NewIndexIterator();
+  }
+}
+
+CompactionInput::~CompactionInput() {
+  for (Input* input : inputs_) {
+    delete input;
+  }
+}
+
+void CompactionInput::SetRange(const Slice& start, const Slice& end) {
+  start_.assign(start.data(), start.size());
+  end_.assign(end.data(), end.size());
+}
+
+void CompactionInput::SeekToFirst() {
+  for (Input* input : inputs_) {
+    if (input->index_iter == nullptr) continue;
+    if (start_.empty()) {
+      input->index_iter->SeekToFirst();
+      LoadBlock(input);
+      continue;
+    }
+    // the block whose index key is at or past start holds the first entry
+    input->index_iter->Seek(start_);
+    LoadBlock(input);
+    if (input->block_iter != nullptr && icmp_->Compare(input->block_iter->key(), start_) < 0) {
+      input->block_iter->Seek(start_);
+      input->block_start = false;
+      if (!input->block_iter->Valid()) {
+        input->index_iter->Next();
+        LoadBlock(input);
+      }
+    }
+  }
+  FindSmallest();
+}
+
+void CompactionInput::Seek(const Slice& target) {
+  // not implemented
+  status_ = Status::NotSupported("CompactionInput::Seek");
+  current_ = nullptr;
+}
+
+void CompactionInput::SeekToLast() {
+  // not implemented
+  status_ = Status::NotSupported("CompactionInput::SeekToLast");
+  current_ = nullptr;
+}
+
+void CompactionInput::Prev() {
+  // not implemented
+  status_ = Status::NotSupported("CompactionInput::Prev");
+  current_ = nullptr;
+}
+
+void CompactionInput::Next() {
+  assert(Valid());
+  Input* input = current_;
+  input->block_iter->Next();
+  input->block_start = false;
+  if (!input->block_iter->Valid()) {
+    if (!input->block_iter->status().ok() && status_.ok()) {
+      status_ = input->block_iter->status();
+    }
+    input->index_iter->Next();
+    LoadBlock(input);
+  }
+  FindSmallest();
+}
+
+void CompactionInput::SkipBlock() {
+  assert(Valid());
+  current_->index_iter->Next();
+  LoadBlock(current_);
+  FindSmallest();
+}
+
+Slice CompactionInput::key() const {
+  assert(Valid());
+  return current_->block_iter->key();
+}
+
+Slice CompactionInput::value() const {
+  assert(Valid());
+  return current_->block_iter->value();
+}
+
+Status CompactionInput::status() const {
+  return status_;
+}
+
+bool CompactionInput::AtWholeBlock() const {
+  assert(Valid());
+  if (!current_->block_start) return false;
+  // the index key of a block is at or past its last key
+  Slice limit = current_->index_iter->key();
+  if (!end_.empty() && icmp_->Compare(limit, end_) >= 0) {
+    return false;
+  }
+  for (Input* input : inputs_) {
+    if (input != current_ && input->block_iter != nullptr &&
+        icmp_->Compare(limit, input->block_iter->key()) >= 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t CompactionInput::file_number() const {
+  assert(Valid());
+  return current_->number;
+}
+
+const BlockHandle& CompactionInput::block_handle() const {
+  assert(Valid());
+  return current_->handle;
+}
+
+Iterator* CompactionInput::NewBlockIterator() const {
+  assert(Valid());
+  return current_->table.table_->BlockIterator(options_, current_->handle);
+}
+
+Status CompactionInput::ReadRawBlock(Slice* contents, CompressionType* type) const {
+  assert(Valid());
+  return current_->table.table_->ReadRawBlock(options_, current_->handle, contents, type);
+}
+
+// Positions input at the first entry of the block of its index iterator,
+// skipping empty blocks
+void CompactionInput::LoadBlock(Input* input) {
+  delete input->block_iter;
+  input->block_iter = nullptr;
+  input->block_start = false;
+  for (; input->index_iter->Valid(); input->index_iter->Next()) {
+    Slice handle_value = input->index_iter->value();
+    Status s = input->handle.DecodeFrom(&handle_value);
+    if (!s.ok()) {
+      if (status_.ok()) status_ = s;
+      return;
+    }
+    Iterator* iter = input->table.table_->BlockIterator(options_, input->handle);
+    iter->SeekToFirst();
+    if (iter->Valid()) {
+      input->block_iter = iter;
+      input->block_start = true;
+      return;
+    }
+    if (!iter->status().ok() && status_.ok()) {
+      status_ = iter->status();
+    }
+    delete iter;
+  }
+  if (!input->index_iter->status().ok() && status_.ok()) {
+    status_ = input->index_iter->status();
+  }
+}
+
+void CompactionInput::FindSmallest() {
+  current_ = nullptr;
+  for (Input* input : inputs_) {
+    if (input->block_iter == nullptr) continue;
+    if (current_ == nullptr ||
+        icmp_->Compare(input->block_iter->key(), current_->block_iter->key()) < 0) {
+      current_ = input;
+    }
+  }
+  if (current_ != nullptr && !end_.empty() &&
+      icmp_->Compare(current_->block_iter->key(), end_) >= 0) {
+    current_ = nullptr;
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,88 @@
+#ifndef STORAGE_LEVELDB_DB_COMPACTION_INPUT_H_
+#define STORAGE_LEVELDB_DB_COMPACTION_INPUT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "db/table_cache.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "table/format.h"
+
+namespace leveldb {
+
+struct FileMetaData;
+class InternalKeyComparator;
+
+// Entries of the input tables of a merge in internal key order, like the
+// iterator of NewMergingIterator, that also lets the caller move a data
+// block to the output as a whole instead of entry by entry.
+class CompactionInput : public Iterator {
+ public:
+  CompactionInput(const InternalKeyComparator* icmp, TableCache* table_cache,
+                  const ReadOptions& options,
+                  const std::vector<std::shared_ptr<FileMetaData>>& files);
+  ~CompactionInput();
+
+  // Restricts the entries to the internal keys in [start, end), an empty
+  // key leaving that side open.  Takes effect with the next SeekToFirst().
+  void SetRange(const Slice& start, const Slice& end);
+
+  virtual bool Valid() const { return current_ != nullptr; }
+  virtual void SeekToFirst();
+  virtual void Seek(const Slice& target);
+  virtual void SeekToLast();
+  virtual void Next();
+  virtual void Prev();
+  virtual Slice key() const;
+  virtual Slice value() const;
+  virtual Status status() const;
+
+  // Whether the current entry is the first of its data block and the whole
+  // block sorts before the current entries of the other tables and the end
+  // of the range, so that the block could be taken without breaking the
+  // order of the output.
+  // REQUIRES: Valid()
+  bool AtWholeBlock() const;
+
+  // Table and position of the data block of the current entry.
+  // REQUIRES: Valid()
+  uint64_t file_number() const;
+  const BlockHandle& block_handle() const;
+
+  // Returns a new iterator over the entries of the current data block.
+  // REQUIRES: Valid()
+  Iterator* NewBlockIterator() const;
+
+  // Reads the current data block as stored, see Table::ReadRawBlock.
+  // REQUIRES: Valid()
+  Status ReadRawBlock(Slice* contents, CompressionType* type) const;
+
+  // Moves past the rest of the current data block.
+  // REQUIRES: Valid()
+  void SkipBlock();
+
+ private:
+  struct Input;
+
+  void LoadBlock(Input* input);
+  void FindSmallest();
+
+  const InternalKeyComparator* icmp_;
+  TableCache* const table_cache_;
+  const ReadOptions options_;
+  std::vector<Input*> inputs_;
+  std::string start_;
+  std::string end_;
+  Input* current_;
+  Status status_;
+
+  // No copying allowed
+  CompactionInput(const CompactionInput&);
+  void operator=(const CompactionInput&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_COMPACTION_INPUT_H_
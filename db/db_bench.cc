@@ -3,6 +3,7 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <sys/types.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <unistd.h>
@@ -34,6 +35,10 @@
 //      readseq       -- read N times sequentially
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
+//      readrandompinned -- read N times in random order, values pinned
+//                       where they are instead of copied
+//      multireadrandom -- read N times in random order, in batches of
+//                       --multiget_batch keys through MultiGet
 //      readmissing   -- read N missing keys in random order
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
@@ -44,6 +49,7 @@
 //      compact     -- Compact the entire DB
 //      stats       -- Print DB stats
 //      sstables    -- Print sstable info
+//      mergepolicy -- Print the merge policy knobs and table live shares
 //      heapprofile -- Dump a heap profile (if supported by this port)
 static const char* FLAGS_benchmarks =
   "fillseq,"
@@ -115,6 +121,47 @@ static int FLAGS_merge_threshold = 50;
 // Range query size
 static int FLAGS_range_size = 1000;
 
+// Number of keys per MultiGet in multireadrandom
+static int FLAGS_multiget_batch = 100;
+
+// Number of threads inserting a new table into the index
+static int FLAGS_index_threads = 0;
+
+// If true, keep the inner nodes of the index in DRAM
+static bool FLAGS_index_dram_inner = false;
+
+// Number of threads scanning tables when the index is rebuilt on open
+static int FLAGS_index_rebuild_threads = 0;
+
+// If true, merges copy fully live data blocks instead of rewriting them
+static bool FLAGS_copy_live_blocks = false;
+
+// If true, data blocks carry a hash index of their keys
+static bool FLAGS_block_hash_index = false;
+
+// If true, data blocks store decimal keys as integers
+static bool FLAGS_int_key_blocks = false;
+
+// Number of key ranges merged concurrently by one merge
+static int FLAGS_max_subcompactions = 0;
+
+// Number of merges that may run at the same time
+static int FLAGS_max_background_merges = 0;
+
+// MB per second that flushes and merges may write, 0 for no limit
+static int FLAGS_compaction_rate_limit_mb = 0;
+
+// If true, lower the rate above while it slows down reads
+static bool FLAGS_compaction_rate_limit_auto = false;
+
+// If true, let the merge threshold follow write amplification, stalls and
+// garbage, starting from --merge_threshold
+static bool FLAGS_adaptive_merge_policy = false;
+
+// If true, use 16-byte binary keys (a fixed 8-byte prefix followed by the
+// big-endian key number) and the byte-string index instead of decimal keys.
+static bool FLAGS_binary_keys = false;
+
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
@@ -138,6 +185,18 @@ namespace leveldb {
 namespace {
 leveldb::Env* g_env = NULL;
 
+// Formats key number k into buf according to FLAGS_binary_keys
+Slice MakeKey(uint64_t k, char* buf) {
+  if (FLAGS_binary_keys) {
+    memcpy(buf, "tenant01", 8);
+    for (int i = 0; i < 8; i++) { // big-endian keeps numeric order
+      buf[8 + i] = static_cast<char>(k >> (56 - 8 * i));
+    }
+    return Slice(buf, 16);
+  }
+  return Slice(buf, snprintf(buf, 100, config::key_format, k));
+}
+
 // Helper for quickly generating random data.
 class RandomGenerator {
 private:
@@ -574,6 +633,10 @@ public:
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("readrandompinned")) {
+        method = &Benchmark::ReadRandomPinned;
+      } else if (name == Slice("multireadrandom")) {
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("scanrandom")) {
         ranges_ = FLAGS_num / FLAGS_range_size / 5; //扫描20%的数据
         range_size_ = FLAGS_range_size;
@@ -646,6 +709,8 @@ public:
         }
       } else if (name == Slice("sstables")) {
         PrintStats("leveldb.sstables");
+      } else if (name == Slice("mergepolicy")) {
+        PrintStats("leveldb.merge-policy");
       } else {
         if (name != Slice()) {  // No error message for empty name
           fprintf(stderr, "unknown benchmark '%s'\n", name.ToString().c_str());
@@ -856,7 +921,18 @@ private:
     options.filter_policy = filter_policy_;
     options.reuse_logs = FLAGS_reuse_logs;
     options.merge_threshold = FLAGS_merge_threshold;
-    options.index = CreateBtreeIndex();
+    options.index = FLAGS_binary_keys ? CreateStringBtreeIndex() : CreateBtreeIndex();
+    options.index_threads = FLAGS_index_threads;
+    options.index_dram_inner_nodes = FLAGS_index_dram_inner;
+    options.index_rebuild_threads = FLAGS_index_rebuild_threads;
+    options.copy_live_blocks = FLAGS_copy_live_blocks;
+    options.block_hash_index = FLAGS_block_hash_index;
+    options.int_key_blocks = FLAGS_int_key_blocks;
+    options.max_subcompactions = FLAGS_max_subcompactions;
+    options.max_background_merges = FLAGS_max_background_merges;
+    options.compaction_rate_limit = static_cast<uint64_t>(FLAGS_compaction_rate_limit_mb) << 20;
+    options.compaction_rate_limit_auto = FLAGS_compaction_rate_limit_auto;
+    options.adaptive_merge_policy = FLAGS_adaptive_merge_policy;
     options.compression = kNoCompression;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
@@ -898,10 +974,10 @@ private:
       batch.Clear();
       for (int j = 0; j < entries_per_batch_; j++) {
         const uint64_t k = seq ? i+j : (thread->rand.Next() % FLAGS_num);
-        char key[100];
-        snprintf(key, sizeof(key), config::key_format, k);
+        char buf[100];
+        Slice key = MakeKey(k, buf);
         batch.Put(key, gen.Generate(value_size_));
-        bytes += value_size_ + strlen(key);
+        bytes += value_size_ + key.size();
         thread->stats.FinishedSingleOp();
       }
       s = db_->Write(write_options_, &batch);
@@ -952,9 +1028,9 @@ private:
     std::string value;
     int found = 0;
     for (int i = 0; i < reads_; i++) {
-      char key[100];
+      char buf[100];
       const uint64_t k = thread->rand.Next() % FLAGS_num;
-      snprintf(key, sizeof(key), config::key_format, k);
+      Slice key = MakeKey(k, buf);
       if (db_->Get(options, key, &value).ok()) {
         found++;
       }
@@ -965,6 +1041,56 @@ private:
     thread->stats.AddMessage(msg);
   }
 
+  void ReadRandomPinned(ThreadState* thread) {
+    Log(db_->GetLogger(), "[db_bench] Starting random pinned read");
+    ReadOptions options;
+    PinnableSlice value;
+    int found = 0;
+    for (int i = 0; i < reads_; i++) {
+      char buf[100];
+      const uint64_t k = thread->rand.Next() % FLAGS_num;
+      Slice key = MakeKey(k, buf);
+      if (db_->Get(options, key, &value).ok()) {
+        found++;
+      }
+      value.Reset();
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
+  void MultiReadRandom(ThreadState* thread) {
+    Log(db_->GetLogger(), "[db_bench] Starting random batched read");
+    ReadOptions options;
+    const int batch = std::max(1, FLAGS_multiget_batch);
+    std::vector<std::string> key_storage(batch);
+    std::vector<Slice> keys(batch);
+    std::vector<std::string> values(batch);
+    std::vector<Status> statuses(batch);
+    int found = 0;
+    for (int i = 0; i < reads_; i += batch) {
+      const int n = std::min(batch, reads_ - i);
+      for (int j = 0; j < n; j++) {
+        char buf[100];
+        const uint64_t k = thread->rand.Next() % FLAGS_num;
+        key_storage[j] = MakeKey(k, buf).ToString();
+        keys[j] = key_storage[j];
+      }
+      db_->MultiGet(options, n, keys.data(), values.data(), statuses.data());
+      for (int j = 0; j < n; j++) {
+        if (statuses[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ScanRandom(ThreadState* thread) {
     Log(db_->GetLogger(), "[db_bench] Starting range query");
     ReadOptions options;
@@ -976,8 +1102,8 @@ private:
     double scanTime = 0;
     for (int i = 0; i < ranges_; i++) {
       const uint64_t k = (thread->rand.Next() % FLAGS_num);
-      char begin[100];
-      snprintf(begin, sizeof(begin), config::key_format, k);
+      char buf[100];
+      Slice begin = MakeKey(k, buf);
       scanbegin=g_env->NowMicros();
       Iterator* iter = db_->NewIterator(options);
       int r = 0;
@@ -1017,9 +1143,9 @@ private:
     std::string value;
     const int range = (FLAGS_num + 99) / 100;
     for (int i = 0; i < reads_; i++) {
-      char key[100];
+      char buf[100];
       const uint64_t k = thread->rand.Next() % range;
-      snprintf(key, sizeof(key), config::key_format, k);
+      Slice key = MakeKey(k, buf);
       db_->Get(options, key, &value);
       thread->stats.FinishedSingleOp();
     }
@@ -1030,9 +1156,9 @@ private:
     int found = 0;
     for (int i = 0; i < reads_; i++) {
       Iterator* iter = db_->NewIterator(options);
-      char key[100];
+      char buf[100];
       const uint64_t k = thread->rand.Next() % FLAGS_num;
-      snprintf(key, sizeof(key), config::key_format, k);
+      Slice key = MakeKey(k, buf);
       iter->Seek(key);
       if (iter->Valid() && iter->key() == key) found++;
       delete iter;
@@ -1051,8 +1177,8 @@ private:
       batch.Clear();
       for (int j = 0; j < entries_per_batch_; j++) {
         const uint64_t k = seq ? i+j : (thread->rand.Next() % FLAGS_num);
-        char key[100];
-        snprintf(key, sizeof(key), config::key_format, k);
+        char buf[100];
+        Slice key = MakeKey(k, buf);
         batch.Delete(key);
         thread->stats.FinishedSingleOp();
       }
@@ -1088,8 +1214,8 @@ private:
         }
 
         const uint64_t k = thread->rand.Next() % FLAGS_num;
-        char key[100];
-        snprintf(key, sizeof(key), config::key_format, k);
+        char buf[100];
+        Slice key = MakeKey(k, buf);
         Status s = db_->Put(write_options_, key, gen.Generate(value_size_));
         if (!s.ok()) {
           fprintf(stderr, "put error: %s\n", s.ToString().c_str());
@@ -1205,6 +1331,11 @@ int main(int argc, char** argv) {
   leveldb::benchmark::CreatePerfLog();
 #endif
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
+  FLAGS_index_threads = leveldb::Options().index_threads;
+  FLAGS_index_rebuild_threads = leveldb::Options().index_rebuild_threads;
+  FLAGS_copy_live_blocks = leveldb::Options().copy_live_blocks;
+  FLAGS_max_subcompactions = leveldb::Options().max_subcompactions;
+  FLAGS_max_background_merges = leveldb::Options().max_background_merges;
   FLAGS_max_file_size = leveldb::Options().max_file_size;
   FLAGS_block_size = leveldb::Options().block_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
@@ -1232,6 +1363,9 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--binary_keys=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_binary_keys = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -1256,6 +1390,36 @@ int main(int argc, char** argv) {
       FLAGS_merge_threshold = n;
     } else if (sscanf(argv[i], "--range_size=%d%c", &n, &junk) == 1) {
       FLAGS_range_size = n;
+    } else if (sscanf(argv[i], "--multiget_batch=%d%c", &n, &junk) == 1) {
+      FLAGS_multiget_batch = n;
+    } else if (sscanf(argv[i], "--index_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_index_threads = n;
+    } else if (sscanf(argv[i], "--index_dram_inner=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_index_dram_inner = n;
+    } else if (sscanf(argv[i], "--index_rebuild_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_index_rebuild_threads = n;
+    } else if (sscanf(argv[i], "--copy_live_blocks=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_copy_live_blocks = n;
+    } else if (sscanf(argv[i], "--block_hash_index=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_block_hash_index = n;
+    } else if (sscanf(argv[i], "--int_key_blocks=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_int_key_blocks = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--max_background_merges=%d%c", &n, &junk) == 1) {
+      FLAGS_max_background_merges = n;
+    } else if (sscanf(argv[i], "--compaction_rate_limit_mb=%d%c", &n, &junk) == 1) {
+      FLAGS_compaction_rate_limit_mb = n;
+    } else if (sscanf(argv[i], "--compaction_rate_limit_auto=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_compaction_rate_limit_auto = n;
+    } else if (sscanf(argv[i], "--adaptive_merge_policy=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_adaptive_merge_policy = n;
     } else if (sscanf(argv[i], "--nvm_size=%d%c", &n, &junk) == 1) {
       nvm_size = n;
       nvm_size = nvm_size * 1024 * 1024;
@@ -1283,14 +1447,22 @@ int main(int argc, char** argv) {
 
   if (!nvm_dir.empty()) {
     fprintf(stdout, "NVRAM pool: dir %s, size %lu\n", nvm_dir.data(), nvm_size);
-    leveldb::nvram::create_pool(nvm_dir, nvm_size);
+    if (FLAGS_use_existing_db) {
+      // the index of the existing db is found again in the pool
+      leveldb::nvram::open_pool(nvm_dir, nvm_size);
+    } else {
+      leveldb::nvram::create_pool(nvm_dir, nvm_size);
+    }
   } else {
     fprintf(stdout, "NVRAM pool is not allocated\n");
     fflush(stdout);
   }
 
-  leveldb::Benchmark benchmark;
-  benchmark.Run();
+  {
+    // the db has to be closed before the pool
+    leveldb::Benchmark benchmark;
+    benchmark.Run();
+  }
 #ifdef PERF_LOG
   leveldb::benchmark::ClosePerfLog();
 #endif
@@ -5,6 +5,8 @@
 #include "db/db_impl.h"
 
 #include <algorithm>
+#include <deque>
+#include <random>
 #include <set>
 #include <string>
 #include <stdint.h>
@@ -14,6 +16,7 @@
 #include "db/db_iter.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
+#include "db/index_builder.h"
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
@@ -32,6 +35,8 @@
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/rate_limiter.h"
+#include "util/thread_pool.h"
 #include "version.h"
 #include "version_control.h"
 #ifdef PERF_LOG
@@ -43,6 +48,17 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+// Marks the PM_root written by this version of the code
+static const uint64_t kPMRootMagic = 0x534c4d2d44420002ull;
+
+// Random id of a new DB, never 0
+static uint64_t NewDbId(Env* env) {
+  std::random_device device;
+  uint64_t id = (static_cast<uint64_t>(device()) << 32) | device();
+  id ^= env->NowMicros();
+  return id != 0 ? id : 1;
+}
+
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   Status status;
@@ -78,6 +94,16 @@ struct DBImpl::CompactionState {
   TableBuilder* builder;
 
   uint64_t total_bytes;
+  uint64_t copied_blocks;  // data blocks taken unchanged from the inputs
+  uint64_t copied_bytes;
+
+  // Range tombstones as of the start of the merge, in order of sequence
+  std::vector<RangeTombstone> range_tombstones;
+
+  // User key range [start, end) of a sub-compaction, empty for an open end
+  std::string start;
+  std::string end;
+  bool partial;            // cut short by shutdown
 
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
@@ -85,7 +111,10 @@ struct DBImpl::CompactionState {
       : compaction(c),
         outfile(nullptr),
         builder(nullptr),
-        total_bytes(0) {
+        total_bytes(0),
+        copied_blocks(0),
+        copied_bytes(0),
+        partial(false) {
   }
 };
 
@@ -106,6 +135,10 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.index_threads,     1,                           64);
+  ClipToRange(&result.index_rebuild_threads, 1,                       64);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
+  ClipToRange(&result.max_background_merges, 1,                       16);
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -122,6 +155,8 @@ Options SanitizeOptions(const std::string& dbname,
   return result;
 }
 
+static std::atomic<uint64_t> next_db_id(1);
+
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
     : env_(raw_options.env),
       internal_comparator_(raw_options.comparator),
@@ -131,6 +166,7 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       owns_info_log_(options_.info_log != raw_options.info_log),
       owns_cache_(options_.block_cache != raw_options.block_cache),
       dbname_(dbname),
+      pm_root_(nullptr),
       db_lock_(nullptr),
       shutting_down_(nullptr),
       bg_cv_(&mutex_),
@@ -141,9 +177,20 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       log_(nullptr),
       seed_(0),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
-      pm_root_(allocate_pm_root(raw_options.index)) {
+      bg_flush_scheduled_(false),
+      bg_merges_scheduled_(0),
+      super_version_(nullptr),
+      db_id_(next_db_id.fetch_add(1)),
+      fold_scheduled_(false) {
   has_imm_.Release_Store(nullptr);
+  options_.index->SetInsertThreads(options_.index_threads);
+  flush_pool_.reset(new ThreadPool(1));
+  merge_pool_.reset(new ThreadPool(options_.max_background_merges));
+  if (options_.max_subcompactions > 1) {
+    subcompaction_pool_.reset(new ThreadPool(options_.max_subcompactions - 1));
+  }
+  rate_limiter_.reset(new RateLimiter(env_, options_.compaction_rate_limit,
+                                      options_.compaction_rate_limit_auto));
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
@@ -158,10 +205,29 @@ DBImpl::~DBImpl() {
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
 
-  while (bg_compaction_scheduled_) {
+  while (bg_flush_scheduled_ || bg_merges_scheduled_ > 0 || fold_scheduled_.load()) {
     bg_cv_.Wait();
   }
-  pm_root_->index->Break();
+  options_.index->Break();
+  if (pm_root_ != nullptr && bg_error_.ok()) {
+    // every index batch was waited for by the LogAndApply of its edit.
+    // after a background error the index may be ahead of the MANIFEST.
+    pm_root_->clean = true;
+    clflush((char*)&pm_root_->clean, sizeof(bool));
+  }
+  ScrapeReadSlots();
+  {
+    // the slots of threads still running outlive the DB
+    MutexLock l(&read_slots_mutex_);
+    for (const auto& slot : read_slots_) {
+      slot->db = nullptr;
+    }
+    read_slots_.clear();
+  }
+  if (super_version_ != nullptr) {
+    UnrefSuperVersion(super_version_);
+    super_version_ = nullptr;
+  }
   mutex_.Unlock();
 
   if (db_lock_ != nullptr) {
@@ -190,6 +256,7 @@ Status DBImpl::NewDB() {
   new_db.SetLogNumber(0);
   new_db.SetNextFile(2);
   new_db.SetLastSequence(0);
+  new_db.SetDbId(NewDbId(env_));
 
   const std::string manifest = DescriptorFileName(dbname_, 1);
   WritableFile* file;
@@ -297,8 +364,10 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     return s;
   }
 
+  bool new_db = false;
   if (!env_->FileExists(CurrentFileName(dbname_))) {
     if (options_.create_if_missing) {
+      new_db = true;
       s = NewDB();
       if (!s.ok()) {
         return s;
@@ -318,6 +387,10 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   if (!s.ok()) {
     return s;
   }
+  s = RecoverIndex(new_db, edit, save_manifest);
+  if (!s.ok()) {
+    return s;
+  }
   SequenceNumber max_sequence(0);
 
   // Recover from all newer log files than the ones named in the
@@ -337,22 +410,14 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   uint64_t number;
   FileType type;
   std::vector<uint64_t> logs;
-  bool missing = false;
+  // tables the MANIFEST does not list are outputs that were never installed,
+  // DeleteObsoleteFiles removes them once the DB is open
   for (const auto& filename : filenames) {
     if (ParseFileName(filename, &number, &type)) {
-      if (type == kTableFile && !versions_->current()->IsAlive(number)) {
-        missing = true;
-        break;
-      }
       if (type == kLogFile && ((number >= min_log) || (number == prev_log)))
         logs.push_back(number);
     }
   }
-  if (missing) {
-    char buf[50];
-    snprintf(buf, sizeof(buf), "missing some files; e.g.");
-    return Status::Corruption(buf, TableFileName(dbname_, number));
-  }
 
   // Recover in the order in which the logs were generated
   std::sort(logs.begin(), logs.end());
@@ -376,6 +441,97 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   return Status::OK();
 }
 
+Status DBImpl::CheckPersistentIndex(const PM_root* root) {
+  if (root == nullptr || root->magic != kPMRootMagic) {
+    return Status::Corruption(dbname_, "no persistent index in the PM pool");
+  }
+  // a pool holds the index of the DB that opened it last
+  if (root->db_id != versions_->DbId()) {
+    return Status::Corruption(dbname_, "persistent index belongs to another DB");
+  }
+  if (!root->clean) {
+    return Status::Corruption(dbname_, "persistent index was not closed cleanly");
+  }
+  if (root->full_keys != options_.index->UsesFullKeys()) {
+    return Status::InvalidArgument(dbname_, "persistent index is of another kind");
+  }
+  // the index is updated before the MANIFEST, a clean index matches the
+  // last MANIFEST record
+  if (root->manifest_next_file != versions_->ManifestFileNumber() ||
+      root->last_sequence != versions_->LastSequence()) {
+    return Status::Corruption(dbname_, "persistent index does not match the MANIFEST");
+  }
+  return Status::OK();
+}
+
+Status DBImpl::RecoverIndex(bool new_db, VersionEdit* edit, bool* save_manifest) {
+  mutex_.AssertHeld();
+  Index* index = options_.index;
+  PM_root* root = static_cast<PM_root*>(nvram::get_root());
+  bool rebuild = false;
+  if (!new_db) {
+    Status s = CheckPersistentIndex(root);
+    if (!s.ok()) {
+      if (!options_.rebuild_index) {
+        return s;
+      }
+      Log(options_.info_log, "Rebuilding index from tables: %s", s.ToString().c_str());
+      rebuild = true;
+    }
+  }
+  if (new_db || rebuild) {
+    // a root of an earlier DB in the same pool is dropped
+    root = allocate_pm_root(index);
+    root->db_id = versions_->DbId();
+    root->manifest_next_file = versions_->ManifestFileNumber();
+    root->last_sequence = versions_->LastSequence();
+    clflush((char*)root, sizeof(PM_root));
+    nvram::set_root(root);
+  }
+  if (rebuild) {
+    index->SetDramInnerNodes(options_.index_dram_inner_nodes);
+    std::vector<std::shared_ptr<FileMetaData>> files;
+    versions_->current()->GetLiveFiles(&files);
+    std::map<uint64_t, uint64_t> live;
+    Status s = RebuildIndex(options_, table_cache_, files,
+                            versions_->current()->RangeTombstones(), user_comparator(), &live);
+    if (!s.ok()) {
+      return s;
+    }
+    // keys overwritten after the last MANIFEST record are no longer counted
+    // as alive
+    for (const auto& f : files) {
+      auto it = live.find(static_cast<uint16_t>(f->number));
+      const uint64_t alive = it == live.end() ? 0 : it->second;
+      if (f->alive > alive) {
+        edit->DecreaseCount(f->number, f->alive - alive);
+        *save_manifest = true;
+      }
+    }
+  } else if (!new_db) {
+    const uint64_t start_micros = env_->NowMicros();
+    index->Attach(root->index);
+    if (options_.paranoid_checks) {
+      std::string cursor;
+      std::set<uint16_t> files;
+      index->ScanFiles(&cursor, UINT64_MAX, &files);
+      for (uint16_t file : files) {
+        if (!versions_->current()->IsAlive(file)) {
+          return Status::Corruption("persistent index refers to missing file",
+                                    TableFileName(dbname_, file));
+        }
+      }
+    }
+    Log(options_.info_log, "Reopened persistent index in %llu micros",
+        (unsigned long long) (env_->NowMicros() - start_micros));
+  }
+  root->clean = false;
+  clflush((char*)&root->clean, sizeof(bool));
+  pm_root_ = root;
+  index->SetDramInnerNodes(options_.index_dram_inner_nodes);
+  return Status::OK();
+}
+
 Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
                               SequenceNumber* max_sequence) {
@@ -500,7 +656,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   return status;
 }
 
-Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
+Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit, uint64_t* pending) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
@@ -513,7 +669,8 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, edit);
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta, edit,
+                   rate_limiter_.get());
     mutex_.Lock();
   }
 
@@ -522,8 +679,11 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
-
+  if (pending != nullptr) {
+    *pending = meta.number;
+  } else {
+    pending_outputs_.erase(meta.number);
+  }
 
   // Note that if file_size is zero, the file has been deleted and
   // should not be added to the manifest.
@@ -538,6 +698,7 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit) {
   stats.micros = env_->NowMicros() - start_micros;
   stats.bytes_written = meta.file_size;
   stats_.Add(stats);
+  versions_->merge_policy()->RecordFlush(meta.file_size);
   return s;
 }
 
@@ -549,26 +710,27 @@ void DBImpl::CompactMemTable() {
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit);
+  uint64_t number;
+  Status s = WriteLevel0Table(imm_, &edit, &number);
   base->Unref();
 
-  if (s.ok() && shutting_down_.Acquire_Load()) {
-    s = Status::IOError("Deleting DB during memtable compaction");
-  }
-
-  // Replace immutable memtable with the generated Table
+  // Replace immutable memtable with the generated Table.  A table finished
+  // during shutdown is installed too, the index already points at it.
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
     s = versions_->LogAndApply(&edit, &mutex_);
   }
+  pending_outputs_.erase(number);
 
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = nullptr;
     has_imm_.Release_Store(nullptr);
+    InstallSuperVersion();
     DeleteObsoleteFiles();
+    versions_->AdjustMergePolicy();
   } else {
     RecordBackgroundError(s);
   }
@@ -584,68 +746,74 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == nullptr &&
-             !versions_->NeedsCompaction()) {
-    Log(options_.info_log, "Skipping reschedule");
-    // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
-    env_->Schedule(&DBImpl::BGWork, this);
+    // flushes have a thread of their own, so that a memtable is never
+    // kept waiting behind a merge
+    bool scheduled = false;
+    if (imm_ != nullptr && !bg_flush_scheduled_) {
+      bg_flush_scheduled_ = true;
+      flush_pool_->enqueue(&DBImpl::BackgroundCall, this, true);
+      scheduled = true;
+    }
+    if (bg_merges_scheduled_ < options_.max_background_merges &&
+        versions_->NeedsCompaction()) {
+      bg_merges_scheduled_++;
+      merge_pool_->enqueue(&DBImpl::BackgroundCall, this, false);
+      scheduled = true;
+    }
+    if (!scheduled) {
+      Log(options_.info_log, "Skipping reschedule");
+    }
   }
 }
 
-void DBImpl::BGWork(void* db) {
-  reinterpret_cast<DBImpl*>(db)->BackgroundCall();
-}
-
-void DBImpl::BackgroundCall() {
+void DBImpl::BackgroundCall(bool flush) {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(flush ? bg_flush_scheduled_ : bg_merges_scheduled_ > 0);
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
+  } else if (flush) {
+    BackgroundFlush();
   } else {
     BackgroundCompaction();
   }
 
-  bg_compaction_scheduled_ = false;
+  if (flush) {
+    bg_flush_scheduled_ = false;
+  } else {
+    bg_merges_scheduled_--;
+  }
 
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
-//  versions_->CheckLocality();
   MaybeScheduleCompaction();
   bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+void DBImpl::BackgroundFlush() {
   mutex_.AssertHeld();
-  Log(options_.info_log, "Background compaction");
+  Log(options_.info_log, "Background flush");
   if (imm_ != nullptr) {
     CompactMemTable();
-    versions_->CheckLocality();
-    return;
+    versions_->CheckLocality(&mutex_);
   }
-  versions_->CheckLocality();
-  Compaction* c = versions_->PickCompaction();
+}
+
+void DBImpl::BackgroundCompaction() {
+  mutex_.AssertHeld();
+  Log(options_.info_log, "Background compaction");
+  versions_->CheckLocality(&mutex_);
+  Compaction* c = versions_->PickCompaction(&mutex_);
 
   Status status;
   if (c != nullptr) {
-    CompactionState* compact = new CompactionState(c);
-    status = DoCompactionWork(compact);
-    if (!status.ok()) {
-      RecordBackgroundError(status);
-    }
-    CleanupCompaction(compact);
-    c->ReleaseInputs();
-    DeleteObsoleteFiles();
-    delete c;
+    status = RunCompaction(c);
   }
 
   if (status.ok()) {
@@ -658,6 +826,68 @@ void DBImpl::BackgroundCompaction() {
   }
 }
 
+Status DBImpl::RunCompaction(Compaction* c) {
+  mutex_.AssertHeld();
+  CompactionState* compact = new CompactionState(c);
+  Status status = DoCompactionWork(compact);
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  CleanupCompaction(compact);
+  c->ReleaseInputs();
+  versions_->ReleaseCompactionFiles(c);
+  DeleteObsoleteFiles();
+  delete c;
+  return status;
+}
+
+void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
+  // the memtable goes to a table first, so that its keys are merged too
+  Status s = Write(WriteOptions(), nullptr);
+  MutexLock l(&mutex_);
+  while (s.ok() && imm_ != nullptr && bg_error_.ok()) {
+    bg_cv_.Wait();
+  }
+
+  // merges in progress install their outputs, which may overlap the
+  // range, before the tables are chosen
+  std::vector<std::shared_ptr<FileMetaData>> files;
+  for (;;) {
+    if (!s.ok() || !bg_error_.ok() || shutting_down_.Acquire_Load()) return;
+    files.clear();
+    versions_->GetOverlappingFiles(begin, end, &files);
+    if (!versions_->IsMerging(files)) break;
+    bg_cv_.Wait();
+  }
+
+  // all groups are taken at once, so that no background merge picks
+  // their files in between
+  std::vector<Compaction*> compactions;
+  for (size_t i = 0; i < files.size(); i += config::ManualCompactionMaxFiles) {
+    size_t n = std::min<size_t>(config::ManualCompactionMaxFiles, files.size() - i);
+    if (n == 1 && files[i]->alive == files[i]->total) {
+      continue;  // a single table without dead keys would only be copied
+    }
+    std::vector<std::shared_ptr<FileMetaData>> group(files.begin() + i, files.begin() + i + n);
+    compactions.push_back(versions_->CompactFiles(group));
+  }
+  for (Compaction* c : compactions) {
+    if (s.ok() && !shutting_down_.Acquire_Load()) {
+      s = RunCompaction(c);
+    } else {
+      versions_->ReleaseCompactionFiles(c);
+      delete c;
+    }
+  }
+  MaybeScheduleCompaction();
+}
+
+void DBImpl::GetApproximateSizes(const Range* range, int n, uint64_t* sizes) {
+  for (int i = 0; i < n; i++) {
+    sizes[i] = options_.index->ApproximateSize(range[i].start, range[i].limit);
+  }
+}
+
 void DBImpl::CleanupCompaction(CompactionState* compact) {
   mutex_.AssertHeld();
   if (compact->builder != nullptr) {
@@ -684,6 +914,7 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
     pending_outputs_.insert(file_number);
     CompactionState::Output out;
     out.number = file_number;
+    out.alive = 0;
     out.smallest.Clear();
     out.largest.Clear();
     compact->outputs.push_back(out);
@@ -694,6 +925,7 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
+    compact->outfile = rate_limiter_->Wrap(compact->outfile, true);
     compact->builder = new TableBuilder(options_, compact->outfile, file_number);
   }
   return s;
@@ -719,7 +951,7 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   const uint64_t current_bytes = compact->builder->FileSize();
   compact->current_output()->file_size = current_bytes;
   compact->current_output()->total = current_entries;
-  compact->current_output()->alive = current_entries;
+  assert(compact->current_output()->alive <= current_entries);
   compact->total_bytes += current_bytes;
   delete compact->builder;
   compact->builder = nullptr;
@@ -746,30 +978,113 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
 }
 
 
-Status DBImpl::InstallCompactionResults(CompactionState* compact) {
+// Moves the data block at the current position of input to the output
+// unchanged if the merge would keep each of its entries as it is, otherwise
+// returns false and leaves input where it was.  That is the case when the
+// index points at that block for every entry and every entry is the newest
+// one of its user key: an older version, also one after "*prev_user_key",
+// the user key merged last, is dropped once it is hidden at
+// smallest_snapshot.  On success "*last_key" is set to the last key of the
+// block.
+bool DBImpl::CopyLiveBlock(CompactionState* compact, CompactionInput* input,
+                           IndexCursor* liveness, const Slice* prev_user_key,
+                           std::string* last_key, Status* status) {
+  const uint64_t number = input->file_number();
+  const uint64_t offset = input->block_handle().offset();
+  Iterator* entries = input->NewBlockIterator();
+  bool live = true;
+  uint64_t live_entries = 0;
+  std::string last_user_key;
+  bool has_last_user_key = prev_user_key != nullptr;
+  if (has_last_user_key) {
+    last_user_key = prev_user_key->ToString();
+  }
+  ParsedInternalKey ikey;
+  for (entries->SeekToFirst(); live && entries->Valid(); entries->Next()) {
+    live = ParseInternalKey(entries->key(), &ikey) &&
+           (!has_last_user_key ||
+            user_comparator()->Compare(ikey.user_key, last_user_key) != 0);
+    if (live) {
+      const IndexMeta* meta = liveness->Get(ikey.user_key);
+      live = meta != nullptr && meta->file_number == number && meta->offset == offset;
+    }
+    if (live) {
+      last_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+      has_last_user_key = true;
+      live_entries++;
+    }
+  }
+  live = live && entries->status().ok();
+
+  Slice contents;
+  CompressionType type;
+  live = live && input->ReadRawBlock(&contents, &type).ok();
+  if (live && compact->builder == nullptr) {
+    *status = OpenCompactionOutputFile(compact);
+    live = status->ok();
+  }
+  if (live) {
+    if (compact->builder->NumEntries() == 0) {
+      compact->current_output()->smallest.DecodeFrom(input->key());
+    }
+    entries->SeekToLast();
+    last_key->assign(entries->key().data(), entries->key().size());
+    compact->current_output()->largest.DecodeFrom(*last_key);
+    compact->builder->AddBlock(contents, type, entries);
+    compact->current_output()->alive += live_entries;
+    compact->copied_blocks++;
+    compact->copied_bytes += contents.size();
+    input->SkipBlock();
+  }
+  delete entries;
+  return live;
+}
+
+Status DBImpl::InstallCompactionResults(CompactionState* compact, bool delete_inputs) {
   mutex_.AssertHeld();
-  Log(options_.info_log,  "Compacted %zu@ files => %lld bytes",
+  Log(options_.info_log,  "Compacted %zu@ files => %lld bytes, %llu blocks (%llu bytes) copied",
       compact->compaction->num_input_files(),
-      static_cast<long long>(compact->total_bytes));
+      static_cast<long long>(compact->total_bytes),
+      static_cast<unsigned long long>(compact->copied_blocks),
+      static_cast<unsigned long long>(compact->copied_bytes));
 
   // Add compaction outputs
-  compact->compaction->AddInputDeletions(compact->compaction->edit());
+  if (delete_inputs) {
+    compact->compaction->AddInputDeletions(compact->compaction->edit());
+  }
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     compact->compaction->edit()->AddFile(
         out.number, out.file_size, out.total, out.alive, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  // the outputs may hold entries of a range deleted while the merge ran,
+  // its tombstone is kept until they are gone too.  that includes a range
+  // still being deleted, whose tombstone takes the table numbers handed
+  // out before it was made.
+  const SequenceNumber seen = compact->range_tombstones.empty()
+      ? 0 : compact->range_tombstones.back().sequence;
+  std::vector<RangeTombstone> tombstones = versions_->current()->RangeTombstones();
+  tombstones.insert(tombstones.end(),
+                    pending_range_tombstones_.begin(), pending_range_tombstones_.end());
+  for (const RangeTombstone& tombstone : tombstones) {
+    if (tombstone.sequence > seen && !compact->outputs.empty()) {
+      RangeTombstone renewed = tombstone;
+      renewed.file_number = versions_->NextFileNumber();
+      compact->compaction->edit()->AddRangeTombstone(renewed);
+    }
+  }
+  Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  if (s.ok()) {
+    // readers let go of the Version that still has the inputs
+    InstallSuperVersion();
+  }
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-
-  Log(options_.info_log,  "Compacting %zu files",
-      compact->compaction->num_input_files());
 
-  assert(versions_->CompactionSize() > 0);
+  assert(compact->compaction->num_input_files() > 0);
   assert(compact->builder == nullptr);
   assert(compact->outfile == nullptr);
   if (snapshots_.empty()) {
@@ -777,13 +1092,95 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   } else {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
+  compact->range_tombstones = versions_->current()->RangeTombstones();
 
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
   VersionEdit edit;
   compact->compaction->SetEdit(&edit);
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  for (int i = 0; i < compact->compaction->num_input_files(); i++) {
+    edit.AddMergeInput(compact->compaction->input(i)->number);
+  }
+
+  // the key range is split into sub-compactions that are merged
+  // concurrently, each into its own output tables
+  std::vector<std::string> bounds;
+  versions_->SplitCompaction(compact->compaction, options_.max_subcompactions, &bounds);
+  Log(options_.info_log,  "Compacting %zu files in %zu key ranges",
+      compact->compaction->num_input_files(), bounds.size() + 1);
+  std::vector<CompactionState*> subs;
+  for (size_t i = 0; i <= bounds.size(); i++) {
+    CompactionState* sub = new CompactionState(compact->compaction);
+    sub->smallest_snapshot = compact->smallest_snapshot;
+    sub->range_tombstones = compact->range_tombstones;
+    if (i > 0) sub->start = bounds[i - 1];
+    if (i < bounds.size()) sub->end = bounds[i];
+    subs.push_back(sub);
+  }
+  std::vector<std::future<Status>> pending;
+  for (size_t i = 1; i < subs.size(); i++) {
+    pending.push_back(subcompaction_pool_->enqueue(&DBImpl::DoSubcompactionWork,
+                                                   this, subs[i]));
+  }
+  Status status = DoSubcompactionWork(subs[0]);
+  for (std::future<Status>& result : pending) {
+    Status s = result.get();
+    if (status.ok()) status = s;
+  }
+
+  bool partial = false;
+  for (CompactionState* sub : subs) {
+    compact->outputs.insert(compact->outputs.end(), sub->outputs.begin(), sub->outputs.end());
+    compact->total_bytes += sub->total_bytes;
+    compact->copied_blocks += sub->copied_blocks;
+    compact->copied_bytes += sub->copied_bytes;
+    partial = partial || sub->partial;
+    delete sub;
+  }
+
+  CompactionStats stats;
+  stats.count = 1;
+  stats.micros = env_->NowMicros() - start_micros;
+  stats.files_deleted += compact->compaction->num_input_files();
+  stats.files_created += compact->outputs.size();
+  stats.copied_blocks = compact->copied_blocks;
+  for (int i = 0; i < compact->compaction->num_input_files(); i++) {
+    stats.bytes_read += compact->compaction->input(i)->file_size;
+  }
+  for (auto& output : compact->outputs) {
+    stats.bytes_written += output.file_size;
+  }
+
+  mutex_.Lock();
+  stats_.Add(stats);
+  versions_->merge_policy()->RecordMerge(stats.bytes_written);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact, !partial);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionControl::SummaryStorage tmp;
+  Log(options_.info_log,
+      "Summary: %s", versions_->Summary(&tmp));
+  return status;
+}
+
+// Merges the entries of the compaction inputs in the key range of compact
+// into output tables of its own.
+Status DBImpl::DoSubcompactionWork(CompactionState* compact) {
+  CompactionInput* input = versions_->MakeInputIterator(compact->compaction);
+  if (!compact->start.empty() || !compact->end.empty()) {
+    InternalKey start(compact->start, kMaxSequenceNumber, kValueTypeForSeek);
+    InternalKey end(compact->end, kMaxSequenceNumber, kValueTypeForSeek);
+    input->SetRange(compact->start.empty() ? Slice() : start.Encode(),
+                    compact->end.empty() ? Slice() : end.Encode());
+  }
   input->SeekToFirst();
+  // the input is sorted, so the liveness lookups move forward through the index
+  IndexCursor* liveness = options_.index->NewCursor();
+  IndexCursor* block_liveness = options_.index->NewCursor();
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
@@ -791,17 +1188,28 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   Slice key;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != nullptr) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != nullptr) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-//        versions_->CheckLocality();
+    // a data block that is still live as a whole goes to the output unchanged
+    if (options_.copy_live_blocks && input->AtWholeBlock()) {
+      std::string last_key;
+      const Slice prev_user_key(current_user_key);
+      if (CopyLiveBlock(compact, input, block_liveness,
+                        has_current_user_key ? &prev_user_key : nullptr, &last_key, &status)) {
+        ParseInternalKey(last_key, &ikey);
+        current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+        has_current_user_key = true;
+        last_sequence_for_key = ikey.sequence;
+        if (compact->builder->FileSize() >=
+            compact->compaction->MaxOutputFileSize()) {
+          status = FinishCompactionOutputFile(compact, input);
+          if (!status.ok()) {
+            break;
+          }
+        }
+        continue;
+      }
+      if (!status.ok()) {
+        break;
       }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
     }
 
     key = input->key();
@@ -839,9 +1247,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->compaction->IsBaseLevelForKey(ikey.user_key),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
-    auto m_ = pm_root_->index->Get(ExtractUserKey(key));
-    assert(m_ != nullptr);
-    if (!compact->compaction->IsInput(m_->file_number)) {
+    auto m_ = liveness->Get(ExtractUserKey(key));
+    // a lock-free lookup racing a shift in the same leaf can miss the key,
+    // the entry is kept then
+    if (m_ != nullptr && !compact->compaction->IsInput(m_->file_number)) {
+      drop = true;
+    } else if (m_ == nullptr && has_current_user_key &&
+               RangeDeleted(compact->range_tombstones, user_comparator(),
+                            ikey.user_key, ikey.sequence)) {
       drop = true;
     }
 
@@ -859,6 +1272,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       }
       compact->current_output()->largest.DecodeFrom(key);
       compact->builder->Add(key, input->value());
+      compact->current_output()->alive++;
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -872,46 +1286,31 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     input->Next();
   }
 
-  if (status.ok() && shutting_down_.Acquire_Load()) {
-    status = Status::IOError("Deleting DB during compaction");
-    compact->compaction->edit()->Wait();
-  }
+  // A merge cut short by shutdown still installs the outputs written so far,
+  // the index already points at them.  The inputs stay live for the keys
+  // that were not copied yet.
+  compact->partial = input->Valid();
   if (status.ok() && compact->builder != nullptr) {
     status = FinishCompactionOutputFile(compact, input);
   }
   if (status.ok()) {
     status = input->status();
   }
+  if (compact->builder != nullptr) {
+    compact->builder->Abandon();
+    delete compact->builder;
+    compact->builder = nullptr;
+    delete compact->outfile;
+    compact->outfile = nullptr;
+  }
   delete input;
   input = nullptr;
-
-  CompactionStats stats;
-  stats.count = 1;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  stats.files_deleted += compact->compaction->num_input_files();
-  stats.files_created += compact->outputs.size();
-  for (int i = 0; i < compact->compaction->num_input_files(); i++) {
-    stats.bytes_read += compact->compaction->input(i)->file_size;
-  }
-  for (auto& output : compact->outputs) {
-    stats.bytes_written += output.file_size;
-  }
-
-  mutex_.Lock();
-  stats_.Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
-  VersionControl::SummaryStorage tmp;
-  Log(options_.info_log,
-      "Summary: %s", versions_->Summary(&tmp));
+  delete liveness;
+  delete block_liveness;
   return status;
 }
 
+
 namespace {
 struct IterState {
   port::Mutex* mu;
@@ -933,24 +1332,23 @@ Status DBImpl::Update(const leveldb::WriteOptions& options,
                       const leveldb::Slice& key,
                       const leveldb::Slice& value) {
   Status s;
+  // the memtables are those of the super version, as for Get
+  ReadSlot* slot = LocalReadSlot();
+  SuperVersion* sv = AcquireSuperVersion(slot);
   SequenceNumber snapshot = versions_->LastSequence();
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  Index* index = pm_root_->index;
+  Index* index = options_.index;
   bool exists = false;
   std::string v;
   LookupKey lkey(key, snapshot);
-  if (mem->Get(lkey, &v, &s)) {
+  if (sv->mem->Get(lkey, &v, &s)) {
     exists = true;
-  } else if (imm != nullptr && imm->Get(lkey, &v, &s)) {
-    exists = true;
-  } else if (index->Get(key) != nullptr){
+  } else if (sv->imm != nullptr && sv->imm->Get(lkey, &v, &s)) {
     exists = true;
+  } else {
+    IndexReadGuard read(index);
+    exists = index->Get(key) != nullptr;
   }
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
+  ReleaseSuperVersion(slot, sv);
   if (exists) {
     s = Put(options, key, value);
     return Status::OK();
@@ -962,7 +1360,11 @@ Status DBImpl::Get(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
   Status s;
-  MutexLock l(&mutex_);
+  ReadSlot* slot = LocalReadSlot();
+  const bool sample = rate_limiter_->AutoTune() &&
+                      ++slot->reads % config::ReadLatencySampleInterval == 0;
+  const uint64_t sample_micros = sample ? env_->NowMicros() : 0;
+  SuperVersion* sv = AcquireSuperVersion(slot);
   SequenceNumber snapshot;
   if (options.snapshot != nullptr) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
@@ -970,48 +1372,283 @@ Status DBImpl::Get(const ReadOptions& options,
     snapshot = versions_->LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != nullptr) imm->Ref();
-  current->Ref();
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  Version* current = sv->current;
   uint16_t file_number = 0;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
+  // First look in the memtable, then in the immutable memtable (if any).
+  LookupKey lkey(key, snapshot);
 #ifdef PERF_LOG
-    bool found;
-    uint64_t start_micros = benchmark::NowMicros();
-    found = mem->Get(lkey, value, &s);
-    if (!found) found = imm != NULL && imm->Get(lkey, value, &s);
-    benchmark::LogMicros(benchmark::MEMTABLE, benchmark::NowMicros() - start_micros);
-    if (!found) {
-      start_micros = benchmark::NowMicros();
-      s = current->Get(options, lkey, value, &file_number);
-      benchmark::LogMicros(benchmark::VERSION, benchmark::NowMicros() - start_micros);
-    }
+  bool found;
+  uint64_t start_micros = benchmark::NowMicros();
+  found = mem->Get(lkey, value, &s);
+  if (!found) found = imm != NULL && imm->Get(lkey, value, &s);
+  benchmark::LogMicros(benchmark::MEMTABLE, benchmark::NowMicros() - start_micros);
+  if (!found) {
+    start_micros = benchmark::NowMicros();
+    s = current->Get(options, lkey, value, &file_number);
+    benchmark::LogMicros(benchmark::VERSION, benchmark::NowMicros() - start_micros);
+  }
 #else
-    if (mem->Get(lkey, value, &s)) {
+  if (mem->Get(lkey, value, &s)) {
+    // Done
+  } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+    // Done
+  } else {
+    s = current->Get(options, lkey, value, &file_number);
+  }
+#endif
+  ReleaseSuperVersion(slot, sv);
+  RecordFileAccess(slot, file_number);
+  if (sample) {
+    rate_limiter_->RecordReadLatency(env_->NowMicros() - sample_micros);
+  }
+  return s;
+}
+
+void DBImpl::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                      std::string* values, Status* statuses) {
+  ReadSlot* slot = LocalReadSlot();
+  SuperVersion* sv = AcquireSuperVersion(slot);
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = sv->mem;
+  MemTable* imm = sv->imm;
+  std::deque<LookupKey> lkeys;
+  std::vector<Version::GetRequest> misses;
+  for (int i = 0; i < n; i++) {
+    lkeys.emplace_back(keys[i], snapshot);
+    const LookupKey& lkey = lkeys.back();
+    statuses[i] = Status::OK();
+    if (mem->Get(lkey, &values[i], &statuses[i])) {
       // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+    } else if (imm != nullptr && imm->Get(lkey, &values[i], &statuses[i])) {
       // Done
     } else {
-      s = current->Get(options, lkey, value, &file_number);
+      Version::GetRequest request = {&lkey, &values[i], &statuses[i], 0};
+      misses.push_back(request);
     }
-#endif
-    mutex_.Lock();
   }
-  versions_->RegisterFileAccess(file_number);
-  mem->Unref();
-  if (imm != nullptr) imm->Unref();
-  current->Unref();
+  if (!misses.empty()) {
+    sv->current->MultiGet(options, misses.data(), misses.size());
+  }
+  ReleaseSuperVersion(slot, sv);
+  for (const Version::GetRequest& request : misses) {
+    RecordFileAccess(slot, request.file_number);
+  }
+}
+
+Status DBImpl::Get(const ReadOptions& options,
+                   const Slice& key,
+                   PinnableSlice* value) {
+  value->Reset();
+  Status s;
+  ReadSlot* slot = LocalReadSlot();
+  const bool sample = rate_limiter_->AutoTune() &&
+                      ++slot->reads % config::ReadLatencySampleInterval == 0;
+  const uint64_t sample_micros = sample ? env_->NowMicros() : 0;
+  SuperVersion* sv = AcquireSuperVersion(slot);
+  SequenceNumber snapshot;
+  if (options.snapshot != nullptr) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  uint16_t file_number = 0;
+  LookupKey lkey(key, snapshot);
+  Slice v;
+  if (sv->mem->Get(lkey, &v, &s) || (sv->imm != nullptr && sv->imm->Get(lkey, &v, &s))) {
+    if (s.ok()) {
+      // the super version keeps the memtable alive
+      sv->refs.fetch_add(1, std::memory_order_relaxed);
+      value->PinSlice(v, &DBImpl::UnpinSuperVersion, this, sv);
+    }
+  } else {
+    s = sv->current->Get(options, lkey, value, &file_number);
+  }
+  ReleaseSuperVersion(slot, sv);
+  RecordFileAccess(slot, file_number);
+  if (sample) {
+    rate_limiter_->RecordReadLatency(env_->NowMicros() - sample_micros);
+  }
   return s;
 }
 
+void DBImpl::UnpinSuperVersion(void* db, void* sv) {
+  DBImpl* impl = reinterpret_cast<DBImpl*>(db);
+  SuperVersion* super_version = reinterpret_cast<SuperVersion*>(sv);
+  // a reference that is not the last one is dropped without the mutex
+  int refs = super_version->refs.load(std::memory_order_relaxed);
+  while (refs > 1 &&
+         !super_version->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel)) {
+  }
+  if (refs > 1) return;
+  MutexLock l(&impl->mutex_);
+  impl->UnrefSuperVersion(super_version);
+}
+
+bool DBImpl::TEST_SuperVersionIsCurrent() {
+  MutexLock l(&mutex_);
+  return super_version_->current == versions_->current();
+}
+
+void DBImpl::TEST_KeyCounts(uint64_t* alive, uint64_t* total) {
+  MutexLock l(&mutex_);
+  std::vector<std::shared_ptr<FileMetaData>> files;
+  versions_->current()->GetLiveFiles(&files);
+  *alive = 0;
+  *total = 0;
+  for (const auto& f : files) {
+    *alive += f->alive;
+    *total += f->total;
+  }
+}
+
+int64_t DBImpl::TEST_CopiedBlocks() {
+  MutexLock l(&mutex_);
+  return stats_.copied_blocks;
+}
+
+void DBImpl::TEST_SetPickHook(std::function<void()> hook) {
+  MutexLock l(&mutex_);
+  versions_->TEST_SetPickHook(std::move(hook));
+}
+
+static char super_version_in_use;
+DBImpl::SuperVersion* const DBImpl::kSuperVersionInUse =
+    reinterpret_cast<DBImpl::SuperVersion*>(&super_version_in_use);
+
+DBImpl::ReadSlot* DBImpl::LocalReadSlot() {
+  static thread_local std::unordered_map<uint64_t, std::shared_ptr<ReadSlot>> slots;
+  std::shared_ptr<ReadSlot>& slot = slots[db_id_];
+  if (slot == nullptr) {
+    slot = std::make_shared<ReadSlot>(this);
+    MutexLock l(&read_slots_mutex_);
+    read_slots_.push_back(slot);
+  }
+  return slot.get();
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion(ReadSlot* slot) {
+  SuperVersion* sv = slot->super_version.exchange(kSuperVersionInUse, std::memory_order_acquire);
+  assert(sv != kSuperVersionInUse);
+  if (sv == nullptr) {
+    // First read on this thread since the last InstallSuperVersion
+    MutexLock l(&mutex_);
+    sv = super_version_;
+    sv->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  return sv;
+}
+
+void DBImpl::ReleaseSuperVersion(ReadSlot* slot, SuperVersion* sv) {
+  SuperVersion* expected = kSuperVersionInUse;
+  if (slot->super_version.compare_exchange_strong(expected, sv, std::memory_order_release)) {
+    return; // keep it cached for the next read
+  }
+  // Scraped by InstallSuperVersion while in use, this thread owns the ref now
+  assert(expected == nullptr);
+  MutexLock l(&mutex_);
+  UnrefSuperVersion(sv);
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  if (sv->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    sv->mem->Unref();
+    if (sv->imm != nullptr) sv->imm->Unref();
+    sv->current->Unref();
+    delete sv;
+  }
+}
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  SuperVersion* sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->current = versions_->current();
+  sv->mem->Ref();
+  if (sv->imm != nullptr) sv->imm->Ref();
+  sv->current->Ref();
+  sv->refs.store(1);
+  SuperVersion* old = super_version_;
+  super_version_ = sv;
+  ScrapeReadSlots();
+  if (old != nullptr) UnrefSuperVersion(old);
+}
+
+void DBImpl::ScrapeReadSlots() {
+  mutex_.AssertHeld();
+  MutexLock l(&read_slots_mutex_);
+  for (size_t i = 0; i < read_slots_.size(); ) {
+    // slots in use are released by their threads in ReleaseSuperVersion
+    SuperVersion* cached = read_slots_[i]->super_version.exchange(nullptr, std::memory_order_acq_rel);
+    if (cached != nullptr && cached != kSuperVersionInUse) {
+      UnrefSuperVersion(cached);
+    }
+    if (read_slots_[i].use_count() == 1) {
+      // thread has exited
+      read_slots_[i].swap(read_slots_.back());
+      read_slots_.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+DBImpl::ReadSlot::~ReadSlot() {
+  if (db == nullptr) return;
+  db->read_slots_mutex_.AssertHeld();
+  for (const auto& access : file_access) {
+    db->pending_file_access_[access.first] += access.second;
+  }
+}
+
+void DBImpl::RecordFileAccess(ReadSlot* slot, uint16_t file_number) {
+  if (file_number == 0) return;
+  slot->file_access[file_number]++;
+  if (++slot->accesses < config::FileAccessBatch) return;
+  {
+    MutexLock l(&read_slots_mutex_);
+    for (const auto& access : slot->file_access) {
+      pending_file_access_[access.first] += access.second;
+    }
+  }
+  slot->file_access.clear();
+  slot->accesses = 0;
+  if (!fold_scheduled_.exchange(true)) {
+    env_->Schedule(&DBImpl::BGFoldFileAccess, this);
+  }
+}
+
+void DBImpl::BGFoldFileAccess(void* db) {
+  reinterpret_cast<DBImpl*>(db)->FoldFileAccess();
+}
+
+void DBImpl::FoldFileAccess() {
+  MutexLock l(&mutex_);
+  std::unordered_map<uint16_t, uint32_t> file_access;
+  {
+    MutexLock l2(&read_slots_mutex_);
+    file_access.swap(pending_file_access_);
+    fold_scheduled_.store(false);
+  }
+  if (!shutting_down_.Acquire_Load()) {
+    for (const auto& access : file_access) {
+      versions_->RegisterFileAccess(access.first, access.second);
+    }
+  }
+  bg_cv_.SignalAll();
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1039,7 +1676,7 @@ Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
     list.push_back(imm_->NewIterator());
     imm_->Ref();
   }
-  list.push_back(pm_root_->index->NewIterator(options, table_cache_, versions_));
+  list.push_back(options_.index->NewIterator(options, table_cache_, versions_));
   Iterator* internal_iter =
     NewMergingIterator(&internal_comparator_, &list[0], list.size());
 
@@ -1072,6 +1709,73 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
   return DB::Delete(options, key);
 }
 
+Status DBImpl::DeleteRange(const WriteOptions& options, const Slice& begin, const Slice& end) {
+  if (user_comparator()->Compare(begin, end) >= 0) {
+    return Status::OK();
+  }
+  const uint64_t start_micros = env_->NowMicros();
+  Writer w(&mutex_);
+  w.batch = nullptr;
+  w.sync = options.sync;
+  w.done = false;
+
+  MutexLock l(&mutex_);
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+
+  // the range goes from the index and the tables only, so the memtable is
+  // flushed first.  no write comes in until the range is gone, every entry
+  // of the range is older than the tombstone.
+  Status s = MakeRoomForWrite(true);
+  while (s.ok() && imm_ != nullptr && bg_error_.ok()) {
+    bg_cv_.Wait();
+  }
+  if (s.ok()) {
+    s = bg_error_;
+  }
+
+  if (s.ok()) {
+    RangeTombstone tombstone;
+    tombstone.begin = begin.ToString();
+    tombstone.end = end.ToString();
+    tombstone.sequence = versions_->LastSequence() + 1;
+    tombstone.file_number = versions_->NextFileNumber();
+    versions_->SetLastSequence(tombstone.sequence);
+    VersionEdit edit;
+    edit.AddRangeTombstone(tombstone);
+    pending_range_tombstones_.push_back(tombstone);
+
+    mutex_.Unlock();
+    options_.index->DeleteRange(begin, end, &edit);
+    mutex_.Lock();
+
+    // merges that ran meanwhile installed their outputs, the tables left
+    // wholly inside the range have no live key
+    std::vector<uint64_t> held;
+    versions_->DeleteFilesInRange(begin, end, &edit, &held);
+    s = versions_->LogAndApply(&edit, &mutex_);
+    versions_->ReleaseFiles(held);
+    pending_range_tombstones_.pop_back();  // DeleteRange calls queue as writers
+    if (s.ok()) {
+      InstallSuperVersion();
+      DeleteObsoleteFiles();
+      MaybeScheduleCompaction();
+      Log(options_.info_log, "Deleted range with %zu whole tables in %llu micros",
+          held.size(), (unsigned long long) (env_->NowMicros() - start_micros));
+    } else {
+      RecordBackgroundError(s);
+    }
+  }
+
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return s;
+}
+
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   Writer w(&mutex_);
   w.batch = my_batch;
@@ -1176,27 +1880,30 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
     Writer* w = *iter;
+    if (w->batch == nullptr) {
+      // a memtable switch or a range deletion waits for its own turn
+      break;
+    }
+
     if (w->sync && !first->sync) {
       // Do not include a sync write into a batch handled by a non-sync write.
       break;
     }
 
-    if (w->batch != nullptr) {
-      size += WriteBatchInternal::ByteSize(w->batch);
-      if (size > max_size) {
-        // Do not make batch too big
-        break;
-      }
+    size += WriteBatchInternal::ByteSize(w->batch);
+    if (size > max_size) {
+      // Do not make batch too big
+      break;
+    }
 
-      // Append to *result
-      if (result == first->batch) {
-        // Switch to temporary batch instead of disturbing caller's batch
-        result = tmp_batch_;
-        assert(WriteBatchInternal::Count(result) == 0);
-        WriteBatchInternal::Append(result, first->batch);
-      }
-      WriteBatchInternal::Append(result, w->batch);
+    // Append to *result
+    if (result == first->batch) {
+      // Switch to temporary batch instead of disturbing caller's batch
+      result = tmp_batch_;
+      assert(WriteBatchInternal::Count(result) == 0);
+      WriteBatchInternal::Append(result, first->batch);
     }
+    WriteBatchInternal::Append(result, w->batch);
     *last_writer = w;
   }
   return result;
@@ -1220,6 +1927,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       env_->SleepForMicroseconds(1000);
       allow_delay = false;
       mutex_.Lock();
+      versions_->merge_policy()->RecordStall(1000);
     } else if (!force &&
                (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
       // There is room in current memtable
@@ -1231,7 +1939,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       bg_cv_.Wait();
     } else if (versions_->CompactionSize() >= config::StopWritesTrigger) {
       Log(options_.info_log, "Too many file for compaction, waiting..." );
+      uint64_t stall_start = env_->NowMicros();
       bg_cv_.Wait();
+      versions_->merge_policy()->RecordStall(env_->NowMicros() - stall_start);
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       if (!options_.disable_recovery_log) {
@@ -1254,6 +1964,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       has_imm_.Release_Store(imm_);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      InstallSuperVersion();
       force = false;   // Do not force another compaction if have room
       MaybeScheduleCompaction();
     }
@@ -1326,11 +2037,44 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
              static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "merge-policy") {
+    versions_->DescribeMergePolicy(value);
+    return true;
+  } else if (in == "compaction-rate-limit") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(rate_limiter_->CurrentBytesPerSecond()));
+    value->append(buf);
+    return true;
   }
 
   return false;
 }
 
+Status DBImpl::SetOption(const Slice& name, const Slice& value) {
+  if (name == "compaction_rate_limit") {
+    uint64_t rate;
+    Slice in = value;
+    if (!ConsumeDecimalNumber(&in, &rate) || !in.empty()) {
+      return Status::InvalidArgument(name, value);
+    }
+    rate_limiter_->SetBytesPerSecond(rate);
+  } else if (name == "compaction_rate_limit_auto") {
+    if (value == "true" || value == "1") {
+      rate_limiter_->SetAutoTune(true);
+    } else if (value == "false" || value == "0") {
+      rate_limiter_->SetAutoTune(false);
+    } else {
+      return Status::InvalidArgument(name, value);
+    }
+  } else {
+    return Status::InvalidArgument("unknown option", name);
+  }
+  Log(options_.info_log, "SetOption %s: %s",
+      name.ToString().c_str(), value.ToString().c_str());
+  return Status::OK();
+}
+
 // Default implementations of convenience methods that subclasses of DB
 // can call if they wish
 Status DB::Put(const WriteOptions& opt, const Slice& key, const Slice& value) {
@@ -1345,6 +2089,28 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+  ReadOptions read_options = options;
+  const Snapshot* snapshot = nullptr;
+  if (read_options.snapshot == nullptr) {
+    read_options.snapshot = snapshot = GetSnapshot();
+  }
+  for (int i = 0; i < n; i++) {
+    statuses[i] = Get(read_options, keys[i], &values[i]);
+  }
+  if (snapshot != nullptr) ReleaseSnapshot(snapshot);
+}
+
+Status DB::Get(const ReadOptions& options, const Slice& key, PinnableSlice* value) {
+  value->Reset();
+  Status s = Get(options, key, value->GetSelf());
+  if (s.ok()) {
+    value->PinSelf();
+  }
+  return s;
+}
+
 DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname,
@@ -1384,6 +2150,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
     s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
   }
   if (s.ok()) {
+    impl->InstallSuperVersion();
     impl->DeleteObsoleteFiles();
     impl->MaybeScheduleCompaction();
   }
@@ -1431,7 +2198,7 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
 }
 
 void DBImpl::WaitComp() {
-  while (!env_->IsSchedulerEmpty() || bg_compaction_scheduled_) {
+  while (!env_->IsSchedulerEmpty() || bg_flush_scheduled_ || bg_merges_scheduled_ > 0) {
     env_->SleepForMicroseconds(1000000);
     if (!versions_->State()) {
       break;
@@ -1442,7 +2209,10 @@ void DBImpl::WaitComp() {
 
 DBImpl::PM_root* DBImpl::allocate_pm_root(Index* index_) {
 	PM_root* p = static_cast<PM_root*>(nvram::pmalloc(sizeof(PM_root)));
-	p->index = index_;
+	p->magic = kPMRootMagic;
+	p->index = index_->PersistentRoot();
+	p->full_keys = index_->UsesFullKeys();
+	p->clean = false;
 	return p;
 }
 
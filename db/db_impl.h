@@ -5,12 +5,18 @@
 #ifndef STORAGE_LEVELDB_DB_DB_IMPL_H_
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
+#include <atomic>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
+#include "db/version.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "port/port.h"
@@ -18,8 +24,13 @@
 
 namespace leveldb {
 
+class Compaction;
+class CompactionInput;
+class IndexCursor;
 class MemTable;
+class RateLimiter;
 class TableCache;
+class ThreadPool;
 class VersionEdit;
 class VersionControl;
 class Version;
@@ -35,25 +46,91 @@ class DBImpl : public DB {
   // Implementations of the DB interface
   virtual Status Put(const WriteOptions&, const Slice& key, const Slice& value);
   virtual Status Delete(const WriteOptions&, const Slice& key);
+  virtual Status DeleteRange(const WriteOptions&, const Slice& begin, const Slice& end);
   virtual Status Write(const WriteOptions& options, WriteBatch* updates);
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key,
+                     PinnableSlice* value);
+  virtual void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* statuses);
   virtual Status Update(const WriteOptions&, const Slice& key, const Slice& value);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
-  virtual void CompactRange(const Slice* begin, const Slice* end) { }
-  virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes) { }
+  virtual Status SetOption(const Slice& name, const Slice& value);
+  virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual void WaitComp();
 
+  // Extra methods (for testing) that are not in the public DB interface
+
+  // Whether the super version handed to readers holds the current Version
+  bool TEST_SuperVersionIsCurrent();
+
+  // Live and total keys of all tables, merge candidates included
+  void TEST_KeyCounts(uint64_t* alive, uint64_t* total);
+
+  // Data blocks the merges took unchanged from their inputs
+  int64_t TEST_CopiedBlocks();
+
+  // Runs hook on a background merge, with the DB mutex released, each
+  // time the merge picks its inputs
+  void TEST_SetPickHook(std::function<void()> hook);
+
  private:
   friend class DB;
   friend class VersionControl;
   struct CompactionState;
   struct Writer;
 
+  // Pins mem_, imm_ and the current Version so that readers can use them
+  // without holding mutex_.  A new one is installed whenever any of them
+  // changes; the last reference drops the pins under mutex_.
+  struct SuperVersion {
+    MemTable* mem;
+    MemTable* imm;
+    Version* current;
+    std::atomic<int> refs;
+  };
+
+  // Per reader thread state: a cached reference to the super version and
+  // file access counters not yet handed over to the version control.
+  struct ReadSlot {
+    std::atomic<SuperVersion*> super_version;
+    std::unordered_map<uint16_t, uint32_t> file_access;
+    uint32_t accesses;
+    uint32_t reads;  // for sampling read latencies
+    DBImpl* db;      // null once the DB has let go of the slot
+
+    explicit ReadSlot(DBImpl* d) : super_version(nullptr), accesses(0), reads(0), db(d) { }
+
+    // Hands the file accesses of a thread that has exited over to db.  Only
+    // ScrapeReadSlots drops the last reference of a slot db still has, with
+    // read_slots_mutex_ held.
+    ~ReadSlot();
+  };
+
+  // Marks a read slot whose super version is being used by its thread
+  static SuperVersion* const kSuperVersionInUse;
+
+  ReadSlot* LocalReadSlot();
+  SuperVersion* AcquireSuperVersion(ReadSlot* slot);
+  void ReleaseSuperVersion(ReadSlot* slot, SuperVersion* sv);
+  void UnrefSuperVersion(SuperVersion* sv) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Cleanup of a value pinned in a memtable of the super version
+  static void UnpinSuperVersion(void* db, void* sv);
+  void InstallSuperVersion() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ScrapeReadSlots() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Counts a read served from file_number, handing the counters over in batches
+  void RecordFileAccess(ReadSlot* slot, uint16_t file_number);
+  static void BGFoldFileAccess(void* db);
+  void FoldFileAccess();
+
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
@@ -76,11 +153,21 @@ class DBImpl : public DB {
   // Errors are recorded in bg_error_.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Takes over the index left in the PM pool by the previous incarnation,
+  // or registers options_.index in the pool for a new DB.  If the old index
+  // cannot be used, it is rebuilt from the tables (options_.rebuild_index)
+  // and corrected live key counts are added to *edit.
+  Status RecoverIndex(bool new_db, VersionEdit* edit, bool* save_manifest)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
                         VersionEdit* edit, SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit)
+  // If pending is non-null the new table stays in pending_outputs_ and its
+  // number is stored in *pending, for the caller to erase once edit is
+  // applied.  Otherwise a merge finishing in between may delete it.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, uint64_t* pending = nullptr)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
@@ -90,17 +177,23 @@ class DBImpl : public DB {
   void RecordBackgroundError(const Status& s);
 
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  static void BGWork(void* db);
-  void BackgroundCall();
+  void BackgroundCall(bool flush);
+  void BackgroundFlush() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Merges the inputs of c and hands them back to versions_
+  Status RunCompaction(Compaction* c) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status DoSubcompactionWork(CompactionState* compact);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
-  Status InstallCompactionResults(CompactionState* compact)
+  bool CopyLiveBlock(CompactionState* compact, CompactionInput* input,
+                     IndexCursor* liveness, const Slice* prev_user_key,
+                     std::string* last_key, Status* status);
+  Status InstallCompactionResults(CompactionState* compact, bool delete_inputs)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   // Constant after construction
@@ -115,12 +208,20 @@ class DBImpl : public DB {
   // table_cache_ provides its own synchronization
   TableCache* table_cache_;
 
-	// PM root
+	// PM root, the root object of the pool.  The pool is mapped at the same
+	// address every time, so the raw pointers in it survive a restart.
   struct PM_root {
-    Index* index; 			// B-tree data block indexing
-    Version* current;		// Files metadata
+    uint64_t magic;
+    void* index; 			// Index::PersistentRoot()
+    bool full_keys;			// Index::UsesFullKeys() of that index
+    bool clean;				// no index work was in flight when it was closed
+    uint64_t db_id;			// VersionControl::DbId() of the DB of the index
+    uint64_t manifest_next_file;	// MANIFEST state the index matches
+    uint64_t last_sequence;
   };
   static PM_root* allocate_pm_root(Index* index_);
+  // Why the index in root cannot be reopened, OK if it can
+  Status CheckPersistentIndex(const PM_root* root);
   PM_root* pm_root_;
 
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
@@ -148,8 +249,36 @@ class DBImpl : public DB {
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Tombstones of the DeleteRange calls whose edit is not applied yet
+  std::vector<RangeTombstone> pending_range_tombstones_;
+
+  // Has a memtable flush been scheduled or is running?
+  bool bg_flush_scheduled_;
+  // Number of merges scheduled or running
+  int bg_merges_scheduled_;
+
+  // Flush memtables and run merges on threads of their own
+  std::unique_ptr<ThreadPool> flush_pool_;
+  std::unique_ptr<ThreadPool> merge_pool_;
+
+  // Runs all but the first sub-compaction of a merge
+  std::unique_ptr<ThreadPool> subcompaction_pool_;
+
+  // Paces the table writes of flushes and merges; provides its own
+  // synchronization
+  std::unique_ptr<RateLimiter> rate_limiter_;
+
+  SuperVersion* super_version_;
+
+  // Identifies this DB in the thread local read slot maps
+  const uint64_t db_id_;
+
+  // Read slots of all threads that have called Get and the file accesses
+  // they handed over; protected by read_slots_mutex_, acquired after mutex_
+  port::Mutex read_slots_mutex_;
+  std::vector<std::shared_ptr<ReadSlot>> read_slots_;
+  std::unordered_map<uint16_t, uint32_t> pending_file_access_;
+  std::atomic<bool> fold_scheduled_;
 
   VersionControl* versions_;
 
@@ -166,8 +295,9 @@ class DBImpl : public DB {
     int64_t bytes_read;
     int64_t bytes_written;
     int64_t total_stalls;
+    int64_t copied_blocks;
 
-    CompactionStats() : count(0), files_deleted(0), files_created(0), micros(0), bytes_read(0), bytes_written(0), total_stalls(0) { }
+    CompactionStats() : count(0), files_deleted(0), files_created(0), micros(0), bytes_read(0), bytes_written(0), total_stalls(0), copied_blocks(0) { }
 
     void Add(const CompactionStats& c) {
       this->count++;
@@ -176,6 +306,7 @@ class DBImpl : public DB {
       this->micros += c.micros;
       this->bytes_read += c.bytes_read;
       this->bytes_written += c.bytes_written;
+      this->copied_blocks += c.copied_blocks;
     }
   };
   CompactionStats stats_;
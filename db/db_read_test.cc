@@ -0,0 +1,586 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "db/db_impl.h"
+#include "db/dbformat.h"
+#include "leveldb/db.h"
+#include "leveldb/env.h"
+#include "leveldb/index.h"
+#include "leveldb/persistant_pool.h"
+#include "leveldb/pinnable_slice.h"
+#include "port/port.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static std::string Key(int i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), config::key_format, static_cast<uint64_t>(i));
+  return buf;
+}
+
+// Holds back the creation of table files while hold_tables is set, which
+// keeps the memtable being flushed immutable
+class HoldTablesEnv : public EnvWrapper {
+ public:
+  std::atomic<bool> hold_tables;
+  std::atomic<int> held;  // table files waiting to be created
+  std::atomic<std::thread::id> last_table_thread;  // created the last table file
+  std::atomic<std::thread::id> pass_thread;  // table files of it are never held
+
+  explicit HoldTablesEnv(Env* base) : EnvWrapper(base), hold_tables(false), held(0) { }
+
+  virtual Status NewWritableFile(const std::string& fname, WritableFile** result) {
+    const bool table = fname.size() > 4 && fname.compare(fname.size() - 4, 4, ".ldb") == 0;
+    if (table) {
+      last_table_thread.store(std::this_thread::get_id());
+    }
+    if (table && hold_tables.load() && pass_thread.load() != std::this_thread::get_id()) {
+      held++;
+      while (hold_tables.load()) {
+        SleepForMicroseconds(1000);
+      }
+      held--;
+    }
+    return target()->NewWritableFile(fname, result);
+  }
+
+  void WaitForHeld(int n) {
+    while (held.load() < n) {
+      SleepForMicroseconds(1000);
+    }
+  }
+
+  virtual bool IsSchedulerEmpty() { return target()->IsSchedulerEmpty(); }
+};
+
+class DBReadTest {
+ public:
+  std::string dbname_;
+  Options options_;
+  DB* db_;
+
+  DBReadTest() : db_(nullptr) {
+    dbname_ = test::TmpDir() + "/db_read_test";
+    DestroyDB(dbname_, Options());
+    options_.create_if_missing = true;
+    options_.index = CreateBtreeIndex();
+    options_.write_buffer_size = 64 << 10;
+    options_.compression = kNoCompression;
+  }
+
+  ~DBReadTest() {
+    delete db_;
+    DestroyDB(dbname_, Options());
+  }
+
+  void Open() {
+    ASSERT_OK(DB::Open(options_, dbname_, &db_));
+  }
+
+  void Close() {
+    delete db_;
+    db_ = nullptr;
+  }
+
+  DBImpl* dbfull() {
+    return reinterpret_cast<DBImpl*>(db_);
+  }
+
+  void Fill(int n, char c) {
+    for (int i = 0; i < n; i++) {
+      ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, c)));
+    }
+  }
+
+  std::string Get(int i) {
+    std::string value;
+    Status s = db_->Get(ReadOptions(), Key(i), &value);
+    return s.ok() ? value : s.ToString();
+  }
+};
+
+TEST(DBReadTest, MergeReleasesOldVersion) {
+  Open();
+  Fill(5000, 'a');
+  db_->WaitComp();
+  // caches the super version in the read slot of this thread
+  ASSERT_EQ(std::string(100, 'a'), Get(7));
+
+  // flushes a table every few rounds, and merges them once there are
+  // enough of them.  Less than a memtable is written per round, so a merge
+  // is the last thing done in the round it runs in.
+  for (int i = 0; i < 5000; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+    if (i % 200 == 199) {
+      db_->WaitComp();
+      ASSERT_TRUE(dbfull()->TEST_SuperVersionIsCurrent());
+    }
+  }
+  for (int i = 0; i < 5000; i += 13) {
+    ASSERT_EQ(std::string(100, 'b'), Get(i));
+  }
+}
+
+TEST(DBReadTest, RebuildIndex) {
+  // the memtable left at close is recovered from the log
+  options_.disable_recovery_log = false;
+  Open();
+  Fill(3000, 'a');
+  for (int i = 0; i < 3000; i += 2) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  for (int i = 1; i < 3000; i += 10) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+  }
+  db_->WaitComp();
+  Close();
+
+  // the pool lost its root, the index is rebuilt from the tables
+  nvram::set_root(nullptr);
+  options_.index = CreateBtreeIndex();
+  Open();
+  for (int i = 0; i < 3000; i++) {
+    if (i % 10 == 1) {
+      ASSERT_EQ("NotFound: ", Get(i));
+    } else {
+      ASSERT_EQ(std::string(100, i % 2 == 0 ? 'b' : 'a'), Get(i));
+    }
+  }
+  // the live counts match the rebuilt index: one entry per key, that of
+  // the tombstone for a deleted key
+  uint64_t alive, total;
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(3000, alive);
+}
+
+TEST(DBReadTest, ReopenIndex) {
+  options_.rebuild_index = false;
+  Open();
+  Fill(3000, 'a');
+  db_->CompactRange(nullptr, nullptr);
+  Close();
+
+  // the index is attached from the pool, not rebuilt
+  options_.index = CreateBtreeIndex();
+  Open();
+  for (int i = 0; i < 3000; i += 7) {
+    ASSERT_EQ(std::string(100, 'a'), Get(i));
+  }
+}
+
+TEST(DBReadTest, RejectIndexOfAnotherDB) {
+  options_.rebuild_index = false;
+  Open();
+  Fill(3000, 'a');
+  db_->CompactRange(nullptr, nullptr);
+  Close();
+
+  // a DB with the same MANIFEST history leaves its index in the pool
+  const std::string dbname = dbname_;
+  dbname_ = test::TmpDir() + "/db_read_test_other";
+  DestroyDB(dbname_, Options());
+  options_.index = CreateBtreeIndex();
+  Open();
+  Fill(3000, 'b');
+  db_->CompactRange(nullptr, nullptr);
+  Close();
+  DestroyDB(dbname_, Options());
+  dbname_ = dbname;
+
+  options_.index = CreateBtreeIndex();
+  Status s = DB::Open(options_, dbname_, &db_);
+  ASSERT_TRUE(s.IsCorruption());
+
+  // rebuilt from the tables of this DB instead
+  options_.rebuild_index = true;
+  options_.index = CreateBtreeIndex();
+  Open();
+  for (int i = 0; i < 3000; i += 7) {
+    ASSERT_EQ(std::string(100, 'a'), Get(i));
+  }
+}
+
+TEST(DBReadTest, CopyLiveBlocks) {
+  Open();
+  Fill(1000, 'a');
+  // the snapshot keeps both versions of the overwritten key in the output
+  // of the merge, next to each other in one block
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(db_->Put(WriteOptions(), Key(500), std::string(100, 'b')));
+  db_->CompactRange(nullptr, nullptr);
+  db_->ReleaseSnapshot(snapshot);
+  uint64_t alive, total;
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(1000, alive);
+  ASSERT_EQ(1001, total);
+
+  // the blocks of the merged table are copied, but for the one with the
+  // older version, which is dropped now
+  for (int i = 1000; i < 1100; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'c')));
+  }
+  const int64_t copied = dbfull()->TEST_CopiedBlocks();
+  db_->CompactRange(nullptr, nullptr);
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_TRUE(dbfull()->TEST_CopiedBlocks() > copied);
+  ASSERT_EQ(1100, alive);
+  ASSERT_EQ(1100, total);
+  for (int i = 0; i < 1100; i++) {
+    ASSERT_EQ(std::string(100, i >= 1000 ? 'c' : i == 500 ? 'b' : 'a'), Get(i));
+  }
+}
+
+TEST(DBReadTest, MultiGetMatchesGet) {
+  HoldTablesEnv env(Env::Default());
+  options_.env = &env;
+  Open();
+  Fill(3000, 'a');
+  for (int i = 0; i < 3000; i += 3) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  for (int i = 3; i < 3000; i += 7) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+  }
+  // also flushes the memtable
+  db_->CompactRange(nullptr, nullptr);
+
+  // fills one memtable, which is not flushed, and starts the next one
+  env.hold_tables.store(true);
+  for (int i = 0; i < 3000; i += 6) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'c')));
+  }
+  for (int i = 5; i < 3000; i += 13) {
+    ASSERT_OK(db_->Delete(WriteOptions(), Key(i)));
+  }
+
+  // keys from 3000 on were never written
+  const int n = 3100;
+  std::vector<std::string> keys;
+  std::vector<Slice> slices;
+  for (int i = 0; i < n; i++) {
+    keys.push_back(Key(i));
+  }
+  for (int i = 0; i < n; i++) {
+    slices.push_back(keys[i]);
+  }
+  std::vector<std::string> values(n);
+  std::vector<Status> statuses(n);
+  db_->MultiGet(ReadOptions(), n, slices.data(), values.data(), statuses.data());
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(Get(i), statuses[i].ok() ? values[i] : statuses[i].ToString());
+  }
+
+  env.hold_tables.store(false);
+  db_->WaitComp();
+  Close();
+}
+
+TEST(DBReadTest, DeleteRangeDuringMergeAndFlush) {
+  HoldTablesEnv env(Env::Default());
+  options_.env = &env;
+  options_.disable_recovery_log = false;
+  options_.max_subcompactions = 1;
+  Open();
+  Fill(3000, 'a');
+  for (int i = 0; i < 3000; i += 2) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  // flushes the memtable, no table is in the range
+  const std::string past_end = Key(3000);
+  const Slice past_end_key(past_end);
+  db_->CompactRange(&past_end_key, &past_end_key);
+  db_->WaitComp();
+
+  // a merge of all tables waits for its output
+  env.hold_tables.store(true);
+  std::thread merge([this] { db_->CompactRange(nullptr, nullptr); });
+  env.WaitForHeld(1);
+
+  // the memtable holds keys of the range, its flush waits too
+  for (int i = 1000; i < 1200; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'c')));
+  }
+  Status s;
+  std::thread deleter([this, &s] {
+    s = db_->DeleteRange(WriteOptions(), Key(1100), Key(2000));
+  });
+  env.WaitForHeld(2);
+  env.hold_tables.store(false);
+  deleter.join();
+  ASSERT_OK(s);
+  for (int i = 0; i < 3000; i++) {
+    if (i >= 1100 && i < 2000) {
+      ASSERT_EQ("NotFound: ", Get(i));
+    } else {
+      ASSERT_EQ(std::string(100, i >= 1000 && i < 1200 ? 'c' : i % 2 == 0 ? 'b' : 'a'), Get(i));
+    }
+  }
+
+  merge.join();
+  db_->WaitComp();
+  // reopened from the pool, then rebuilt from the tables
+  for (int round = 0; round < 2; round++) {
+    Close();
+    if (round == 1) {
+      nvram::set_root(nullptr);
+    }
+    options_.index = CreateBtreeIndex();
+    Open();
+    for (int i = 0; i < 3000; i++) {
+      if (i >= 1100 && i < 2000) {
+        ASSERT_EQ("NotFound: ", Get(i));
+      } else {
+        ASSERT_EQ(std::string(100, i >= 1000 && i < 1200 ? 'c' : i % 2 == 0 ? 'b' : 'a'), Get(i));
+      }
+    }
+  }
+  Close();
+}
+
+TEST(DBReadTest, FlushDuringMerge) {
+  HoldTablesEnv env(Env::Default());
+  options_.env = &env;
+  options_.max_background_merges = 1;
+  options_.max_subcompactions = 1;
+  Open();
+  // no garbage, no merge: only the flush thread creates tables
+  Fill(3000, 'a');
+  const std::string past_end = Key(3000);
+  const Slice past_end_key(past_end);
+  db_->CompactRange(&past_end_key, &past_end_key);
+  db_->WaitComp();
+  env.pass_thread.store(env.last_table_thread.load());
+
+  // the half overwritten tables are merged, and the merge waits for its
+  // output
+  env.hold_tables.store(true);
+  for (int i = 0; i < 3000; i += 2) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  env.WaitForHeld(1);
+
+  // memtables keep being flushed meanwhile, or the writes would block
+  for (int i = 3000; i < 6000; i++) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'c')));
+  }
+  const std::string new_end = Key(6000);
+  const Slice new_end_key(new_end);
+  db_->CompactRange(&new_end_key, &new_end_key);
+  ASSERT_EQ(1, env.held.load());
+  for (int i = 0; i < 6000; i += 7) {
+    ASSERT_EQ(std::string(100, i >= 3000 ? 'c' : i % 2 == 0 ? 'b' : 'a'), Get(i));
+  }
+
+  env.hold_tables.store(false);
+  db_->WaitComp();
+  for (int i = 0; i < 6000; i += 7) {
+    ASSERT_EQ(std::string(100, i >= 3000 ? 'c' : i % 2 == 0 ? 'b' : 'a'), Get(i));
+  }
+  Close();
+}
+
+TEST(DBReadTest, PickedFilesMergedMeanwhile) {
+  options_.max_background_merges = 1;
+  Open();
+  Fill(3000, 'a');
+  const std::string past_end = Key(3000);
+  const Slice past_end_key(past_end);
+  db_->CompactRange(&past_end_key, &past_end_key);
+  db_->WaitComp();
+
+  // the first background merge finds its picks merged by CompactRange by
+  // the time it takes the DB mutex back
+  std::atomic<int> picks(0);
+  std::atomic<bool> merged(false);
+  dbfull()->TEST_SetPickHook([this, &picks, &merged] {
+    if (picks++ == 0) {
+      db_->CompactRange(nullptr, nullptr);
+      merged.store(true);
+    }
+  });
+  for (int i = 0; i < 3000; i += 2) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  while (!merged.load()) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  db_->WaitComp();
+  dbfull()->TEST_SetPickHook(nullptr);
+
+  // no background error stops the writes
+  for (int i = 1; i < 3000; i += 2) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'c')));
+  }
+  db_->CompactRange(nullptr, nullptr);
+  for (int i = 0; i < 3000; i++) {
+    ASSERT_EQ(std::string(100, i % 2 == 0 ? 'b' : 'c'), Get(i));
+  }
+  Close();
+}
+
+TEST(DBReadTest, CompactRangeAndApproximateSizes) {
+  Open();
+  // too little garbage for the tables to become merge candidates, and too
+  // few tables for a locality merge
+  Fill(2000, 'a');
+  for (int i = 0; i < 2000; i += 5) {
+    ASSERT_OK(db_->Put(WriteOptions(), Key(i), std::string(100, 'b')));
+  }
+  const std::string past_end = Key(2000);
+  const Slice past_end_key(past_end);
+  db_->CompactRange(&past_end_key, &past_end_key);
+  db_->WaitComp();
+  uint64_t alive, total;
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(2000, alive);
+  ASSERT_EQ(2400, total);
+
+  // the tables outside the range keep their garbage
+  const std::string begin = Key(700);
+  const std::string end = Key(1299);
+  const Slice begin_key(begin);
+  const Slice end_key(end);
+  db_->CompactRange(&begin_key, &end_key);
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(2000, alive);
+  ASSERT_GT(total, 2000);
+  ASSERT_LT(total, 2400);
+
+  db_->CompactRange(nullptr, nullptr);
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(2000, alive);
+  ASSERT_EQ(2000, total);
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_EQ(std::string(100, i % 5 == 0 ? 'b' : 'a'), Get(i));
+  }
+
+  // every entry takes its 100 bytes of value and some more
+  const std::string keys[] = {Key(0), Key(500), Key(1500), Key(2000), Key(3000)};
+  Range ranges[] = {Range(keys[0], keys[3]), Range(keys[1], keys[2]), Range(keys[3], keys[4])};
+  uint64_t sizes[3];
+  db_->GetApproximateSizes(ranges, 3, sizes);
+  ASSERT_GT(sizes[0], 200000);
+  ASSERT_LT(sizes[0], 400000);
+  ASSERT_GT(sizes[1], sizes[0] * 2 / 5);
+  ASSERT_LT(sizes[1], sizes[0] * 3 / 5);
+  ASSERT_EQ(0, sizes[2]);
+  Close();
+}
+
+TEST(DBReadTest, SplitCompaction) {
+  HoldTablesEnv env(Env::Default());
+  options_.env = &env;
+  options_.write_buffer_size = 1 << 20;
+  options_.max_file_size = 1 << 20;
+  options_.max_subcompactions = 4;
+  Open();
+  // about ten tables without garbage, which no background merge picks
+  Fill(80000, 'a');
+  const std::string past_end = Key(80000);
+  const Slice past_end_key(past_end);
+  db_->CompactRange(&past_end_key, &past_end_key);
+  db_->WaitComp();
+
+  // every key range of the merge creates its first output at once
+  env.hold_tables.store(true);
+  std::thread merge([this] { db_->CompactRange(nullptr, nullptr); });
+  env.WaitForHeld(4);
+  env.hold_tables.store(false);
+  merge.join();
+
+  uint64_t alive, total;
+  dbfull()->TEST_KeyCounts(&alive, &total);
+  ASSERT_EQ(80000, alive);
+  ASSERT_EQ(80000, total);
+  for (int i = 0; i < 80000; i += 7) {
+    ASSERT_EQ(std::string(100, 'a'), Get(i));
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int n = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_EQ(Key(n), iter->key().ToString());
+    n++;
+  }
+  ASSERT_EQ(80000, n);
+  delete iter;
+  Close();
+}
+
+TEST(DBReadTest, PinnedValueInMemTable) {
+  Open();
+  ASSERT_OK(db_->Put(WriteOptions(), Key(1), "first"));
+  PinnableSlice value;
+  ASSERT_OK(db_->Get(ReadOptions(), Key(1), &value));
+  ASSERT_TRUE(value.IsPinned());
+  ASSERT_EQ("first", value.ToString());
+
+  // the memtable is flushed and merged away under the pinned value
+  Fill(5000, 'a');
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ("first", value.ToString());
+  value.Reset();
+  ASSERT_EQ(std::string(100, 'a'), Get(1));
+}
+
+TEST(DBReadTest, PinnedValueInMappedFile) {
+  Open();
+  Fill(5000, 'a');
+  db_->WaitComp();
+  // uncompressed blocks point into the mapped table, which is not cached
+  PinnableSlice value;
+  ASSERT_OK(db_->Get(ReadOptions(), Key(7), &value));
+  ASSERT_TRUE(value.IsPinned());
+  ASSERT_EQ(std::string(100, 'a'), value.ToString());
+
+  // the merge deletes the table the value points into
+  Fill(5000, 'b');
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ(std::string(100, 'a'), value.ToString());
+  value.Reset();
+  ASSERT_EQ(std::string(100, 'b'), Get(7));
+}
+
+TEST(DBReadTest, PinnedValueInBlock) {
+  std::string compressed;
+  if (!port::Snappy_Compress("aaaaaaaaaa", 10, &compressed)) {
+    fprintf(stderr, "skipping test because snappy is not available\n");
+    return;
+  }
+  // uncompressed blocks are on the heap
+  options_.compression = kSnappyCompression;
+  Open();
+  Fill(5000, 'a');
+  db_->WaitComp();
+
+  // not cached: the value is copied
+  ReadOptions no_fill;
+  no_fill.fill_cache = false;
+  PinnableSlice copied;
+  ASSERT_OK(db_->Get(no_fill, Key(7), &copied));
+  ASSERT_TRUE(!copied.IsPinned());
+  ASSERT_EQ(std::string(100, 'a'), copied.ToString());
+
+  // cached: the block cache keeps the block for the value
+  PinnableSlice cached;
+  ASSERT_OK(db_->Get(ReadOptions(), Key(7), &cached));
+  ASSERT_TRUE(cached.IsPinned());
+  ASSERT_EQ(std::string(100, 'a'), cached.ToString());
+
+  Fill(5000, 'b');
+  db_->CompactRange(nullptr, nullptr);
+  ASSERT_EQ(std::string(100, 'a'), copied.ToString());
+  ASSERT_EQ(std::string(100, 'a'), cached.ToString());
+  cached.Reset();
+  ASSERT_EQ(std::string(100, 'b'), Get(7));
+}
+
+}  // namespace leveldb
+
+int main() {
+  return leveldb::test::RunAllTests();
+}
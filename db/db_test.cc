@@ -1970,6 +1970,12 @@ class ModelDB: public DB {
   virtual Status Delete(const WriteOptions& o, const Slice& key) {
     return DB::Delete(o, key);
   }
+  virtual Status DeleteRange(const WriteOptions& o, const Slice& begin, const Slice& end) {
+    if (begin.compare(end) < 0) {
+      map_.erase(map_.lower_bound(begin.ToString()), map_.lower_bound(end.ToString()));
+    }
+    return Status::OK();
+  }
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) {
     assert(false);      // Not implemented
@@ -2014,6 +2020,9 @@ class ModelDB: public DB {
   virtual bool GetProperty(const Slice& property, std::string* value) {
     return false;
   }
+  virtual Status SetOption(const Slice& name, const Slice& value) {
+    return Status::InvalidArgument("unknown option", name);
+  }
   virtual void GetApproximateSizes(const Range* r, int n, uint64_t* sizes) {
     for (int i = 0; i < n; i++) {
       sizes[i] = 0;
@@ -22,12 +22,16 @@ namespace config {
 
 static constexpr char key_format[] = "%020lu";
 
-// Locality check configs
-static constexpr int LocalityMagicNumber = 1;
-
-// Number of iterations for one round during locality check
+// Number of index entries one locality check looks at
 static constexpr int LocalityCheckRange = 128000;
 
+// A locality check is spread over several background calls, each of which
+// spends at most this long on it with the DB mutex released
+static constexpr int LocalityCheckBudgetMicros = 2000;
+
+// Index entries per key range that the index keeps file counts for
+static constexpr int LocalitySegmentEntries = 4096;
+
 // Min number of unique files to mark for merge during locality check
 static constexpr int LocalityMinFileNumber = 10;
 
@@ -40,6 +44,14 @@ static constexpr int CompactionTrigger = 4;
 // Max number of files to be merged at once
 static constexpr int CompactionMaxSize = 15;
 
+// Max number of files merged at once by DB::CompactRange.  A range with
+// more tables is merged in groups of neighbouring tables.
+static constexpr int ManualCompactionMaxFiles = 64;
+
+// One in this many index leaves in a key range is read entry by entry by
+// DB::GetApproximateSizes, the others only have their entries counted.
+static constexpr int ApproximateSizeSampleStride = 8;
+
 // Overlap ratio threshold for compaction
 static constexpr float OverlapRatioThreshold = 0.0;
 
@@ -49,6 +61,18 @@ static constexpr int SlowdownWritesTrigger = 15;
 // Maximum number of merge candidate files.  We stop writes at this point.
 static constexpr int StopWritesTrigger = 35;
 
+// Number of file accesses a reader thread counts locally before handing
+// them over to be folded into the file access statistics.
+static constexpr int FileAccessBatch = 64;
+
+// One in this many reads of a thread is timed for the compaction rate
+// limiter when it adjusts its rate to the read latency.
+static constexpr int ReadLatencySampleInterval = 64;
+
+// Min number of queued index entries per insertion thread.  Smaller
+// batches are not worth handing to other threads.
+static constexpr int IndexMinRangeSize = 4096;
+
 // Approximate gap in bytes between samples of data read during iteration.
 static constexpr int kReadBytesPeriod = 1048576;
 
@@ -0,0 +1,230 @@
+#include "db/index_builder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <string>
+#include "db/dbformat.h"
+#include "db/table_cache.h"
+#include "db/version.h"
+#include "db/version_edit.h"
+#include "leveldb/env.h"
+#include "leveldb/index.h"
+#include "leveldb/options.h"
+#include "leveldb/table.h"
+#include "table/format.h"
+#include "util/mutexlock.h"
+#include "util/thread_pool.h"
+
+namespace leveldb {
+
+namespace {
+
+// One entry of a table as the index sees it
+struct TableEntry {
+  entry_key_t key;
+  SequenceNumber sequence;
+  std::shared_ptr<IndexMeta> meta;  // shared by the entries of a block
+  std::string user_key;             // only for indexes that use full keys
+};
+
+// Orders entries by key, the newest entry of a key first
+struct NewestFirst {
+  bool operator()(const TableEntry& a, const TableEntry& b) const {
+    if (a.key != b.key) return a.key < b.key;
+    const int r = a.user_key.compare(b.user_key);
+    if (r != 0) return r < 0;
+    if (a.sequence != b.sequence) return a.sequence > b.sequence;
+    // a merge cut short by shutdown leaves copies with equal sequence numbers
+    // in its inputs and outputs, the index pointed at the output
+    return a.meta->file_number > b.meta->file_number;
+  }
+};
+
+struct RebuildState {
+  RebuildState(const Options& options, TableCache* table_cache,
+               const std::vector<std::shared_ptr<FileMetaData>>& files,
+               const std::vector<RangeTombstone>& tombstones, const Comparator* ucmp)
+      : options(options), table_cache(table_cache), files(files),
+        tombstones(tombstones), ucmp(ucmp),
+        next_file(0), failed(false), done_files(0), done_bytes(0),
+        total_bytes(0), reported_step(0),
+        start_micros(options.env->NowMicros()) {
+    for (const auto& f : files) total_bytes += f->file_size;
+  }
+
+  // Logs the progress every tenth of the tables
+  void FileDone(const FileMetaData& f) {
+    MutexLock l(&mu);
+    done_files++;
+    done_bytes += f.file_size;
+    const int step = static_cast<int>(10 * done_files / files.size());
+    if (step > reported_step) {
+      reported_step = step;
+      const uint64_t micros = std::max<uint64_t>(1, options.env->NowMicros() - start_micros);
+      Log(options.info_log, "Index rebuild: %zu of %zu tables, %.1f of %.1f MB, %.2f GB/s",
+          done_files, files.size(), done_bytes / 1048576.0, total_bytes / 1048576.0,
+          done_bytes / 1e3 / micros);
+    }
+  }
+
+  void Fail(const Status& s) {
+    MutexLock l(&mu);
+    if (status.ok()) status = s;
+    failed.store(true);
+  }
+
+  const Options& options;
+  TableCache* const table_cache;
+  const std::vector<std::shared_ptr<FileMetaData>>& files;
+  const std::vector<RangeTombstone>& tombstones;
+  const Comparator* const ucmp;
+  std::atomic<size_t> next_file;
+  std::atomic<bool> failed;
+
+  port::Mutex mu;
+  Status status;  // first error of any thread
+  size_t done_files;
+  uint64_t done_bytes;
+  uint64_t total_bytes;
+  int reported_step;
+  const uint64_t start_micros;
+};
+
+// Appends the entries of every data block of table f that no range
+// tombstone deletes.  A deleted entry is older than any entry of its key
+// that is not, so the newest entry left is still the one to index.
+Status ScanTable(const Options& options, TableCache* table_cache,
+                 const ReadOptions& read_options, const FileMetaData& f,
+                 const std::vector<RangeTombstone>& tombstones, const Comparator* ucmp,
+                 std::vector<TableEntry>* entries) {
+  TableHandle handle;
+  Status s = table_cache->GetTable(f.number, f.file_size, &handle);
+  if (!s.ok()) return s;
+  Index* index = options.index;
+  const bool full_keys = index->UsesFullKeys();
+  Iterator* index_iter = handle.table_->NewIndexIterator();
+  for (index_iter->SeekToFirst(); s.ok() && index_iter->Valid(); index_iter->Next()) {
+    Slice input = index_iter->value();
+    BlockHandle block_handle;
+    s = block_handle.DecodeFrom(&input);
+    if (!s.ok()) break;
+    std::shared_ptr<IndexMeta> meta = std::make_shared<IndexMeta>(
+        block_handle.offset(), block_handle.size(), f.number);
+    Iterator* block_iter = handle.table_->BlockIterator(read_options, block_handle);
+    for (block_iter->SeekToFirst(); block_iter->Valid(); block_iter->Next()) {
+      ParsedInternalKey ikey;
+      if (!ParseInternalKey(block_iter->key(), &ikey)) {
+        s = Status::Corruption("bad internal key in table", std::to_string(f.number));
+        break;
+      }
+      if (!tombstones.empty() &&
+          RangeDeleted(tombstones, ucmp, ikey.user_key, ikey.sequence)) {
+        continue;
+      }
+      TableEntry entry;
+      entry.key = index->EntryKey(ikey.user_key);
+      entry.sequence = ikey.sequence;
+      entry.meta = meta;
+      if (full_keys) {
+        entry.user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+      }
+      entries->push_back(std::move(entry));
+    }
+    if (s.ok()) s = block_iter->status();
+    delete block_iter;
+  }
+  if (s.ok()) s = index_iter->status();
+  delete index_iter;
+  return s;
+}
+
+// Scans tables until none are left and sorts what it found
+void ScanTables(RebuildState* state, std::vector<TableEntry>* entries) {
+  ReadOptions read_options;
+  read_options.verify_checksums = state->options.paranoid_checks;
+  read_options.fill_cache = false;
+  for (;;) {
+    const size_t i = state->next_file.fetch_add(1);
+    if (i >= state->files.size() || state->failed.load()) break;
+    const FileMetaData& f = *state->files[i];
+    Status s = ScanTable(state->options, state->table_cache, read_options, f,
+                         state->tombstones, state->ucmp, entries);
+    if (!s.ok()) {
+      state->Fail(s);
+      break;
+    }
+    state->FileDone(f);
+  }
+  std::sort(entries->begin(), entries->end(), NewestFirst());
+}
+
+}  // anonymous namespace
+
+Status RebuildIndex(const Options& options,
+                    TableCache* table_cache,
+                    const std::vector<std::shared_ptr<FileMetaData>>& files,
+                    const std::vector<RangeTombstone>& tombstones,
+                    const Comparator* user_comparator,
+                    std::map<uint64_t, uint64_t>* live) {
+  live->clear();
+  if (files.empty()) return Status::OK();
+  RebuildState state(options, table_cache, files, tombstones, user_comparator);
+  const size_t threads = std::max<size_t>(1, std::min<size_t>(options.index_rebuild_threads,
+                                                              files.size()));
+  std::vector<std::vector<TableEntry>> parts(threads);
+  {
+    ThreadPool pool(threads - 1);
+    std::vector<std::future<void>> pending;
+    for (size_t i = 1; i < threads; i++) {
+      pending.push_back(pool.enqueue(&ScanTables, &state, &parts[i]));
+    }
+    ScanTables(&state, &parts[0]);
+    for (std::future<void>& result : pending) {
+      result.wait();
+    }
+  }
+  if (!state.status.ok()) return state.status;
+  const uint64_t scan_micros = std::max<uint64_t>(1, options.env->NowMicros() - state.start_micros);
+
+  std::vector<TableEntry> entries;
+  entries.swap(parts[0]);
+  for (size_t i = 1; i < threads; i++) {
+    const size_t middle = entries.size();
+    std::move(parts[i].begin(), parts[i].end(), std::back_inserter(entries));
+    std::vector<TableEntry>().swap(parts[i]);
+    std::inplace_merge(entries.begin(), entries.begin() + middle, entries.end(), NewestFirst());
+  }
+
+  // the queue keeps the newest entry of every key
+  std::deque<KeyAndMeta> queue;
+  for (size_t i = 0; i < entries.size(); i++) {
+    TableEntry& entry = entries[i];
+    if (!queue.empty() && queue.back().key == entry.key && queue.back().user_key == entry.user_key) {
+      continue;
+    }
+    (*live)[entry.meta->file_number]++;
+    KeyAndMeta key_meta;
+    key_meta.key = entry.key;
+    key_meta.meta = entry.meta;
+    key_meta.user_key.swap(entry.user_key);
+    queue.push_back(std::move(key_meta));
+  }
+  const size_t scanned = entries.size();
+  std::vector<TableEntry>().swap(entries);
+
+  const size_t indexed = queue.size();
+  VersionEdit edit;
+  options.index->AddQueue(queue, &edit);
+  edit.Wait();
+  const uint64_t micros = std::max<uint64_t>(1, options.env->NowMicros() - state.start_micros);
+  Log(options.info_log,
+      "Rebuilt index from %zu tables (%.1f MB): %zu of %zu entries indexed in %.3f s, "
+      "scan %.2f GB/s, total %.2f GB/s",
+      files.size(), state.total_bytes / 1048576.0, indexed, scanned, micros / 1e6,
+      state.total_bytes / 1e3 / scan_micros, state.total_bytes / 1e3 / micros);
+  return Status::OK();
+}
+
+}  // namespace leveldb
@@ -0,0 +1,35 @@
+#ifndef STORAGE_LEVELDB_DB_INDEX_BUILDER_H_
+#define STORAGE_LEVELDB_DB_INDEX_BUILDER_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+struct Options;
+class Comparator;
+struct FileMetaData;
+struct RangeTombstone;
+
+class TableCache;
+
+// Fills the still empty options.index from the tables in "files", e.g. when
+// the persistent memory pool holding the index was lost.  The tables are
+// scanned by options.index_rebuild_threads threads.  A user key found in
+// several tables is indexed at its entry with the highest sequence number.
+// Entries deleted by one of "tombstones", whose keys are ordered by
+// "user_comparator", are left out.  On success "*live" holds the number of index entries pointing into each
+// table.
+extern Status RebuildIndex(const Options& options,
+                           TableCache* table_cache,
+                           const std::vector<std::shared_ptr<FileMetaData>>& files,
+                           const std::vector<RangeTombstone>& tombstones,
+                           const Comparator* user_comparator,
+                           std::map<uint64_t, uint64_t>* live);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_INDEX_BUILDER_H_
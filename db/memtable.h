@@ -61,6 +61,10 @@ class MemTable {
   // Else, return false.
   bool Get(const LookupKey& key, std::string* value, Status* s);
 
+  // Same as above, but *value points into the memtable, which has to stay
+  // alive while it is used.
+  bool Get(const LookupKey& key, Slice* value, Status* s);
+
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
 
@@ -0,0 +1,172 @@
+#include "db/merge_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "db/dbformat.h"
+#include "db/version.h"
+#include "leveldb/options.h"
+
+namespace leveldb {
+
+// The knobs move at most once per this many memtable flushes
+static const int kAdjustFlushes = 4;
+
+// merge_threshold moves by this many percent at a time
+static const int kThresholdStep = 5;
+
+// Share of the window that writes may spend stalled on the merge backlog
+static const double kMaxStallShare = 0.05;
+
+// The policy backs off below this share of garbage in the tables, and gets
+// more eager above the other one
+static const double kLowGarbage = 0.10;
+static const double kHighGarbage = 0.25;
+
+// Overlap ratio threshold once the policy backed off all the way
+static const double kMaxOverlapRatio = 0.25;
+
+MergePolicy::MergePolicy(const Options* options)
+    : adaptive_(options->adaptive_merge_policy),
+      initial_threshold_(options->merge_threshold),
+      min_threshold_(std::min(options->min_merge_threshold, options->merge_threshold)),
+      max_threshold_(std::max(options->max_merge_threshold, options->merge_threshold)),
+      target_write_amplification_(options->target_write_amplification),
+      merge_threshold_(options->merge_threshold),
+      window_start_(0),
+      flushes_(0),
+      flush_bytes_(0),
+      merge_bytes_(0),
+      stall_micros_(0),
+      last_write_amplification_(0),
+      last_stall_share_(0),
+      last_garbage_(0),
+      raises_(0),
+      cuts_(0),
+      last_decision_(options->adaptive_merge_policy ? "none yet" : "fixed") {
+}
+
+double MergePolicy::Shift() const {
+  if (max_threshold_ == min_threshold_) return 0;
+  return static_cast<double>(merge_threshold_ - initial_threshold_) /
+         (max_threshold_ - min_threshold_);
+}
+
+int MergePolicy::compaction_trigger() const {
+  int trigger = config::CompactionTrigger -
+                static_cast<int>(std::lround(Shift() * config::CompactionTrigger));
+  return std::max(1, std::min(trigger, config::SlowdownWritesTrigger - 1));
+}
+
+int MergePolicy::compaction_max_size() const {
+  int size = config::CompactionMaxSize +
+             static_cast<int>(std::lround(Shift() * config::CompactionMaxSize / 2));
+  return std::max(2, size);
+}
+
+int MergePolicy::locality_check_range() const {
+  return static_cast<int>(config::LocalityCheckRange * (1 + Shift() * 3 / 4));
+}
+
+double MergePolicy::overlap_ratio_threshold() const {
+  return config::OverlapRatioThreshold + std::max(0.0, -Shift()) * kMaxOverlapRatio;
+}
+
+void MergePolicy::RecordFlush(uint64_t bytes_written) {
+  flushes_++;
+  flush_bytes_ += bytes_written;
+}
+
+void MergePolicy::RecordMerge(uint64_t bytes_written) {
+  merge_bytes_ += bytes_written;
+}
+
+void MergePolicy::RecordStall(uint64_t micros) {
+  stall_micros_ += micros;
+}
+
+double MergePolicy::Garbage(const std::vector<std::shared_ptr<FileMetaData>>& live,
+                            uint64_t histogram[10]) {
+  std::fill(histogram, histogram + 10, 0);
+  double bytes = 0;
+  double garbage = 0;
+  for (const auto& f : live) {
+    if (f->total == 0) continue;
+    double live_share = static_cast<double>(f->alive) / f->total;
+    histogram[std::min(9, static_cast<int>(live_share * 10))] += f->file_size;
+    bytes += f->file_size;
+    garbage += f->file_size * (1 - live_share);
+  }
+  return bytes > 0 ? garbage / bytes : 0;
+}
+
+void MergePolicy::MaybeAdjust(uint64_t now, const std::vector<std::shared_ptr<FileMetaData>>& live) {
+  if (window_start_ == 0) window_start_ = now;
+  if (flushes_ < kAdjustFlushes || flush_bytes_ == 0 || now <= window_start_) return;
+
+  uint64_t histogram[10];
+  last_write_amplification_ = static_cast<double>(flush_bytes_ + merge_bytes_) / flush_bytes_;
+  last_stall_share_ = static_cast<double>(stall_micros_) / (now - window_start_);
+  last_garbage_ = Garbage(live, histogram);
+  window_start_ = now;
+  flushes_ = 0;
+  flush_bytes_ = 0;
+  merge_bytes_ = 0;
+  stall_micros_ = 0;
+  if (!adaptive_) return;
+
+  int threshold = merge_threshold_;
+  if (last_stall_share_ > kMaxStallShare) {
+    last_decision_ = "backed off, writes stalled";
+    threshold -= kThresholdStep;
+  } else if (last_write_amplification_ > target_write_amplification_) {
+    last_decision_ = "backed off, over the write amplification target";
+    threshold -= kThresholdStep;
+  } else if (last_garbage_ < kLowGarbage) {
+    last_decision_ = "backed off, little garbage";
+    threshold -= kThresholdStep;
+  } else if (last_garbage_ > kHighGarbage &&
+             last_write_amplification_ < 0.75 * target_write_amplification_) {
+    last_decision_ = "raised, much garbage";
+    threshold += kThresholdStep;
+  } else {
+    last_decision_ = "held";
+  }
+  threshold = std::max(min_threshold_, std::min(threshold, max_threshold_));
+  if (threshold > merge_threshold_) raises_++;
+  if (threshold < merge_threshold_) cuts_++;
+  merge_threshold_ = threshold;
+}
+
+void MergePolicy::Describe(const std::vector<std::shared_ptr<FileMetaData>>& live,
+                           std::string* out) const {
+  char buf[200];
+  snprintf(buf, sizeof(buf),
+           "adaptive: %s\n"
+           "merge_threshold: %d (bounds %d-%d)\n"
+           "compaction_trigger: %d\n"
+           "compaction_max_size: %d\n"
+           "locality_check_range: %d\n"
+           "overlap_ratio_threshold: %.2f\n",
+           adaptive_ ? "yes" : "no", merge_threshold_, min_threshold_, max_threshold_,
+           compaction_trigger(), compaction_max_size(), locality_check_range(),
+           overlap_ratio_threshold());
+  out->append(buf);
+  snprintf(buf, sizeof(buf),
+           "last decision: %s (raised %d, backed off %d times)\n"
+           "last window: write amplification %.2f (target %.2f), stalled %.1f%%, garbage %.1f%%\n",
+           last_decision_, raises_, cuts_, last_write_amplification_,
+           target_write_amplification_, last_stall_share_ * 100, last_garbage_ * 100);
+  out->append(buf);
+
+  uint64_t histogram[10];
+  double garbage = Garbage(live, histogram);
+  snprintf(buf, sizeof(buf), "table MB by live share, garbage now %.1f%%:\n", garbage * 100);
+  out->append(buf);
+  for (int i = 0; i < 10; i++) {
+    snprintf(buf, sizeof(buf), "  %3d-%3d%% %10.1f\n", i * 10, i * 10 + 10, histogram[i] / 1048576.0);
+    out->append(buf);
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,94 @@
+#ifndef STORAGE_LEVELDB_DB_MERGE_POLICY_H_
+#define STORAGE_LEVELDB_DB_MERGE_POLICY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace leveldb {
+
+struct FileMetaData;
+struct Options;
+
+// How eagerly merges collect the garbage of the tables.  The knobs below
+// stand in for Options::merge_threshold and the config:: constants of the
+// same names.  With Options::adaptive_merge_policy they follow what the
+// last few memtable flushes saw: the policy backs off while merges
+// rewrite more than Options::target_write_amplification allows, while
+// writes stall on the merge backlog, or while the tables hold little
+// garbage, and gets more eager while the tables hold much garbage and the
+// budget leaves room.  merge_threshold moves within
+// [Options::min_merge_threshold, Options::max_merge_threshold] and the
+// other knobs move along with it.
+//
+// REQUIRES: the DB mutex is held for every call
+class MergePolicy {
+ public:
+  explicit MergePolicy(const Options* options);
+
+  // A table whose live share, in percent, is at or below this becomes a
+  // merge candidate
+  int merge_threshold() const { return merge_threshold_; }
+  // Merges are scheduled once there are more merge candidates than this
+  int compaction_trigger() const;
+  // Max number of merge candidates merged at once
+  int compaction_max_size() const;
+  // Index entries one locality check looks at
+  int locality_check_range() const;
+  // Candidates overlapping the leading one by no more than this are not
+  // merged along with it
+  double overlap_ratio_threshold() const;
+
+  void RecordFlush(uint64_t bytes_written);
+  void RecordMerge(uint64_t bytes_written);
+  void RecordStall(uint64_t micros);
+
+  // Moves the knobs once enough memtables were flushed since they last
+  // moved.  live holds the tables of the current version.
+  void MaybeAdjust(uint64_t now, const std::vector<std::shared_ptr<FileMetaData>>& live);
+
+  // Appends the knobs, the numbers behind the last decision and the live
+  // share distribution of live
+  void Describe(const std::vector<std::shared_ptr<FileMetaData>>& live, std::string* out) const;
+
+ private:
+  // Share of the table bytes that are garbage, and the table bytes by live
+  // share in tenths
+  static double Garbage(const std::vector<std::shared_ptr<FileMetaData>>& live,
+                        uint64_t histogram[10]);
+
+  // How far merge_threshold_ moved from where it started, as a share of
+  // its bounds, in [-1, 1]
+  double Shift() const;
+
+  const bool adaptive_;
+  const int initial_threshold_;
+  const int min_threshold_;
+  const int max_threshold_;
+  const double target_write_amplification_;
+  int merge_threshold_;
+
+  // Since the last adjustment
+  uint64_t window_start_;
+  int flushes_;
+  uint64_t flush_bytes_;
+  uint64_t merge_bytes_;
+  uint64_t stall_micros_;
+
+  // What the last adjustment saw and did
+  double last_write_amplification_;
+  double last_stall_share_;
+  double last_garbage_;
+  int raises_;
+  int cuts_;
+  const char* last_decision_;
+
+  // No copying allowed
+  MergePolicy(const MergePolicy&);
+  void operator=(const MergePolicy&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_MERGE_POLICY_H_
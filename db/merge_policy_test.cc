@@ -0,0 +1,150 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/merge_policy.h"
+
+#include "db/dbformat.h"
+#include "db/version.h"
+#include "leveldb/options.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class MergePolicyTest {
+ public:
+  Options options_;
+  std::vector<std::shared_ptr<FileMetaData>> live_;
+  uint64_t now_;
+
+  MergePolicyTest() : now_(1000000) {
+    options_.adaptive_merge_policy = true;
+  }
+
+  // Replaces the tables with one of 1MB whose live share is alive percent
+  void SetLive(uint64_t alive) {
+    live_.clear();
+    std::shared_ptr<FileMetaData> f(new FileMetaData);
+    f->file_size = 1 << 20;
+    f->total = 100;
+    f->alive = alive;
+    live_.push_back(f);
+  }
+
+  // Runs one window of kAdjustFlushes flushes of 1MB each that merged
+  // merge_mb and stalled for stall_micros out of a second
+  void Window(MergePolicy* policy, uint64_t merge_mb, uint64_t stall_micros) {
+    policy->MaybeAdjust(now_, live_);
+    for (int i = 0; i < 4; i++) {
+      policy->RecordFlush(1 << 20);
+    }
+    policy->RecordMerge(merge_mb << 20);
+    policy->RecordStall(stall_micros);
+    now_ += 1000000;
+    policy->MaybeAdjust(now_, live_);
+  }
+};
+
+TEST(MergePolicyTest, Fixed) {
+  options_.adaptive_merge_policy = false;
+  MergePolicy policy(&options_);
+  SetLive(10);
+  Window(&policy, 0, 500000);
+  Window(&policy, 0, 0);
+  ASSERT_EQ(70, policy.merge_threshold());
+  ASSERT_EQ(config::CompactionTrigger, policy.compaction_trigger());
+  ASSERT_EQ(config::CompactionMaxSize, policy.compaction_max_size());
+  ASSERT_EQ(config::LocalityCheckRange, policy.locality_check_range());
+  ASSERT_EQ(config::OverlapRatioThreshold, policy.overlap_ratio_threshold());
+}
+
+TEST(MergePolicyTest, WaitsForFlushes) {
+  MergePolicy policy(&options_);
+  SetLive(95);
+  policy.MaybeAdjust(now_, live_);
+  for (int i = 0; i < 3; i++) {
+    policy.RecordFlush(1 << 20);
+  }
+  now_ += 1000000;
+  policy.MaybeAdjust(now_, live_);
+  ASSERT_EQ(70, policy.merge_threshold());
+
+  // the fourth flush completes the window
+  policy.RecordFlush(1 << 20);
+  policy.MaybeAdjust(now_, live_);
+  ASSERT_EQ(65, policy.merge_threshold());
+}
+
+TEST(MergePolicyTest, BacksOff) {
+  MergePolicy policy(&options_);
+  // much garbage, yet writes stalled for a tenth of the window
+  SetLive(50);
+  Window(&policy, 0, 100000);
+  ASSERT_EQ(65, policy.merge_threshold());
+
+  // merges wrote 20MB for 4MB flushed, over the target of 4
+  Window(&policy, 20, 0);
+  ASSERT_EQ(60, policy.merge_threshold());
+
+  // little garbage left to collect
+  SetLive(95);
+  Window(&policy, 0, 0);
+  ASSERT_EQ(55, policy.merge_threshold());
+}
+
+TEST(MergePolicyTest, Raises) {
+  MergePolicy policy(&options_);
+  SetLive(50);
+  Window(&policy, 4, 0);
+  ASSERT_EQ(75, policy.merge_threshold());
+
+  // write amplification of 3.5 leaves too little room to raise
+  Window(&policy, 10, 0);
+  ASSERT_EQ(75, policy.merge_threshold());
+
+  // garbage in between the two marks
+  SetLive(85);
+  Window(&policy, 0, 0);
+  ASSERT_EQ(75, policy.merge_threshold());
+}
+
+TEST(MergePolicyTest, Bounds) {
+  MergePolicy policy(&options_);
+  SetLive(50);
+  for (int i = 0; i < 10; i++) {
+    Window(&policy, 0, 0);
+  }
+  ASSERT_EQ(90, policy.merge_threshold());
+  // eager: merges start earlier, take more tables, and check a wider range
+  ASSERT_EQ(3, policy.compaction_trigger());
+  ASSERT_EQ(18, policy.compaction_max_size());
+  ASSERT_EQ(160000, policy.locality_check_range());
+  ASSERT_EQ(0.0, policy.overlap_ratio_threshold());
+
+  SetLive(100);
+  for (int i = 0; i < 20; i++) {
+    Window(&policy, 0, 0);
+  }
+  ASSERT_EQ(30, policy.merge_threshold());
+  ASSERT_EQ(7, policy.compaction_trigger());
+  ASSERT_EQ(10, policy.compaction_max_size());
+  ASSERT_EQ(64000, policy.locality_check_range());
+  ASSERT_LT(0.16, policy.overlap_ratio_threshold());
+  ASSERT_LT(policy.overlap_ratio_threshold(), 0.17);
+}
+
+TEST(MergePolicyTest, Describe) {
+  MergePolicy policy(&options_);
+  SetLive(95);
+  Window(&policy, 0, 0);
+  std::string out;
+  policy.Describe(live_, &out);
+  ASSERT_TRUE(out.find("merge_threshold: 65 (bounds 30-90)") != std::string::npos);
+  ASSERT_TRUE(out.find("backed off, little garbage") != std::string::npos);
+}
+
+}  // namespace leveldb
+
+int main() {
+  return leveldb::test::RunAllTests();
+}
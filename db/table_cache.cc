@@ -6,6 +6,7 @@
 
 #include "db/filename.h"
 #include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
 #include "table/format.h"
@@ -112,33 +113,50 @@ Status TableCache::Get(const ReadOptions& options,
                        const IndexMeta* index,
                        const Slice& k,
                        void* arg,
-                       void(*saver)(void*, const Slice&, const Slice&)) {
-  Iterator* block_iter = nullptr;
-  Status s = GetBlockIterator(options, index, &block_iter);
-  assert(s.ok());
-  if (block_iter != nullptr) {
+                       void(*saver)(void*, const Slice&, const Slice&),
+                       PinnableSlice* pinned) {
+  Cache::Handle* handle = nullptr;
+  Status s = FindTable(index->file_number, 0, &handle);
+  if (s.ok()) {
+    Table* table = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
 #ifdef PERF_LOG
     uint64_t start_micros = benchmark::NowMicros();
-    block_iter->Seek(k);
+    s = table->BlockGet(options, BlockHandle(index->size, index->offset), k, arg, saver, pinned);
     benchmark::LogMicros(benchmark::QUERY_VALUE, benchmark::NowMicros() - start_micros);
-    start_micros = benchmark::NowMicros();
-    assert(block_iter->Valid());
-    if (block_iter->Valid()) {
-      (*saver)(arg, block_iter->key(), block_iter->value());
-    }
-    benchmark::LogMicros(benchmark::VALUE_COPY, benchmark::NowMicros() - start_micros);
 #else
-    block_iter->Seek(k);
-    if (block_iter->Valid()) {
-      (*saver)(arg, block_iter->key(), block_iter->value());
-    }
+    s = table->BlockGet(options, BlockHandle(index->size, index->offset), k, arg, saver, pinned);
 #endif
-    s = block_iter->status();
-    delete block_iter;
+    if (pinned != nullptr && pinned->IsPinned()) {
+      // the block may point into the file, which a merge can delete
+      pinned->RegisterCleanup(&UnrefEntry, cache_, handle);
+    } else {
+      cache_->Release(handle);
+    }
   }
   return s;
 }
 
+void TableCache::MultiGet(const ReadOptions& options,
+                          const IndexMeta& index,
+                          size_t n,
+                          const Slice* keys,
+                          void* const* args,
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Status* statuses) {
+  Cache::Handle* handle = nullptr;
+  Status s = FindTable(index.file_number, 0, &handle);
+  if (!s.ok()) {
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = s;
+    }
+    return;
+  }
+  Table* table = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  table->BlockMultiGet(options, BlockHandle(index.size, index.offset), n, keys, args, saver,
+                       statuses);
+  cache_->Release(handle);
+}
+
 Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_number,
                        uint64_t file_size,
@@ -31,7 +31,7 @@ struct TableHandle {
   }
 
   ~TableHandle() {
-    (*func)(arg1, arg2);
+    if (func != nullptr) (*func)(arg1, arg2);
   }
 
   Table* table_;
@@ -58,12 +58,26 @@ class TableCache {
                         Table** tableptr = nullptr);
 
   // If a seek to internal key "k" in specified file finds an entry,
-  // call (*handle_result)(arg, found_key, found_value).
+  // call (*handle_result)(arg, found_key, found_value).  If
+  // handle_result pinned found_value in "*pinned", the table and the
+  // block it points into are kept open until "*pinned" is reset.
   Status Get(const ReadOptions& options,
              const IndexMeta* index,
              const Slice& k,
              void* arg,
-             void(*handle_result)(void*, const Slice&, const Slice&));
+             void(*handle_result)(void*, const Slice&, const Slice&),
+             PinnableSlice* pinned = nullptr);
+
+  // Same as Get without pinning for each of keys[0,n-1], which are all
+  // in the block of "index", with args[i] for keys[i].  statuses[i] is
+  // set to the result of the lookup of keys[i].
+  void MultiGet(const ReadOptions& options,
+                const IndexMeta& index,
+                size_t n,
+                const Slice* keys,
+                void* const* args,
+                void (*handle_result)(void*, const Slice&, const Slice&),
+                Status* statuses);
 
   Status Get(const ReadOptions& options,
              uint64_t file_number,
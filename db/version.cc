@@ -1,6 +1,9 @@
 #include "version.h"
+
+#include <algorithm>
 #include "version_control.h"
 #include "leveldb/index.h"
+#include "leveldb/pinnable_slice.h"
 #ifdef PERF_LOG
 #include "util/perf_log.h"
 #endif
@@ -19,6 +22,7 @@ struct Saver {
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  PinnableSlice* pinned;  // takes the value instead of value if not NULL
 };
 
 static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
@@ -29,20 +33,45 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
       s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
+      if (s->state == kFound && s->pinned != nullptr) {
+        s->pinned->PinSlice(v);
+      } else if (s->state == kFound) {
         s->value->assign(v.data(), v.size());
       }
     }
   }
 }
 
+static Status SaverStatus(const Saver& saver) {
+  switch (saver.state) {
+    case kFound:
+      return Status::OK();
+    case kCorrupt:
+      return Status::Corruption("corrupted key for", saver.user_key);
+    case kNotFound:
+    case kDeleted:
+    default:
+      return Status::NotFound(Slice());
+  }
+}
+
 Status Version::Get(const ReadOptions& options, const LookupKey& key, std::string* val, uint16_t* file_number) {
+  return Get(options, key, val, nullptr, file_number);
+}
+
+Status Version::Get(const ReadOptions& options, const LookupKey& key, PinnableSlice* val, uint16_t* file_number) {
+  return Get(options, key, nullptr, val, file_number);
+}
+
+Status Version::Get(const ReadOptions& options, const LookupKey& key, std::string* val,
+                    PinnableSlice* pinned, uint16_t* file_number) {
   Status s;
   Slice ikey = key.internal_key();
   Slice user_key = key.user_key();
   const Comparator* ucmp = vcontrol_->user_comparator();
 
   Index* index = vcontrol_->options()->index;
+  IndexReadGuard read(index);
 
 #ifdef PERF_LOG
   uint64_t start_micros = benchmark::NowMicros();
@@ -58,28 +87,88 @@ Status Version::Get(const ReadOptions& options, const LookupKey& key, std::strin
     saver.ucmp = ucmp;
     saver.user_key = user_key;
     saver.value = val;
-    s = vcontrol_->cache()->Get(options, index_meta, ikey, &saver, SaveValue);
+    saver.pinned = pinned;
+    s = vcontrol_->cache()->Get(options, index_meta, ikey, &saver, SaveValue, pinned);
     *file_number = index_meta->file_number;
     if (!s.ok()) {
       return s;
     }
-    switch (saver.state) {
-      case kNotFound:
-        s = Status::NotFound(Slice());
-        return s;
-      case kFound:
-        return s;
-      case kDeleted:
-        s = Status::NotFound(Slice());
-        return s;
-      case kCorrupt:
-        s = Status::Corruption("corrupted key for", user_key);
-        return s;
-    }
+    return SaverStatus(saver);
   }
   return Status::NotFound(Slice());
 }
 
+void Version::MultiGet(const ReadOptions& options, GetRequest* requests, size_t n) {
+  const Comparator* ucmp = vcontrol_->user_comparator();
+  Index* index = vcontrol_->options()->index;
+
+  // in ascending order every lookup resumes at the leaf of the previous one
+  std::sort(requests, requests + n, [ucmp](const GetRequest& a, const GetRequest& b) {
+    return ucmp->Compare(a.key->user_key(), b.key->user_key()) < 0;
+  });
+  // the metas are copied while the cursor is on them, a merge may free
+  // them once it has moved on
+  std::vector<std::pair<IndexMeta, GetRequest*>> probes;
+  probes.reserve(n);
+  IndexCursor* cursor = index->NewCursor();
+  for (size_t i = 0; i < n; i++) {
+    const IndexMeta* index_meta = cursor->Get(requests[i].key->user_key());
+    if (index_meta != nullptr) {
+      probes.emplace_back(IndexMeta(index_meta->offset, index_meta->size,
+                                    index_meta->file_number),
+                          &requests[i]);
+    } else {
+      *requests[i].status = Status::NotFound(Slice());
+    }
+  }
+  delete cursor;
+
+  // the keys of one block are looked up in a single copy of it, still in
+  // ascending order
+  std::stable_sort(probes.begin(), probes.end(),
+                   [](const std::pair<IndexMeta, GetRequest*>& a,
+                      const std::pair<IndexMeta, GetRequest*>& b) {
+    if (a.first.file_number != b.first.file_number) {
+      return a.first.file_number < b.first.file_number;
+    }
+    return a.first.offset < b.first.offset;
+  });
+  std::vector<Saver> savers;
+  std::vector<Slice> keys;
+  std::vector<void*> args;
+  std::vector<Status> statuses;
+  for (size_t i = 0; i < probes.size(); ) {
+    const IndexMeta& index_meta = probes[i].first;
+    size_t end = i + 1;
+    while (end < probes.size() && probes[end].first.file_number == index_meta.file_number &&
+           probes[end].first.offset == index_meta.offset) {
+      end++;
+    }
+    savers.resize(end - i);
+    keys.resize(end - i);
+    args.resize(end - i);
+    statuses.resize(end - i);
+    for (size_t j = 0; j < end - i; j++) {
+      const GetRequest* request = probes[i + j].second;
+      Saver& saver = savers[j];
+      saver.state = kNotFound;
+      saver.ucmp = ucmp;
+      saver.user_key = request->key->user_key();
+      saver.value = request->value;
+      saver.pinned = nullptr;
+      keys[j] = request->key->internal_key();
+      args[j] = &saver;
+    }
+    vcontrol_->cache()->MultiGet(options, index_meta, end - i, keys.data(), args.data(),
+                                 SaveValue, statuses.data());
+    for (size_t j = 0; i < end; i++, j++) {
+      GetRequest* request = probes[i].second;
+      request->file_number = index_meta.file_number;
+      *request->status = statuses[j].ok() ? SaverStatus(savers[j]) : statuses[j];
+    }
+  }
+}
+
 void Version::Ref() {
   ++refs_;
 }
@@ -131,7 +220,7 @@ std::string Version::DebugString() const {
 }
 
 void Version::AddFile(std::shared_ptr<FileMetaData> f) {
-  max_key_ = std::max(max_key_, fast_atoi(f->largest.user_key()));
+  max_key_ = std::max(max_key_, f->largest_entry);
   files_.insert({f->number, f});
 }
 
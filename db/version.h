@@ -5,13 +5,16 @@
 #include <cstdint>
 #include <map>
 #include <set>
+#include <string>
 #include <utility>
+#include <vector>
 #include "leveldb/env.h"
 #include "log_writer.h"
 #include "table_cache.h"
 
 namespace leveldb {
 
+class PinnableSlice;
 class VersionControl;
 
 struct FileMetaData {
@@ -22,22 +25,69 @@ struct FileMetaData {
   uint64_t alive;             // Count of live keys
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
+  entry_key_t smallest_entry; // Index entry keys of smallest and largest,
+  entry_key_t largest_entry;  // set once the file is added to a version
 
-  FileMetaData() : file_size(0), total(0), alive(0) { }
+  FileMetaData() : file_size(0), total(0), alive(0), smallest_entry(0), largest_entry(0) { }
   FileMetaData(uint64_t number_, uint64_t file_size_,
                uint64_t total_, uint64_t alive_,
                InternalKey smallest_, InternalKey largest_)
       : number(number_), file_size(file_size_),
         total(total_), alive(alive_),
-        smallest(std::move(smallest_)), largest(std::move(largest_)) { }
+        smallest(std::move(smallest_)), largest(std::move(largest_)),
+        smallest_entry(0), largest_entry(0) { }
 };
 
+// A key range deleted by DB::DeleteRange.  The entries of the range older
+// than sequence are gone from the index, but tables written before the
+// deletion may still hold them; merges drop them and an index rebuilt from
+// the tables skips them.  Kept while any live table numbered below
+// file_number overlaps the range.
+struct RangeTombstone {
+  std::string begin;          // first user key of the range
+  std::string end;            // user key past the range
+  SequenceNumber sequence;
+  uint64_t file_number;
+
+  RangeTombstone() : sequence(0), file_number(0) { }
+
+  // Whether the entry of user_key with sequence s is deleted by the range
+  bool Covers(const Comparator* ucmp, const Slice& user_key, SequenceNumber s) const {
+    return s < sequence && ucmp->Compare(user_key, begin) >= 0 &&
+           ucmp->Compare(user_key, end) < 0;
+  }
+};
+
+// Whether one of tombstones deletes the entry of user_key with sequence s
+inline bool RangeDeleted(const std::vector<RangeTombstone>& tombstones, const Comparator* ucmp,
+                         const Slice& user_key, SequenceNumber s) {
+  for (const RangeTombstone& tombstone : tombstones) {
+    if (tombstone.Covers(ucmp, user_key, s)) return true;
+  }
+  return false;
+}
+
 class Version {
  public:
   explicit Version(VersionControl* vcontrol)
       : vcontrol_(vcontrol), refs_(0), max_key_(0) { }
 
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val, uint16_t*);
+  // Same as above, but a value found is pinned in *val, see DB::Get
+  Status Get(const ReadOptions&, const LookupKey& key, PinnableSlice* val, uint16_t*);
+
+  // A key of DB::MultiGet that is not in the memtables
+  struct GetRequest {
+    const LookupKey* key;
+    std::string* value;
+    Status* status;
+    uint16_t file_number;  // table the key was looked up in, 0 if none
+  };
+
+  // Same as Get for each of requests[0,n-1], which are reordered.  The
+  // index is walked once in key order and every block is read once for
+  // all the keys it holds.
+  void MultiGet(const ReadOptions&, GetRequest* requests, size_t n);
 
   void Ref();
   void Unref();
@@ -66,18 +116,30 @@ class Version {
 
   bool MoveToMerge(std::set<uint16_t> array, bool is_scan);
 
+  // Appends the metadata of every table, merge candidates included
+  void GetLiveFiles(std::vector<std::shared_ptr<FileMetaData>>* files) {
+    for (const auto& f : files_) files->push_back(f.second);
+    for (const auto& f : merge_candidates_) files->push_back(f.second);
+  }
+
   bool IsAlive(uint64_t fnumber) { return files_.count(fnumber) > 0 || merge_candidates_.count(fnumber) > 0; }
 
+  const std::vector<RangeTombstone>& RangeTombstones() const { return range_tombstones_; }
+
   std::string DebugString() const;
 
   friend class VersionControl;
  private:
   std::unordered_map<uint64_t, std::shared_ptr<FileMetaData>> files_;
   std::unordered_map<uint64_t, std::shared_ptr<FileMetaData>> merge_candidates_;
+  std::vector<RangeTombstone> range_tombstones_;  // in order of sequence
   VersionControl* vcontrol_;
   entry_key_t max_key_;
   int refs_;
 
+  Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
+             PinnableSlice* pinned, uint16_t*);
+
   ~Version() = default;
   // no copy
   Version(const Version&);
@@ -1,8 +1,9 @@
+#include <algorithm>
 #include <util/random.h>
 #include "version_control.h"
 #include "filename.h"
 #include "log_reader.h"
-#include "table/merger.h"
+#include "table/format.h"
 #include "index/btree_index.h"
 #include "index/ff_btree_iterator.h"
 #include "index/ff_btree.h"
@@ -11,12 +12,17 @@
 
 namespace leveldb {
 
+// Fewest output tables worth of entries a merge range is given
+static const int kMinTablesPerRange = 2;
+
 // Builder class
 
 class VersionControl::Builder {
-  std::vector<std::shared_ptr<FileMetaData>> added_files_;
+  // files added by the applied edits and whether they are merge candidates
+  std::map<uint64_t, std::pair<std::shared_ptr<FileMetaData>, bool>> added_files_;
   std::set<uint64_t> deleted_files_;
   std::unordered_map<uint64_t, uint64_t> dead_key_counter_;
+  std::map<SequenceNumber, RangeTombstone> range_tombstones_;
   VersionControl* vcontrol_;
   Version* base_;
  public:
@@ -24,74 +30,116 @@ class VersionControl::Builder {
   Builder(VersionControl* vcontrol, Version* base)
       : vcontrol_(vcontrol), base_(base) {
     base_->Ref();
+    for (const auto& tombstone : base_->range_tombstones_) {
+      range_tombstones_[tombstone.sequence] = tombstone;
+    }
   }
 
   ~Builder() {
     base_->Unref();
   }
 
+  // Recover applies every edit of the MANIFEST to one builder, so a later
+  // edit may delete or count dead keys of a file added by an earlier one
   void Apply(VersionEdit* edit) {
     for (const auto& iter : edit->deleted_files_) {
       deleted_files_.insert(iter);
+      added_files_.erase(iter);
+    }
+    for (const auto& iter : edit->new_files_) {
+      Add(iter, false);
+    }
+    for (const auto& iter : edit->merge_candidates_) {
+      Add(iter, true);
     }
     for (const auto& iter : edit->dead_key_counter_) {
-      dead_key_counter_.insert({iter.first, iter.second});
+      dead_key_counter_[iter.first] += iter.second;
     }
-    for (const auto& iter : edit->new_files_) {
-      std::shared_ptr<FileMetaData> f = std::make_shared<FileMetaData>();
-      f->number = iter.number;
-      f->file_size = iter.file_size;
-      f->total = iter.total;
-      f->alive = iter.alive;
-      f->smallest = iter.smallest;
-      f->largest = iter.largest;
-      deleted_files_.erase(f->number);
-      f->allowed_seeks = (f->file_size / 2048);
-      if (f->allowed_seeks < 100) f->allowed_seeks = 100;
-      added_files_.push_back(f);
+    for (const auto& iter : edit->range_tombstones_) {
+      RangeTombstone& tombstone = range_tombstones_[iter.sequence];
+      uint64_t file_number = std::max(tombstone.file_number, iter.file_number);
+      tombstone = iter;
+      tombstone.file_number = file_number;
     }
   }
 
   void SaveTo(Version* v, int threshold) {
     for (const auto& iter : base_->files_) {
       assert(iter.first == iter.second->number);
-      auto f = iter.second;
       if (deleted_files_.count(iter.first) <= 0) { // do not add if got deleted
-        uint64_t dead = 0;
-        try {
-          dead = dead_key_counter_.at(f->number);
-        } catch (std::exception& e) { }
-        if (f->alive > dead) {
-          f->alive -= dead;
-          if (100 * f->alive / f->total <= threshold) { // move to compaction list
-            v->AddCompactionFile(f);
-            vcontrol_->state_change_ = true;
-          } else {
-            v->AddFile(f);
-          }
-        }
+        Save(v, iter.second, false, threshold);
       }
     }
     for (const auto& iter : base_->merge_candidates_) {
       assert(iter.first == iter.second->number);
-      auto f = iter.second;
       if (deleted_files_.count(iter.first) <= 0) { // do not add if got deleted
-        uint64_t dead = 0;
-        try {
-          dead = dead_key_counter_.at(f->number);
-        } catch (std::exception& e) { }
-        if (f->alive > dead) {
-          f->alive -= dead;
-          v->AddCompactionFile(f);
-        }
+        Save(v, iter.second, true, threshold);
       }
     }
-    for (const auto& f : added_files_) {
-      assert(dead_key_counter_.count(f->number) >= 0);
-      v->AddFile(f);
+    for (const auto& iter : added_files_) {
+      Save(v, iter.second.first, iter.second.second, threshold);
     }
+    for (const auto& iter : range_tombstones_) {
+      if (MayHoldCovered(v, iter.second)) {
+        v->range_tombstones_.push_back(iter.second);
+      }
+    }
+  }
+
+ private:
+  void Add(const FileMetaData& file, bool merge_candidate) {
+    std::shared_ptr<FileMetaData> f = std::make_shared<FileMetaData>();
+    f->number = file.number;
+    f->file_size = file.file_size;
+    f->total = file.total;
+    f->alive = file.alive;
+    f->smallest = file.smallest;
+    f->largest = file.largest;
+    f->smallest_entry = vcontrol_->options_->index->EntryKey(f->smallest.user_key());
+    f->largest_entry = vcontrol_->options_->index->EntryKey(f->largest.user_key());
+    deleted_files_.erase(f->number);
+    f->allowed_seeks = (f->file_size / 2048);
+    if (f->allowed_seeks < 100) f->allowed_seeks = 100;
+    // a file added again (a MANIFEST snapshot) comes with its live count
+    dead_key_counter_.erase(f->number);
+    added_files_[f->number] = std::make_pair(f, merge_candidate);
+  }
+
+  // Whether a table of v may still hold entries deleted by tombstone
+  bool MayHoldCovered(Version* v, const RangeTombstone& tombstone) const {
+    const Comparator* ucmp = vcontrol_->user_comparator();
+    for (const auto* files : {&v->files_, &v->merge_candidates_}) {
+      for (const auto& iter : *files) {
+        const FileMetaData* f = iter.second.get();
+        if (f->number < tombstone.file_number &&
+            ucmp->Compare(f->largest.user_key(), tombstone.begin) >= 0 &&
+            ucmp->Compare(f->smallest.user_key(), tombstone.end) < 0) {
+          return true;
+        }
+      }
+    }
+    return false;
   }
 
+  // Files without live keys are dropped
+  void Save(Version* v, const std::shared_ptr<FileMetaData>& f, bool merge_candidate, int threshold) {
+    uint64_t dead = 0;
+    auto it = dead_key_counter_.find(f->number);
+    if (it != dead_key_counter_.end()) {
+      dead = it->second;
+    }
+    if (f->alive > dead) {
+      f->alive -= dead;
+      if (merge_candidate) {
+        v->AddCompactionFile(f);
+      } else if (100 * f->alive / f->total <= threshold) { // move to compaction list
+        v->AddCompactionFile(f);
+        vcontrol_->state_change_ = true;
+      } else {
+        v->AddFile(f);
+      }
+    }
+  }
 };
 
 // Compaction class
@@ -137,23 +185,28 @@ VersionControl::VersionControl(DBImpl* db,
                                TableCache* table_cache,
                                const InternalKeyComparator* cmp)
     : env_(options->env),
-      db_(db),
       dbname_(dbname),
-      options_(options),
-      table_cache_(table_cache),
-      icmp_(*cmp),
       next_file_number_(2),
       manifest_file_number_(0),
+      db_id_(0),
       last_sequence_(0),
       log_number_(0),
       prev_log_number_(0),
+      icmp_(*cmp),
+      options_(options),
+      db_(db),
+      descriptor_file_(nullptr),
+      descriptor_log_(nullptr),
+      current_(nullptr),
+      table_cache_(table_cache),
+      locality_checking_(false),
+      locality_entries_(0),
       gen(rd()),
       distribution(0, INT_MAX),
-      locality_check_key(0),
       state_change_(false),
-      descriptor_file_(nullptr),
-      descriptor_log_(nullptr),
-      current_(nullptr) {
+      merge_policy_(options),
+      manifest_writing_(false),
+      manifest_cv_(&db->mutex_) {
   AppendVersion(new Version(this));
 }
 
@@ -167,8 +220,6 @@ void VersionControl::AppendVersion(Version* v) {
   assert(v->refs_ == 0);
   assert(v != current_);
   if (current_ != nullptr) {
-		db_->pm_root_->current = v;
-		clflush((char*)(db_->pm_root_->current), sizeof(void*));
     current_->Unref();
   }
   current_ = v;
@@ -212,6 +263,7 @@ Status VersionControl::Recover(bool* save_manifest) {
   uint64_t last_sequence = 0;
   uint64_t log_number = 0;
   uint64_t prev_log_number = 0;
+  uint64_t db_id = 0;
   Builder builder(this, current_);
 
   {
@@ -255,6 +307,10 @@ Status VersionControl::Recover(bool* save_manifest) {
         last_sequence = edit.GetLastSequence();
         have_last_sequence = true;
       }
+
+      if (edit.HasDbId()) {
+        db_id = edit.GetDbId();
+      }
     }
   }
 
@@ -280,11 +336,12 @@ Status VersionControl::Recover(bool* save_manifest) {
 
   if (s.ok()) {
     Version* v = new Version(this);
-    builder.SaveTo(v, options_->merge_threshold);
+    builder.SaveTo(v, merge_policy_.merge_threshold());
     AppendVersion(v);
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
     last_sequence_ = last_sequence;
+    db_id_ = db_id;
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
 
@@ -305,6 +362,9 @@ bool VersionControl::ReuseManifest(const std::string& dscname,
 }
 
 Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
+  while (manifest_writing_) {
+    manifest_cv_.Wait();
+  }
   if (edit->HasLogNumber()) {
     assert(edit->GetLogNumber() >= log_number_);
     assert(edit->GetLogNumber() < next_file_number_);
@@ -322,7 +382,7 @@ Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     Builder builder(this, current_);
     edit->Wait();
     builder.Apply(edit);
-    builder.SaveTo(v, options_->merge_threshold);
+    builder.SaveTo(v, merge_policy_.merge_threshold());
   }
 
   std::string new_manifest_file;
@@ -339,6 +399,7 @@ Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   {
+    manifest_writing_ = true;
     mu->Unlock();
     if (s.ok()) {
       std::string record;
@@ -358,6 +419,12 @@ Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   if (s.ok()) {
+    // the index now matches this MANIFEST record
+    if (db_->pm_root_ != nullptr) {
+      db_->pm_root_->manifest_next_file = edit->GetNextFile();
+      db_->pm_root_->last_sequence = edit->GetLastSequence();
+      clflush((char*)db_->pm_root_, sizeof(DBImpl::PM_root));
+    }
     // append version
     AppendVersion(v);
     log_number_ = edit->GetLogNumber();
@@ -372,6 +439,8 @@ Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
       env_->DeleteFile(new_manifest_file);
     }
   }
+  manifest_writing_ = false;
+  manifest_cv_.SignalAll();
   std::string msg;
   for (const auto& f : current()->merge_candidates_) {
     msg.append(" ").append(std::to_string(f.first));
@@ -380,12 +449,12 @@ Status VersionControl::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   return s;
 }
 
-void VersionControl::RegisterFileAccess(const uint16_t& file_number) {
+void VersionControl::RegisterFileAccess(const uint16_t& file_number, uint32_t count) {
   if (file_number == 0) return;
   std::shared_ptr<FileMetaData> file_metadata;
   try {
     file_metadata = current_->files_.at(file_number);
-    file_metadata->allowed_seeks--;
+    file_metadata->allowed_seeks -= std::min(count, file_metadata->allowed_seeks);
   } catch (std::exception& e) {
 //    try {
 //      file_metadata = current_->merge_candidates_.at(file_number);
@@ -404,87 +473,89 @@ void VersionControl::RegisterFileAccess(const uint16_t& file_number) {
   }
 }
 
-void VersionControl::UpdateLocalityCheckKey(const leveldb::Slice& target) {
-  locality_check_key = fast_atoi(target);
-}
+void VersionControl::CheckLocality(port::Mutex* mu) {
+  if (locality_checking_) return;  // the other background thread is at it
+  if (current_->merge_candidates_.size() >= config::StopWritesTrigger) {
+    Log(options_->info_log, "Too many files... Skip locality check");
+    return;
+  }
+  const uint64_t range = merge_policy_.locality_check_range();
+  locality_checking_ = true;
+  mu->Unlock();
+  const uint64_t start_micros = env_->NowMicros();
+  bool complete = options_->index->LocalityWindow(
+      &locality_cursor_, range, env_, start_micros + config::LocalityCheckBudgetMicros,
+      &locality_entries_, &locality_files_);
+  mu->Lock();
+  locality_checking_ = false;
+  if (!complete) return;  // resumed by the next call
 
-void VersionControl::CheckLocality() {
-  for (int64_t r = 0; r < config::LocalityMagicNumber; r++) {
-    Log(options_->info_log, "Locality Check");
-    if (current_->merge_candidates_.size() >= config::StopWritesTrigger) {
-      Log(options_->info_log, "Too many files... Skip locality check");
-      return;
-    }
-    auto iter = dynamic_cast<BtreeIndex*>(options_->index)->BtreeIterator();
-    std::set<uint16_t> uniq_files;
-    // go to prev RR key
-    iter->Seek(locality_check_key);
-    // go to first key if not valid
-    if (!iter->Valid()) iter->SeekToFirst();
-    uint64_t temp = iter->key();
-    Log(options_->info_log, "Starting locality check by key %lu", iter->key());
-    for (uint64_t scanned_size = 0; scanned_size < config::LocalityCheckRange && iter->Valid(); scanned_size++) {
-      IndexMeta* meta = (IndexMeta*) iter->value();
-      uint16_t fnumber = meta->file_number;
-      uniq_files.insert(fnumber);
-      iter->Next();
-    }
-    if (iter->Valid()) {
-      locality_check_key = iter->key();
-    } else {
-      locality_check_key = 0;
-    }
-    if (uniq_files.empty() || uniq_files.size() < config::LocalityMinFileNumber) {
-      std::string msg;
-      for (const auto& file : uniq_files) {
-        msg.append(" ").append(std::to_string(file));
-      }
-      Log(options_->info_log, "Not enough files for locality merge %lu@[%s]", uniq_files.size(), msg.c_str());
-      return;
-    }
-    delete iter;
-    std::string msg;
-    char buf[100];
-    for (const auto& f : uniq_files) {
-      snprintf(buf, sizeof(buf), "%d, ", f);
-      msg.append(buf);
-    }
+  std::string msg;
+  for (const auto& f : locality_files_) {
+    msg.append(" ").append(std::to_string(f));
+  }
+  if (locality_files_.size() < config::LocalityMinFileNumber) {
+    Log(options_->info_log, "Not enough files for locality merge %zu@[%s] in %llu entries",
+        locality_files_.size(), msg.c_str(), (unsigned long long)locality_entries_);
+  } else if (current_->MoveToMerge(locality_files_, false)) {
     state_change_ = true;
-    if (current_->MoveToMerge(uniq_files, false)) {
-      Log(options_->info_log, "Added for locality merge %lu@[%s] files; Starting key %lu", uniq_files.size(), msg.c_str(), temp);
-    } else {
-      Log(options_->info_log, "Too many files... Skip add new candidates; Starting key %lu", temp);
-    }
+    Log(options_->info_log, "Added for locality merge %zu@[%s] files",
+        locality_files_.size(), msg.c_str());
+  } else {
+    Log(options_->info_log, "Too many files... Skip add new candidates");
   }
+  locality_entries_ = 0;
+  locality_files_.clear();
 }
 
-Compaction* VersionControl::PickCompaction() {
+Compaction* VersionControl::PickCompaction(port::Mutex* mu) {
   // get compaction and return
   if (current_->merge_candidates_.size() <= 1) return nullptr;
-  state_change_ = true;
+  std::vector<std::shared_ptr<FileMetaData>> candidates;
+  candidates.reserve(current_->merge_candidates_.size());
+  for (const auto& f : current_->merge_candidates_) {
+    if (merging_files_.count(f.first) == 0) candidates.push_back(f.second);
+  }
+  const bool forced = current_->merge_candidates_.size() >= config::StopWritesTrigger;
+  const double overlap_threshold = merge_policy_.overlap_ratio_threshold();
+  const int max_size = merge_policy_.compaction_max_size();
+
+  // score the candidates without holding mu
+  mu->Unlock();
+  if (pick_hook_) pick_hook_();
+  std::vector<std::shared_ptr<FileMetaData>> picked;
+  bool state_change = true;
+  TryToPick(candidates, overlap_threshold, max_size, &picked);
+  if (picked.size() <= 1 && forced) {
+    picked.clear();
+    ForcedPick(candidates, &picked);
+  }
+  if (picked.size() <= 1) {
+    state_change = false;
+    picked.clear();
+    TryToPick(candidates, 0.0, max_size, &picked);
+    if (picked.size() > 1) state_change = true;
+  }
+  mu->Lock();
+
+  // another merge may have taken some of the files in the meantime
   Compaction* c = new Compaction(options_);
-  TryToPick(&c);
-  if (c->num_input_files() <= 1) {
-    c->ReleaseFiles();
-    if (current_->merge_candidates_.size() >= config::StopWritesTrigger) {
-      ForcedPick(&c);
+  for (const auto& f : picked) {
+    if (merging_files_.count(f->number) == 0 && current_->merge_candidates_.count(f->number) != 0) {
+      c->AddInput(f);
     }
   }
-  if (c->num_input_files() <= 1) {
-    state_change_ = false;
-    c->ReleaseFiles();
-    TryToPick(&c);
-    if (c->num_input_files() > 1) state_change_ = true;
-  }
   if (c->num_input_files() <= 1) {
     state_change_ = false;
     Log(options_->info_log, "No compaction candidates were picked");
     delete c;
     return nullptr;
   }
+  state_change_ = state_change;
   Log(options_->info_log, "Compact %zu candidates for merge", c->num_input_files());
   std::string msg;
   for (int i = 0; i < c->num_input_files(); i++) {
+    merging_files_.insert(c->input(i)->number);
     msg.append(std::to_string(c->input(i)->number));
     msg.append(" ");
   }
@@ -492,73 +563,301 @@ Compaction* VersionControl::PickCompaction() {
   return c;
 }
 
-void VersionControl::ForcedPick(Compaction** c) {
+void VersionControl::ReleaseCompactionFiles(Compaction* c) {
+  for (int i = 0; i < c->num_input_files(); i++) {
+    merging_files_.erase(c->input(i)->number);
+  }
+  // the candidates left over are picked again once the merge finished
+  state_change_ = true;
+}
+
+void VersionControl::GetOverlappingFiles(const Slice* begin, const Slice* end,
+                                         std::vector<std::shared_ptr<FileMetaData>>* files) {
+  const Comparator* ucmp = user_comparator();
+  std::vector<std::shared_ptr<FileMetaData>> live;
+  current_->GetLiveFiles(&live);
+  for (const auto& f : live) {
+    if (begin != nullptr && ucmp->Compare(f->largest.user_key(), *begin) < 0) continue;
+    if (end != nullptr && ucmp->Compare(f->smallest.user_key(), *end) > 0) continue;
+    files->push_back(f);
+  }
+  std::sort(files->begin(), files->end(),
+            [this](const std::shared_ptr<FileMetaData>& a, const std::shared_ptr<FileMetaData>& b) {
+              return icmp_.Compare(a->smallest, b->smallest) < 0;
+            });
+}
+
+bool VersionControl::IsMerging(const std::vector<std::shared_ptr<FileMetaData>>& files) const {
+  for (const auto& f : files) {
+    if (merging_files_.count(f->number) != 0) return true;
+  }
+  return false;
+}
+
+Compaction* VersionControl::CompactFiles(const std::vector<std::shared_ptr<FileMetaData>>& files) {
+  Compaction* c = new Compaction(options_);
+  std::string msg;
+  for (const auto& f : files) {
+    assert(merging_files_.count(f->number) == 0);
+    c->AddInput(f);
+    merging_files_.insert(f->number);
+    msg.append(std::to_string(f->number));
+    msg.append(" ");
+  }
+  Log(options_->info_log, "Manual compaction of files %s", msg.c_str());
+  return c;
+}
+
+void VersionControl::DeleteFilesInRange(const Slice& begin, const Slice& end, VersionEdit* edit,
+                                        std::vector<uint64_t>* held) {
+  const Comparator* ucmp = user_comparator();
+  std::vector<std::shared_ptr<FileMetaData>> live;
+  current_->GetLiveFiles(&live);
+  for (const auto& f : live) {
+    if (merging_files_.count(f->number) == 0 &&
+        ucmp->Compare(f->smallest.user_key(), begin) >= 0 &&
+        ucmp->Compare(f->largest.user_key(), end) < 0) {
+      edit->DeleteFile(f->number);
+      merging_files_.insert(f->number);
+      held->push_back(f->number);
+    }
+  }
+}
+
+void VersionControl::ReleaseFiles(const std::vector<uint64_t>& held) {
+  for (uint64_t number : held) {
+    merging_files_.erase(number);
+  }
+}
+
+void VersionControl::ForcedPick(const std::vector<std::shared_ptr<FileMetaData>>& candidates,
+                                std::vector<std::shared_ptr<FileMetaData>>* picked) {
   Log(options_->info_log, "Forced compaction");
-  for (auto iter = current_->merge_candidates_.begin(); iter != current_->merge_candidates_.end() &&
-      (*c)->num_input_files() <= options_->forced_compaction_size;
+  for (auto iter = candidates.begin(); iter != candidates.end() &&
+      picked->size() <= options_->forced_compaction_size;
     iter++) {
-      (*c)->AddInput(iter->second);
-  }
-}
-
-void VersionControl::TryToPick(Compaction** c) {
-  std::vector<std::pair<double, std::shared_ptr<FileMetaData>>> best_pick_list;
-  best_pick_list.reserve(current()->merge_candidates_.size());
-  double best_pick_score = 0.0;
-  for (const auto& main_candidate : current()->merge_candidates_) {
-    std::vector<std::pair<double, std::shared_ptr<FileMetaData>>> current_pick_list;
-    current_pick_list.reserve(current()->merge_candidates_.size());
-    double current_pick_score = 0.0;
-    double smallest1 = fast_atoi(main_candidate.second->smallest.user_key());
-    double largest1 = fast_atoi(main_candidate.second->largest.user_key());
-    for (const auto& next_candidate : current()->merge_candidates_) {
-      double smallest2 = fast_atoi(next_candidate.second->smallest.user_key());
-      double largest2 = fast_atoi(next_candidate.second->largest.user_key());
-      if (largest2 < smallest1 || smallest2 > largest1) {
-        continue; // skip
-      } else {
-        double score = (min(largest1, largest2) - max(smallest1, smallest2))/(max(largest1, largest2) - min(smallest1, smallest2));
-        current_pick_score += score;
-        current_pick_list.emplace_back(score, next_candidate.second);
+      picked->push_back(*iter);
+  }
+}
+
+namespace {
+
+// Keys of the ends of the merge candidates, in the order of their user
+// keys, for the overlap estimates.  Those of an integer index are its
+// entry keys.  The entry key of a full-key index only holds the first
+// bytes of a key, which all candidates may share, so there the 8 bytes
+// following the prefix common to all candidates stand in for the key.
+class CandidateKeys {
+ public:
+  CandidateKeys(const std::vector<std::shared_ptr<FileMetaData>>& files, bool full_keys)
+      : full_keys_(full_keys), prefix_(0) {
+    if (!full_keys_ || files.empty()) return;
+    Slice first = files[0]->smallest.user_key();
+    prefix_ = first.size();
+    for (const auto& f : files) {
+      prefix_ = std::min(prefix_, SharedBytes(first, f->smallest.user_key()));
+      prefix_ = std::min(prefix_, SharedBytes(first, f->largest.user_key()));
+    }
+  }
+
+  entry_key_t Smallest(const FileMetaData& f) const {
+    return full_keys_ ? Suffix(f.smallest.user_key()) : f.smallest_entry;
+  }
+
+  entry_key_t Largest(const FileMetaData& f) const {
+    return full_keys_ ? Suffix(f.largest.user_key()) : f.largest_entry;
+  }
+
+ private:
+  static size_t SharedBytes(const Slice& a, const Slice& b) {
+    size_t n = 0;
+    while (n < a.size() && n < b.size() && a[n] == b[n]) {
+      n++;
+    }
+    return n;
+  }
+
+  // Big-endian value of the 8 bytes after the common prefix, zero padded
+  entry_key_t Suffix(const Slice& user_key) const {
+    entry_key_t key = 0;
+    for (size_t i = prefix_; i < prefix_ + sizeof(entry_key_t); i++) {
+      key <<= 8;
+      if (i < user_key.size()) {
+        key |= static_cast<unsigned char>(user_key[i]);
       }
     }
-    if (current_pick_score > best_pick_score) {
-      best_pick_list.swap(current_pick_list);
-      best_pick_score = current_pick_score;
+    return key;
+  }
+
+  const bool full_keys_;
+  size_t prefix_;
+};
+
+// Endpoints of the merge candidates in candidate key order.  A candidate
+// overlaps the others that start at or before its end, less those that end
+// before its start.
+class CandidateIntervals {
+ public:
+  CandidateIntervals(const std::vector<std::shared_ptr<FileMetaData>>& files,
+                     const CandidateKeys& keys)
+      : keys_(keys) {
+    starts_.reserve(files.size());
+    ends_.reserve(files.size());
+    for (const auto& f : files) {
+      starts_.push_back(keys_.Smallest(*f));
+      ends_.push_back(keys_.Largest(*f));
     }
+    std::sort(starts_.begin(), starts_.end());
+    std::sort(ends_.begin(), ends_.end());
   }
 
-  std::sort(best_pick_list.begin(), best_pick_list.end(), [](const auto& a, const auto& b) {
+  // Number of candidates, f included, whose key range overlaps f
+  size_t Overlaps(const FileMetaData& f) const {
+    return (std::upper_bound(starts_.begin(), starts_.end(), keys_.Largest(f)) - starts_.begin()) -
+           (std::lower_bound(ends_.begin(), ends_.end(), keys_.Smallest(f)) - ends_.begin());
+  }
+
+ private:
+  const CandidateKeys& keys_;
+  std::vector<entry_key_t> starts_;
+  std::vector<entry_key_t> ends_;
+};
+
+} // anonymous namespace
+
+void VersionControl::TryToPick(const std::vector<std::shared_ptr<FileMetaData>>& candidates,
+                               double threshold, int max_size,
+                               std::vector<std::shared_ptr<FileMetaData>>* picked) {
+  if (candidates.empty()) return;
+  // the candidate overlapping the most others leads the merge
+  CandidateKeys keys(candidates, options_->index->UsesFullKeys());
+  CandidateIntervals intervals(candidates, keys);
+  const FileMetaData* main = nullptr;
+  size_t best_overlaps = 0;
+  for (const auto& f : candidates) {
+    size_t overlaps = intervals.Overlaps(*f);
+    if (overlaps > best_overlaps) {
+      main = f.get();
+      best_overlaps = overlaps;
+    }
+  }
+  if (main == nullptr) return;
+
+  std::vector<std::pair<double, std::shared_ptr<FileMetaData>>> pick_list;
+  double smallest1 = keys.Smallest(*main);
+  double largest1 = keys.Largest(*main);
+  for (const auto& next_candidate : candidates) {
+    double smallest2 = keys.Smallest(*next_candidate);
+    double largest2 = keys.Largest(*next_candidate);
+    if (largest2 < smallest1 || smallest2 > largest1) {
+      continue; // skip
+    }
+    double width = max(largest1, largest2) - min(smallest1, smallest2);
+    // ranges that collapse to a single entry key overlap completely
+    double score = width > 0 ? (min(largest1, largest2) - max(smallest1, smallest2))/width : 1.0;
+    pick_list.emplace_back(score, next_candidate);
+  }
+
+  std::sort(pick_list.begin(), pick_list.end(), [](const auto& a, const auto& b) {
     return a.first > b.first;
   });
 
-  double threshold = state_change_ ? config::OverlapRatioThreshold : 0.0;
-  for (const auto& iter : best_pick_list) {
-    (*c)->AddInput(iter.second);
-    if (iter.first <= threshold || (*c)->num_input_files() >= config::CompactionMaxSize) {
+  for (const auto& iter : pick_list) {
+    picked->push_back(iter.second);
+    if (iter.first <= threshold || picked->size() >= max_size) {
       break;
     }
   }
-//  printf("finish\n");
 }
 
 bool VersionControl::NeedsCompaction() const {
   // decide whether it needed or not looking for current version
-  return current_->merge_candidates_.size() > config::CompactionTrigger && state_change_;
+  return current_->merge_candidates_.size() > merge_policy_.compaction_trigger() && state_change_;
 }
 
-Iterator* VersionControl::MakeInputIterator(Compaction* c) {
+void VersionControl::AdjustMergePolicy() {
+  std::vector<std::shared_ptr<FileMetaData>> live;
+  current_->GetLiveFiles(&live);
+  int threshold = merge_policy_.merge_threshold();
+  merge_policy_.MaybeAdjust(env_->NowMicros(), live);
+  if (merge_policy_.merge_threshold() != threshold) {
+    Log(options_->info_log, "Merge threshold %d -> %d", threshold, merge_policy_.merge_threshold());
+  }
+}
+
+void VersionControl::DescribeMergePolicy(std::string* out) {
+  std::vector<std::shared_ptr<FileMetaData>> live;
+  current_->GetLiveFiles(&live);
+  merge_policy_.Describe(live, out);
+}
+
+CompactionInput* VersionControl::MakeInputIterator(Compaction* c) {
   ReadOptions options;
   options.verify_checksums = options_->paranoid_checks;
   options.fill_cache = false;
 
-  Iterator** list = new Iterator*[c->num_input_files()];
+  std::vector<std::shared_ptr<FileMetaData>> files;
+  for (size_t i = 0; i < c->num_input_files(); i++) {
+    files.push_back(c->input(i));
+  }
+  return new CompactionInput(&icmp_, table_cache_, options, files);
+}
+
+void VersionControl::SplitCompaction(Compaction* c, int max_ranges,
+                                     std::vector<std::string>* bounds) {
+  bounds->clear();
+  if (max_ranges <= 1) return;
+
+  // the index block of every input gives the last key and size of its
+  // blocks, the live share of the table tells how much reaches the output
+  std::vector<std::pair<std::string, uint64_t>> blocks;
+  uint64_t total = 0;
   for (size_t i = 0; i < c->num_input_files(); i++) {
-    list[i] = table_cache_->NewIterator(options, c->input(i)->number, c->input(i)->file_size);
+    const std::shared_ptr<FileMetaData>& f = c->input(i);
+    TableHandle handle;
+    if (!table_cache_->GetTable(f->number, f->file_size, &handle).ok()) {
+      continue;
+    }
+    Iterator* iter = handle.table_->NewIndexIterator();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      Slice input = iter->value();
+      BlockHandle block;
+      if (!block.DecodeFrom(&input).ok()) break;
+      uint64_t live = f->total > 0 ? block.size() * f->alive / f->total : block.size();
+      blocks.emplace_back(ExtractUserKey(iter->key()).ToString(), live);
+      total += live;
+    }
+    delete iter;
+  }
+
+  // every range but the last ends a little short of a whole number of
+  // output tables.  a range that ends just past a table boundary leaves a
+  // small table behind, and later merges rarely pick those up.
+  const uint64_t table = c->MaxOutputFileSize();
+  const int ranges = static_cast<int>(std::min<uint64_t>(max_ranges, total / (kMinTablesPerRange * table)));
+  if (ranges <= 1) return;
+  const uint64_t range_size = (total / ranges + table - 1) / table * table - table / 8;
+
+  const Comparator* ucmp = icmp_.user_comparator();
+  std::sort(blocks.begin(), blocks.end(),
+            [ucmp](const std::pair<std::string, uint64_t>& a,
+                   const std::pair<std::string, uint64_t>& b) {
+              return ucmp->Compare(a.first, b.first) < 0;
+            });
+  uint64_t bytes = 0;
+  int range = 1;
+  for (size_t i = 0; i + 1 < blocks.size() && range < ranges; i++) {
+    bytes += blocks[i].second;
+    if (bytes < range_size * range) continue;
+    // a range ends after the last key of the block, keys of one user key
+    // stay in one range
+    const std::string& bound = blocks[i + 1].first;
+    if (ucmp->Compare(bound, blocks[i].first) > 0 &&
+        (bounds->empty() || ucmp->Compare(bound, bounds->back()) > 0)) {
+      bounds->push_back(bound);
+      range++;
+    }
   }
-  Iterator* result = NewMergingIterator(&icmp_, list, c->num_input_files());
-  delete[] list;
-  return result;
 }
 
 void VersionControl::MarkFileNumberUsed(uint64_t number) {
@@ -581,6 +880,9 @@ void VersionControl::SetLastSequence(uint64_t s) {
 Status VersionControl::WriteSnapshot(log::Writer* log) {
   VersionEdit edit;
   edit.SetComparatorName(icmp_.user_comparator()->Name());
+  if (db_id_ != 0) {
+    edit.SetDbId(db_id_);
+  }
   for (const auto& iter : current_->files_) {
     auto f = iter.second;
     edit.AddFile(f->number, f->file_size, f->total, f->alive, f->smallest, f->largest);
@@ -589,6 +891,9 @@ Status VersionControl::WriteSnapshot(log::Writer* log) {
     auto f = iter.second;
     edit.AddMergeCandidates(f->number, f->file_size, f->total, f->alive, f->smallest, f->largest);
   }
+  for (const auto& tombstone : current_->range_tombstones_) {
+    edit.AddRangeTombstone(tombstone);
+  }
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
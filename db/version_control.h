@@ -1,10 +1,14 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_CONTROL_H_
 #define STORAGE_LEVELDB_DB_VERSION_CONTROL_H_
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <random>
 #include "version.h"
 #include "version_edit.h"
+#include "compaction_input.h"
+#include "merge_policy.h"
 #include "port/port_posix.h"
 
 namespace leveldb {
@@ -32,21 +36,58 @@ class VersionControl {
   const Comparator* internal_comparator() const { return &icmp_;}
 
   Status LogAndApply(VersionEdit* edit, port::Mutex* mu);
-  Compaction* PickCompaction();
-  void RegisterFileAccess(const uint16_t& file_number);
-  void CheckLocality();
-  void UpdateLocalityCheckKey(const Slice& target);
+  // Picks merge candidates that no other merge in progress holds, scoring
+  // them with *mu released.  The caller hands them back with
+  // ReleaseCompactionFiles once done.
+  Compaction* PickCompaction(port::Mutex* mu);
+  void ReleaseCompactionFiles(Compaction* c);
+  // Appends the tables, merge candidates included, whose user key range
+  // overlaps [*begin, *end] in order of their smallest keys.  A null begin
+  // or end leaves that side open.
+  void GetOverlappingFiles(const Slice* begin, const Slice* end,
+                           std::vector<std::shared_ptr<FileMetaData>>* files);
+  // Whether a merge in progress holds any of files
+  bool IsMerging(const std::vector<std::shared_ptr<FileMetaData>>& files) const;
+  // A merge of files, which no merge in progress may hold, for
+  // DB::CompactRange.  Released like the ones of PickCompaction.
+  Compaction* CompactFiles(const std::vector<std::shared_ptr<FileMetaData>>& files);
+  // Adds to edit the deletion of every table wholly inside the user key
+  // range [begin, end) that no merge in progress holds.  The tables are
+  // held like merge inputs until ReleaseFiles, so that no merge picks one
+  // before edit is applied.
+  void DeleteFilesInRange(const Slice& begin, const Slice& end, VersionEdit* edit,
+                          std::vector<uint64_t>* held);
+  void ReleaseFiles(const std::vector<uint64_t>& held);
+  void RegisterFileAccess(const uint16_t& file_number, uint32_t count = 1);
+  MergePolicy* merge_policy() { return &merge_policy_; }
+  // Lets the merge policy look at the tables of the current version, after
+  // a memtable flush
+  void AdjustMergePolicy();
+  // For DB::GetProperty("leveldb.merge-policy")
+  void DescribeMergePolicy(std::string* out);
+  // Continues the locality check for up to config::LocalityCheckBudgetMicros
+  // with *mu released.  Once a window of index entries is complete, its
+  // files become merge candidates all at once if there are enough of them.
+  void CheckLocality(port::Mutex* mu);
   Status Recover(bool* save_manifest);
-  Iterator* MakeInputIterator(Compaction* c);
+  CompactionInput* MakeInputIterator(Compaction* c);
+  // Picks up to max_ranges - 1 user keys that split the inputs of c into
+  // key ranges of about the same size, at data block boundaries.  Each
+  // range gets about a whole number of output tables.
+  void SplitCompaction(Compaction* c, int max_ranges, std::vector<std::string>* bounds);
   const char* Summary(SummaryStorage* scratch) const;
 
   bool NeedsCompaction() const;
 
   uint64_t ManifestFileNumber() const { return manifest_file_number_; }
   uint64_t NewFileNumber() { return next_file_number_++; }
+  // The number the next NewFileNumber() hands out
+  uint64_t NextFileNumber() const { return next_file_number_; }
   uint64_t LogNumber() const { return log_number_; }
   uint64_t PrevLogNumber() const { return prev_log_number_; }
   uint64_t LastSequence() const { return last_sequence_; }
+  // Id the DB was created with, 0 for a DB created before ids were kept
+  uint64_t DbId() const { return db_id_; }
 
   void MarkFileNumberUsed(uint64_t number);
   void ReuseFileNumber(uint64_t file_number);
@@ -59,21 +100,29 @@ class VersionControl {
 
   bool State() { return state_change_; }
 
+  // For tests: runs while PickCompaction scores the candidates with the DB
+  // mutex released
+  void TEST_SetPickHook(std::function<void()> hook) { pick_hook_ = std::move(hook); }
+
  private:
   class Builder;
 
   void AppendVersion(Version* v);
   Status WriteSnapshot(log::Writer* log);
   bool ReuseManifest(const std::string& dscname, const std::string& dscbase);
-  void ForcedPick(Compaction**);
-  void TryToPick(Compaction**);
+  void ForcedPick(const std::vector<std::shared_ptr<FileMetaData>>& candidates,
+                  std::vector<std::shared_ptr<FileMetaData>>* picked);
+  void TryToPick(const std::vector<std::shared_ptr<FileMetaData>>& candidates,
+                 double threshold, int max_size,
+                 std::vector<std::shared_ptr<FileMetaData>>* picked);
 
   Env* const env_;
   const std::string dbname_;
 
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  uint64_t db_id_;
+  std::atomic<uint64_t> last_sequence_;  // read by DBImpl::Get without mutex
   uint64_t log_number_;
   uint64_t prev_log_number_;
 
@@ -84,11 +133,24 @@ class VersionControl {
   log::Writer* descriptor_log_;
   Version* current_;
   TableCache* table_cache_;
-  entry_key_t locality_check_key;
+  // The locality check window in progress, only touched by the thread
+  // that set locality_checking_
+  bool locality_checking_;
+  std::string locality_cursor_;
+  uint64_t locality_entries_;
+  std::set<uint16_t> locality_files_;
   std::random_device rd;
   std::mt19937 gen;
   std::uniform_int_distribution<> distribution;
   bool state_change_;
+  std::function<void()> pick_hook_;
+  std::set<uint64_t> merging_files_;  // inputs of the merges in progress
+  MergePolicy merge_policy_;
+
+  // LogAndApply writes the MANIFEST with the mutex released, the next edit
+  // has to wait so that it builds on the version of the previous one
+  bool manifest_writing_;
+  port::CondVar manifest_cv_;
 
   // no copy
   VersionControl(const VersionControl&);
@@ -11,24 +11,30 @@ enum Tag {
   kNewFile        = 6,
   kPrevLogNumber  = 7,
   kDeadCount      = 8,
-  kMergeFile      = 9
+  kMergeFile      = 9,
+  kRangeTombstone = 10,
+  kDbId           = 11
 };
 
 void VersionEdit::Clear() {
   recovery_list_.clear();
+  merge_inputs_.clear();
   comparator_.clear();
   refs_ = 0;
   log_number_ = 0;
   prev_log_number_ = 0;
   last_sequence_ = 0;
   next_file_number_ = 0;
+  db_id_ = 0;
   has_comparator_ = false;
   has_log_number_ = false;
   has_prev_log_number_ = false;
   has_next_file_number_ = false;
   has_last_sequence_ = false;
+  has_db_id_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  range_tombstones_.clear();
 }
 
 void VersionEdit::SetComparatorName(const Slice& comparator) {
@@ -56,6 +62,11 @@ void VersionEdit::SetLastSequence(uint64_t num) {
   last_sequence_ = num;
 }
 
+void VersionEdit::SetDbId(uint64_t id) {
+  has_db_id_ = true;
+  db_id_ = id;
+}
+
 void VersionEdit::EncodeTo(std::string* dst) const {
   if (has_comparator_) {
     PutVarint32(dst, kComparator);
@@ -77,6 +88,10 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint32(dst, kLastSequence);
     PutVarint64(dst, last_sequence_);
   }
+  if (has_db_id_) {
+    PutVarint32(dst, kDbId);
+    PutVarint64(dst, db_id_);
+  }
   for (auto file : deleted_files_) {
     PutVarint32(dst, kDeletedFile);
     PutVarint64(dst, file);
@@ -104,6 +119,13 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutLengthPrefixedSlice(dst, file.smallest.Encode());
     PutLengthPrefixedSlice(dst, file.largest.Encode());
   }
+  for (const auto& tombstone : range_tombstones_) {
+    PutVarint32(dst, kRangeTombstone);
+    PutLengthPrefixedSlice(dst, tombstone.begin);
+    PutLengthPrefixedSlice(dst, tombstone.end);
+    PutVarint64(dst, tombstone.sequence);
+    PutVarint64(dst, tombstone.file_number);
+  }
 }
 
 static bool GetInternalKey(Slice* input, InternalKey* dst) {
@@ -125,8 +147,10 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   uint64_t number;
   FileMetaData f;
   Slice str;
+  Slice limit;
   InternalKey key;
   std::pair<uint64_t, uint64_t> pair;
+  RangeTombstone tombstone;
 
   while (msg == nullptr && GetVarint32(&input, &tag)) {
     switch (tag) {
@@ -171,6 +195,14 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kDbId:
+        if (GetVarint64(&input, &db_id_)) {
+          has_db_id_ = true;
+        } else {
+          msg = "db id";
+        }
+        break;
+
       case kDeletedFile:
         if (GetVarint64(&input, &number)) {
           deleted_files_.push_back(number);
@@ -214,6 +246,19 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kRangeTombstone:
+        if (GetLengthPrefixedSlice(&input, &str) &&
+            GetLengthPrefixedSlice(&input, &limit) &&
+            GetVarint64(&input, &tombstone.sequence) &&
+            GetVarint64(&input, &tombstone.file_number)) {
+          tombstone.begin = str.ToString();
+          tombstone.end = limit.ToString();
+          range_tombstones_.push_back(tombstone);
+        } else {
+          msg = "range tombstone";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -1,6 +1,7 @@
 #ifndef STORAGE_LEVELDB_DB_ZERO_LEVEL_VERSION_EDIT_H_
 #define STORAGE_LEVELDB_DB_ZERO_LEVEL_VERSION_EDIT_H_
 
+#include <set>
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
@@ -8,6 +9,7 @@
 #include "dbformat.h"
 #include "version.h"
 #include "index/nvm_btree.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
@@ -16,8 +18,12 @@ class VersionEdit {
   VersionEdit() : signal_(&mutex_) { Clear(); };
   ~VersionEdit() = default;
 
-  void Ref() { refs_++; };
+  void Ref() {
+    MutexLock l(&mutex_);
+    refs_++;
+  };
   void Unref() {
+    MutexLock l(&mutex_);
     assert(refs_ > 0);
     refs_--;
     if (refs_ <= 0) {
@@ -25,8 +31,10 @@ class VersionEdit {
     }
   };
 
+  // Blocks until the index has applied every queue added with this edit
   void Wait() {
-    if (refs_ > 0) {
+    MutexLock l(&mutex_);
+    while (refs_ > 0) {
       signal_.Wait();
     }
   }
@@ -38,25 +46,25 @@ class VersionEdit {
   void SetPrevLogNumber(uint64_t);
   void SetNextFile(uint64_t);
   void SetLastSequence(uint64_t);
+  // Identifies the DB, written once when it is created
+  void SetDbId(uint64_t);
 
   std::string GetComparatorName() const { return comparator_; }
   uint64_t GetLogNumber() { return log_number_; }
   uint64_t GetPrevLogNumber() { return prev_log_number_; }
   uint64_t GetNextFile() { return next_file_number_; }
   uint64_t GetLastSequence() { return last_sequence_; }
+  uint64_t GetDbId() { return db_id_; }
 
   bool HasComparatorName() { return has_comparator_; }
   bool HasLogNumber() { return has_log_number_; }
   bool HasPrevLogNumber() { return has_prev_log_number_; }
   bool HasNextFileNumber() { return has_next_file_number_; }
   bool HasLastSequence() { return has_last_sequence_; }
+  bool HasDbId() { return has_db_id_; }
 
-  void DecreaseCount(uint64_t fnumber) {
-    if (dead_key_counter_.find(fnumber) != dead_key_counter_.end()) {
-      dead_key_counter_[fnumber]++;
-    } else {
-      dead_key_counter_[fnumber] = 1;
-    }
+  void DecreaseCount(uint64_t fnumber, uint64_t count = 1) {
+    dead_key_counter_[fnumber] += count;
   }
 
   void DeleteFile(uint64_t file) {
@@ -95,6 +103,26 @@ class VersionEdit {
     merge_candidates_.push_back(f);
   }
 
+  // A range tombstone, or a new file_number for a tombstone already
+  // logged with the same sequence
+  void AddRangeTombstone(const RangeTombstone& tombstone) {
+    range_tombstones_.push_back(tombstone);
+  }
+
+  // Index entries of the tables added by a merge only replace entries that
+  // still point into one of its inputs.  A key written again by a flush while
+  // the merge ran keeps its newer entry, a key removed by DeleteRange stays
+  // removed.
+  void AddMergeInput(uint64_t fnumber) {
+    merge_inputs_.insert(static_cast<uint16_t>(fnumber));
+  }
+
+  bool HasMergeInputs() const { return !merge_inputs_.empty(); }
+
+  bool Replaces(const IndexMeta* current) const {
+    return current != nullptr && merge_inputs_.count(current->file_number) > 0;
+  }
+
   void AllocateRecoveryList(uint64_t size) {
     recovery_list_.reserve(size);
   }
@@ -114,21 +142,25 @@ class VersionEdit {
   std::vector<FileMetaData> merge_candidates_;
   std::vector<uint64_t> deleted_files_;
   std::unordered_map<uint64_t, uint64_t> dead_key_counter_;
+  std::vector<RangeTombstone> range_tombstones_;
 
   std::vector<uint64_t> recovery_list_;
+  std::set<uint16_t> merge_inputs_;
 
   std::string comparator_;
   uint64_t log_number_;
   uint64_t prev_log_number_;
   uint64_t next_file_number_;
   SequenceNumber last_sequence_;
+  uint64_t db_id_;
   bool has_comparator_;
   bool has_log_number_;
   bool has_prev_log_number_;
   bool has_next_file_number_;
   bool has_last_sequence_;
+  bool has_db_id_;
 
-  volatile uint64_t refs_;
+  uint64_t refs_;
   port::Mutex mutex_;
   port::CondVar signal_;
 };
@@ -10,6 +10,7 @@
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -71,6 +72,14 @@ class LEVELDB_EXPORT DB {
   // Note: consider setting options.sync = true.
   virtual Status Delete(const WriteOptions& options, const Slice& key) = 0;
 
+  // Remove the database entries (if any) for the keys in [begin, end).
+  // Memtable contents are flushed first; the covered index entries are then
+  // dropped in bulk, tables wholly inside the range are deleted and one
+  // range tombstone is logged in the MANIFEST instead of one deletion per
+  // key.  Returns OK on success, and a non-OK status on error.
+  virtual Status DeleteRange(const WriteOptions& options,
+                             const Slice& begin, const Slice& end) = 0;
+
   // Apply the specified updates to the database.
   // Returns OK on success, non-OK on failure.
   // Note: consider setting options.sync = true.
@@ -90,6 +99,21 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Same as above, but "*value" may point to where the value already is,
+  // a block of a table or a memtable, instead of holding a copy of it.
+  // The memory stays pinned until value->Reset() or destruction, which
+  // has to happen before this db is deleted.
+  virtual Status Get(const ReadOptions& options,
+                     const Slice& key, PinnableSlice* value);
+
+  // For each i in [0,n-1], look up "keys[i]" as Get does, storing the
+  // status in "statuses[i]" and the value, if found, in "values[i]".  All
+  // of the keys see the same state of the database.  Cheaper than n calls
+  // to Get, as the index and the tables are visited in key order and
+  // every block is read once for the whole batch.
+  virtual void MultiGet(const ReadOptions& options, int n, const Slice* keys,
+                        std::string* values, Status* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -124,8 +148,25 @@ class LEVELDB_EXPORT DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.compaction-rate-limit" - returns the bytes per second that
+  //     flushes and merges are currently held to, 0 if they are not.
+  //  "leveldb.merge-policy" - returns a multi-line string with the merge
+  //     threshold and related knobs in force, the last decision of the
+  //     adaptive merge policy and why it was taken, and the table bytes
+  //     by live share.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
+  // Changes an option of the open DB.  Returns InvalidArgument if name is
+  // not an option that can be changed or value is not valid for it.
+  //
+  // Options that can be changed:
+  //
+  //  "compaction_rate_limit" - Options::compaction_rate_limit, in bytes
+  //     per second.
+  //  "compaction_rate_limit_auto" - Options::compaction_rate_limit_auto,
+  //     "true"/"false" or "1"/"0".
+  virtual Status SetOption(const Slice& name, const Slice& value) = 0;
+
   // For each i in [0,n-1], store in "sizes[i]", the approximate
   // file system space used by keys in "[range[i].start .. range[i].limit)".
   //
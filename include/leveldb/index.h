@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <memory>
 #include <deque>
+#include <set>
+#include <string>
 #include "leveldb/slice.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
@@ -13,6 +15,7 @@ using entry_key_t = uint64_t;
 
 namespace leveldb {
 
+class Env;
 class TableCache;
 class VersionEdit;
 class VersionControl;
@@ -22,11 +25,12 @@ public:
   uint32_t offset;
   uint32_t size;
   uint16_t file_number;
+  uint32_t refs; // index entries sharing this persistent block meta
 
-  IndexMeta() : offset(0), size(0), file_number(0) { }
+  IndexMeta() : offset(0), size(0), file_number(0), refs(0) { }
 
-  IndexMeta(uint32_t offset, uint16_t size, uint16_t file_number) :
-    offset(offset), size(size), file_number(file_number) { }
+  IndexMeta(uint32_t offset, uint32_t size, uint16_t file_number) :
+    offset(offset), size(size), file_number(file_number), refs(0) { }
 
 };
 
@@ -35,6 +39,24 @@ extern bool IsEqual(const IndexMeta* lhs, const IndexMeta* rhs);
 struct KeyAndMeta{
   entry_key_t key;
   std::shared_ptr<IndexMeta> meta;
+  std::string user_key; // only filled for indexes that use full keys
+};
+
+// Looks up keys given in ascending order, e.g. while walking the merged
+// input of a compaction.  Each lookup resumes where the previous one ended
+// instead of descending from the root; a key smaller than the previous one
+// starts over from the root.
+class IndexCursor {
+public:
+  IndexCursor() = default;
+  virtual ~IndexCursor() = default;
+
+  // Same as Index::Get.
+  virtual IndexMeta* Get(const Slice& key) = 0;
+
+private:
+  IndexCursor(const IndexCursor&);
+  void operator=(const IndexCursor&);
 };
 
 class Index {
@@ -43,13 +65,92 @@ public:
   virtual ~Index() = default;
   //virtual void Insert(const uint32_t& key, IndexMeta meta) = 0;
   virtual IndexMeta* Get(const Slice& key) = 0;
+  // Returns a cursor for lookups in ascending key order.  The caller deletes
+  // it before the index.
+  virtual IndexCursor* NewCursor() = 0;
   virtual void AddQueue(std::deque<KeyAndMeta>& queue, VersionEdit* edit) = 0;
+  // Removes the entries of the keys in [start, limit) once every queue
+  // added before is applied, and counts them as dead keys of their tables
+  // in edit.
+  virtual void DeleteRange(const Slice& start, const Slice& limit, VersionEdit* edit) = 0;
   virtual Iterator* NewIterator(const ReadOptions& options, TableCache* table_cache, VersionControl* vcontrol) = 0;
   virtual void Break() = 0;
+
+  // Returns an order-preserving integer approximation of the user key.  Used
+  // to fill KeyAndMeta::key and to estimate key range overlap between files.
+  virtual entry_key_t EntryKey(const Slice& key) const = 0;
+
+  // Whether KeyAndMeta::user_key must be filled when adding to the queue.
+  virtual bool UsesFullKeys() const = 0;
+
+  // Walks up to "count" entries in key order starting from "*cursor" (empty
+  // means the first key) and collects the file numbers they point to.
+  // "*cursor" is set to the position where the next walk should resume, or
+  // cleared when the end of the index has been reached.
+  virtual void ScanFiles(std::string* cursor, uint64_t count, std::set<uint16_t>* files) = 0;
+
+  // Continues a locality check window from "*cursor" (empty means the
+  // first key): adds the files behind the following index entries to
+  // "*files" and their number to "*entries", until "*entries" reaches
+  // "count", the index ends or env's clock passes "deadline_micros".  Works
+  // from per key range file counts that the inserts keep up to date, a
+  // range is only walked in the index when it has none yet.  Returns true
+  // once the window is complete, "*cursor" then being where the next one
+  // starts, or cleared at the end of the index.  Safe to call while queues
+  // are applied, but not from several threads at once.
+  virtual bool LocalityWindow(std::string* cursor, uint64_t count, Env* env,
+                              uint64_t deadline_micros, uint64_t* entries,
+                              std::set<uint16_t>* files) = 0;
+
+  // Estimates the bytes of table data holding the keys in [start, limit)
+  // from the data block sizes kept in the index entries.  No table is read.
+  virtual uint64_t ApproximateSize(const Slice& start, const Slice& limit) = 0;
+
+  // Begins a read that uses the IndexMetas found by Get() and returns the
+  // ticket to end it with.  The meta of a replaced entry is only freed once
+  // every read that began before it was replaced has ended, so a meta stays
+  // valid until EndRead(), see IndexReadGuard.  Cursors and iterators hold
+  // a read of their own while they live.
+  virtual int BeginRead() = 0;
+  virtual void EndRead(int ticket) = 0;
+
+  // Sets the number of threads inserting the entries of one queue.
+  virtual void SetInsertThreads(int threads) = 0;
+
+  // Keeps the inner nodes of the index in DRAM and only the leaves in
+  // persistent memory, or moves them back.  Called before the index serves
+  // any reads.
+  virtual void SetDramInnerNodes(bool enabled) = 0;
+
+  // Persistent state of the index.  Kept in the PM root so that a reopened
+  // pool can hand it back to Attach().
+  virtual void* PersistentRoot() = 0;
+
+  // Drops the state of this still empty index and takes over the one
+  // returned by PersistentRoot() before the pool was closed.
+  virtual void Attach(void* persistent_root) = 0;
 };
 
+// Holds a read of an index, see Index::BeginRead(), while in scope
+class IndexReadGuard {
+public:
+  explicit IndexReadGuard(Index* index) : index_(index), ticket_(index->BeginRead()) { }
+  ~IndexReadGuard() { index_->EndRead(ticket_); }
+
+private:
+  Index* const index_;
+  const int ticket_;
+
+  IndexReadGuard(const IndexReadGuard&);
+  void operator=(const IndexReadGuard&);
+};
+
+// Index over keys formatted with config::key_format.
 Index* CreateBtreeIndex();
 
+// Index over arbitrary byte-string keys.
+Index* CreateStringBtreeIndex();
+
 } // namespace leveldb
 
 #endif //STORAGE_LEVELDB_INCLUDE_INDEX_H_
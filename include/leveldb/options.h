@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <cstdint>
 #include "leveldb/export.h"
 
 namespace leveldb {
@@ -118,6 +119,23 @@ struct LEVELDB_EXPORT Options {
   // Default: 16
   int block_restart_interval;
 
+  // If true, data blocks end with a hash index from the user keys in the
+  // block to their restart points, so that a point read goes straight to
+  // the restart interval of its key, or returns at once if the key is not
+  // in the block.  Blocks written without it stay readable.
+  //
+  // Default: false
+  bool block_hash_index;
+
+  // If true and "index" is over config::key_format keys, a data block
+  // whose user keys all have that format stores them as an array of
+  // integers, packed as offsets from the smallest one, with the values in
+  // a region of their own.  Seeks in the block are a binary search over
+  // the array.  Blocks written without it stay readable.
+  //
+  // Default: false
+  bool int_key_blocks;
+
   // disable writing of recovery log during DB::Write() / Put() calls.
   // This speeds performance but can lead to loss of tens of megabytes
   // of data if system crashes.
@@ -126,6 +144,88 @@ struct LEVELDB_EXPORT Options {
   // Global index
   Index* index;
 
+  // Number of threads inserting the entries of a new table into the index.
+  // The sorted entries are split into that many key ranges.
+  //
+  // Default: 4
+  int index_threads;
+
+  // If true, only the leaves of the global index are kept in persistent
+  // memory.  Inner nodes live in DRAM and are rebuilt from the leaf chain
+  // when the DB is reopened.
+  //
+  // Default: false
+  bool index_dram_inner_nodes;
+
+  // If true, a global index that cannot be reopened from persistent memory
+  // (lost pool, unclean close) is rebuilt from the tables on open instead
+  // of failing the open with Corruption.
+  //
+  // Default: true
+  bool rebuild_index;
+
+  // Number of threads scanning tables while rebuilding the global index.
+  //
+  // Default: 4
+  int index_rebuild_threads;
+
+  // If true, a merge copies data blocks whose entries are all still live
+  // into its output unchanged and only points the index at the copies.
+  // Other blocks are decoded and rewritten entry by entry.
+  //
+  // Default: true
+  bool copy_live_blocks;
+
+  // Number of key ranges a merge is split into.  The ranges are merged
+  // concurrently, each into its own output tables, and installed together.
+  //
+  // Default: 4
+  int max_subcompactions;
+
+  // Number of merges that may run at the same time, each on its own
+  // background thread and over its own merge candidates.  Memtables are
+  // flushed by a separate thread and never wait for a merge.
+  //
+  // Default: 2
+  int max_background_merges;
+
+  // Bytes per second that memtable flushes and merges together may write
+  // to table files, 0 for no limit.  Flushes are never held back, but the
+  // bytes they write are taken out of what merges may write.  Can be
+  // changed with DB::SetOption("compaction_rate_limit", ...).
+  //
+  // Default: 0
+  uint64_t compaction_rate_limit;
+
+  // If true, the rate above is lowered while reads that run during table
+  // writes are markedly slower than the others, down to a sixteenth of
+  // it, and raised back once they are not.  Has no effect without a rate.
+  // Can be changed with DB::SetOption("compaction_rate_limit_auto", ...).
+  //
+  // Default: false
+  bool compaction_rate_limit_auto;
+
+  // If true, merge_threshold is only where the threshold starts.  It is
+  // then lowered while merges rewrite more than target_write_amplification
+  // bytes per byte flushed, while writes stall on the merge backlog or
+  // while the tables hold little garbage, and raised while they hold much,
+  // within [min_merge_threshold, max_merge_threshold].  How often merges
+  // run, how many tables they take and how far locality checks look move
+  // along with it.  See DB::GetProperty("leveldb.merge-policy").
+  //
+  // Default: false
+  bool adaptive_merge_policy;
+
+  // Default: 30 and 90
+  int min_merge_threshold;
+  int max_merge_threshold;
+
+  // Bytes written by flushes and merges together per byte flushed that
+  // the adaptive merge policy aims to stay under
+  //
+  // Default: 4.0
+  double target_write_amplification;
+
   // Leveldb will write up to this amount of bytes to a file before
   // switching to a new one.
   // Most clients should leave this parameter alone.  However if your
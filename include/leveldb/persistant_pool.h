@@ -9,7 +9,14 @@ namespace leveldb {
 namespace nvram {
 
 extern void create_pool(const std::string& dir, const size_t& s);
+// Opens the pool left by an earlier run, or creates one if there is none.
+// Returns true if an existing pool was opened.  The pool is mapped at the
+// address it was created at, so pointers stored in it stay valid.
+extern bool open_pool(const std::string& dir, const size_t& s);
 extern void close_pool();
+// Root object of the pool, NULL until set_root is called on a new pool
+extern void* get_root();
+extern void set_root(void* root);
 extern void pfree(void*);
 extern void* pmalloc(size_t);
 extern void stats();
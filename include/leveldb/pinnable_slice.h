@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PinnableSlice is a value returned by DB::Get that may point to where
+// the value already is, a block of a table or a memtable, instead of
+// holding a copy of it.  The memory stays pinned until the slice is reset
+// or destroyed.  A pinned slice must be released before the DB is
+// deleted.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <string>
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT PinnableSlice : public Slice {
+ public:
+  PinnableSlice();
+  ~PinnableSlice();
+
+  typedef void (*CleanupFunction)(void* arg1, void* arg2);
+
+  // Points to "s", which stays valid until the functions registered with
+  // RegisterCleanup() are invoked on Reset() or destruction.
+  void PinSlice(const Slice& s);
+
+  // Same as PinSlice(s) followed by RegisterCleanup(function, arg1, arg2).
+  void PinSlice(const Slice& s, CleanupFunction function, void* arg1, void* arg2);
+
+  // Clients are allowed to register function/arg1/arg2 triples that
+  // will be invoked when this slice is reset or destroyed.
+  void RegisterCleanup(CleanupFunction function, void* arg1, void* arg2);
+
+  // Copies "s" into a buffer of the slice and points to it.
+  void PinSelf(const Slice& s);
+
+  // The buffer of the slice, to be filled in and then pointed to with
+  // PinSelf().
+  std::string* GetSelf() { return &self_; }
+  void PinSelf();
+
+  // Whether the slice points to memory pinned elsewhere rather than to a
+  // copy of its own
+  bool IsPinned() const { return pinned_; }
+
+  // Releases the pinned memory, if any, and makes the slice empty.
+  void Reset();
+
+ private:
+  struct Cleanup {
+    CleanupFunction function;
+    void* arg1;
+    void* arg2;
+    Cleanup* next;
+  };
+  Cleanup cleanup_;
+  bool pinned_;
+  std::string self_;
+
+  void RunCleanups();
+
+  // No copying allowed
+  PinnableSlice(const PinnableSlice&);
+  void operator=(const PinnableSlice&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
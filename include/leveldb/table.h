@@ -6,14 +6,18 @@
 #define STORAGE_LEVELDB_INCLUDE_TABLE_H_
 
 #include <cstdint>
+#include "leveldb/cache.h"
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
+#include "leveldb/options.h"
 
 namespace leveldb {
 
 class Block;
 class BlockHandle;
+struct BlockContents;
 class Footer;
+class PinnableSlice;
 struct Options;
 class RandomAccessFile;
 struct ReadOptions;
@@ -50,6 +54,16 @@ class LEVELDB_EXPORT Table {
 
   Iterator* BlockIterator(const ReadOptions&, const BlockHandle&);
 
+  // Returns a new iterator over the index block.  Its values are the
+  // encoded BlockHandles of the data blocks, in key order.
+  Iterator* NewIndexIterator() const;
+
+  // Reads the data block at "handle" as stored in the file, without
+  // uncompressing it, e.g. to copy it into another table.  "*contents"
+  // stays valid while the table is open.
+  Status ReadRawBlock(const ReadOptions&, const BlockHandle& handle,
+                      Slice* contents, CompressionType* type) const;
+
  private:
   struct Rep;
   Rep* rep_;
@@ -57,10 +71,34 @@ class LEVELDB_EXPORT Table {
   explicit Table(Rep* rep) { rep_ = rep; }
   static Iterator* BlockReader(void*, const ReadOptions&, const Slice&);
 
+  // Finds the data block at "handle" in the block cache, or reads it and
+  // adds it to the cache if it can be cached.  "*cache_handle" pins the
+  // cached block; if it is NULL, "*contents" holds the block as read.
+  Status LoadBlock(const ReadOptions&, const BlockHandle& handle,
+                   Cache::Handle** cache_handle, BlockContents* contents);
+
+  friend class TableCache;
+  // Calls (*handle_result)(arg, ...) with the entry of the data block at
+  // "handle" that Seek(key) would find, if any, without an iterator.  If
+  // the handler pinned the value in "*pinned", the block cache keeps the
+  // block for it; the value of a block that was only read for the lookup
+  // is copied into "*pinned" unless it points into the mapped file.
+  Status BlockGet(const ReadOptions&, const BlockHandle& handle,
+                  const Slice& key, void* arg,
+                  void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+                  PinnableSlice* pinned = nullptr);
+
+  // Same as BlockGet without pinning for each of keys[0,n-1], which are
+  // all looked up in one copy of the block, with args[i] for keys[i].
+  // statuses[i] is set to the result of the lookup of keys[i].
+  void BlockMultiGet(const ReadOptions&, const BlockHandle& handle, size_t n,
+                     const Slice* keys, void* const* args,
+                     void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+                     Status* statuses);
+
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
   // that key is not present.
-  friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
@@ -22,6 +22,7 @@ namespace leveldb {
 
 class BlockBuilder;
 class BlockHandle;
+class Iterator;
 class WritableFile;
 class VersionEdit;
 
@@ -48,6 +49,14 @@ class LEVELDB_EXPORT TableBuilder {
   // REQUIRES: Finish(), Abandon() have not been called
   void Add(const Slice& key, const Slice& value);
 
+  // Advanced operation: append a data block taken unchanged from another
+  // table.  "contents" is the block as stored and "type" its compression;
+  // "entries" iterates over its decoded entries, whose keys are needed for
+  // the index and the filter.  Buffered key/value pairs are flushed first.
+  // REQUIRES: the keys of the block are after any previously added key
+  // REQUIRES: Finish(), Abandon() have not been called
+  void AddBlock(const Slice& contents, CompressionType type, Iterator* entries);
+
   // Advanced operation: flush any buffered key/value pairs to file.
   // Can be used to ensure that two adjacent entries never live in
   // the same data block.  Most clients should not need to use this method.
@@ -78,6 +87,9 @@ class LEVELDB_EXPORT TableBuilder {
 
  private:
   bool ok() const { return status().ok(); }
+  // account for a key of the current data block in the index block, the
+  // filter and the queue of entries for the global index
+  void AddKey(const Slice& key);
   void WriteBlock(BlockBuilder* block, BlockHandle* handle, bool is_data_block = false);
   void WriteRawBlock(const Slice& data, CompressionType, BlockHandle* handle, bool is_data_block = false);
 
@@ -1,33 +1,201 @@
 #include <stdlib.h>
+#include <algorithm>
 #include "util/coding.h"
 #include "leveldb/slice.h"
 #include "btree_index.h"
 #include "index_iterator.h"
 #include "table/format.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
-BtreeIndex::BtreeIndex() : condvar_(&mutex_) {
+BtreeIndex::BtreeIndex()
+    : tree_(FFBtree::Create()), insert_threads_(1), read_epoch_(0), condvar_(&mutex_) {
   bgstarted_ = false;
 }
 
+int BtreeIndex::BeginRead() {
+  // threads take turns over the stripes, so few of them share a counter
+  static std::atomic<int> next_stripe(0);
+  thread_local const int stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % kReadStripes;
+  for (;;) {
+    const int epoch = read_epoch_.load();
+    std::atomic<int>* reads = &reads_[epoch][stripe].reads;
+    reads->fetch_add(1);
+    // counted in the epoch only if it did not change meanwhile, otherwise
+    // the runner may have looked at the counter already
+    if (read_epoch_.load() == epoch) {
+      return epoch * kReadStripes + stripe;
+    }
+    reads->fetch_sub(1);
+  }
+}
+
+void BtreeIndex::EndRead(int ticket) {
+  reads_[ticket / kReadStripes][ticket % kReadStripes].reads.fetch_sub(1);
+}
+
+void BtreeIndex::EndReadCleanup(void* index, void* ticket) {
+  reinterpret_cast<BtreeIndex*>(index)->EndRead(static_cast<int>(reinterpret_cast<intptr_t>(ticket)));
+}
+
+bool BtreeIndex::ReadsActive(int epoch) const {
+  for (const ReadCount& count : reads_[epoch]) {
+    if (count.reads.load() != 0) return true;
+  }
+  return false;
+}
+
 IndexMeta* BtreeIndex::Get(const Slice& key) {
-  IndexMeta* result = (IndexMeta*)tree_.Search(fast_atoi(key));
-  return result;
+  return ToMeta(tree_->Search(fast_atoi(key)));
+}
+
+namespace {
+
+class BtreeCursor : public IndexCursor {
+public:
+  BtreeCursor(FFBtree* tree, Index* index)
+      : read_(index), tree_(tree), leaf_(nullptr), last_key_(0) { }
+
+  virtual IndexMeta* Get(const Slice& key) {
+    entry_key_t entry_key = fast_atoi(key);
+    if (entry_key < last_key_) leaf_ = nullptr;
+    last_key_ = entry_key;
+    return BtreeIndex::ToMeta(tree_->Search(entry_key, &leaf_));
+  }
+
+private:
+  IndexReadGuard read_;
+  FFBtree* tree_;
+  void* leaf_;  // leaf of the previous key
+  entry_key_t last_key_;
+};
+
+} // anonymous namespace
+
+IndexCursor* BtreeIndex::NewCursor() {
+  return new BtreeCursor(tree_, this);
+}
+
+IndexMeta* BtreeIndex::SharedMeta(const std::shared_ptr<IndexMeta>& meta, InsertContext* context,
+                                  uint16_t* ordinal) {
+  // a block with more entries than ordinals gets another copy
+  if (meta != context->last_meta || context->next_ordinal > UINT16_MAX) {
+    IndexMeta* ptr = (IndexMeta*) nvram::pmalloc(sizeof(IndexMeta));
+    ptr->size = meta->size;
+    ptr->file_number = meta->file_number;
+    ptr->offset = meta->offset;
+    ptr->refs = 0;
+    clflush((char*)ptr, sizeof(IndexMeta));
+    context->recovery_list.push_back(meta->file_number);
+    context->last_meta = meta;
+    context->last_persistent_meta = ptr;
+    context->next_ordinal = 0;
+  }
+  if (ordinal != nullptr) *ordinal = context->next_ordinal;
+  context->next_ordinal++;
+  // refs can be recounted from the tree, no need to flush it per entry.
+  // a new copy is only seen by the thread that made it until the batch ends.
+  context->last_persistent_meta->refs++;
+  return context->last_persistent_meta;
+}
+
+void BtreeIndex::ReleaseMeta(IndexMeta* meta, InsertContext* context) {
+  context->dead_keys[meta->file_number]++;
+  // entries of an older block may be overwritten by several threads
+  if (__atomic_sub_fetch(&meta->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    context->retired_metas.push_back(meta);
+  }
+}
+
+bool BtreeIndex::Replaces(const IndexMeta* current, const KeyAndMeta& key_meta,
+                          InsertContext* context) {
+  // the runner is the only writer, the entry cannot change until it is replaced
+  if (edit_->Replaces(current)) return true;
+  context->dead_keys[key_meta.meta->file_number]++;
+  return false;
 }
 
-void BtreeIndex::Insert(const entry_key_t& key, const IndexMeta& meta) {
-  edit_->AddToRecoveryList(meta.file_number);
+void BtreeIndex::InsertRange(QueueIterator begin, QueueIterator end, InsertContext* context) {
+  std::vector<FFBtree::BulkEntry> entries;
+  entries.reserve(end - begin);
+  bool sorted = true;
+  for (QueueIterator it = begin; it != end; ++it) {
+    if (edit_->HasMergeInputs() && !Replaces(ToMeta(tree_->Search(it->key)), *it, context)) {
+      continue;
+    }
+    uint16_t ordinal;
+    IndexMeta* ptr = SharedMeta(it->meta, context, &ordinal);
+    sorted = sorted && (entries.empty() || entries.back().key <= it->key);
+    entries.push_back({it->key, ToValue(ptr, ordinal), nullptr});
+  }
+  if (!sorted) {
+    // keys whose numeric order differs from the comparator, keep the last
+    // queued entry of a key last
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const FFBtree::BulkEntry& a, const FFBtree::BulkEntry& b) { return a.key < b.key; });
+  }
+  tree_->BulkInsertSorted(entries.data(), entries.data() + entries.size());
   // check btree if updated
-  IndexMeta* ptr = (IndexMeta*) nvram::pmalloc(sizeof(IndexMeta));
-  ptr->size = meta.size;
-  ptr->file_number = meta.file_number;
-  ptr->offset = meta.offset;
-  clflush((char*)ptr, sizeof(IndexMeta));
-  IndexMeta* old_ptr = (IndexMeta*) tree_.Insert(key, ptr);
-  if (old_ptr != nullptr) {
-    edit_->DecreaseCount(old_ptr->file_number);
-    nvram::pfree(old_ptr);
+  context->locality_changes.reserve(entries.size());
+  for (const FFBtree::BulkEntry& entry : entries) {
+    context->locality_changes.push_back({EntrySegmentKey(entry.key), ToMeta(entry.value)->file_number, 1});
+    if (entry.old_value != nullptr) {
+      context->locality_changes.push_back({EntrySegmentKey(entry.key), ToMeta(entry.old_value)->file_number, -1});
+      ReleaseMeta(ToMeta(entry.old_value), context);
+    }
+  }
+}
+
+void BtreeIndex::InsertBatch() {
+  size_t ranges = std::max<size_t>(1, std::min<size_t>(insert_threads_,
+                                                       queue_.size() / config::IndexMinRangeSize));
+  if (tree_->Empty()) {
+    ranges = 1;  // built bottom-up by this thread
+  }
+  if (ranges > 1 && insert_pool_ == nullptr) {
+    insert_pool_.reset(new ThreadPool(insert_threads_ - 1));
+  }
+
+  std::vector<InsertContext> contexts(ranges);
+  std::vector<std::future<void>> pending;
+  size_t begin = 0;
+  for (size_t i = 0; i < ranges; i++) {
+    size_t end = std::max(begin, queue_.size() * (i + 1) / ranges);
+    // keep equal entry keys together so the last queued entry still wins
+    while (end > begin && end < queue_.size() && queue_[end].key == queue_[end - 1].key) {
+      end++;
+    }
+    if (i + 1 < ranges) {
+      pending.push_back(insert_pool_->enqueue(&BtreeIndex::InsertRange, this,
+                                              queue_.cbegin() + begin, queue_.cbegin() + end, &contexts[i]));
+    } else {
+      InsertRange(queue_.cbegin() + begin, queue_.cbegin() + end, &contexts[i]);
+    }
+    begin = end;
+  }
+  for (std::future<void>& result : pending) {
+    result.wait();
+  }
+
+  std::vector<LocalityChange> locality_changes;
+  for (InsertContext& context : contexts) {
+    locality_changes.insert(locality_changes.end(),
+                            context.locality_changes.begin(), context.locality_changes.end());
+  }
+  ApplyLocalityChanges(&locality_changes);
+
+  for (InsertContext& context : contexts) {
+    for (uint64_t file_number : context.recovery_list) {
+      edit_->AddToRecoveryList(file_number);
+    }
+    for (const auto& dead : context.dead_keys) {
+      edit_->DecreaseCount(dead.first, dead.second);
+    }
+    retired_metas_.insert(retired_metas_.end(),
+                          context.retired_metas.begin(), context.retired_metas.end());
+    retired_values_.insert(retired_values_.end(),
+                           context.retired_values.begin(), context.retired_values.end());
   }
 }
 
@@ -40,12 +208,20 @@ void BtreeIndex::Runner() {
       condvar_.Wait();
     }
     edit_->AllocateRecoveryList(queue_.size());
-    assert(!queue_.empty());
-    for (;!queue_.empty();) {
-      uint64_t key = queue_.front().key;
-      std::shared_ptr<IndexMeta> value = queue_.front().meta;
-      queue_.pop_front();
-      Insert(key, *value);
+    InsertBatch();
+    queue_.clear();
+    condvar_.SignalAll();
+    // a long read, e.g. an iterator, holds back what was retired since it
+    // began, but never the inserts
+    const int epoch = read_epoch_.load();
+    if (!ReadsActive(1 - epoch)) {
+      for (IndexMeta* meta : grace_metas_) nvram::pfree(meta);
+      grace_metas_.swap(retired_metas_);
+      retired_metas_.clear();
+      for (void* value : grace_values_) FreeValue(value);
+      grace_values_.swap(retired_values_);
+      retired_values_.clear();
+      read_epoch_.store(1 - epoch);
     }
     if (edit_ != nullptr) edit_->Unref();
     assert(queue_.empty());
@@ -61,7 +237,11 @@ void* BtreeIndex::ThreadWrapper(void* ptr) {
 void BtreeIndex::AddQueue(std::deque<KeyAndMeta>& queue, VersionEdit* edit) {
   if (edit == nullptr) return;
   mutex_.Lock();
-  assert(queue_.size() == 0);
+  // a batch handed over right after the previous one waits for it, the
+  // runner only takes one at a time
+  while (!queue_.empty()) {
+    condvar_.Wait();
+  }
   queue_.swap(queue);
   edit_ = edit;
   edit_->Ref();
@@ -69,20 +249,248 @@ void BtreeIndex::AddQueue(std::deque<KeyAndMeta>& queue, VersionEdit* edit) {
     bgstarted_ = true;
     port::PthreadCall("create thread", pthread_create(&thread_, NULL, &BtreeIndex::ThreadWrapper, this));
   }
-  condvar_.Signal();
+  condvar_.SignalAll();
   mutex_.Unlock();
 }
 
+void BtreeIndex::DeleteRange(const Slice& start, const Slice& limit, VersionEdit* edit) {
+  MutexLock l(&mutex_);
+  // the runner holds mutex_ while it applies a queue, so once the queue is
+  // empty this thread is the only writer
+  while (!queue_.empty()) {
+    condvar_.Wait();
+  }
+  InsertContext context;
+  RemoveRange(start, limit, &context);
+  InvalidateLocality(SegmentKey(start), SegmentKey(limit));
+  for (const auto& dead : context.dead_keys) {
+    edit->DecreaseCount(dead.first, dead.second);
+  }
+  // freed by the runner with those of the batches
+  retired_metas_.insert(retired_metas_.end(),
+                        context.retired_metas.begin(), context.retired_metas.end());
+  retired_values_.insert(retired_values_.end(),
+                         context.retired_values.begin(), context.retired_values.end());
+}
+
+void BtreeIndex::RemoveRange(const Slice& start, const Slice& limit, InsertContext* context) {
+  std::vector<void*> removed;
+  tree_->RemoveRange(EntryKey(start), EntryKey(limit), &removed);
+  for (void* value : removed) {
+    ReleaseMeta(ToMeta(value), context);
+  }
+}
+
 Iterator* BtreeIndex::NewIterator(const ReadOptions& options, TableCache* table_cache, VersionControl* vcontrol) {
-  return new IndexIterator(options, tree_.GetIterator(), table_cache, vcontrol);
+  const int ticket = BeginRead();
+  Iterator* iter = new IndexIterator(options, tree_->GetIterator(), table_cache, vcontrol);
+  iter->RegisterCleanup(&EndReadCleanup, this, reinterpret_cast<void*>(static_cast<intptr_t>(ticket)));
+  return iter;
+}
+
+void BtreeIndex::SetInsertThreads(int threads) {
+  MutexLock l(&mutex_);
+  if (threads != insert_threads_) {
+    insert_threads_ = threads;
+    insert_pool_.reset();
+  }
+}
+
+void BtreeIndex::SetDramInnerNodes(bool enabled) {
+  MutexLock l(&mutex_);
+  tree_->SetDramInnerNodes(enabled);
+}
+
+void BtreeIndex::Attach(void* persistent_root) {
+  MutexLock l(&mutex_);
+  FFBtree::Destroy(tree_);
+  tree_ = reinterpret_cast<FFBtree*>(persistent_root);
+  tree_->Recover();
+  MutexLock locality(&locality_mutex_);
+  segments_.clear();
+}
+
+entry_key_t BtreeIndex::EntryKey(const Slice& key) const {
+  return fast_atoi(key);
+}
+
+void BtreeIndex::ScanFiles(std::string* cursor, uint64_t count, std::set<uint16_t>* files) {
+  IndexReadGuard read(this);
+  FFBtreeIterator* iter = tree_->GetIterator();
+  if (!cursor->empty()) {
+    iter->Seek(DecodeFixed64(cursor->data()));
+  }
+  if (!iter->Valid()) {
+    iter->SeekToFirst();
+  }
+  for (uint64_t i = 0; i < count && iter->Valid(); i++) {
+    files->insert(ToMeta(iter->value())->file_number);
+    iter->Next();
+  }
+  cursor->clear();
+  if (iter->Valid()) {
+    PutFixed64(cursor, iter->key());
+  }
+  delete iter;
+}
+
+std::string BtreeIndex::EntrySegmentKey(entry_key_t key) {
+  char buf[sizeof(entry_key_t)];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = static_cast<char>(key >> (8 * (sizeof(buf) - 1 - i)));
+  }
+  return std::string(buf, sizeof(buf));
+}
+
+std::string BtreeIndex::SegmentKey(const Slice& user_key) const {
+  return EntrySegmentKey(EntryKey(user_key));
+}
+
+void BtreeIndex::ApplyLocalityChanges(std::vector<LocalityChange>* changes) {
+  std::sort(changes->begin(), changes->end(),
+            [](const LocalityChange& a, const LocalityChange& b) { return a.key < b.key; });
+  MutexLock l(&locality_mutex_);
+  auto segment = segments_.end();
+  for (const LocalityChange& change : *changes) {
+    if (segment == segments_.end() || change.key < segment->first ||
+        (!segment->second.to_end && change.key >= segment->second.limit)) {
+      segment = segments_.upper_bound(change.key);
+      if (segment == segments_.begin()) {
+        segment = segments_.end();
+        continue;
+      }
+      --segment;
+      if (!segment->second.to_end && change.key >= segment->second.limit) {
+        // a key range not walked yet
+        segment = segments_.end();
+        continue;
+      }
+    }
+    LocalitySegment* s = &segment->second;
+    s->entries += change.delta;
+    if ((s->files[change.file_number] += change.delta) == 0) {
+      s->files.erase(change.file_number);
+    }
+    if (s->entries > 2 * config::LocalitySegmentEntries) {
+      s->stale = true;  // split by the next walk
+    }
+  }
+}
+
+void BtreeIndex::InvalidateLocality(const std::string& start, const std::string& limit) {
+  MutexLock l(&locality_mutex_);
+  auto segment = segments_.upper_bound(start);
+  if (segment != segments_.begin()) --segment;
+  for (; segment != segments_.end() && segment->first <= limit; ++segment) {
+    segment->second.stale = true;
+  }
+}
+
+void BtreeIndex::ScanSegment(const std::string& start, LocalitySegment* segment) {
+  IndexReadGuard read(this);
+  entry_key_t key = 0;
+  for (char c : start) {
+    key = (key << 8) | static_cast<uint8_t>(c);
+  }
+  FFBtreeIterator* iter = tree_->GetIterator();
+  iter->Seek(key);
+  while (segment->entries < config::LocalitySegmentEntries && iter->Valid()) {
+    segment->entries++;
+    segment->files[ToMeta(iter->value())->file_number]++;
+    iter->Next();
+  }
+  segment->to_end = !iter->Valid();
+  if (iter->Valid()) {
+    segment->limit = EntrySegmentKey(iter->key());
+  }
+  delete iter;
+}
+
+bool BtreeIndex::UseSegment(std::string* cursor, uint64_t* entries, std::set<uint16_t>* files) {
+  auto it = segments_.upper_bound(*cursor);
+  if (it == segments_.begin()) return false;
+  --it;
+  const LocalitySegment& segment = it->second;
+  if (segment.stale || (!segment.to_end && *cursor >= segment.limit)) return false;
+  for (const auto& file : segment.files) {
+    if (file.second > 0) files->insert(file.first);
+  }
+  *entries += std::max<int64_t>(segment.entries, 0);
+  if (segment.to_end) {
+    cursor->clear();
+  } else {
+    *cursor = segment.limit;
+  }
+  return true;
+}
+
+bool BtreeIndex::LocalityWindow(std::string* cursor, uint64_t count, Env* env,
+                                uint64_t deadline_micros, uint64_t* entries,
+                                std::set<uint16_t>* files) {
+  // a segment limit is past some key, so only the end of the index leaves
+  // the cursor empty
+  while (*entries < count) {
+    if (env->NowMicros() >= deadline_micros) return false;
+    {
+      MutexLock l(&locality_mutex_);
+      if (UseSegment(cursor, entries, files)) {
+        if (cursor->empty()) return true;
+        continue;
+      }
+    }
+
+    // walked without holding locality_mutex_, the inserts go on meanwhile
+    LocalitySegment segment;
+    ScanSegment(*cursor, &segment);
+    MutexLock l(&locality_mutex_);
+    auto it = segments_.upper_bound(*cursor);
+    if (it != segments_.begin()) {
+      auto previous = std::prev(it);
+      if (previous->second.to_end || previous->second.limit > *cursor) {
+        segments_.erase(previous);
+      }
+    }
+    while (it != segments_.end() && (segment.to_end || it->first < segment.limit)) {
+      it = segments_.erase(it);
+    }
+    segments_[*cursor] = segment;
+    UseSegment(cursor, entries, files);
+    if (cursor->empty()) return true;
+  }
+  return true;
+}
+
+// The entries of the sampled leaves stand for all entries in the range
+uint64_t BtreeIndex::ApproximateSize(const Slice& start, const Slice& limit) {
+  IndexReadGuard read(this);
+  std::vector<void*> samples;
+  uint64_t entries = tree_->SampleRange(EntryKey(start), EntryKey(limit),
+                                        config::ApproximateSizeSampleStride, &samples);
+  if (samples.empty()) return 0;
+  double bytes = 0;
+  for (void* value : samples) {
+    bytes += ValueBytes(value);
+  }
+  return static_cast<uint64_t>(bytes * entries / samples.size());
+}
+
+double BtreeIndex::ValueBytes(void* value) {
+  return EntryBytes(ToMeta(value));
 }
 
 FFBtreeIterator* BtreeIndex::BtreeIterator() {
-  return tree_.GetIterator();
+  return tree_->GetIterator();
+}
+
+size_t BtreeIndex::TEST_RetiredMetas() {
+  MutexLock l(&mutex_);
+  return retired_metas_.size() + grace_metas_.size();
 }
 
 void BtreeIndex::Break() {
-  pthread_cancel(thread_);
+  if (bgstarted_) {
+    pthread_cancel(thread_);
+  }
 }
 
 
@@ -1,9 +1,12 @@
 #ifndef STORAGE_LEVELDB_INCLUDE_BTREE_INDEX_H_
 #define STORAGE_LEVELDB_INCLUDE_BTREE_INDEX_H_
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <deque>
+#include <unordered_map>
+#include <vector>
 #include <shared_mutex>
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
@@ -12,7 +15,9 @@
 #include "db/version_edit.h"
 #include "index/ff_btree.h"
 #include "port/port.h"
+#include "port/thread_annotations.h"
 #include "db/table_cache.h"
+#include "util/thread_pool.h"
 
 namespace leveldb {
 
@@ -20,32 +25,201 @@ class BtreeIndex : public Index{
 public:
   BtreeIndex();
 
-  ~BtreeIndex() = default;
+  virtual ~BtreeIndex() = default;
 
   virtual IndexMeta* Get(const Slice& key);
 
-  void Insert(const entry_key_t& key, const IndexMeta& meta);
+  virtual IndexCursor* NewCursor();
 
   virtual void AddQueue(std::deque<KeyAndMeta>& queue, VersionEdit* edit);
 
+  virtual void DeleteRange(const Slice& start, const Slice& limit, VersionEdit* edit);
+
   virtual Iterator* NewIterator(const ReadOptions& options, TableCache* table_cache, VersionControl* vcontrol);
 
   virtual void Break();
 
+  virtual entry_key_t EntryKey(const Slice& key) const;
+
+  virtual bool UsesFullKeys() const { return false; }
+
+  virtual void ScanFiles(std::string* cursor, uint64_t count, std::set<uint16_t>* files);
+
+  virtual bool LocalityWindow(std::string* cursor, uint64_t count, Env* env,
+                              uint64_t deadline_micros, uint64_t* entries,
+                              std::set<uint16_t>* files);
+
+  virtual uint64_t ApproximateSize(const Slice& start, const Slice& limit);
+
+  virtual int BeginRead();
+
+  virtual void EndRead(int ticket);
+
+  virtual void SetInsertThreads(int threads);
+
+  virtual void SetDramInnerNodes(bool enabled);
+
+  virtual void* PersistentRoot() { return tree_; }
+
+  virtual void Attach(void* persistent_root);
+
   FFBtreeIterator* BtreeIterator();
 
+  // Metas taken out of the tree that are not freed yet, for testing
+  size_t TEST_RetiredMetas();
+
+  // Leaf values of tree_ pack the persistent block meta (a 48-bit address)
+  // with the ordinal of the entry in its block.  FAST takes equal neighbouring
+  // pointers for a shift in progress, so entries of a block must differ.
+  static void* ToValue(IndexMeta* meta, uint16_t ordinal) {
+    assert(((uintptr_t)meta >> 48) == 0);
+    return (void*)(((uintptr_t)meta << 16) | ordinal);
+  }
+  static IndexMeta* ToMeta(void* value) {
+    return (IndexMeta*)((uintptr_t)value >> 16);
+  }
+
+protected:
+  // An entry of a file gained (delta 1) or lost (delta -1) at the segment
+  // key "key"
+  struct LocalityChange {
+    std::string key;
+    uint16_t file_number;
+    int16_t delta;
+  };
+
+  // Per-thread state while inserting one range of a batch.  It is merged
+  // into edit_ once every range of the batch is done.
+  struct InsertContext {
+    InsertContext() : last_persistent_meta(nullptr), next_ordinal(0) { }
+
+    // Block meta of the last inserted entry and its persistent copy.  Entries
+    // of a block are queued together, so one copy serves the whole block.
+    std::shared_ptr<IndexMeta> last_meta;
+    IndexMeta* last_persistent_meta;
+    uint32_t next_ordinal;
+
+    std::vector<uint64_t> recovery_list;
+    std::map<uint64_t, uint64_t> dead_keys;
+    std::vector<IndexMeta*> retired_metas;
+    std::vector<void*> retired_values;  // leaf values taken out of the tree
+    std::vector<LocalityChange> locality_changes;
+  };
+
+  typedef std::deque<KeyAndMeta>::const_iterator QueueIterator;
+
+  // Called from the insertion threads with a sorted range of the queue.
+  // Entries with the same key are always inserted by the same thread.
+  virtual void InsertRange(QueueIterator begin, QueueIterator end, InsertContext* context);
+
+  // Returns the persistent copy of meta shared by all entries of its block
+  // and takes a reference on it for the new entry.  If ordinal is not null it
+  // is set to the position of the entry among the users of the copy.
+  IndexMeta* SharedMeta(const std::shared_ptr<IndexMeta>& meta, InsertContext* context,
+                        uint16_t* ordinal = nullptr);
+
+  // Drops the reference of an overwritten entry and counts it as dead
+  void ReleaseMeta(IndexMeta* meta, InsertContext* context);
+
+  // Called from DeleteRange with no queue being applied
+  virtual void RemoveRange(const Slice& start, const Slice& limit, InsertContext* context);
+
+  // Frees a leaf value retired through InsertContext::retired_values.  The
+  // values of tree_ own nothing but their meta.
+  virtual void FreeValue(void* value) { }
+
+  // Bytes of table data behind the leaf value of tree_, for ApproximateSize
+  virtual double ValueBytes(void* value);
+
+  // Index entries from a segment key on, for the locality check.  Segment
+  // keys order like the keys of the index: the big-endian entry key here,
+  // the user key in indexes over full keys.  The file counts follow the
+  // inserts once the segment was walked, and are only close: a batch
+  // applied while the segment was walked may be left out.
+  struct LocalitySegment {
+    LocalitySegment() : to_end(false), stale(false), entries(0) { }
+
+    std::string limit;  // the first key past the segment, unless to_end
+    bool to_end;
+    bool stale;  // walked again before it is used
+    int64_t entries;
+    std::unordered_map<uint16_t, int64_t> files;  // entries per file
+  };
+
+  static std::string EntrySegmentKey(entry_key_t key);
+  virtual std::string SegmentKey(const Slice& user_key) const;
+
+  // Walks about config::LocalitySegmentEntries entries from the segment
+  // key start into segment
+  virtual void ScanSegment(const std::string& start, LocalitySegment* segment);
+
+  // Brings the file counts of the segments up to date with changes
+  void ApplyLocalityChanges(std::vector<LocalityChange>* changes);
+
+  // The share of one entry in the size of its data block
+  static double EntryBytes(const IndexMeta* meta) {
+    return meta->refs > 0 ? static_cast<double>(meta->size) / meta->refs : meta->size;
+  }
+
+  // Whether a queued entry replaces current, the entry the index holds for
+  // its key (see VersionEdit::AddMergeInput).  A skipped entry is counted as
+  // dead in its own table.
+  bool Replaces(const IndexMeta* current, const KeyAndMeta& key_meta, InsertContext* context);
+
+  // Ends a read of the index, as a cleanup of an iterator holding it
+  static void EndReadCleanup(void* index, void* ticket);
+
+  FFBtree* tree_;  // in persistent memory
+  VersionEdit* edit_;
+
 private:
   void Runner();
+
+  // Splits queue_ into key ranges and inserts them concurrently
+  void InsertBatch();
+
+  // Adds the segment holding cursor to the window and moves cursor past
+  // it.  Returns false if there is no such segment or it is stale.
+  bool UseSegment(std::string* cursor, uint64_t* entries, std::set<uint16_t>* files)
+      EXCLUSIVE_LOCKS_REQUIRED(locality_mutex_);
+  // Marks the segments holding keys in [start, limit] to be walked again
+  void InvalidateLocality(const std::string& start, const std::string& limit);
+
+  int insert_threads_;
+  std::unique_ptr<ThreadPool> insert_pool_;
+
+  // Lock-free readers may still use the metas and values taken out of the
+  // tree.  Those retired since the epoch of reads last changed wait in
+  // retired_, those retired before in grace_.  The runner frees grace_ and
+  // changes the epoch again once the reads of the previous epoch are done,
+  // none of them can have found what is in retired_ then.
+  std::vector<IndexMeta*> retired_metas_;
+  std::vector<IndexMeta*> grace_metas_;
+  std::vector<void*> retired_values_;
+  std::vector<void*> grace_values_;
+
+  // Reads in progress per epoch, spread over cache lines by thread
+  enum { kReadStripes = 16 };
+  struct alignas(CACHE_LINE_SIZE) ReadCount {
+    std::atomic<int> reads{0};
+  };
+  ReadCount reads_[2][kReadStripes];
+  std::atomic<int> read_epoch_;
+
+  bool ReadsActive(int epoch) const;
   static void* ThreadWrapper(void* ptr);
 
-  FFBtree tree_;
   bool bgstarted_;
   pthread_t thread_;
   port::Mutex mutex_;
   port::CondVar condvar_;
 
   std::deque<KeyAndMeta> queue_;
-  VersionEdit* edit_;
+
+  // Keyed by the first segment key of the segment, protected by
+  // locality_mutex_
+  port::Mutex locality_mutex_;
+  std::map<std::string, LocalitySegment> segments_;
 
   BtreeIndex(const BtreeIndex&);
   void operator=(const BtreeIndex&);
@@ -1,23 +1,260 @@
 #include "ff_btree.h"
 #include "ff_btree_iterator.h"
+#include <immintrin.h>
 
 namespace leveldb {
 
+static_assert(sizeof(Entry) == 2 * sizeof(uint64_t), "page search reads records as word pairs");
+
+static int FindEqualScalar(const uint64_t* words, int from, int n, entry_key_t key) {
+  for (int i = from; i < n; i++) {
+    if (words[2 * i + 1] == 0 || words[2 * i] == key) return i;
+  }
+  return n;
+}
+
+static int FindGreaterScalar(const uint64_t* words, int from, int n, entry_key_t key) {
+  for (int i = from; i < n; i++) {
+    if (words[2 * i + 1] == 0 || words[2 * i] > key) return i;
+  }
+  return n;
+}
+
+static int FindEqualKeysScalar(const uint64_t* keys, int from, int n, entry_key_t key) {
+  for (int i = from; i < n; i++) {
+    if (keys[i] == key) return i;
+  }
+  return n;
+}
+
+static int FindGreaterKeysScalar(const uint64_t* keys, int from, int n, entry_key_t key) {
+  for (int i = from; i < n; i++) {
+    if (keys[i] > key) return i;
+  }
+  return n;
+}
+
+// The kernels compare a register of (key, ptr) pairs twice, once against the
+// key and once against NULL, and keep the key lanes of the first and the
+// ptr lanes of the second.  Entry j of the register then owns mask bits 2j
+// and 2j + 1.
+
+__attribute__((target("sse4.2")))
+static inline int PairMask(__m128i key_cmp, __m128i null_cmp) {
+  return _mm_movemask_pd(_mm_castsi128_pd(_mm_blend_epi16(key_cmp, null_cmp, 0xF0)));
+}
+
+__attribute__((target("sse4.2")))
+static int FindEqualSse42(const uint64_t* words, int from, int n, entry_key_t key) {
+  const __m128i k = _mm_set1_epi64x(key);
+  const __m128i zero = _mm_setzero_si128();
+  int i = from;
+  for (; i + 2 <= n; i += 2) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(words + 2 * i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(words + 2 * i + 2));
+    int hits = PairMask(_mm_cmpeq_epi64(lo, k), _mm_cmpeq_epi64(lo, zero)) |
+               PairMask(_mm_cmpeq_epi64(hi, k), _mm_cmpeq_epi64(hi, zero)) << 2;
+    if (hits != 0) return i + __builtin_ctz(hits) / 2;
+  }
+  return FindEqualScalar(words, i, n, key);
+}
+
+__attribute__((target("sse4.2")))
+static int FindGreaterSse42(const uint64_t* words, int from, int n, entry_key_t key) {
+  // there is no unsigned compare, flip the sign bits instead
+  const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+  const __m128i k = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+  const __m128i zero = _mm_setzero_si128();
+  int i = from;
+  for (; i + 2 <= n; i += 2) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(words + 2 * i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(words + 2 * i + 2));
+    int hits = PairMask(_mm_cmpgt_epi64(_mm_xor_si128(lo, sign), k), _mm_cmpeq_epi64(lo, zero)) |
+               PairMask(_mm_cmpgt_epi64(_mm_xor_si128(hi, sign), k), _mm_cmpeq_epi64(hi, zero)) << 2;
+    if (hits != 0) return i + __builtin_ctz(hits) / 2;
+  }
+  return FindGreaterScalar(words, i, n, key);
+}
+
+__attribute__((target("sse4.2")))
+static int FindEqualKeysSse42(const uint64_t* keys, int from, int n, entry_key_t key) {
+  const __m128i k = _mm_set1_epi64x(key);
+  int i = from;
+  for (; i + 4 <= n; i += 4) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(keys + i));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(keys + i + 2));
+    int hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(lo, k))) |
+               _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(hi, k))) << 2;
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return FindEqualKeysScalar(keys, i, n, key);
+}
+
+__attribute__((target("sse4.2")))
+static int FindGreaterKeysSse42(const uint64_t* keys, int from, int n, entry_key_t key) {
+  const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+  const __m128i k = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+  int i = from;
+  for (; i + 4 <= n; i += 4) {
+    __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), sign);
+    __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i + 2)), sign);
+    int hits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(lo, k))) |
+               _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(hi, k))) << 2;
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return FindGreaterKeysScalar(keys, i, n, key);
+}
+
+__attribute__((target("avx2")))
+static inline int PairMask(__m256i key_cmp, __m256i null_cmp) {
+  return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_blend_epi32(key_cmp, null_cmp, 0xCC)));
+}
+
+// The tail that does not fill a step is left to the scalar kernel, so
+// nothing past the page is read.
+__attribute__((target("avx2")))
+static int FindEqualAvx2(const uint64_t* words, int from, int n, entry_key_t key) {
+  const __m256i k = _mm256_set1_epi64x(key);
+  const __m256i zero = _mm256_setzero_si256();
+  int i = from;
+  for (; i + 4 <= n; i += 4) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)(words + 2 * i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(words + 2 * i + 4));
+    int hits = PairMask(_mm256_cmpeq_epi64(lo, k), _mm256_cmpeq_epi64(lo, zero)) |
+               PairMask(_mm256_cmpeq_epi64(hi, k), _mm256_cmpeq_epi64(hi, zero)) << 4;
+    if (hits != 0) return i + __builtin_ctz(hits) / 2;
+  }
+  return FindEqualScalar(words, i, n, key);
+}
+
+__attribute__((target("avx2")))
+static int FindGreaterAvx2(const uint64_t* words, int from, int n, entry_key_t key) {
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+  const __m256i zero = _mm256_setzero_si256();
+  int i = from;
+  for (; i + 4 <= n; i += 4) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)(words + 2 * i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(words + 2 * i + 4));
+    int hits = PairMask(_mm256_cmpgt_epi64(_mm256_xor_si256(lo, sign), k), _mm256_cmpeq_epi64(lo, zero)) |
+               PairMask(_mm256_cmpgt_epi64(_mm256_xor_si256(hi, sign), k), _mm256_cmpeq_epi64(hi, zero)) << 4;
+    if (hits != 0) return i + __builtin_ctz(hits) / 2;
+  }
+  return FindGreaterScalar(words, i, n, key);
+}
+
+__attribute__((target("avx2")))
+static int FindEqualKeysAvx2(const uint64_t* keys, int from, int n, entry_key_t key) {
+  const __m256i k = _mm256_set1_epi64x(key);
+  int i = from;
+  for (; i + 8 <= n; i += 8) {
+    __m256i lo = _mm256_loadu_si256((const __m256i*)(keys + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(keys + i + 4));
+    int hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, k))) |
+               _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, k))) << 4;
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return FindEqualKeysScalar(keys, i, n, key);
+}
+
+__attribute__((target("avx2")))
+static int FindGreaterKeysAvx2(const uint64_t* keys, int from, int n, entry_key_t key) {
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+  int i = from;
+  for (; i + 8 <= n; i += 8) {
+    __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+    __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i + 4)), sign);
+    int hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(lo, k))) |
+               _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hi, k))) << 4;
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return FindGreaterKeysScalar(keys, i, n, key);
+}
+
+static const PageSearch kPageSearches[] = {
+  { "scalar", FindEqualScalar, FindGreaterScalar, FindEqualKeysScalar, FindGreaterKeysScalar },
+  { "sse4.2", FindEqualSse42, FindGreaterSse42, FindEqualKeysSse42, FindGreaterKeysSse42 },
+  { "avx2", FindEqualAvx2, FindGreaterAvx2, FindEqualKeysAvx2, FindGreaterKeysAvx2 },
+};
+
+static bool PageSearchSupported(PageSearchMode mode) {
+  __builtin_cpu_init();
+  switch (mode) {
+    case kScalarPageSearch: return true;
+    case kSse42PageSearch: return __builtin_cpu_supports("sse4.2");
+    case kAvx2PageSearch: return __builtin_cpu_supports("avx2");
+  }
+  return false;
+}
+
+static PageSearch BestPageSearch() {
+  if (PageSearchSupported(kAvx2PageSearch)) return kPageSearches[kAvx2PageSearch];
+  if (PageSearchSupported(kSse42PageSearch)) return kPageSearches[kSse42PageSearch];
+  return kPageSearches[kScalarPageSearch];
+}
+
+PageSearch page_search = BestPageSearch();
+
+bool SetPageSearchMode(PageSearchMode mode) {
+  if (!PageSearchSupported(mode)) return false;
+  page_search = kPageSearches[mode];
+  return true;
+}
+
 /*
  *  class btree
  */
-FFBtree::FFBtree(){
-  root = new Page();
+template <int kPageSize, bool kSplitLayout>
+BasicFFBtree<kPageSize, kSplitLayout>::BasicFFBtree(){
+  dram_inner = false;
+  head = new Page();
+  root = head;
   height = 1;
 }
 
-void FFBtree::setNewRoot(void* new_root) {
+template <int kPageSize, bool kSplitLayout>
+BasicFFBtree<kPageSize, kSplitLayout>* BasicFFBtree<kPageSize, kSplitLayout>::Create() {
+  BasicFFBtree* tree = new (nvram::pmalloc(sizeof(BasicFFBtree))) BasicFFBtree();
+  clflush((char*)tree, sizeof(BasicFFBtree));
+  return tree;
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::Destroy(BasicFFBtree* tree) {
+  tree->FreeInnerLevels();
+  for(Page* leaf = tree->head; leaf != NULL; ) {
+    Page* sibling = leaf->hdr.sibling_ptr;
+    Page::Free(leaf);
+    leaf = sibling;
+  }
+  nvram::pfree(tree);
+}
+
+template <int kPageSize, bool kSplitLayout>
+typename BasicFFBtree<kPageSize, kSplitLayout>::Page*
+BasicFFBtree<kPageSize, kSplitLayout>::NewPage(uint32_t level) {
+  bool in_dram = dram_inner && level > 0;
+  return new (in_dram) Page(level, in_dram);
+}
+
+template <int kPageSize, bool kSplitLayout>
+typename BasicFFBtree<kPageSize, kSplitLayout>::Page*
+BasicFFBtree<kPageSize, kSplitLayout>::NewPage(Page* left, const entry_key_t& key, Page* right,
+                                               uint32_t level) {
+  bool in_dram = dram_inner && level > 0;
+  return new (in_dram) Page(left, key, right, level, in_dram);
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::setNewRoot(void* new_root) {
   this->root = new_root;
   clflush((char*)&(this->root),sizeof(void*));
   ++height;
 }
 
-void* FFBtree::Search(const entry_key_t& key){
+template <int kPageSize, bool kSplitLayout>
+void* BasicFFBtree<kPageSize, kSplitLayout>::Search(const entry_key_t& key){
   Page* p = (Page*)root;
 
   while(p->hdr.leftmost_ptr != NULL) {
@@ -34,7 +271,30 @@ void* FFBtree::Search(const entry_key_t& key){
   return (char *)t;
 }
 
-void* FFBtree::Insert(const entry_key_t& key, void* right){ //need to be string
+template <int kPageSize, bool kSplitLayout>
+void* BasicFFBtree<kPageSize, kSplitLayout>::Search(const entry_key_t& key, void** leaf){
+  // a key this many leaves past the previous one is found faster from the root
+  const int kMaxSiblingHops = 2;
+
+  Page* p = (Page*)*leaf;
+  if(p == NULL) {
+    p = FindLeaf(key);
+  }
+
+  Page *t;
+  int hops = 0;
+  while((t = (Page *)p->linear_search(key)) == p->hdr.sibling_ptr) {
+    if(!t) {
+      break;
+    }
+    p = (++hops == kMaxSiblingHops) ? FindLeaf(key) : t;
+  }
+  *leaf = p;
+  return (char *)t;
+}
+
+template <int kPageSize, bool kSplitLayout>
+void* BasicFFBtree<kPageSize, kSplitLayout>::Insert(const entry_key_t& key, void* right){ //need to be string
   Page* p = (Page*)root;
 
   while(p->hdr.leftmost_ptr != NULL) {
@@ -48,8 +308,243 @@ void* FFBtree::Insert(const entry_key_t& key, void* right){ //need to be string
   return ret;
 }
 
-void* FFBtree::InsertInternal(void* left, const entry_key_t& key,
-                             void* right, uint32_t level) {
+template <int kPageSize, bool kSplitLayout>
+bool BasicFFBtree<kPageSize, kSplitLayout>::Empty() {
+  Page* p = (Page*)root;
+  return p->hdr.leftmost_ptr == NULL && p->hdr.sibling_ptr == NULL && p->count() == 0;
+}
+
+template <int kPageSize, bool kSplitLayout>
+typename BasicFFBtree<kPageSize, kSplitLayout>::Page* BasicFFBtree<kPageSize, kSplitLayout>::FindLeaf(const entry_key_t& key) {
+  Page* p = (Page*)root;
+  while(p->hdr.leftmost_ptr != NULL) {
+    p = (Page*)p->linear_search(key);
+  }
+  return p;
+}
+
+template <int kPageSize, bool kSplitLayout>
+uint64_t BasicFFBtree<kPageSize, kSplitLayout>::SampleRange(const entry_key_t& start,
+                                                           const entry_key_t& limit, int stride,
+                                                           std::vector<void*>* samples) {
+  uint64_t entries = 0;
+  int leaf = 0;
+  for (Page* p = FindLeaf(start); p != NULL; p = p->hdr.sibling_ptr, leaf++) {
+    int count = p->count();
+    if (count == 0) continue;
+    if (p->records[0].key >= limit) break;
+    bool sampled = leaf % stride == 0;
+    if (!sampled && p->records[0].key >= start && p->records[count - 1].key < limit) {
+      // the whole leaf is in the range
+      entries += count;
+      continue;
+    }
+    for (int i = 0; i < count; i++) {
+      void* value = p->records[i].ptr;
+      if (value == NULL) break;
+      entry_key_t key = p->records[i].key;
+      if (key < start || key >= limit) continue;
+      entries++;
+      if (sampled) samples->push_back(value);
+    }
+  }
+  return entries;
+}
+
+template <int kPageSize, bool kSplitLayout>
+uint64_t BasicFFBtree<kPageSize, kSplitLayout>::RemoveRange(const entry_key_t& start,
+                                                           const entry_key_t& limit,
+                                                           std::vector<void*>* removed) {
+  uint64_t entries = 0;
+  std::vector<entry_key_t> keys;
+  for (Page* p = FindLeaf(start); p != NULL; p = p->hdr.sibling_ptr) {
+    p->lock();
+    int count = p->count();
+    if (count > 0 && p->records[0].key >= limit) {
+      p->unlock();
+      break;
+    }
+    keys.clear();
+    for (int i = 0; i < count; i++) {
+      entry_key_t key = p->records[i].key;
+      if (key >= start && key < limit) {
+        keys.push_back(key);
+        removed->push_back(p->records[i].ptr);
+      }
+    }
+    entries += keys.size();
+    bool last = count > 0 && p->records[count - 1].key >= limit;
+    if (keys.size() == static_cast<size_t>(count) && count > 0) {
+      // the whole leaf goes at once.  the first key stays behind the NULL
+      // pointer, the left neighbour compares inserts with it.
+      if (!IS_FORWARD(p->hdr.switch_counter)) {
+        ++p->hdr.switch_counter;
+      }
+      p->records[0].ptr = NULL;
+      if (p->durable()) p->records.flush_ptr(0);
+      p->hdr.last_index = -1;
+      p->persist(&p->hdr.last_index, sizeof(int16_t));
+    } else {
+      for (entry_key_t key : keys) {
+        p->remove_key(key);
+      }
+    }
+    p->unlock();
+    if (last) break;
+  }
+  return entries;
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::BulkInsertSorted(BulkEntry* begin, BulkEntry* end) {
+  // Leaves of a bulk built tree are left this full so that later inserts
+  // do not split them right away
+  const int kBulkFill = (Page::cardinality - 1) * 3 / 4;
+
+  if(begin == end) {
+    return;
+  }
+  if(Empty()) {
+    // the empty root becomes the first leaf, readers keep finding keys
+    // through the sibling chain until the inner levels are in place
+    std::vector<std::pair<entry_key_t, Page*> > children;
+    Page* leaf = (Page*)root;
+    children.push_back(std::make_pair(begin->key, leaf));
+    int num_entries = 0;
+    for(BulkEntry* e = begin; e != end; ++e) {
+      if(num_entries >= kBulkFill && e->key != leaf->records[num_entries - 1].key) {
+        Page* next = NewPage(0);
+        leaf->hdr.sibling_ptr = next;
+        clflush((char*)leaf, sizeof(Page));
+        leaf = next;
+        children.push_back(std::make_pair(e->key, leaf));
+        num_entries = 0;
+      }
+      e->old_value = leaf->insert_key(e->key, e->value, &num_entries, false);
+    }
+    clflush((char*)leaf, sizeof(Page));
+
+    BuildInnerLevels(&children, 0);
+    return;
+  }
+
+  Page* leaf = NULL;
+  Page* dirty = NULL;
+  for(BulkEntry* e = begin; e != end; ++e) {
+    // walking the siblings is only worth it for the next leaf
+    Page* sibling = leaf != NULL ? leaf->hdr.sibling_ptr : NULL;
+    if(leaf == NULL || (sibling != NULL && sibling->hdr.sibling_ptr != NULL &&
+                        e->key >= sibling->hdr.sibling_ptr->records[0].key)) {
+      leaf = FindLeaf(e->key);
+    }
+    e->old_value = NULL;
+    Page* stored;
+    while((stored = leaf->store(this, NULL, e->key, e->value, false, NULL, &e->old_value)) == NULL) {
+      leaf = FindLeaf(e->key);  // the leaf was merged away
+    }
+    if(stored != dirty) {
+      if(dirty != NULL) {
+        clflush((char*)dirty, sizeof(Page));
+      }
+      dirty = stored;
+    }
+    leaf = stored;
+  }
+  clflush((char*)dirty, sizeof(Page));
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::BuildInnerLevels(
+    std::vector<std::pair<entry_key_t, Page*> >* children, uint32_t level) {
+  const int kBulkFill = (Page::cardinality - 1) * 3 / 4;
+  while(children->size() > 1) {
+    level++;
+    std::vector<std::pair<entry_key_t, Page*> > parents;
+    Page* parent = NULL;
+    int num_entries = 0;
+    for(size_t i = 0; i < children->size(); i++) {
+      // a page with only its leftmost child has no key for the sibling
+      // hop to check against, so a last lone child goes to the page before
+      if(parent == NULL || (num_entries >= kBulkFill && i + 1 < children->size())) {
+        Page* next = NewPage(level);
+        next->hdr.leftmost_ptr = (*children)[i].second;
+        if(parent != NULL) {
+          parent->hdr.sibling_ptr = next;
+          parent->persist(parent, sizeof(Page));
+        }
+        parent = next;
+        parents.push_back(std::make_pair((*children)[i].first, parent));
+        num_entries = 0;
+      } else {
+        parent->insert_key((*children)[i].first, (*children)[i].second, &num_entries, false);
+      }
+    }
+    parent->persist(parent, sizeof(Page));
+    children->swap(parents);
+  }
+  root = (*children)[0].second;
+  clflush((char*)&root, sizeof(void*));
+  height = level + 1;
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::FreeInnerLevels() {
+  Page* level_start = (Page*)root;
+  while(level_start->hdr.leftmost_ptr != NULL) {
+    Page* next_level = level_start->hdr.leftmost_ptr;
+    for(Page* p = level_start; p != NULL; ) {
+      Page* sibling = p->hdr.sibling_ptr;
+      Page::Free(p);
+      p = sibling;
+    }
+    level_start = next_level;
+  }
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::SetDramInnerNodes(bool enabled) {
+  if(enabled == dram_inner) {
+    return;
+  }
+  FreeInnerLevels();
+  dram_inner = enabled;
+  RebuildInnerLevels();
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::RebuildInnerLevels() {
+  // leaves emptied by removals stay in the chain but get no separator
+  std::vector<std::pair<entry_key_t, Page*> > children;
+  for(Page* leaf = head; leaf != NULL; leaf = leaf->hdr.sibling_ptr) {
+    if(leaf == head || leaf->records[0].ptr != NULL) {
+      children.push_back(std::make_pair(leaf->records[0].key, leaf));
+    }
+  }
+  BuildInnerLevels(&children, 0);
+}
+
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::Recover() {
+  for(Page* leaf = head; leaf != NULL; leaf = leaf->hdr.sibling_ptr) {
+    leaf->hdr.locked = false;
+  }
+  if(dram_inner) {
+    // the DRAM pages went away with the process
+    RebuildInnerLevels();
+    return;
+  }
+  Page* level_start = (Page*)root;
+  while(level_start->hdr.leftmost_ptr != NULL) {
+    for(Page* p = level_start; p != NULL; p = p->hdr.sibling_ptr) {
+      p->hdr.locked = false;
+    }
+    level_start = level_start->hdr.leftmost_ptr;
+  }
+}
+
+template <int kPageSize, bool kSplitLayout>
+void* BasicFFBtree<kPageSize, kSplitLayout>::InsertInternal(void* left, const entry_key_t& key,
+                                                            void* right, uint32_t level) {
   if(level > ((Page *)root)->hdr.level)
     return nullptr;
 
@@ -65,7 +560,8 @@ void* FFBtree::InsertInternal(void* left, const entry_key_t& key,
   return ret;
 }
 
-void FFBtree::Remove(const entry_key_t& key) {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::Remove(const entry_key_t& key) {
   Page* p = (Page*)root;
 
   while(p->hdr.leftmost_ptr != NULL){
@@ -89,9 +585,10 @@ void FFBtree::Remove(const entry_key_t& key) {
   }
 }
 
-void FFBtree::RemoveInternal(const entry_key_t& key, void* ptr, uint32_t level,
-                             entry_key_t* deleted_key, bool* is_leftmost_node,
-                             Page** left_sibling) {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtree<kPageSize, kSplitLayout>::RemoveInternal(const entry_key_t& key, void* ptr, uint32_t level,
+                                                           entry_key_t* deleted_key, bool* is_leftmost_node,
+                                                           Page** left_sibling) {
   if(level > ((Page *)this->root)->hdr.level)
   return;
 
@@ -130,8 +627,20 @@ void FFBtree::RemoveInternal(const entry_key_t& key, void* ptr, uint32_t level,
   }
 }
 
-FFBtreeIterator* FFBtree::GetIterator() {
-  return new FFBtreeIterator(this);
+template <int kPageSize, bool kSplitLayout>
+typename BasicFFBtree<kPageSize, kSplitLayout>::Iterator* BasicFFBtree<kPageSize, kSplitLayout>::GetIterator() {
+  return new Iterator(this);
 }
 
+template class BasicFFBtree<256, false>;
+template class BasicFFBtree<256, true>;
+template class BasicFFBtree<512, false>;
+template class BasicFFBtree<512, true>;
+template class BasicFFBtree<1024, false>;
+template class BasicFFBtree<1024, true>;
+template class BasicFFBtree<2048, false>;
+template class BasicFFBtree<2048, true>;
+template class BasicFFBtree<4096, false>;
+template class BasicFFBtree<4096, true>;
+
 }
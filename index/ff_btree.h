@@ -17,6 +17,9 @@
 #include <climits>
 #include <future>
 #include <mutex>
+#include <new>
+#include <sched.h>
+#include <type_traits>
 #include "leveldb/persistant_pool.h"
 #include "leveldb/index.h"
 #include "util/persist.h"
@@ -29,54 +32,37 @@ using namespace std;
 
 namespace leveldb {
 
-class FFBtreeIterator;
-class Page;
+template <int kPageSize = PAGESIZE, bool kSplitLayout = false> class BasicFFBtree;
+template <int kPageSize = PAGESIZE, bool kSplitLayout = false> class BasicFFBtreeIterator;
+template <int kPageSize, bool kSplitLayout> class BasicPage;
 
-class FFBtree {
+template <class PageT>
+class PageHeader {
 private:
-  int height;
-  void* root;
-
-  void setNewRoot(void* new_root);
-  // store the key into the node at the given level
-  void* InsertInternal(void* left, const entry_key_t& key, void* right, uint32_t level);
-  void RemoveInternal(const entry_key_t& key, void* ptr, uint32_t level,
-                      entry_key_t* deleted_key, bool* is_leftmost_node, Page** left_sibling);
-
-public:
-  FFBtree();
-// insert the key in the leaf node
-  void* Insert(const entry_key_t& key, void* right);
-  void Remove(const entry_key_t& key);
-  void* Search(const entry_key_t& key);
-  FFBtreeIterator* GetIterator();
-
-  friend class Page;
-  friend class FFBtreeIterator;
-};
-
-class Header {
-private:
-  Page* leftmost_ptr;         // 8 bytes
-  Page* sibling_ptr;          // 8 bytes
+  PageT* leftmost_ptr;        // 8 bytes
+  PageT* sibling_ptr;         // 8 bytes
   uint32_t level;             // 4 bytes
   uint8_t switch_counter;     // 1 bytes
   bool is_deleted;         // 1 bytes
   int16_t last_index;         // 2 bytes
+  bool locked;                // 1 byte, writer lock
+  bool in_dram;               // 1 byte, inner page of a hybrid tree
 
-  friend class Page;
-  friend class FFBtree;
-  friend class FFBtreeIterator;
+  template <int, bool> friend class BasicPage;
+  template <int, bool> friend class BasicFFBtree;
+  template <int, bool> friend class BasicFFBtreeIterator;
 public:
-  Header() {
+  PageHeader() {
     leftmost_ptr = NULL;
     sibling_ptr = NULL;
     switch_counter = 0;
     last_index = -1;
     is_deleted = false;
+    locked = false;
+    in_dram = false;
   }
 
-  ~Header() {
+  ~PageHeader() {
   }
 };
 
@@ -90,49 +76,223 @@ public :
     ptr = NULL;
   }
 
-  friend class Page;
-  friend class FFBtree;
-  friend class FFBtreeIterator;
+  template <int> friend class InterleavedRecords;
+  template <int, bool> friend class BasicPage;
+  template <int, bool> friend class BasicFFBtree;
+  template <int, bool> friend class BasicFFBtreeIterator;
 };
 
-const int cardinality = (PAGESIZE - sizeof(Header)) / sizeof(Entry);
+// entries of a default page
+const int cardinality = (PAGESIZE - sizeof(PageHeader<void>)) / sizeof(Entry);
 const int count_in_line = CACHE_LINE_SIZE / sizeof(Entry);
 
-class Page {
+// Search kernels over the records of a page, seen as pairs of (key, ptr)
+// words.  Both return the first index in [from, n) whose ptr is NULL or whose
+// key equals (find_equal) or is greater than (find_greater) key, and n if
+// there is none.  Callers check the candidate the same way a scalar scan
+// does, so concurrent shifts are still caught by the switch_counter.
+// The *_keys variants do the same over a plain key array, where n must
+// already stop at the NULL entry.
+struct PageSearch {
+  const char* name;
+  int (*find_equal)(const uint64_t* words, int from, int n, entry_key_t key);
+  int (*find_greater)(const uint64_t* words, int from, int n, entry_key_t key);
+  int (*find_equal_keys)(const uint64_t* keys, int from, int n, entry_key_t key);
+  int (*find_greater_keys)(const uint64_t* keys, int from, int n, entry_key_t key);
+};
+
+enum PageSearchMode {
+  kScalarPageSearch,
+  kSse42PageSearch,
+  kAvx2PageSearch
+};
+
+// Kernels used by every Page, picked from the CPU features at startup
+extern PageSearch page_search;
+
+// Switches the kernels used by every Page.  Returns false and keeps the
+// current ones if the CPU lacks the instructions for mode.
+bool SetPageSearchMode(PageSearchMode mode);
+
+// Slots of a page with the key and ptr of an entry side by side
+template <int kSlots>
+class InterleavedRecords {
+public:
+  Entry& operator[](int i) { return slots_[i]; }
+
+  // first entry in [from, end) matching key or ending the page
+  int find_equal(int from, int end, entry_key_t key) const {
+    return page_search.find_equal(words(), from, end, key);
+  }
+  int find_greater(int from, int end, entry_key_t key) const {
+    return page_search.find_greater(words(), from, end, key);
+  }
+
+  void flush(int i) { clflush((char*) &slots_[i], sizeof(Entry)); }
+  void flush_ptr(int i) { clflush((char*) &slots_[i].ptr, sizeof(void*)); }
+  void flush_line(int i) { clflush((char*) &slots_[i], CACHE_LINE_SIZE); }
+  void flush_range(int from, int to) {
+    clflush((char*) &slots_[from], (to - from) * sizeof(Entry));
+  }
+  bool ptr_starts_line(int i) const {
+    return (uint64_t) &slots_[i].ptr % CACHE_LINE_SIZE == 0;
+  }
+  // whether entry i is the last one written of its cache line while
+  // shifting entries one by one
+  bool ends_line(int i) const {
+    uint64_t remainder = (uint64_t) &slots_[i] % CACHE_LINE_SIZE;
+    return (remainder == 0) ||
+           ((((int) (remainder + sizeof(Entry)) / CACHE_LINE_SIZE) == 1) &&
+            ((remainder + sizeof(Entry)) % CACHE_LINE_SIZE) != 0);
+  }
+
+private:
+  const uint64_t* words() const {
+    return reinterpret_cast<const uint64_t*>(slots_);
+  }
+
+  Entry slots_[kSlots];
+};
+
+// Slots of a page with all keys ahead of all ptrs, so that searching a
+// page only reads the cache lines of the keys
+template <int kSlots>
+class SplitRecords {
+public:
+  struct Ref {
+    entry_key_t& key;
+    void*& ptr;
+  };
+
+  SplitRecords() {
+    memset(keys_, 0, sizeof(keys_));
+    memset(ptrs_, 0, sizeof(ptrs_));
+  }
+
+  Ref operator[](int i) { return Ref{keys_[i], ptrs_[i]}; }
+
+  // first entry in [from, end) matching key, end has to be the NULL entry
+  int find_equal(int from, int end, entry_key_t key) const {
+    return page_search.find_equal_keys(keys_, from, end, key);
+  }
+  int find_greater(int from, int end, entry_key_t key) const {
+    return page_search.find_greater_keys(keys_, from, end, key);
+  }
+
+  void flush(int i) {
+    clflush((char*) &keys_[i], sizeof(entry_key_t));
+    clflush((char*) &ptrs_[i], sizeof(void*));
+  }
+  void flush_ptr(int i) { clflush((char*) &ptrs_[i], sizeof(void*)); }
+  void flush_line(int i) {
+    clflush((char*) &keys_[i], CACHE_LINE_SIZE);
+    clflush((char*) &ptrs_[i], CACHE_LINE_SIZE);
+  }
+  void flush_range(int from, int to) {
+    clflush((char*) &keys_[from], (to - from) * sizeof(entry_key_t));
+    clflush((char*) &ptrs_[from], (to - from) * sizeof(void*));
+  }
+  bool ptr_starts_line(int i) const {
+    return (uint64_t) &ptrs_[i] % CACHE_LINE_SIZE == 0;
+  }
+  bool ends_line(int i) const {
+    return (uint64_t) &keys_[i] % CACHE_LINE_SIZE == 0;
+  }
+
 private:
-  Header hdr;  // header in persistent memory, 16 bytes
-  Entry records[cardinality]; // slots in persistent memory, 16 bytes * n
+  entry_key_t keys_[kSlots];
+  void* ptrs_[kSlots];
+};
 
+// A node of kPageSize bytes, its slots either interleaved (the FAST+FAIR
+// layout) or split into a key array and a ptr array
+template <int kPageSize, bool kSplitLayout>
+class BasicPage {
 public:
-  friend class FFBtree;
-  friend class FFBtreeIterator;
+  typedef PageHeader<BasicPage> Header;
+  static const int cardinality = (kPageSize - sizeof(Header)) / sizeof(Entry);
+  typedef typename std::conditional<kSplitLayout, SplitRecords<cardinality>,
+                                    InterleavedRecords<cardinality> >::type Records;
 
-  Page(uint32_t level = 0) {
+private:
+  typedef BasicFFBtree<kPageSize, kSplitLayout> Tree;
+
+  Header hdr;  // header in persistent memory, 32 bytes
+  Records records; // slots in persistent memory, 16 bytes * n
+
+public:
+  friend class BasicFFBtree<kPageSize, kSplitLayout>;
+  friend class BasicFFBtreeIterator<kPageSize, kSplitLayout>;
+
+  BasicPage(uint32_t level = 0, bool in_dram = false) {
     hdr.level = level;
+    hdr.in_dram = in_dram;
     records[0].ptr = NULL;
   }
 
   // this is called when tree grows
-  Page(Page* left, const entry_key_t& key, Page* right, uint32_t level = 0) {
+  BasicPage(BasicPage* left, const entry_key_t& key, BasicPage* right, uint32_t level = 0,
+            bool in_dram = false) {
     hdr.leftmost_ptr = left;
     hdr.level = level;
+    hdr.in_dram = in_dram;
     records[0].key = key;
     records[0].ptr = right;
     records[1].ptr = NULL;
 
     hdr.last_index = 0;
 
-    clflush((char*) this, sizeof(Page));
+    persist(this, sizeof(BasicPage));
   }
 
   void* operator new(size_t size) {
     return nvram::pmalloc(size);
   }
 
+  // inner pages of a hybrid tree come from DRAM
+  void* operator new(size_t size, bool in_dram) {
+    if (!in_dram) return nvram::pmalloc(size);
+    void* buffer;
+    if (posix_memalign(&buffer, CACHE_LINE_SIZE, size) != 0) throw std::bad_alloc();
+    return buffer;
+  }
+
   void operator delete(void* buffer) {
     nvram::pfree(buffer);
   }
 
+  void operator delete(void* buffer, bool in_dram) {
+    if (in_dram) free(buffer); else nvram::pfree(buffer);
+  }
+
+  static void Free(BasicPage* page) {
+    bool in_dram = page->hdr.in_dram;
+    page->~BasicPage();
+    operator delete(page, in_dram);
+  }
+
+  // DRAM pages are rebuilt after a restart, so they are never flushed
+  bool durable() const {
+    return !hdr.in_dram;
+  }
+
+  void persist(const void* data, int len) {
+    if (durable()) clflush((const char*) data, len);
+  }
+
+  // Writers of a page serialize on its header, readers never take the lock
+  void lock() {
+    bool unlocked = false;
+    while (!CAS(&hdr.locked, &unlocked, true)) {
+      unlocked = false;
+      sched_yield();
+    }
+  }
+
+  void unlock() {
+    __atomic_store_n(&hdr.locked, false, __ATOMIC_RELEASE);
+  }
+
   inline int count() {
     uint8_t previous_switch_counter;
     int count = 0;
@@ -178,13 +338,8 @@ public:
         records[i].ptr = records[i + 1].ptr;
 
         // flush
-        uint64_t records_ptr = (uint64_t) (&records[i]);
-        uint64_t remainder = records_ptr % CACHE_LINE_SIZE;
-        bool do_flush = (remainder == 0) ||
-                        ((((int) (remainder + sizeof(Entry)) / CACHE_LINE_SIZE) == 1) &&
-                         ((remainder + sizeof(Entry)) % CACHE_LINE_SIZE) != 0);
-        if (do_flush) {
-          clflush((char*) records_ptr, CACHE_LINE_SIZE);
+        if (durable() && records.ends_line(i)) {
+          records.flush_line(i);
         }
       }
     }
@@ -195,12 +350,12 @@ public:
     return shift;
   }
 
-  bool remove(FFBtree* bt, const entry_key_t& key, bool only_rebalance = false, bool with_lock = true) {
+  bool remove(Tree* bt, const entry_key_t& key, bool only_rebalance = false, bool with_lock = true) {
     if (!only_rebalance) {
       int num_entries_before = count();
 
       // This node is root
-      if (this == (Page*) bt->root) {
+      if (this == (BasicPage*) bt->root) {
         if (hdr.level > 0) {
           if (num_entries_before == 1 && !hdr.sibling_ptr) {
             bt->root = hdr.leftmost_ptr;
@@ -232,7 +387,7 @@ public:
     //Remove a key from the parent node
     entry_key_t deleted_key_from_parent = 0;
     bool is_leftmost_node = false;
-    Page* left_sibling;
+    BasicPage* left_sibling;
     bt->RemoveInternal(key, this, hdr.level + 1,
                        &deleted_key_from_parent, &is_leftmost_node, &left_sibling);
 
@@ -263,10 +418,10 @@ public:
           }
 
           left_sibling->records[m].ptr = nullptr;
-          clflush((char*) &(left_sibling->records[m].ptr), sizeof(void*));
+          if (durable()) left_sibling->records.flush_ptr(m);
 
           left_sibling->hdr.last_index = m - 1;
-          clflush((char*) &(left_sibling->hdr.last_index), sizeof(int16_t));
+          persist(&(left_sibling->hdr.last_index), sizeof(int16_t));
 
           parent_key = records[0].key;
         } else {
@@ -280,18 +435,18 @@ public:
 
           parent_key = left_sibling->records[m].key;
 
-          hdr.leftmost_ptr = (Page*) left_sibling->records[m].ptr;
-          clflush((char*) &(hdr.leftmost_ptr), sizeof(Page*));
+          hdr.leftmost_ptr = (BasicPage*) left_sibling->records[m].ptr;
+          persist(&(hdr.leftmost_ptr), sizeof(BasicPage*));
 
           left_sibling->records[m].ptr = nullptr;
-          clflush((char*) &(left_sibling->records[m].ptr), sizeof(void*));
+          if (durable()) left_sibling->records.flush_ptr(m);
 
           left_sibling->hdr.last_index = m - 1;
-          clflush((char*) &(left_sibling->hdr.last_index), sizeof(int16_t));
+          persist(&(left_sibling->hdr.last_index), sizeof(int16_t));
         }
 
-        if (left_sibling == ((Page*) bt->root)) {
-          Page* new_root = new Page(left_sibling, parent_key, this, hdr.level + 1);
+        if (left_sibling == ((BasicPage*) bt->root)) {
+          BasicPage* new_root = bt->NewPage(left_sibling, parent_key, this, hdr.level + 1);
           bt->setNewRoot(new_root);
         } else {
           bt->InsertInternal
@@ -299,9 +454,9 @@ public:
         }
       } else { // from leftmost case
         hdr.is_deleted = 1;
-        clflush((char*) &(hdr.is_deleted), sizeof(uint8_t));
+        persist(&(hdr.is_deleted), sizeof(uint8_t));
 
-        Page* new_sibling = new Page(hdr.level);
+        BasicPage* new_sibling = bt->NewPage(hdr.level);
         new_sibling->hdr.sibling_ptr = hdr.sibling_ptr;
 
         int num_dist_entries = num_entries - m;
@@ -318,10 +473,10 @@ public:
                                     &new_sibling_cnt, false);
           }
 
-          clflush((char*) (new_sibling), sizeof(Page));
+          persist(new_sibling, sizeof(BasicPage));
 
           left_sibling->hdr.sibling_ptr = new_sibling;
-          clflush((char*) &(left_sibling->hdr.sibling_ptr), sizeof(Page*));
+          persist(&(left_sibling->hdr.sibling_ptr), sizeof(BasicPage*));
 
           parent_key = new_sibling->records[0].key;
         } else {
@@ -335,19 +490,19 @@ public:
 
           parent_key = records[num_dist_entries - 1].key;
 
-          new_sibling->hdr.leftmost_ptr = (Page*) records[num_dist_entries - 1].ptr;
+          new_sibling->hdr.leftmost_ptr = (BasicPage*) records[num_dist_entries - 1].ptr;
           for (int i = num_dist_entries; records[i].ptr != NULL; i++) {
             new_sibling->insert_key(records[i].key, records[i].ptr,
                                     &new_sibling_cnt, false);
           }
-          clflush((char*) (new_sibling), sizeof(Page));
+          persist(new_sibling, sizeof(BasicPage));
 
           left_sibling->hdr.sibling_ptr = new_sibling;
-          clflush((char*) &(left_sibling->hdr.sibling_ptr), sizeof(Page*));
+          persist(&(left_sibling->hdr.sibling_ptr), sizeof(BasicPage*));
         }
 
-        if (left_sibling == ((Page*) bt->root)) {
-          Page* new_root = new Page(left_sibling, parent_key, new_sibling, hdr.level + 1);
+        if (left_sibling == ((BasicPage*) bt->root)) {
+          BasicPage* new_root = bt->NewPage(left_sibling, parent_key, new_sibling, hdr.level + 1);
           bt->setNewRoot((char*) new_root);
         } else {
           bt->InsertInternal(left_sibling, parent_key, new_sibling, hdr.level + 1);
@@ -355,7 +510,7 @@ public:
       }
     } else {
       hdr.is_deleted = 1;
-      clflush((char*) &(hdr.is_deleted), sizeof(uint8_t));
+      persist(&(hdr.is_deleted), sizeof(uint8_t));
       if (hdr.leftmost_ptr)
         left_sibling->insert_key(deleted_key_from_parent,
                                  hdr.leftmost_ptr, &left_num_entries);
@@ -365,7 +520,7 @@ public:
       }
 
       left_sibling->hdr.sibling_ptr = hdr.sibling_ptr;
-      clflush((char*) &(left_sibling->hdr.sibling_ptr), sizeof(Page*));
+      persist(&(left_sibling->hdr.sibling_ptr), sizeof(BasicPage*));
     }
 
     return true;
@@ -374,6 +529,7 @@ public:
   inline void*
   insert_key(const entry_key_t& key, void* ptr, int* num_entries, bool flush = true,
              bool update_last_index = true) {
+    flush = flush && durable();
     // update switch_counter
     if (!IS_FORWARD(hdr.switch_counter))
       ++hdr.switch_counter;
@@ -388,15 +544,15 @@ public:
       records[1].ptr = NULL;
 
       if (flush) {
-        clflush((char*) this, CACHE_LINE_SIZE);
+        records.flush_range(0, 2);
       }
     } else {
       int i, to_flush_cnt = 0;
       bool inserted = false;
       records[*num_entries + 1].ptr = records[*num_entries].ptr;
       if (flush) {
-        if ((uint64_t) &(records[*num_entries + 1].ptr) % CACHE_LINE_SIZE == 0)
-          clflush((char*) &(records[*num_entries + 1].ptr), sizeof(void*));
+        if (records.ptr_starts_line(*num_entries + 1))
+          records.flush_ptr(*num_entries + 1);
       }
 
       // check for duplicate key
@@ -406,7 +562,7 @@ public:
             void* old_ptr = records[i].ptr;
             records[i].ptr = ptr;
             if (flush) {
-              clflush((char*) &records[i].ptr, sizeof(void*));
+              records.flush_ptr(i);
             }
             return old_ptr;
           }
@@ -420,14 +576,8 @@ public:
           records[i + 1].key = records[i].key;
 
           if (flush) {
-            uint64_t records_ptr = (uint64_t) (&records[i + 1]);
-
-            uint64_t remainder = records_ptr % CACHE_LINE_SIZE;
-            bool do_flush = (remainder == 0) ||
-                            ((((int) (remainder + sizeof(Entry)) / CACHE_LINE_SIZE) == 1)
-                             && ((remainder + sizeof(Entry)) % CACHE_LINE_SIZE) != 0);
-            if (do_flush) {
-              clflush((char*) records_ptr, CACHE_LINE_SIZE);
+            if (records.ends_line(i + 1)) {
+              records.flush_line(i + 1);
               to_flush_cnt = 0;
             } else
               ++to_flush_cnt;
@@ -438,7 +588,7 @@ public:
           records[i + 1].ptr = ptr;
 
           if (flush)
-            clflush((char*) &records[i + 1], sizeof(Entry));
+            records.flush(i + 1);
           inserted = true;
           break;
         }
@@ -448,7 +598,7 @@ public:
         records[0].key = key;
         records[0].ptr = ptr;
         if (flush)
-          clflush((char*) &records[0], sizeof(Entry));
+          records.flush(0);
       }
     }
 
@@ -460,14 +610,21 @@ public:
   }
 
   // Insert a new key - FAST and FAIR
-  Page* store(FFBtree* bt, void* left, const entry_key_t& key, void* right,
-              bool flush, Page* invalid_sibling = NULL, void** upd_ptr = NULL) {
+  BasicPage* store(Tree* bt, void* left, const entry_key_t& key, void* right,
+                   bool flush, BasicPage* invalid_sibling = NULL, void** upd_ptr = NULL) {
+    lock();
+    if (hdr.is_deleted) {
+      unlock();
+      return NULL;
+    }
+
     // If this node has a sibling node,
     if (hdr.sibling_ptr && (hdr.sibling_ptr != invalid_sibling)) {
       // Compare this key with the first key of the sibling
-      if (key > hdr.sibling_ptr->records[0].key) {
+      if (key >= hdr.sibling_ptr->records[0].key) {
+        unlock();
         return hdr.sibling_ptr->store(bt, NULL, key, right,
-                                      true, invalid_sibling);
+                                      true, invalid_sibling, upd_ptr);
       }
     }
 
@@ -475,12 +632,14 @@ public:
 
     // FAST
     if (num_entries < cardinality - 1) {
-      *upd_ptr = insert_key(key, right, &num_entries, flush);
+      void* old_ptr = insert_key(key, right, &num_entries, flush);
+      if (upd_ptr != nullptr) *upd_ptr = old_ptr;
+      unlock();
       return this;
     } else {// FAIR
       // overflow
       // create a new node
-      Page* sibling = new Page(hdr.level);
+      BasicPage* sibling = bt->NewPage(hdr.level);
       int m = (int) ceil(num_entries / 2);
       entry_key_t split_key = records[m].key;
 
@@ -488,20 +647,20 @@ public:
       int sibling_cnt = 0;
       if (hdr.leftmost_ptr == NULL) { // leaf node
         for (int i = m; i < num_entries; ++i) {
-          *upd_ptr = sibling->insert_key(records[i].key, records[i].ptr, &sibling_cnt, false);
+          sibling->insert_key(records[i].key, records[i].ptr, &sibling_cnt, false);
         }
       } else { // internal node
         for (int i = m + 1; i < num_entries; ++i) {
           sibling->insert_key(records[i].key, records[i].ptr, &sibling_cnt, false);
         }
-        sibling->hdr.leftmost_ptr = (Page*) records[m].ptr;
+        sibling->hdr.leftmost_ptr = (BasicPage*) records[m].ptr;
       }
 
       sibling->hdr.sibling_ptr = hdr.sibling_ptr;
-      clflush((char*) sibling, sizeof(Page));
+      persist(sibling, sizeof(BasicPage));
 
       hdr.sibling_ptr = sibling;
-      clflush((char*) &hdr, sizeof(hdr));
+      persist(&hdr, sizeof(hdr));
 
       // set to NULL
       if (IS_FORWARD(hdr.switch_counter))
@@ -509,114 +668,55 @@ public:
       else
         ++hdr.switch_counter;
       records[m].ptr = NULL;
-      clflush((char*) &records[m], sizeof(Entry));
+      if (durable()) records.flush(m);
 
       hdr.last_index = m - 1;
-      clflush((char*) &(hdr.last_index), sizeof(int16_t));
+      persist(&(hdr.last_index), sizeof(int16_t));
 
       num_entries = hdr.last_index + 1;
 
-      Page* ret;
+      BasicPage* ret;
+      void* old_ptr;
 
       // insert the key
       if (key < split_key) {
-        insert_key(key, right, &num_entries);
+        old_ptr = insert_key(key, right, &num_entries);
         ret = this;
       } else {
-        sibling->insert_key(key, right, &sibling_cnt);
+        old_ptr = sibling->insert_key(key, right, &sibling_cnt);
         ret = sibling;
       }
+      if (upd_ptr != nullptr) *upd_ptr = old_ptr;
 
       // Set a new root or insert the split key to the parent
       if (bt->root == this) { // only one node can update the root ptr
-        Page* new_root = new Page(this, split_key, sibling, hdr.level + 1);
+        BasicPage* new_root = bt->NewPage(this, split_key, sibling, hdr.level + 1);
         bt->setNewRoot((char *)new_root);
+        unlock();
       }
       else {
+        unlock();
         bt->InsertInternal(NULL, split_key, (char *)sibling, hdr.level + 1);
       }
       return ret;
     }
   }
 
-  // Search keys with linear Search
-  void linear_search_range (const entry_key_t& min, const entry_key_t& max, unsigned long* buf) {
-    int i, off = 0;
-    uint8_t previous_switch_counter;
-    Page* current = this;
-
-    while (current) {
-      int old_off = off;
-      do {
-        previous_switch_counter = current->hdr.switch_counter;
-        off = old_off;
-
-        entry_key_t tmp_key;
-        void* tmp_ptr;
-
-        if (IS_FORWARD(previous_switch_counter)) {
-          if ((tmp_key = current->records[0].key) > min) {
-            if (tmp_key < max) {
-              if ((tmp_ptr = current->records[0].ptr) != NULL) {
-                if (tmp_key == current->records[0].key) {
-                  if (tmp_ptr) {
-                    buf[off++] = (unsigned long) tmp_ptr;
-                  }
-                }
-              }
-            } else
-              return;
-          }
-
-          for (i = 1; current->records[i].ptr != NULL; ++i) {
-            if ((tmp_key = current->records[i].key) > min) {
-              if (tmp_key < max) {
-                if ((tmp_ptr = current->records[i].ptr) != current->records[i - 1].ptr) {
-                  if (tmp_key == current->records[i].key) {
-                    if (tmp_ptr)
-                      buf[off++] = (unsigned long) tmp_ptr;
-                  }
-                }
-              } else
-                return;
-            }
-          }
-        } else {
-          for (i = count() - 1; i > 0; --i) {
-            if ((tmp_key = current->records[i].key) > min) {
-              if (tmp_key < max) {
-                if ((tmp_ptr = current->records[i].ptr) != current->records[i - 1].ptr) {
-                  if (tmp_key == current->records[i].key) {
-                    if (tmp_ptr)
-                      buf[off++] = (unsigned long) tmp_ptr;
-                  }
-                }
-              } else
-                return;
-            }
-          }
-
-          if ((tmp_key = current->records[0].key) > min) {
-            if (tmp_key < max) {
-              if ((tmp_ptr = current->records[0].ptr) != NULL) {
-                if (tmp_key == current->records[0].key) {
-                  if (tmp_ptr) {
-                    buf[off++] = (unsigned long) tmp_ptr;
-                  }
-                }
-              }
-            } else
-              return;
-          }
-        }
-      } while (previous_switch_counter != current->hdr.switch_counter);
+  // Forward searches stop at the NULL entry.  The interleaved kernels see
+  // it on their own, the key-only ones are bounded by count() instead, and
+  // a search that ran into that bound while an insert was growing the page
+  // has to be repeated.
+  int search_end() {
+    return kSplitLayout ? count() : cardinality;
+  }
 
-      current = current->hdr.sibling_ptr;
-    }
+  bool search_overran(int i, int end) {
+    return kSplitLayout && i == end && end < cardinality && records[end].ptr != NULL;
   }
 
   void* linear_search(const entry_key_t& key) {
     int i = 1;
+    int end;
     uint8_t previous_switch_counter;
     void* ret = NULL;
     void* t;
@@ -626,21 +726,16 @@ public:
       do {
         previous_switch_counter = hdr.switch_counter;
         ret = NULL;
+        end = -1;
 
         // Search from left ro right
         if (IS_FORWARD(previous_switch_counter)) {
-          if ((k = records[0].key) == key) {
-            if ((t = records[0].ptr) != NULL) {
-              if (k == records[0].key) {
-                ret = t;
-                continue;
-              }
-            }
-          }
-
-          for (i = 1; records[i].ptr != NULL; ++i) {
+          end = search_end();
+          for (i = records.find_equal(0, end, key);
+               i < end && (t = records[i].ptr) != NULL;
+               i = records.find_equal(i + 1, end, key)) {
             if ((k = records[i].key) == key) {
-              if (records[i-1].ptr != (t = records[i].ptr)) {
+              if (i == 0 || records[i - 1].ptr != t) {
                 if (k == records[i].key) {
                   ret = t;
                   break;
@@ -671,13 +766,13 @@ public:
             }
           }
         }
-      } while (hdr.switch_counter != previous_switch_counter);
+      } while (hdr.switch_counter != previous_switch_counter || search_overran(i, end));
 
       if (ret) {
         return ret;
       }
 
-      if ((t = hdr.sibling_ptr) && key >= ((Page*) t)->records[0].key)
+      if ((t = hdr.sibling_ptr) && key >= ((BasicPage*) t)->records[0].key)
         return t;
 
       return NULL;
@@ -685,26 +780,22 @@ public:
       do {
         previous_switch_counter = hdr.switch_counter;
         ret = NULL;
+        end = -1;
 
         if (IS_FORWARD(previous_switch_counter)) {
-          if (key < (k = records[0].key)) {
-            if ((t = hdr.leftmost_ptr) != records[0].ptr) {
+          end = search_end();
+          for (i = records.find_greater(0, end, key);
+               i < end && records[i].ptr != NULL;
+               i = records.find_greater(i + 1, end, key)) {
+            t = (i == 0) ? hdr.leftmost_ptr : records[i - 1].ptr;
+            if (t != records[i].ptr) {
               ret = t;
-              continue;
-            }
-          }
-
-          for (i = 1; records[i].ptr != NULL; ++i) {
-            if (key < (k = records[i].key)) {
-              if ((t = records[i - 1].ptr) != records[i].ptr) {
-                ret = t;
-                break;
-              }
+              break;
             }
           }
 
           if (!ret) {
-            ret = records[i - 1].ptr;
+            ret = (i > 0) ? records[i - 1].ptr : hdr.leftmost_ptr;
             continue;
           }
         } else { // Search from right to left
@@ -724,10 +815,10 @@ public:
             }
           }
         }
-      } while (hdr.switch_counter != previous_switch_counter);
+      } while (hdr.switch_counter != previous_switch_counter || search_overran(i, end));
 
       if ((t = hdr.sibling_ptr) != NULL) {
-        if (key >= ((Page*) t)->records[0].key)
+        if (key >= ((BasicPage*) t)->records[0].key)
           return t;
       }
 
@@ -738,134 +829,100 @@ public:
     }
     return nullptr;
   }
+};
 
-  void* linear_search_entry(const entry_key_t& key) {
-    int i = 1;
-    uint8_t previous_switch_counter;
-    void* ret = nullptr;
-    void* t;
-    entry_key_t k;
-
-    if (hdr.leftmost_ptr == NULL) { // Search a leaf node
-      do {
-        previous_switch_counter = hdr.switch_counter;
-        ret = NULL;
-
-        // Search from left ro right
-        if (IS_FORWARD(previous_switch_counter)) {
-          if ((k = records[0].key) == key) {
-            if ((t = records[0].ptr) != NULL) {
-              if (k == records[0].key) {
-                ret = &records[0];
-                continue;
-              }
-            }
-          }
-
-          for (i = 1; records[i].ptr != NULL; ++i) {
-            if ((k = records[i].key) == key) {
-              if (records[i - 1].ptr != (t = records[i].ptr)) {
-                if (k == records[i].key) {
-                  ret = &records[i];
-                  break;
-                }
-              }
-            }
-          }
-        } else { // Search from right to left
-          for (i = count() - 1; i > 0; --i) {
-            if ((k = records[i].key) == key) {
-              if (records[i - 1].ptr != (t = records[i].ptr) && t) {
-                if (k == records[i].key) {
-                  ret = &records[i];
-                  break;
-                }
-              }
-            }
-          }
-
-          if (!ret) {
-            if ((k = records[0].key) == key) {
-              if (NULL != (t = records[0].ptr) && t) {
-                if (k == records[0].key) {
-                  ret = &records[0];
-                  continue;
-                }
-              }
-            }
-          }
-        }
-      } while (hdr.switch_counter != previous_switch_counter);
-
-      if (ret) {
-        return ret;
-      }
-
-      if ((t = hdr.sibling_ptr) && key >= ((Page*) t)->records[0].key)
-        return t;
-
-      return NULL;
-    } else { // internal node
-      do {
-        previous_switch_counter = hdr.switch_counter;
-        ret = NULL;
-
-        if (IS_FORWARD(previous_switch_counter)) {
-          if (key < (k = records[0].key)) {
-            if ((t = hdr.leftmost_ptr) != records[0].ptr) {
-              ret = t;
-              continue;
-            }
-          }
-
-          for (i = 1; records[i].ptr != NULL; ++i) {
-            if (key < (k = records[i].key)) {
-              if ((t = records[i - 1].ptr) != records[i].ptr) {
-                ret = &records[i-1];
-                break;
-              }
-            }
-          }
-
-          if (!ret) {
-            ret = &records[i - 1];
-            continue;
-          }
-        } else { // Search from right to left
-          for (i = count() - 1; i >= 0; --i) {
-            if (key >= (k = records[i].key)) {
-              if (i == 0) {
-                if (hdr.leftmost_ptr != (t = records[i].ptr)) {
-                  ret = &records[i];
-                  break;
-                }
-              } else {
-                if (records[i - 1].ptr != (t = records[i].ptr)) {
-                  ret = &records[i];
-                  break;
-                }
-              }
-            }
-          }
-        }
-      } while (hdr.switch_counter != previous_switch_counter);
-
-      if ((t = hdr.sibling_ptr) != NULL) {
-        if (key >= ((Page*) t)->records[0].key)
-          return t;
-      }
+// FAST+FAIR B+-tree over pages of kPageSize bytes.  The members are
+// instantiated in ff_btree.cc for pages of 256 to 4096 bytes in both layouts.
+template <int kPageSize, bool kSplitLayout>
+class BasicFFBtree {
+public:
+  typedef BasicPage<kPageSize, kSplitLayout> Page;
+  typedef BasicFFBtreeIterator<kPageSize, kSplitLayout> Iterator;
 
-      if (ret) {
-        return ret;
-      } else
-        return hdr.leftmost_ptr;
-    }
-    return nullptr;
-  }
+private:
+  int height;
+  void* root;
+  Page* head;       // first leaf, where the persistent leaf chain starts
+  bool dram_inner;  // inner pages live in DRAM, only the leaves in PM
 
+  void setNewRoot(void* new_root);
+  // allocate a page of the given level, in DRAM if it is an inner page
+  // of a hybrid tree
+  Page* NewPage(uint32_t level);
+  Page* NewPage(Page* left, const entry_key_t& key, Page* right, uint32_t level);
+  // build the inner levels over a run of pages given with their first keys
+  // and make the top one the root.  children is consumed.
+  void BuildInnerLevels(std::vector<std::pair<entry_key_t, Page*> >* children, uint32_t level);
+  void FreeInnerLevels();
+  // store the key into the node at the given level
+  void* InsertInternal(void* left, const entry_key_t& key, void* right, uint32_t level);
+  void RemoveInternal(const entry_key_t& key, void* ptr, uint32_t level,
+                      entry_key_t* deleted_key, bool* is_leftmost_node, Page** left_sibling);
+  // descend to the leaf responsible for key
+  Page* FindLeaf(const entry_key_t& key);
 
+public:
+  // One key of a sorted batch
+  struct BulkEntry {
+    entry_key_t key;
+    void* value;
+    void* old_value;  // set to the value replaced by this entry, or NULL
+  };
+
+  BasicFFBtree();
+  // a tree allocated in persistent memory, found again after a restart
+  // through whatever persistent object points at it
+  static BasicFFBtree* Create();
+  // frees the pages and the tree made by Create()
+  static void Destroy(BasicFFBtree* tree);
+// insert the key in the leaf node
+  void* Insert(const entry_key_t& key, void* right);
+  // insert a run of entries sorted by key.  an empty tree is built bottom-up,
+  // otherwise the leaf of the previous key is reused while the keys fall in
+  // it and every touched leaf is flushed once when the run moves past it.
+  void BulkInsertSorted(BulkEntry* begin, BulkEntry* end);
+  bool Empty();
+  void Remove(const entry_key_t& key);
+  void* Search(const entry_key_t& key);
+  // Search for keys looked up in ascending order.  *leaf is the leaf the
+  // previous lookup ended in (NULL for the first one) and the search starts
+  // there instead of at the root; it is set to the leaf of key on return.
+  // Leaves only split to the right, so a key never moves below that leaf.
+  void* Search(const entry_key_t& key, void** leaf);
+  // Counts the entries with keys in [start, limit) and appends the values
+  // of those in every stride-th leaf to *samples, so that an estimate over
+  // a key range reads only a part of the entries.  Returns the count.
+  uint64_t SampleRange(const entry_key_t& start, const entry_key_t& limit, int stride,
+                       std::vector<void*>* samples);
+  // Removes the entries with keys in [start, limit) and appends their values
+  // to *removed.  Leaves are emptied in place rather than merged, so keys
+  // never move left under lock-free readers; an empty leaf keeps its first
+  // key as a fence and fills up again with later inserts.  Returns the
+  // number of entries removed.
+  uint64_t RemoveRange(const entry_key_t& start, const entry_key_t& limit,
+                       std::vector<void*>* removed);
+  Iterator* GetIterator();
+
+  // Moves the inner pages to DRAM, or back to PM, by rebuilding them from
+  // the leaves.  Must not run concurrently with other operations.
+  void SetDramInnerNodes(bool enabled);
+  bool DramInnerNodes() const { return dram_inner; }
+  // Rebuilds the inner levels from the leaf chain alone, for a hybrid tree
+  // whose DRAM pages were lost in a restart.  Must not run concurrently
+  // with other operations.
+  void RebuildInnerLevels();
+  // Makes a tree found again in a reopened pool usable: clears the page
+  // locks held when it was closed and rebuilds lost DRAM inner levels.
+  void Recover();
+
+  friend class BasicPage<kPageSize, kSplitLayout>;
+  friend class BasicFFBtreeIterator<kPageSize, kSplitLayout>;
 };
 
+// The tree used by the index, 512 byte pages with interleaved slots
+typedef BasicFFBtree<> FFBtree;
+typedef BasicFFBtreeIterator<> FFBtreeIterator;
+
 } // namespace leveldb
 
 #endif // STORAGE_LEVELDB_INDEX_FF_BTREE_H_
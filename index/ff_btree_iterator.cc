@@ -3,27 +3,34 @@
 
 namespace leveldb {
 
-FFBtreeIterator::FFBtreeIterator(FFBtree* b) : valid(true), last(false) {
+template <int kPageSize, bool kSplitLayout>
+BasicFFBtreeIterator<kPageSize, kSplitLayout>::BasicFFBtreeIterator(Tree* b) : valid(true) {
   btree = b;
   SeekToFirst();
 }
 
-bool FFBtreeIterator::Valid() const {
+template <int kPageSize, bool kSplitLayout>
+bool BasicFFBtreeIterator<kPageSize, kSplitLayout>::Valid() const {
   return valid;
 }
 
-void FFBtreeIterator::SeekToFirst() {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtreeIterator<kPageSize, kSplitLayout>::SeekToFirst() {
   Page* page = (Page*)btree->root;
   while(page->hdr.leftmost_ptr != NULL) {
     page = page->hdr.leftmost_ptr;
   }
+  // skip pages left empty
+  while (page->records[0].ptr == nullptr && page->hdr.sibling_ptr != nullptr) {
+    page = page->hdr.sibling_ptr;
+  }
   cur_page = page;
-  cur = &(page->records[0]);
   index = 0;
-  valid = cur != NULL;
+  valid = page->records[0].ptr != nullptr;
 }
 
-void FFBtreeIterator::SeekToLast() {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtreeIterator<kPageSize, kSplitLayout>::SeekToLast() {
   Page* page = (Page*)btree->root;
   while(page->hdr.leftmost_ptr != NULL) {
     page = page->hdr.leftmost_ptr;
@@ -32,12 +39,13 @@ void FFBtreeIterator::SeekToLast() {
     page = page->hdr.sibling_ptr;
   }
   cur_page = page;
-  cur = &(cur_page->records[cur_page->count()-1]);
   index = cur_page->count()-1;
-  valid = cur != NULL;
+  valid = index >= 0;
+  if (index < 0) index = 0;
 }
 
-void FFBtreeIterator::Seek(const entry_key_t& key) {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtreeIterator<kPageSize, kSplitLayout>::Seek(const entry_key_t& key) {
   Page* page = (Page*)btree->root;
   // search until leaf node
   while(page->hdr.leftmost_ptr!=NULL) {
@@ -45,77 +53,89 @@ void FFBtreeIterator::Seek(const entry_key_t& key) {
   }
   uint8_t previous_switch_counter;
   int i;
-  Entry* ret = nullptr;
+  bool ret = false;
   do {
     int record_count = page->count();
     do {
       previous_switch_counter = page->hdr.switch_counter;
-      ret = nullptr;
+      ret = false;
       if (IS_FORWARD(previous_switch_counter)) {
         for (i = 0; page->records[i].ptr != nullptr && i < record_count; ++i) {
           if (page->records[i].key >= key && page->records[i].ptr != nullptr) {
-            ret = &page->records[i];
+            ret = true;
             index = i;
             break;
           }
         }
       } else {
-        for (i = record_count - 1; i >= 0; --i) {
-          if (page->records[i].key >= key && page->records[i].ptr != nullptr) {
-            ret = &page->records[i];
+        // the first key from the left that is not smaller, a removal
+        // leaves the page in this direction
+        for (i = record_count - 1; i >= 0 && page->records[i].key >= key; --i) {
+          if (page->records[i].ptr != nullptr) {
+            ret = true;
             index = i;
-            break;
           }
         }
       }
     } while (page->hdr.switch_counter != previous_switch_counter);
 
     if (ret) {
-      cur = ret;
       cur_page = page;
     }
   } while (page != page->hdr.sibling_ptr
            && (page = page->hdr.sibling_ptr)
            && !ret);
 
-  valid = ret != nullptr;
+  valid = ret;
 }
 
-void FFBtreeIterator::Next() {
-  if (last) {
-    valid = false;
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtreeIterator<kPageSize, kSplitLayout>::Next() {
+  if (!valid) return;
+  if (cur_page->records[index+1].ptr != nullptr) {
+    index = index+1;
     return;
   }
-  if (cur_page->records[index+1].ptr == nullptr) {
-    if (cur_page->hdr.sibling_ptr != nullptr) {
-      cur_page = cur_page->hdr.sibling_ptr;
-      cur = &(cur_page->records[0]);
-      index = 0;
-    }
-  } else {
-    index = index+1;
-    cur = &(cur_page->records[index]);
+  Page* page = cur_page->hdr.sibling_ptr;
+  while (page != nullptr && page->records[0].ptr == nullptr) {
+    page = page->hdr.sibling_ptr;
   }
-  // if this is a last key, make invalid
-  if (cur_page->records[index+1].ptr == nullptr && cur_page->hdr.sibling_ptr == nullptr) {
-    last = true;
+  // past the last key, keep pointing at it but make invalid
+  if (page == nullptr) {
+    valid = false;
+    return;
   }
+  cur_page = page;
+  index = 0;
 }
 
-void FFBtreeIterator::Prev() {
+template <int kPageSize, bool kSplitLayout>
+void BasicFFBtreeIterator<kPageSize, kSplitLayout>::Prev() {
   if(index == 0) {
   } else {
     index = index-1;
-    cur = &(cur_page->records[index]);
   }
 }
 
-entry_key_t FFBtreeIterator::key() const {
-  return cur->key;
+template <int kPageSize, bool kSplitLayout>
+entry_key_t BasicFFBtreeIterator<kPageSize, kSplitLayout>::key() const {
+  return cur_page->records[index].key;
 }
 
-void* FFBtreeIterator::value() const {
-  return cur->ptr;
+template <int kPageSize, bool kSplitLayout>
+void* BasicFFBtreeIterator<kPageSize, kSplitLayout>::value() const {
+  return cur_page->records[index].ptr;
 }
 
+template class BasicFFBtreeIterator<256, false>;
+template class BasicFFBtreeIterator<256, true>;
+template class BasicFFBtreeIterator<512, false>;
+template class BasicFFBtreeIterator<512, true>;
+template class BasicFFBtreeIterator<1024, false>;
+template class BasicFFBtreeIterator<1024, true>;
+template class BasicFFBtreeIterator<2048, false>;
+template class BasicFFBtreeIterator<2048, true>;
+template class BasicFFBtreeIterator<4096, false>;
+template class BasicFFBtreeIterator<4096, true>;
+
 } // namespace leveldb
\ No newline at end of file
@@ -5,9 +5,13 @@
 
 namespace leveldb {
 
-class FFBtreeIterator {
+template <int kPageSize, bool kSplitLayout>
+class BasicFFBtreeIterator {
 public:
-  FFBtreeIterator(FFBtree* b);
+  typedef BasicFFBtree<kPageSize, kSplitLayout> Tree;
+  typedef typename Tree::Page Page;
+
+  BasicFFBtreeIterator(Tree* b);
 
   bool Valid() const;
 
@@ -26,12 +30,10 @@ public:
   void* value() const;
 
 private:
-  FFBtree* btree;
-  Entry* cur;
+  Tree* btree;
   Page* cur_page;
   int index;
   bool valid; // validity of current entry
-  bool last;
 };
 
 } // namespace leveldb
@@ -1,6 +1,12 @@
+#include <map>
+#include <set>
+#include <thread>
 #include "ff_btree.h"
+#include "ff_btree_iterator.h"
+#include "string_btree_index.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
+#include "util/random.h"
 
 namespace leveldb {
 
@@ -18,6 +24,486 @@ TEST(FFBtree, Mix1) {
   }
 }
 
+TEST(FFBtree, ConcurrentRanges) {
+  FFBtree btree;
+  const int kThreads = 4;
+  const int kPerThread = 20000;
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; t++) {
+    writers.emplace_back([&btree, t] {
+      for (int i = t * kPerThread + 1; i <= (t + 1) * kPerThread; i++) {
+        btree.Insert(i, (void*)(uintptr_t)i);
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  for (int i = 1; i <= kThreads * kPerThread; i++) {
+    ASSERT_EQ(btree.Search(i), (void*)(uintptr_t)i);
+  }
+  FFBtreeIterator* iter = btree.GetIterator();
+  for (int i = 1; i <= kThreads * kPerThread; i++) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key(), i);
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+TEST(FFBtree, BulkInsertSorted) {
+  FFBtree btree;
+  std::vector<FFBtree::BulkEntry> entries;
+  for (uintptr_t i = 2; i <= 20000; i += 2) {
+    entries.push_back({i, (void*)i, nullptr});
+  }
+  btree.BulkInsertSorted(entries.data(), entries.data() + entries.size());
+  ASSERT_TRUE(!btree.Empty());
+
+  // fill the gaps and overwrite every tenth key of the bulk built tree
+  entries.clear();
+  for (uintptr_t i = 1; i <= 20001; i++) {
+    if (i % 2 == 1 || i % 20 == 0) {
+      entries.push_back({i, (void*)(i + 100000), nullptr});
+    }
+  }
+  btree.BulkInsertSorted(entries.data(), entries.data() + entries.size());
+  for (const FFBtree::BulkEntry& entry : entries) {
+    ASSERT_EQ(entry.old_value, entry.key % 20 == 0 ? (void*)entry.key : nullptr);
+  }
+
+  FFBtreeIterator* iter = btree.GetIterator();
+  for (uintptr_t i = 1; i <= 20001; i++) {
+    void* expected = (void*)(i % 2 == 1 || i % 20 == 0 ? i + 100000 : i);
+    ASSERT_EQ(btree.Search(i), expected);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key(), i);
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+TEST(FFBtree, BulkInsertLoneLastChild) {
+  // sizes around one leaf more than the inner pages fill up with
+  const int fill = (FFBtree::Page::cardinality - 1) * 3 / 4;
+  for (int pages = 1; pages <= 3; pages++) {
+    for (int extra = -1; extra <= 1; extra++) {
+      FFBtree btree;
+      std::vector<FFBtree::BulkEntry> entries;
+      uintptr_t n = fill * (fill + 1) * pages + extra + fill;
+      for (uintptr_t i = 1; i <= n; i++) {
+        entries.push_back({i, (void*)i, nullptr});
+      }
+      btree.BulkInsertSorted(entries.data(), entries.data() + entries.size());
+      for (uintptr_t i = 1; i <= n; i++) {
+        ASSERT_EQ(btree.Search(i), (void*)i);
+      }
+    }
+  }
+}
+
+TEST(FFBtree, AscendingSearch) {
+  FFBtree btree;
+  for (uintptr_t i = 10; i <= 100000; i += 10) {
+    btree.Insert(i, (void*)i);
+  }
+  // small steps stay in the leaf, large ones go back to the root
+  void* leaf = nullptr;
+  for (uintptr_t i = 1; i <= 100010; i += (i % 1000 == 1) ? 997 : 3) {
+    ASSERT_EQ(btree.Search(i, &leaf), i % 10 == 0 ? (void*)i : nullptr);
+  }
+
+  // keys inserted behind the cursor's leaf split it to the right
+  std::thread writer([&btree] {
+    for (uintptr_t i = 5; i <= 100000; i += 10) {
+      btree.Insert(i, (void*)i);
+    }
+  });
+  leaf = nullptr;
+  for (uintptr_t i = 10; i <= 100000; i += 10) {
+    ASSERT_EQ(btree.Search(i, &leaf), (void*)i);
+  }
+  writer.join();
+  leaf = nullptr;
+  for (uintptr_t i = 5; i <= 100000; i += 5) {
+    ASSERT_EQ(btree.Search(i, &leaf), (void*)i);
+  }
+}
+
+TEST(FFBtree, PageSearchModes) {
+  FFBtree btree;
+  Random rnd(301);
+  std::vector<uint64_t> keys;
+  for (int i = 0; i < 5000; i++) {
+    // large keys check that the kernels compare unsigned
+    uint64_t key = (static_cast<uint64_t>(rnd.Next()) << 33) | i;
+    keys.push_back(key);
+    btree.Insert(key, (void*)(uintptr_t)(i + 1));
+  }
+  for (PageSearchMode mode : {kScalarPageSearch, kSse42PageSearch, kAvx2PageSearch}) {
+    if (!SetPageSearchMode(mode)) continue;
+    for (int i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(btree.Search(keys[i]), (void*)(uintptr_t)(i + 1));
+      ASSERT_TRUE(btree.Search(keys[i] + (1ull << 32)) == nullptr);
+    }
+  }
+}
+
+template <int kPageSize, bool kSplitLayout>
+static void CheckPageLayout() {
+  BasicFFBtree<kPageSize, kSplitLayout> btree;
+  Random rnd(kPageSize + kSplitLayout);
+  std::map<uint64_t, void*> expected;
+  for (int i = 0; i < 20000; i++) {
+    uint64_t key = (static_cast<uint64_t>(rnd.Next()) << 32) | rnd.Next();
+    expected[key] = (void*)(uintptr_t)(i + 1);
+    btree.Insert(key, expected[key]);
+  }
+  for (PageSearchMode mode : {kScalarPageSearch, kSse42PageSearch, kAvx2PageSearch}) {
+    if (!SetPageSearchMode(mode)) continue;
+    for (const auto& entry : expected) {
+      ASSERT_EQ(btree.Search(entry.first), entry.second);
+      if (expected.count(entry.first + 1) == 0) {
+        ASSERT_TRUE(btree.Search(entry.first + 1) == nullptr);
+      }
+    }
+  }
+  BasicFFBtreeIterator<kPageSize, kSplitLayout>* iter = btree.GetIterator();
+  for (const auto& entry : expected) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key(), entry.first);
+    ASSERT_EQ(iter->value(), entry.second);
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+TEST(FFBtree, PageLayouts) {
+  CheckPageLayout<256, false>();
+  CheckPageLayout<256, true>();
+  CheckPageLayout<512, true>();
+  CheckPageLayout<1024, false>();
+  CheckPageLayout<1024, true>();
+  CheckPageLayout<4096, false>();
+  CheckPageLayout<4096, true>();
+}
+
+TEST(FFBtree, DramInnerNodes) {
+  FFBtree btree;
+  btree.SetDramInnerNodes(true);
+  Random rnd(17);
+  std::map<uint64_t, void*> expected;
+  for (int i = 0; i < 50000; i++) {
+    uint64_t key = rnd.Next();
+    expected[key] = (void*)(uintptr_t)(i + 1);
+    btree.Insert(key, expected[key]);
+  }
+  // a restart loses the DRAM pages, only the leaf chain is left
+  btree.RebuildInnerLevels();
+  for (int i = 0; i < 1000; i++) {
+    uint64_t key = rnd.Next();
+    expected[key] = (void*)(uintptr_t)(i + 100001);
+    btree.Insert(key, expected[key]);
+  }
+  for (int round = 0; round < 2; round++) {
+    for (const auto& entry : expected) {
+      ASSERT_EQ(btree.Search(entry.first), entry.second);
+    }
+    FFBtreeIterator* iter = btree.GetIterator();
+    for (const auto& entry : expected) {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(iter->key(), entry.first);
+      iter->Next();
+    }
+    ASSERT_TRUE(!iter->Valid());
+    delete iter;
+    btree.SetDramInnerNodes(false);
+  }
+}
+
+TEST(FFBtree, IterateSingleEntry) {
+  FFBtree btree;
+  FFBtreeIterator* iter = btree.GetIterator();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+  btree.Insert(7, (void*)7);
+  iter = btree.GetIterator();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key(), 7);
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  delete iter;
+}
+
+TEST(FFBtree, SampleRange) {
+  FFBtree btree;
+  for (uintptr_t i = 1; i <= 10000; i++) {
+    btree.Insert(i, (void*)i);
+  }
+  std::vector<void*> samples;
+  ASSERT_EQ(btree.SampleRange(1001, 3001, 1, &samples), 2000);
+  ASSERT_EQ(samples.size(), 2000);
+  for (void* value : samples) {
+    ASSERT_TRUE((uintptr_t)value >= 1001 && (uintptr_t)value < 3001);
+  }
+
+  // other leaves are only counted
+  samples.clear();
+  ASSERT_EQ(btree.SampleRange(1001, 3001, 8, &samples), 2000);
+  ASSERT_TRUE(!samples.empty() && samples.size() < 2000);
+
+  samples.clear();
+  ASSERT_EQ(btree.SampleRange(20000, 30000, 8, &samples), 0);
+  ASSERT_EQ(btree.SampleRange(0, 20000, 8, &samples), 10000);
+}
+
+TEST(FFBtree, RemoveRange) {
+  FFBtree btree;
+  for (uintptr_t i = 1; i <= 10000; i++) {
+    btree.Insert(i, (void*)i);
+  }
+  std::vector<void*> removed;
+  ASSERT_EQ(btree.RemoveRange(1001, 3001, &removed), 2000);
+  ASSERT_EQ(removed.size(), 2000);
+  for (void* value : removed) {
+    ASSERT_TRUE((uintptr_t)value >= 1001 && (uintptr_t)value < 3001);
+  }
+  for (uintptr_t i = 1; i <= 10000; i++) {
+    void* value = btree.Search(i);
+    ASSERT_TRUE(i >= 1001 && i < 3001 ? value == nullptr : value == (void*)i);
+  }
+
+  // emptied leaves take keys again, in order
+  for (uintptr_t i = 2000; i < 2100; i++) {
+    btree.Insert(i, (void*)i);
+  }
+  FFBtreeIterator* iter = btree.GetIterator();
+  uintptr_t count = 0;
+  entry_key_t last = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    ASSERT_TRUE(iter->key() > last);
+    last = iter->key();
+    count++;
+  }
+  ASSERT_EQ(count, 8100);
+  delete iter;
+
+  removed.clear();
+  ASSERT_EQ(btree.RemoveRange(0, 20000, &removed), 8100);
+  ASSERT_TRUE(btree.Search(5000) == nullptr);
+}
+
+class TestStringIndex : public StringBtreeIndex {
+public:
+  explicit TestStringIndex(VersionEdit* edit) { edit_ = edit; }
+
+  void Add(const std::string& key, uint16_t file_number) {
+    Add(key, std::make_shared<IndexMeta>(0, 0, file_number));
+  }
+
+  void Add(const std::string& key, const std::shared_ptr<IndexMeta>& meta) {
+    KeyAndMeta key_meta;
+    key_meta.key = EntryKey(key);
+    key_meta.user_key = key;
+    key_meta.meta = meta;
+    Insert(key_meta, &context_);
+  }
+
+  // Returns the number of entries counted as dead
+  uint64_t Remove(const std::string& start, const std::string& limit) {
+    InsertContext context;
+    RemoveRange(start, limit, &context);
+    uint64_t dead = 0;
+    for (const auto& file : context.dead_keys) dead += file.second;
+    return dead;
+  }
+
+  // Applies the file count changes of the keys added so far
+  void ApplyLocality() {
+    ApplyLocalityChanges(&context_.locality_changes);
+    context_.locality_changes.clear();
+  }
+
+  FFBtree* root() { return tree_; }
+
+private:
+  InsertContext context_;
+};
+
+TEST(FFBtree, StringKeys) {
+  VersionEdit edit;
+  edit.AllocateRecoveryList(64);
+  TestStringIndex index(&edit);
+  std::set<std::string> keys = {
+    "", "a", "ab", std::string("ab\0", 3), "abcdefg", "abcdefgh",
+    "abcdefghijklmnopqrstu", "abcdefghijklmnopqrstuv", "abcdefgz", "b"
+  };
+  for (uint64_t i = 0; i < 16; i++) {
+    std::string key("tenant01");
+    for (int b = 7; b >= 0; b--) key.push_back(static_cast<char>(i >> (8 * b)));
+    keys.insert(key);
+  }
+  uint16_t file_number = 1;
+  for (const std::string& key : keys) {
+    index.Add(key, file_number++);
+  }
+  index.Add("abcdefgh", 100); // overwrite
+
+  file_number = 1;
+  for (const std::string& key : keys) {
+    IndexMeta* meta = index.Get(key);
+    ASSERT_TRUE(meta != nullptr);
+    ASSERT_EQ(meta->file_number, key == "abcdefgh" ? 100 : file_number);
+    file_number++;
+  }
+  ASSERT_TRUE(index.Get("abcdefgha") == nullptr);
+  ASSERT_TRUE(index.Get("tenant0") == nullptr);
+
+  StringBtreeIterator iter(index.root());
+  iter.SeekToFirst();
+  for (const std::string& key : keys) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(iter.key().ToString(), key);
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+
+  iter.Seek("abcdefgi");
+  ASSERT_TRUE(iter.Valid());
+  ASSERT_EQ(iter.key().ToString(), "abcdefgz");
+  iter.Seek("abcdefgha");
+  ASSERT_EQ(iter.key().ToString(), "abcdefghijklmnopqrstu");
+  iter.Seek("c");
+  ASSERT_EQ(iter.key().ToString(), *keys.lower_bound("c"));
+  iter.Seek("u");
+  ASSERT_TRUE(!iter.Valid());
+
+  // the bounds share slices with the keys on both sides of them
+  ASSERT_EQ(index.Remove("abcdefg", "abcdefghijklmnopqrstuv"), 3);
+  ASSERT_EQ(index.Remove("tenant01", std::string("tenant01\0\0\0\0\0\0\0\x08", 16)), 8);
+  for (const std::string& key : keys) {
+    bool removed = (key >= "abcdefg" && key < "abcdefghijklmnopqrstuv") ||
+                   (key.compare(0, 8, "tenant01") == 0 && key[15] < 8);
+    ASSERT_EQ(index.Get(key) == nullptr, removed);
+  }
+  iter.Seek("abcdef");
+  ASSERT_EQ(iter.key().ToString(), "abcdefghijklmnopqrstuv");
+  index.Add("abcdefgh", 101);
+  ASSERT_EQ(index.Get("abcdefgh")->file_number, 101);
+}
+
+TEST(FFBtree, LocalityWindow) {
+  VersionEdit edit;
+  edit.AllocateRecoveryList(64);
+  TestStringIndex index(&edit);
+  char key[16];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(key, sizeof(key), "key%06d", i);
+    index.Add(key, 1 + i / 2000);
+  }
+  index.ApplyLocality();
+
+  // walks the index the first time
+  std::string cursor;
+  uint64_t entries = 0;
+  std::set<uint16_t> files;
+  uint64_t deadline = Env::Default()->NowMicros() + 60000000;
+  ASSERT_TRUE(index.LocalityWindow(&cursor, 100000, Env::Default(), deadline, &entries, &files));
+  ASSERT_EQ(entries, 20000);
+  ASSERT_EQ(files.size(), 10);
+  ASSERT_TRUE(cursor.empty());
+
+  // a window ends after the segment that fills it
+  entries = 0;
+  files.clear();
+  ASSERT_TRUE(index.LocalityWindow(&cursor, 1, Env::Default(), deadline, &entries, &files));
+  ASSERT_TRUE(!cursor.empty());
+  ASSERT_EQ(files.size(), 1 + (entries - 1) / 2000);
+  ASSERT_TRUE(files.count(1) == 1);
+
+  // overwrites move entries between files without another walk
+  for (int i = 0; i < 2000; i++) {
+    snprintf(key, sizeof(key), "key%06d", i);
+    index.Add(key, 50);
+  }
+  index.ApplyLocality();
+  cursor.clear();
+  entries = 0;
+  files.clear();
+  ASSERT_TRUE(index.LocalityWindow(&cursor, 100000, Env::Default(), deadline, &entries, &files));
+  ASSERT_EQ(entries, 20000);
+  ASSERT_EQ(files.size(), 10);
+  ASSERT_TRUE(files.count(1) == 0);
+  ASSERT_TRUE(files.count(50) == 1);
+
+  // an expired budget leaves the window open
+  cursor.clear();
+  entries = 0;
+  files.clear();
+  ASSERT_TRUE(!index.LocalityWindow(&cursor, 100000, Env::Default(), 0, &entries, &files));
+  ASSERT_EQ(entries, 0);
+}
+
+TEST(FFBtree, SharedBlockMeta) {
+  VersionEdit edit;
+  edit.AllocateRecoveryList(64);
+  TestStringIndex index(&edit);
+  std::shared_ptr<IndexMeta> block = std::make_shared<IndexMeta>(0, 100, 1);
+  index.Add("k1", block);
+  index.Add("k2", block);
+  index.Add("k3", block);
+  IndexMeta* meta = index.Get("k1");
+  ASSERT_TRUE(meta == index.Get("k2"));
+  ASSERT_TRUE(meta == index.Get("k3"));
+  ASSERT_EQ(meta->refs, 3);
+
+  // overwrite from the next file
+  std::shared_ptr<IndexMeta> next = std::make_shared<IndexMeta>(0, 100, 2);
+  index.Add("k1", next);
+  index.Add("k2", next);
+  ASSERT_EQ(meta->refs, 1);
+  ASSERT_EQ(index.Get("k3")->file_number, 1);
+  ASSERT_EQ(index.Get("k1")->file_number, 2);
+  ASSERT_EQ(index.Get("k1")->refs, 2);
+}
+
+// Queues one entry for key and waits until the index applied it
+static void Apply(BtreeIndex* index, const std::string& key, uint16_t file_number) {
+  VersionEdit edit;
+  std::deque<KeyAndMeta> queue(1);
+  queue[0].key = index->EntryKey(key);
+  queue[0].meta = std::make_shared<IndexMeta>(0, 100, file_number);
+  index->AddQueue(queue, &edit);
+  edit.Wait();
+}
+
+TEST(FFBtree, ReadKeepsRetiredMetas) {
+  BtreeIndex* index = new BtreeIndex;  // its runner is never stopped
+  char key[32];
+  snprintf(key, sizeof(key), config::key_format, 7ul);
+  Apply(index, key, 1);
+  const int ticket = index->BeginRead();
+  IndexMeta* meta = index->Get(key);
+  ASSERT_EQ(meta->file_number, 1);
+
+  // the batches after the one that replaced it keep it for the read
+  for (uint16_t file_number = 2; file_number <= 5; file_number++) {
+    Apply(index, key, file_number);
+  }
+  ASSERT_EQ(meta->file_number, 1);
+  ASSERT_EQ(index->TEST_RetiredMetas(), 4);
+  ASSERT_EQ(index->Get(key)->file_number, 5);
+
+  // once the read is done, only the last one waits for reads after it
+  index->EndRead(ticket);
+  Apply(index, key, 6);
+  Apply(index, key, 7);
+  ASSERT_EQ(index->TEST_RetiredMetas(), 1);
+}
+
 }
 
 int main() {
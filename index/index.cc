@@ -1,10 +1,12 @@
 #include "leveldb/index.h"
 #include "btree_index.h"
+#include "string_btree_index.h"
 
 namespace leveldb {
 
 bool IsEqual(const IndexMeta* lhs, const IndexMeta* rhs) {
   if (lhs == nullptr || rhs == nullptr) return false;
+  if (lhs == rhs) return true; // entries of the same block share their meta
   if (lhs->file_number != rhs->file_number) return false;
   if (lhs->offset != rhs->offset) return false;
   if (lhs->size != rhs->size) return false;
@@ -15,4 +17,8 @@ Index* CreateBtreeIndex() {
   return new BtreeIndex();
 }
 
+Index* CreateStringBtreeIndex() {
+  return new StringBtreeIndex();
+}
+
 } // namespace leveldb
\ No newline at end of file
@@ -48,6 +48,7 @@ void IndexIterator::SeekToLast() {
 void IndexIterator::Seek(const Slice& target) {
   btree_iterator_->Seek(fast_atoi(ExtractUserKey(target)));
   Advance();
+  if (block_iterator_ == nullptr) return;
   block_iterator_->Seek(target);
   status_ = block_iterator_->status();
 }
@@ -105,8 +106,10 @@ void IndexIterator::CacheLookup() {
 
 void IndexIterator::Advance() {
   counter_++;
-  if (!IsEqual(index_meta_, (IndexMeta*)btree_iterator_->value())) {
-    index_meta_ = (IndexMeta*) btree_iterator_->value();
+  if (!btree_iterator_->Valid() && index_meta_ == nullptr) return; // empty index
+  IndexMeta* meta = BtreeIndex::ToMeta(btree_iterator_->value());
+  if (!IsEqual(index_meta_, meta)) {
+    index_meta_ = meta;
     uniq_files_.insert(index_meta_->file_number);
     if (counter_ % cardinality == 0 && uniq_files_.size() > files_to_merge_.size()) {
       files_to_merge_.swap(uniq_files_);
@@ -0,0 +1,503 @@
+#include <limits>
+#include <new>
+#include <stddef.h>
+#include "index/string_btree_index.h"
+#include "db/dbformat.h"
+#include "db/version_control.h"
+
+namespace leveldb {
+
+static const size_t kSliceBytes = 7;
+
+// Packs the kSliceBytes bytes of key that the layer at "depth" is responsible
+// for into the high bits and the number of remaining bytes (capped at
+// kSliceBytes + 1) into the low byte.
+static entry_key_t EncodeSlice(const Slice& key, size_t depth) {
+  size_t offset = depth * kSliceBytes;
+  assert(offset <= key.size());
+  size_t remaining = key.size() - offset;
+  entry_key_t slice = 0;
+  for (size_t i = 0; i < kSliceBytes; i++) {
+    slice = (slice << 8) | (i < remaining ? static_cast<uint8_t>(key[offset + i]) : 0);
+  }
+  return (slice << 8) | (remaining > kSliceBytes ? kSliceBytes + 1 : remaining);
+}
+
+static bool IsLayer(void* value) {
+  return (reinterpret_cast<uintptr_t>(value) & 1) != 0;
+}
+
+static FFBtree* ToLayer(void* value) {
+  return reinterpret_cast<FFBtree*>(reinterpret_cast<uintptr_t>(value) & ~uintptr_t(1));
+}
+
+static void* TagLayer(FFBtree* layer) {
+  return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(layer) | 1);
+}
+
+static FFBtree* NewLayer(bool dram_inner) {
+  FFBtree* layer = FFBtree::Create();
+  layer->SetDramInnerNodes(dram_inner);
+  clflush((char*)layer, sizeof(FFBtree));
+  return layer;
+}
+
+// Recovers the layers below layer, which has been recovered already
+static void RecoverLayers(FFBtree* layer) {
+  FFBtreeIterator* iter = layer->GetIterator();
+  for (; iter->Valid(); iter->Next()) {
+    if (IsLayer(iter->value())) {
+      FFBtree* next = ToLayer(iter->value());
+      next->Recover();
+      RecoverLayers(next);
+    }
+  }
+  delete iter;
+}
+
+static StringRecord* NewRecord(const Slice& key, IndexMeta* meta) {
+  size_t size = offsetof(StringRecord, key_data) + key.size();
+  StringRecord* record = (StringRecord*) nvram::pmalloc(size);
+  record->meta = meta;
+  record->key_size = key.size();
+  memcpy(record->key_data, key.data(), key.size());
+  clflush((char*)record, size);
+  return record;
+}
+
+IndexMeta* StringBtreeIndex::Get(const Slice& key) {
+  FFBtree* layer = tree_;
+  for (size_t depth = 0; ; depth++) {
+    void* value = layer->Search(EncodeSlice(key, depth));
+    if (value == nullptr) return nullptr;
+    if (!IsLayer(value)) {
+      StringRecord* record = (StringRecord*)value;
+      return record->key() == key ? record->meta : nullptr;
+    }
+    layer = ToLayer(value);
+  }
+}
+
+namespace {
+
+// Resumes in the first layer only, the layers below hold the few keys that
+// share a slice and are searched from their roots
+class StringCursor : public IndexCursor {
+public:
+  StringCursor(FFBtree* root, Index* index)
+      : read_(index), root_(root), leaf_(nullptr), last_slice_(0) { }
+
+  virtual IndexMeta* Get(const Slice& key) {
+    entry_key_t slice = EncodeSlice(key, 0);
+    if (slice < last_slice_) leaf_ = nullptr;
+    last_slice_ = slice;
+    void* value = root_->Search(slice, &leaf_);
+    for (size_t depth = 1; value != nullptr && IsLayer(value); depth++) {
+      value = ToLayer(value)->Search(EncodeSlice(key, depth));
+    }
+    if (value == nullptr) return nullptr;
+    StringRecord* record = (StringRecord*)value;
+    return record->key() == key ? record->meta : nullptr;
+  }
+
+private:
+  IndexReadGuard read_;
+  FFBtree* root_;
+  void* leaf_;  // first layer leaf of the previous key
+  entry_key_t last_slice_;
+};
+
+} // anonymous namespace
+
+IndexCursor* StringBtreeIndex::NewCursor() {
+  return new StringCursor(tree_, this);
+}
+
+void StringBtreeIndex::InsertRange(QueueIterator begin, QueueIterator end, InsertContext* context) {
+  for (QueueIterator it = begin; it != end; ++it) {
+    Insert(*it, context);
+  }
+}
+
+void StringBtreeIndex::Insert(const KeyAndMeta& key_meta, InsertContext* context) {
+  Slice key(key_meta.user_key);
+  if (edit_->HasMergeInputs() && !Replaces(Get(key), key_meta, context)) return;
+  IndexMeta* ptr = SharedMeta(key_meta.meta, context);
+  context->locality_changes.push_back({key_meta.user_key, ptr->file_number, 1});
+  FFBtree* layer = tree_;
+  for (size_t depth = 0; ; depth++) {
+    entry_key_t slice = EncodeSlice(key, depth);
+    void* value = layer->Search(slice);
+    if (value == nullptr) {
+      layer->Insert(slice, NewRecord(key, ptr));
+      return;
+    }
+    if (IsLayer(value)) {
+      layer = ToLayer(value);
+      continue;
+    }
+    StringRecord* record = (StringRecord*)value;
+    if (record->key() == key) {
+      IndexMeta* old_ptr = record->meta;
+      record->meta = ptr;
+      clflush((char*)&record->meta, sizeof(IndexMeta*));
+      context->locality_changes.push_back({key_meta.user_key, old_ptr->file_number, -1});
+      ReleaseMeta(old_ptr, context);
+      return;
+    }
+    // both keys continue past this slice, push the record one layer down.
+    // keys sharing the first slice go to the same thread, so no other
+    // writer can be working on this layer.
+    // readers see either the record or the complete new layer.
+    FFBtree* next = NewLayer(tree_->DramInnerNodes());
+    next->Insert(EncodeSlice(record->key(), depth + 1), record);
+    layer->Insert(slice, TagLayer(next));
+    layer = next;
+  }
+}
+
+void StringBtreeIndex::Attach(void* persistent_root) {
+  BtreeIndex::Attach(persistent_root);
+  RecoverLayers(tree_);
+}
+
+entry_key_t StringBtreeIndex::EntryKey(const Slice& key) const {
+  return EncodeSlice(key, 0);
+}
+
+void StringBtreeIndex::ScanFiles(std::string* cursor, uint64_t count, std::set<uint16_t>* files) {
+  IndexReadGuard read(this);
+  StringBtreeIterator iter(tree_);
+  iter.Seek(*cursor);
+  if (!iter.Valid()) {
+    iter.SeekToFirst();
+  }
+  for (uint64_t i = 0; i < count && iter.Valid(); i++) {
+    files->insert(iter.value()->file_number);
+    iter.Next();
+  }
+  cursor->clear();
+  if (iter.Valid()) {
+    cursor->assign(iter.key().data(), iter.key().size());
+  }
+}
+
+double StringBtreeIndex::ValueBytes(void* value) {
+  if (!IsLayer(value)) {
+    return EntryBytes(((StringRecord*)value)->meta);
+  }
+  double bytes = 0;
+  FFBtreeIterator* iter = ToLayer(value)->GetIterator();
+  for (; iter->Valid(); iter->Next()) {
+    bytes += ValueBytes(iter->value());
+  }
+  delete iter;
+  return bytes;
+}
+
+void StringBtreeIndex::ScanSegment(const std::string& start, LocalitySegment* segment) {
+  IndexReadGuard read(this);
+  StringBtreeIterator iter(tree_);
+  iter.Seek(start);
+  while (segment->entries < config::LocalitySegmentEntries && iter.Valid()) {
+    segment->entries++;
+    segment->files[iter.value()->file_number]++;
+    iter.Next();
+  }
+  segment->to_end = !iter.Valid();
+  if (iter.Valid()) {
+    segment->limit = iter.key().ToString();
+  }
+}
+
+uint64_t StringBtreeIndex::ApproximateSize(const Slice& start, const Slice& limit) {
+  IndexReadGuard read(this);
+  return static_cast<uint64_t>(RangeBytes(tree_, 0, &start, &limit));
+}
+
+double StringBtreeIndex::RangeBytes(FFBtree* layer, size_t depth,
+                                    const Slice* start, const Slice* limit) {
+  entry_key_t lo = start != nullptr ? EncodeSlice(*start, depth) : 0;
+  entry_key_t hi = limit != nullptr ? EncodeSlice(*limit, depth)
+                                    : std::numeric_limits<entry_key_t>::max();
+  if (lo > hi) return 0;
+  double bytes = 0;
+  if (start != nullptr) {
+    bytes += EdgeBytes(layer->Search(lo), depth, start, lo == hi ? limit : nullptr);
+  }
+  if (limit != nullptr && (start == nullptr || lo != hi)) {
+    bytes += EdgeBytes(layer->Search(hi), depth, nullptr, limit);
+  }
+  // no slice is the maximum, so lo + 1 does not wrap
+  entry_key_t from = start != nullptr ? lo + 1 : lo;
+  if (from < hi) {
+    std::vector<void*> samples;
+    uint64_t entries = layer->SampleRange(from, hi, config::ApproximateSizeSampleStride, &samples);
+    if (!samples.empty()) {
+      double sampled = 0;
+      for (void* value : samples) {
+        sampled += ValueBytes(value);
+      }
+      bytes += sampled * entries / samples.size();
+    }
+  }
+  return bytes;
+}
+
+double StringBtreeIndex::EdgeBytes(void* value, size_t depth,
+                                   const Slice* start, const Slice* limit) {
+  if (value == nullptr) return 0;
+  if (IsLayer(value)) {
+    // keys below a layer go on past its slice, and so does the bound
+    return RangeBytes(ToLayer(value), depth + 1, start, limit);
+  }
+  StringRecord* record = (StringRecord*)value;
+  if ((start != nullptr && record->key().compare(*start) < 0) ||
+      (limit != nullptr && record->key().compare(*limit) >= 0)) {
+    return 0;
+  }
+  return EntryBytes(record->meta);
+}
+
+void StringBtreeIndex::RemoveRange(const Slice& start, const Slice& limit, InsertContext* context) {
+  RemoveLayerRange(tree_, 0, &start, &limit, context);
+}
+
+void StringBtreeIndex::RemoveLayerRange(FFBtree* layer, size_t depth,
+                                        const Slice* start, const Slice* limit,
+                                        InsertContext* context) {
+  entry_key_t lo = start != nullptr ? EncodeSlice(*start, depth) : 0;
+  entry_key_t hi = limit != nullptr ? EncodeSlice(*limit, depth)
+                                    : std::numeric_limits<entry_key_t>::max();
+  if (lo > hi) return;
+  if (start != nullptr) {
+    RemoveEdge(layer, lo, depth, start, lo == hi ? limit : nullptr, context);
+  }
+  if (limit != nullptr && (start == nullptr || lo != hi)) {
+    RemoveEdge(layer, hi, depth, nullptr, limit, context);
+  }
+  entry_key_t from = start != nullptr ? lo + 1 : lo;
+  if (from < hi) {
+    std::vector<void*> removed;
+    layer->RemoveRange(from, hi, &removed);
+    for (void* value : removed) {
+      Retire(value, context);
+    }
+  }
+}
+
+void StringBtreeIndex::RemoveEdge(FFBtree* layer, entry_key_t slice, size_t depth,
+                                  const Slice* start, const Slice* limit,
+                                  InsertContext* context) {
+  void* value = layer->Search(slice);
+  if (value == nullptr) return;
+  if (IsLayer(value)) {
+    RemoveLayerRange(ToLayer(value), depth + 1, start, limit, context);
+    return;
+  }
+  StringRecord* record = (StringRecord*)value;
+  if ((start != nullptr && record->key().compare(*start) < 0) ||
+      (limit != nullptr && record->key().compare(*limit) >= 0)) {
+    return;
+  }
+  std::vector<void*> removed;
+  layer->RemoveRange(slice, slice + 1, &removed);
+  for (void* removed_value : removed) {
+    Retire(removed_value, context);
+  }
+}
+
+void StringBtreeIndex::Retire(void* value, InsertContext* context) {
+  if (IsLayer(value)) {
+    FFBtreeIterator* iter = ToLayer(value)->GetIterator();
+    for (; iter->Valid(); iter->Next()) {
+      Retire(iter->value(), context);
+    }
+    delete iter;
+  } else {
+    ReleaseMeta(((StringRecord*)value)->meta, context);
+  }
+  context->retired_values.push_back(value);
+}
+
+void StringBtreeIndex::FreeValue(void* value) {
+  if (IsLayer(value)) {
+    FFBtree::Destroy(ToLayer(value));
+  } else {
+    nvram::pfree(value);
+  }
+}
+
+StringBtreeIterator::StringBtreeIterator(FFBtree* root) : root_(root) { }
+
+StringBtreeIterator::~StringBtreeIterator() {
+  for (FFBtreeIterator* iter : stack_) delete iter;
+}
+
+StringRecord* StringBtreeIterator::record() const {
+  assert(Valid());
+  return (StringRecord*)stack_.back()->value();
+}
+
+void StringBtreeIterator::SeekToFirst() {
+  for (FFBtreeIterator* iter : stack_) delete iter;
+  stack_.clear();
+  stack_.push_back(root_->GetIterator());
+  Settle();
+}
+
+void StringBtreeIterator::Seek(const Slice& target) {
+  for (FFBtreeIterator* iter : stack_) delete iter;
+  stack_.clear();
+  FFBtree* layer = root_;
+  for (size_t depth = 0; ; depth++) {
+    entry_key_t slice = EncodeSlice(target, depth);
+    FFBtreeIterator* iter = layer->GetIterator();
+    stack_.push_back(iter);
+    iter->Seek(slice);
+    if (!iter->Valid() || iter->key() != slice || !IsLayer(iter->value())) break;
+    layer = ToLayer(iter->value());
+  }
+  Settle();
+  // a single record may share the last slice with target and still be smaller
+  while (Valid() && key().compare(target) < 0) {
+    Next();
+  }
+}
+
+void StringBtreeIterator::Next() {
+  assert(Valid());
+  stack_.back()->Next();
+  Settle();
+}
+
+void StringBtreeIterator::Settle() {
+  while (!stack_.empty()) {
+    FFBtreeIterator* iter = stack_.back();
+    if (!iter->Valid()) {
+      delete iter;
+      stack_.pop_back();
+      if (!stack_.empty()) stack_.back()->Next();
+    } else if (IsLayer(iter->value())) {
+      stack_.push_back(ToLayer(iter->value())->GetIterator());
+    } else {
+      return;
+    }
+  }
+}
+
+namespace {
+
+// Same as IndexIterator but ordered by the full user keys of the index
+class StringIndexIterator : public Iterator {
+public:
+  StringIndexIterator(const ReadOptions& options, FFBtree* root, TableCache* table_cache, VersionControl* vcontrol)
+    : options_(options),
+      iter_(root),
+      table_cache_(table_cache),
+      vcontrol_(vcontrol),
+      block_iterator_(nullptr),
+      index_meta_(nullptr),
+      counter_(0) {
+    SeekToFirst();
+  }
+
+  ~StringIndexIterator() {
+    if (files_to_merge_.size() > config::ScanCheckMinFileNumber &&
+        vcontrol_->current()->MoveToMerge(files_to_merge_, true)) {
+      vcontrol_->StateChange();
+    }
+    delete block_iterator_;
+  }
+
+  virtual bool Valid() const {
+    return iter_.Valid() && block_iterator_ != nullptr && block_iterator_->Valid();
+  }
+
+  virtual void SeekToFirst() {
+    iter_.SeekToFirst();
+    Advance();
+  }
+
+  virtual void SeekToLast() {
+    // not implemented
+  }
+
+  virtual void Seek(const Slice& target) {
+    iter_.Seek(ExtractUserKey(target));
+    Advance();
+  }
+
+  virtual void Next() {
+    assert(iter_.Valid());
+    iter_.Next();
+    Advance();
+  }
+
+  virtual void Prev() {
+    // not implemented
+  }
+
+  virtual Slice key() const { return block_iterator_->key(); }
+
+  virtual Slice value() const { return block_iterator_->value(); }
+
+  virtual Status status() const {
+    if (block_iterator_ != nullptr && !block_iterator_->status().ok()) {
+      return block_iterator_->status();
+    }
+    return status_;
+  }
+
+private:
+  // Positions the block iterator on the entry of the current index key
+  void Advance() {
+    if (!iter_.Valid()) return;
+    counter_++;
+    IndexMeta* meta = iter_.value();
+    if (!IsEqual(index_meta_, meta)) {
+      index_meta_ = meta;
+      uniq_files_.insert(index_meta_->file_number);
+      if (counter_ % cardinality == 0 && uniq_files_.size() > files_to_merge_.size()) {
+        files_to_merge_.swap(uniq_files_);
+        uniq_files_.clear();
+      }
+      delete block_iterator_;
+      block_iterator_ = nullptr;
+      status_ = table_cache_->GetBlockIterator(options_, index_meta_, &block_iterator_);
+      if (!status_.ok()) return; // something went wrong
+      InternalKey target(iter_.key(), kMaxSequenceNumber, kValueTypeForSeek);
+      block_iterator_->Seek(target.Encode());
+    } else {
+      while (block_iterator_->Valid() &&
+             ExtractUserKey(block_iterator_->key()).compare(iter_.key()) < 0) {
+        block_iterator_->Next();
+      }
+    }
+    if (!block_iterator_->Valid() || ExtractUserKey(block_iterator_->key()) != iter_.key()) {
+      status_ = Status::NotFound(iter_.key());
+    }
+  }
+
+  ReadOptions options_;
+  StringBtreeIterator iter_;
+  TableCache* table_cache_;
+  VersionControl* vcontrol_;
+  Iterator* block_iterator_;
+  IndexMeta* index_meta_;
+  std::set<uint16_t> uniq_files_;
+  std::set<uint16_t> files_to_merge_;
+  Status status_;
+  int counter_;
+};
+
+} // anonymous namespace
+
+Iterator* StringBtreeIndex::NewIterator(const ReadOptions& options, TableCache* table_cache, VersionControl* vcontrol) {
+  const int ticket = BeginRead();
+  Iterator* iter = new StringIndexIterator(options, tree_, table_cache, vcontrol);
+  iter->RegisterCleanup(&EndReadCleanup, this, reinterpret_cast<void*>(static_cast<intptr_t>(ticket)));
+  return iter;
+}
+
+} // namespace leveldb
@@ -0,0 +1,113 @@
+#ifndef STORAGE_LEVELDB_INDEX_STRING_BTREE_INDEX_H_
+#define STORAGE_LEVELDB_INDEX_STRING_BTREE_INDEX_H_
+
+#include <set>
+#include <string>
+#include <vector>
+#include "leveldb/iterator.h"
+#include "index/btree_index.h"
+#include "index/ff_btree_iterator.h"
+
+namespace leveldb {
+
+// Index over arbitrary byte-string keys built from layers of FFBtrees.  Each
+// layer indexes the next 7 bytes of the key packed into an entry_key_t
+// together with the number of bytes left (8 meaning "more than 7"), so the
+// integer order of the slices matches the bytewise order of the keys.
+// A leaf value is either a StringRecord holding the full key, or a tagged
+// pointer to the next layer once two keys share the same slice.
+class StringBtreeIndex : public BtreeIndex {
+public:
+  StringBtreeIndex() = default;
+
+  virtual IndexMeta* Get(const Slice& key);
+
+  virtual IndexCursor* NewCursor();
+
+  virtual Iterator* NewIterator(const ReadOptions& options, TableCache* table_cache, VersionControl* vcontrol);
+
+  virtual entry_key_t EntryKey(const Slice& key) const;
+
+  virtual bool UsesFullKeys() const { return true; }
+
+  virtual void ScanFiles(std::string* cursor, uint64_t count, std::set<uint16_t>* files);
+
+  virtual uint64_t ApproximateSize(const Slice& start, const Slice& limit);
+
+  virtual void Attach(void* persistent_root);
+
+protected:
+  virtual void InsertRange(QueueIterator begin, QueueIterator end, InsertContext* context);
+
+  // Records differ per key, so entries go in one at a time
+  void Insert(const KeyAndMeta& key_meta, InsertContext* context);
+
+  // A layer counts with all the records below it
+  virtual double ValueBytes(void* value);
+
+  virtual std::string SegmentKey(const Slice& user_key) const { return user_key.ToString(); }
+  virtual void ScanSegment(const std::string& start, LocalitySegment* segment);
+
+  virtual void RemoveRange(const Slice& start, const Slice& limit, InsertContext* context);
+
+  // Records and whole layers are taken out of the tree
+  virtual void FreeValue(void* value);
+
+private:
+  // Estimate for the keys of layer, at depth, in [*start, *limit), a null
+  // bound leaving that side open.  The slices of the bounds may hold keys
+  // on both sides of them and are looked at exactly, the ones in between
+  // are sampled.
+  double RangeBytes(FFBtree* layer, size_t depth, const Slice* start, const Slice* limit);
+  // The part of the leaf value in the slice of a bound that is in range
+  double EdgeBytes(void* value, size_t depth, const Slice* start, const Slice* limit);
+
+  // Same walk as RangeBytes, removing the keys of layer in [*start, *limit).
+  // Layers at the bounds stay in place, possibly empty, the ones in between
+  // go with their records.
+  void RemoveLayerRange(FFBtree* layer, size_t depth, const Slice* start, const Slice* limit,
+                        InsertContext* context);
+  void RemoveEdge(FFBtree* layer, entry_key_t slice, size_t depth,
+                  const Slice* start, const Slice* limit, InsertContext* context);
+  // Counts the records of a removed leaf value as dead and retires it
+  void Retire(void* value, InsertContext* context);
+};
+
+// Full key and index entry stored in persistent memory
+struct StringRecord {
+  IndexMeta* meta;
+  uint32_t key_size;
+  char key_data[1];
+
+  Slice key() const { return Slice(key_data, key_size); }
+};
+
+// Walks the records of a StringBtreeIndex in key order
+class StringBtreeIterator {
+public:
+  explicit StringBtreeIterator(FFBtree* root);
+  ~StringBtreeIterator();
+
+  bool Valid() const { return !stack_.empty(); }
+  void SeekToFirst();
+  void Seek(const Slice& target);
+  void Next();
+
+  Slice key() const { return record()->key(); }
+  IndexMeta* value() const { return record()->meta; }
+
+private:
+  StringRecord* record() const;
+  // Descends into layers and pops exhausted ones until positioned on a record
+  void Settle();
+
+  FFBtree* root_;
+  std::vector<FFBtreeIterator*> stack_;
+
+  StringBtreeIterator(const StringBtreeIterator&);
+  void operator=(const StringBtreeIterator&);
+};
+
+} // namespace leveldb
+
+#endif // STORAGE_LEVELDB_INDEX_STRING_BTREE_INDEX_H_
@@ -6,8 +6,10 @@
 
 #include "table/block.h"
 
+#include <string.h>
 #include <vector>
 #include <algorithm>
+#include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "table/format.h"
 #include "util/coding.h"
@@ -15,25 +17,49 @@
 
 namespace leveldb {
 
-inline uint32_t Block::NumRestarts() const {
-  assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+inline uint32_t Block::RestartPoint(uint32_t index) const {
+  return DecodeFixed32(data_ + restart_offset_ + index * sizeof(uint32_t));
 }
 
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
-      owned_(contents.heap_allocated) {
+      num_restarts_(0),
+      num_buckets_(0),
+      owned_(contents.heap_allocated),
+      num_int_entries_(0) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (size_-sizeof(uint32_t)) / sizeof(uint32_t);
-    if (NumRestarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
+    return;
+  }
+  size_t trailer = sizeof(uint32_t);
+  num_restarts_ = DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+  if ((num_restarts_ & (kBlockHashIndexFlag | kBlockIntKeysFlag)) == kBlockIntKeysFlag) {
+    ParseIntKeys(num_restarts_ & ~kBlockIntKeysFlag);
+    num_restarts_ = 0;
+    return;
+  }
+  if ((num_restarts_ & kBlockHashIndexFlag) != 0) {
+    // Hash index between the restart array and the restart count
+    num_restarts_ &= ~kBlockHashIndexFlag;
+    trailer += sizeof(uint32_t);
+    if (size_ < trailer) {
       size_ = 0;
-    } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      return;
     }
+    num_buckets_ = DecodeFixed32(data_ + size_ - trailer);
+    if (num_buckets_ > size_ - trailer) {
+      size_ = 0;
+      return;
+    }
+    trailer += num_buckets_;
+  }
+  size_t max_restarts_allowed = (size_ - trailer) / sizeof(uint32_t);
+  if (num_restarts_ > max_restarts_allowed) {
+    // The size is too small for the number of restarts
+    size_ = 0;
+  } else {
+    restart_offset_ = size_ - trailer - num_restarts_ * sizeof(uint32_t);
   }
 }
 
@@ -43,6 +69,113 @@ Block::~Block() {
   }
 }
 
+static inline bool ValidWidth(uint32_t width) {
+  return width == 1 || width == 2 || width == 4 || width == 8;
+}
+
+// Reads a number stored in "width" bytes, see PutFixedWidth()
+static inline uint64_t DecodeFixedWidth(const char* p, int width) {
+  switch (width) {
+    case 1:
+      return static_cast<uint8_t>(p[0]);
+    case 2:
+      return static_cast<uint8_t>(p[0]) |
+             static_cast<uint64_t>(static_cast<uint8_t>(p[1])) << 8;
+    case 4:
+      return DecodeFixed32(p);
+    default:
+      return DecodeFixed64(p);
+  }
+}
+
+void Block::ParseIntKeys(uint32_t num_entries) {
+  static const size_t kTrailerSize = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+  if (num_entries == 0 || size_ < kTrailerSize) {
+    size_ = 0;
+    return;
+  }
+  const char* trailer = data_ + size_ - kTrailerSize;
+  key_base_ = DecodeFixed64(trailer);
+  tag_base_ = DecodeFixed64(trailer + sizeof(uint64_t));
+  const uint32_t widths = DecodeFixed32(trailer + 2 * sizeof(uint64_t));
+  key_width_ = widths & 0xff;
+  tag_width_ = (widths >> 8) & 0xff;
+  offset_width_ = (widths >> 16) & 0xff;
+  const uint64_t arrays_size =
+      static_cast<uint64_t>(num_entries) * (key_width_ + tag_width_ + offset_width_);
+  if (!ValidWidth(key_width_) || !ValidWidth(tag_width_) || !ValidWidth(offset_width_) ||
+      arrays_size > size_ - kTrailerSize) {
+    size_ = 0;
+    return;
+  }
+  value_offsets_ = size_ - kTrailerSize - arrays_size;
+  tags_ = value_offsets_ + num_entries * offset_width_;
+  int_keys_ = tags_ + num_entries * tag_width_;
+  num_int_entries_ = num_entries;
+}
+
+inline uint64_t Block::IntKey(uint32_t index) const {
+  return key_base_ + DecodeFixedWidth(data_ + int_keys_ + index * key_width_, key_width_);
+}
+
+inline uint64_t Block::IntTag(uint32_t index) const {
+  return tag_base_ + DecodeFixedWidth(data_ + tags_ + index * tag_width_, tag_width_);
+}
+
+// Rebuilds the internal key of entry "index" in dst[0,kIntUserKeySize+7]
+inline void Block::IntEntryKey(uint32_t index, char* dst) const {
+  FormatIntUserKey(IntKey(index), dst);
+  EncodeFixed64(dst + kIntUserKeySize, IntTag(index));
+}
+
+inline bool Block::IntValue(uint32_t index, Slice* value) const {
+  const char* offsets = data_ + value_offsets_;
+  const uint64_t start = DecodeFixedWidth(offsets + index * offset_width_, offset_width_);
+  const uint64_t limit = index + 1 < num_int_entries_
+      ? DecodeFixedWidth(offsets + (index + 1) * offset_width_, offset_width_)
+      : value_offsets_;
+  if (start > limit || limit > value_offsets_) {
+    return false;
+  }
+  *value = Slice(data_ + start, limit - start);
+  return true;
+}
+
+// Index of the first entry whose key is >= target, num_int_entries_ if
+// there is none
+uint32_t Block::IntLowerBound(const Comparator* cmp, const Slice& target) const {
+  uint32_t left = 0;
+  uint32_t right = num_int_entries_;
+  uint64_t key;
+  if (target.size() == kIntUserKeySize + 8 &&
+      ParseIntUserKey(Slice(target.data(), kIntUserKeySize), &key)) {
+    // Internal keys are ordered by user key, then by decreasing tag
+    const uint64_t tag = DecodeFixed64(target.data() + kIntUserKeySize);
+    while (left < right) {
+      const uint32_t mid = left + (right - left) / 2;
+      const uint64_t mid_key = IntKey(mid);
+      if (mid_key < key || (mid_key == key && IntTag(mid) > tag)) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+  } else {
+    // Other targets are compared with the keys rebuilt
+    char mid_key[kIntUserKeySize + 8];
+    while (left < right) {
+      const uint32_t mid = left + (right - left) / 2;
+      IntEntryKey(mid, mid_key);
+      if (cmp->Compare(Slice(mid_key, sizeof(mid_key)), target) < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+  }
+  return left;
+}
+
 // Helper routine: decode the next block entry starting at "p",
 // storing the number of shared key bytes, non_shared key bytes,
 // and the length of the value in "*shared", "*non_shared", and
@@ -253,15 +386,181 @@ class Block::Iter : public Iterator {
   }
 };
 
+// Iterator over a block with integer keys.  An entry is found by its
+// index in the arrays, so no entry has to be decoded to reach another.
+class Block::IntIter : public Iterator {
+ private:
+  const Comparator* const comparator_;
+  const Block* const block_;
+  uint32_t const num_entries_;
+
+  // current_ is the index of the current entry, num_entries_ if !Valid
+  uint32_t current_;
+  char key_[kIntUserKeySize + 8];
+  Slice value_;
+  Status status_;
+
+  void ParseEntry() {
+    if (current_ >= num_entries_) {
+      current_ = num_entries_;
+      return;
+    }
+    block_->IntEntryKey(current_, key_);
+    if (!block_->IntValue(current_, &value_)) {
+      current_ = num_entries_;
+      status_ = Status::Corruption("bad entry in block");
+      value_.clear();
+    }
+  }
+
+ public:
+  IntIter(const Comparator* comparator, const Block* block)
+      : comparator_(comparator),
+        block_(block),
+        num_entries_(block->num_int_entries_),
+        current_(num_entries_) {
+    assert(num_entries_ > 0);
+  }
+
+  virtual bool Valid() const { return current_ < num_entries_; }
+  virtual Status status() const { return status_; }
+  virtual Slice key() const {
+    assert(Valid());
+    return Slice(key_, sizeof(key_));
+  }
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    current_++;
+    ParseEntry();
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    current_ = current_ == 0 ? num_entries_ : current_ - 1;
+    ParseEntry();
+  }
+
+  virtual void Seek(const Slice& target) {
+    current_ = block_->IntLowerBound(comparator_, target);
+    ParseEntry();
+  }
+
+  virtual void SeekToFirst() {
+    current_ = 0;
+    ParseEntry();
+  }
+
+  virtual void SeekToLast() {
+    current_ = num_entries_ - 1;
+    ParseEntry();
+  }
+};
+
+Status Block::Get(const Comparator* cmp, const Slice& target, void* arg,
+                  void (*handle_result)(void*, const Slice&, const Slice&)) const {
+  if (size_ < sizeof(uint32_t)) {
+    return Status::Corruption("bad block contents");
+  }
+  if (num_int_entries_ > 0) {
+    const uint32_t index = IntLowerBound(cmp, target);
+    if (index < num_int_entries_) {
+      char key[kIntUserKeySize + 8];
+      Slice value;
+      IntEntryKey(index, key);
+      if (!IntValue(index, &value)) {
+        return Status::Corruption("bad entry in block");
+      }
+      (*handle_result)(arg, Slice(key, sizeof(key)), value);
+    }
+    return Status::OK();
+  }
+  const uint32_t num_restarts = num_restarts_;
+  if (num_restarts == 0) {
+    return Status::OK();
+  }
+  const char* limit = data_ + restart_offset_;
+
+  uint32_t left = 0;
+  uint32_t right = num_restarts - 1;
+  if (num_buckets_ > 0) {
+    // The hash index names the restart interval in which the user key
+    // first appears, or tells that it is not in the block
+    const char* buckets = limit + num_restarts * sizeof(uint32_t);
+    const uint8_t bucket = static_cast<uint8_t>(
+        buckets[BlockHashIndexHash(ExtractUserKey(target)) % num_buckets_]);
+    if (bucket == kBlockHashEmpty) {
+      return Status::OK();
+    } else if (bucket < num_restarts) {
+      left = right = bucket;
+    }
+  }
+
+  // Binary search for the last restart point with a key < target, as in
+  // Iter::Seek
+  while (left < right) {
+    uint32_t mid = (left + right + 1) / 2;
+    uint32_t shared, non_shared, value_length;
+    const char* key_ptr = DecodeEntry(data_ + RestartPoint(mid), limit,
+                                      &shared, &non_shared, &value_length);
+    if (key_ptr == nullptr || shared != 0) {
+      return Status::Corruption("bad entry in block");
+    }
+    if (cmp->Compare(Slice(key_ptr, non_shared), target) < 0) {
+      left = mid;
+    } else {
+      right = mid - 1;
+    }
+  }
+
+  // Linear search for the first key >= target.  Keys are rebuilt on the
+  // stack, a key longer than that goes to the heap.
+  char stack_key[256];
+  std::string heap_key;
+  char* key = stack_key;
+  uint32_t key_size = 0;
+  const char* p = data_ + RestartPoint(left);
+  while (p < limit) {
+    uint32_t shared, non_shared, value_length;
+    p = DecodeEntry(p, limit, &shared, &non_shared, &value_length);
+    if (p == nullptr || key_size < shared) {
+      return Status::Corruption("bad entry in block");
+    }
+    if (key == stack_key && shared + non_shared > sizeof(stack_key)) {
+      heap_key.assign(stack_key, shared);
+      key = nullptr;
+    }
+    if (key == stack_key) {
+      memcpy(stack_key + shared, p, non_shared);
+    } else {
+      heap_key.resize(shared);
+      heap_key.append(p, non_shared);
+    }
+    key_size = shared + non_shared;
+    Slice entry_key(key == stack_key ? stack_key : heap_key.data(), key_size);
+    if (cmp->Compare(entry_key, target) >= 0) {
+      (*handle_result)(arg, entry_key, Slice(p + non_shared, value_length));
+      return Status::OK();
+    }
+    p += non_shared + value_length;
+  }
+  return Status::OK();
+}
+
 Iterator* Block::NewIterator(const Comparator* cmp) {
   if (size_ < sizeof(uint32_t)) {
     return NewErrorIterator(Status::Corruption("bad block contents"));
   }
-  const uint32_t num_restarts = NumRestarts();
-  if (num_restarts == 0) {
+  if (num_int_entries_ > 0) {
+    return new IntIter(cmp, this);
+  } else if (num_restarts_ == 0) {
     return NewEmptyIterator();
   } else {
-    return new Iter(cmp, data_, restart_offset_, num_restarts);
+    return new Iter(cmp, data_, restart_offset_, num_restarts_);
   }
 }
 
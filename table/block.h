@@ -8,11 +8,13 @@
 #include <cstddef>
 #include <cstdint>
 #include "leveldb/iterator.h"
+#include "leveldb/status.h"
 
 namespace leveldb {
 
 struct BlockContents;
 class Comparator;
+class Slice;
 
 class Block {
  public:
@@ -24,19 +26,52 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Point lookup without an iterator.  Calls (*handle_result)(arg, ...)
+  // with the first entry whose key is >= target, the one Seek(target)
+  // of an iterator would land on, if there is one.  The value passed
+  // points into the block; the key is rebuilt on the stack, so it is
+  // only valid during the call.  If the block has a hash index, target
+  // is an internal key and the entry is only guaranteed to be that one
+  // when the user key of target is in the block; otherwise there may be
+  // no call at all.  If the block has integer keys, target is an internal
+  // key too.
+  Status Get(const Comparator* comparator, const Slice& target, void* arg,
+             void (*handle_result)(void* arg, const Slice& k, const Slice& v)) const;
+
  private:
-  uint32_t NumRestarts() const;
+  uint32_t RestartPoint(uint32_t index) const;
 
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;     // Offset in data_ of restart array
+  uint32_t num_restarts_;
+  uint32_t num_buckets_;        // Hash buckets after the restart array, if any
   bool owned_;                  // Block owns data_[]
 
+  // Blocks with integer keys, see block_builder.cc
+  void ParseIntKeys(uint32_t num_entries);
+  uint64_t IntKey(uint32_t index) const;
+  uint64_t IntTag(uint32_t index) const;
+  void IntEntryKey(uint32_t index, char* dst) const;
+  bool IntValue(uint32_t index, Slice* value) const;
+  uint32_t IntLowerBound(const Comparator* comparator, const Slice& target) const;
+
+  uint32_t num_int_entries_;    // 0 unless the block has integer keys
+  uint32_t value_offsets_;      // Offsets in data_ of the arrays
+  uint32_t tags_;
+  uint32_t int_keys_;
+  uint64_t key_base_;
+  uint64_t tag_base_;
+  uint8_t key_width_;
+  uint8_t tag_width_;
+  uint8_t offset_width_;
+
   // No copying allowed
   Block(const Block&);
   void operator=(const Block&);
 
   class Iter;
+  class IntIter;
 };
 
 }  // namespace leveldb
@@ -25,22 +25,78 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// A block built with a hash index has the trailer:
+//     restarts: uint32[num_restarts]
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint32
+//     num_restarts | kBlockHashIndexFlag: uint32
+// The keys of such a block are internal keys.  buckets[Hash(user_key) %
+// num_buckets] holds the index of the restart interval in which user_key
+// first appears, kBlockHashEmpty if no user key of the block hashes
+// there, or kBlockHashCollision if several do.  A block with more
+// restarts than fit in a bucket is written without the hash index.
+//
+// A block built with integer keys, whose user keys all have the
+// config::key_format, has instead the form:
+//     values: char[]
+//     value_offsets: uint<offset_width>[n]
+//     tags: uint<tag_width>[n]
+//     keys: uint<key_width>[n]
+//     key_base: uint64
+//     tag_base: uint64
+//     widths: uint32
+//     n | kBlockIntKeysFlag: uint32
+// Entry i has the user key keys[i] + key_base, the tag (sequence number
+// and type) tags[i] + tag_base, and the value from value_offsets[i] up to
+// the next offset, or up to the offset array for the last entry.  The
+// bases are the smallest key and tag, and each width, 1, 2, 4 or 8 bytes,
+// is the smallest that holds the largest difference.  widths packs
+// key_width | tag_width << 8 | offset_width << 16.  As soon as a user key
+// does not have the format, the block falls back to the format above.
 
 #include "table/block_builder.h"
 
 #include <algorithm>
 #include <cassert>
+#include "db/dbformat.h"
 #include "leveldb/comparator.h"
 #include "leveldb/table_builder.h"
+#include "table/format.h"
 #include "util/coding.h"
 
 namespace leveldb {
 
-BlockBuilder::BlockBuilder(const Options* options)
+// Hash buckets per user key, for few collisions at one byte a bucket
+static const double kHashBucketsPerKey = 1.5;
+
+// Size of the part of an integer key block after the keys
+static const size_t kIntTrailerSize = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+// Bytes needed for the numbers up to "max"
+static int FixedWidth(uint64_t max) {
+  if (max <= 0xff) return 1;
+  if (max <= 0xffff) return 2;
+  if (max <= 0xffffffffu) return 4;
+  return 8;
+}
+
+static void PutFixedWidth(std::string* dst, uint64_t value, int width) {
+  char buf[sizeof(value)];
+  EncodeFixed64(buf, value);
+  dst->append(buf, width);
+}
+
+BlockBuilder::BlockBuilder(const Options* options, bool hash_index, bool int_keys)
     : options_(options),
+      hash_index_(hash_index),
+      try_int_keys_(int_keys),
+      int_format_(int_keys),
       restarts_(),
       counter_(0),
-      finished_(false) {
+      finished_(false),
+      min_tag_(~static_cast<uint64_t>(0)),
+      max_tag_(0) {
   assert(options->block_restart_interval >= 1);
   restarts_.push_back(0);       // First restart point is at offset 0
 }
@@ -52,25 +108,135 @@ void BlockBuilder::Reset() {
   counter_ = 0;
   finished_ = false;
   last_key_.clear();
+  hashes_.clear();
+  int_format_ = try_int_keys_;
+  int_keys_.clear();
+  tags_.clear();
+  value_offsets_.clear();
+  min_tag_ = ~static_cast<uint64_t>(0);
+  max_tag_ = 0;
+}
+
+void BlockBuilder::IntWidths(int* key_width, int* tag_width, int* offset_width) const {
+  *key_width = FixedWidth(int_keys_.back() - int_keys_.front());
+  *tag_width = FixedWidth(max_tag_ - min_tag_);
+  *offset_width = FixedWidth(value_offsets_.back());
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
+  if (!int_keys_.empty()) {
+    int key_width, tag_width, offset_width;
+    IntWidths(&key_width, &tag_width, &offset_width);
+    return (buffer_.size() +                      // Values
+            int_keys_.size() * (key_width + tag_width + offset_width) +
+            kIntTrailerSize);
+  }
   return (buffer_.size() +                        // Raw data buffer
           restarts_.size() * sizeof(uint32_t) +   // Restart array
-          sizeof(uint32_t));                      // Restart array length
+          sizeof(uint32_t) +                      // Restart array length
+          (hash_index_ ? static_cast<size_t>(hashes_.size() * kHashBucketsPerKey) +
+                         sizeof(uint32_t) : 0));  // Hash index
 }
 
 Slice BlockBuilder::Finish() {
+  if (!int_keys_.empty()) {
+    int key_width, tag_width, offset_width;
+    IntWidths(&key_width, &tag_width, &offset_width);
+    for (uint32_t offset : value_offsets_) {
+      PutFixedWidth(&buffer_, offset, offset_width);
+    }
+    for (uint64_t tag : tags_) {
+      PutFixedWidth(&buffer_, tag - min_tag_, tag_width);
+    }
+    for (uint64_t key : int_keys_) {
+      PutFixedWidth(&buffer_, key - int_keys_.front(), key_width);
+    }
+    PutFixed64(&buffer_, int_keys_.front());
+    PutFixed64(&buffer_, min_tag_);
+    PutFixed32(&buffer_, key_width | tag_width << 8 | offset_width << 16);
+    PutFixed32(&buffer_, int_keys_.size() | kBlockIntKeysFlag);
+    finished_ = true;
+    return Slice(buffer_);
+  }
+
   // Append restart array
   for (unsigned int restart : restarts_) {
     PutFixed32(&buffer_, restart);
   }
-  PutFixed32(&buffer_, restarts_.size());
+  if (hash_index_ && !hashes_.empty() && restarts_.size() < kBlockHashCollision) {
+    AppendHashIndex();
+  } else {
+    PutFixed32(&buffer_, restarts_.size());
+  }
   finished_ = true;
   return Slice(buffer_);
 }
 
+void BlockBuilder::AppendHashIndex() {
+  const uint32_t num_buckets = static_cast<uint32_t>(hashes_.size() * kHashBucketsPerKey) + 1;
+  const size_t buckets_offset = buffer_.size();
+  buffer_.append(num_buckets, static_cast<char>(kBlockHashEmpty));
+  char* buckets = &buffer_[buckets_offset];
+  for (const auto& hash : hashes_) {
+    char* bucket = &buckets[hash.first % num_buckets];
+    if (static_cast<uint8_t>(*bucket) == kBlockHashEmpty) {
+      *bucket = static_cast<char>(hash.second);
+    } else {
+      *bucket = static_cast<char>(kBlockHashCollision);
+    }
+  }
+  PutFixed32(&buffer_, num_buckets);
+  PutFixed32(&buffer_, restarts_.size() | kBlockHashIndexFlag);
+}
+
+bool BlockBuilder::AddIntKey(const Slice& key, const Slice& value) {
+  assert(!finished_);
+  uint64_t int_key;
+  if (key.size() != kIntUserKeySize + 8 ||
+      !ParseIntUserKey(ExtractUserKey(key), &int_key)) {
+    return false;
+  }
+  const uint64_t tag = DecodeFixed64(key.data() + kIntUserKeySize);
+  assert(int_keys_.empty() || int_key > int_keys_.back() ||
+         (int_key == int_keys_.back() && tag < tags_.back()));
+  int_keys_.push_back(int_key);
+  tags_.push_back(tag);
+  min_tag_ = std::min(min_tag_, tag);
+  max_tag_ = std::max(max_tag_, tag);
+  value_offsets_.push_back(buffer_.size());
+  buffer_.append(value.data(), value.size());
+  return true;
+}
+
+void BlockBuilder::LeaveIntKeys() {
+  int_format_ = false;
+  std::string values;
+  std::vector<uint64_t> int_keys, tags;
+  std::vector<uint32_t> value_offsets;
+  values.swap(buffer_);
+  int_keys.swap(int_keys_);
+  tags.swap(tags_);
+  value_offsets.swap(value_offsets_);
+
+  // Add the entries so far again in the prefix-compressed format
+  char key[kIntUserKeySize + 8];
+  for (size_t i = 0; i < int_keys.size(); i++) {
+    FormatIntUserKey(int_keys[i], key);
+    EncodeFixed64(key + kIntUserKeySize, tags[i]);
+    const size_t limit = i + 1 < value_offsets.size() ? value_offsets[i + 1] : values.size();
+    Add(Slice(key, sizeof(key)),
+        Slice(values.data() + value_offsets[i], limit - value_offsets[i]));
+  }
+}
+
 void BlockBuilder::Add(const Slice& key, const Slice& value) {
+  if (int_format_) {
+    if (AddIntKey(key, value)) {
+      return;
+    }
+    LeaveIntKeys();
+  }
+
   Slice last_key_piece(last_key_);
   assert(!finished_);
   assert(counter_ <= options_->block_restart_interval);
@@ -90,6 +256,14 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   }
   const size_t non_shared = key.size() - shared;
 
+  if (hash_index_) {
+    // Versions of a user key are adjacent, only the first one is hashed
+    Slice user_key = ExtractUserKey(key);
+    if (buffer_.empty() || user_key != ExtractUserKey(last_key_piece)) {
+      hashes_.emplace_back(BlockHashIndexHash(user_key), restarts_.size() - 1);
+    }
+  }
+
   // Add "<shared><non_shared><value_size>" to buffer_
   PutVarint32(&buffer_, shared);
   PutVarint32(&buffer_, non_shared);
@@ -5,6 +5,7 @@
 #ifndef STORAGE_LEVELDB_TABLE_BLOCK_BUILDER_H_
 #define STORAGE_LEVELDB_TABLE_BLOCK_BUILDER_H_
 
+#include <utility>
 #include <vector>
 
 #include <cstdint>
@@ -16,7 +17,12 @@ struct Options;
 
 class BlockBuilder {
  public:
-  explicit BlockBuilder(const Options* options);
+  // If hash_index or int_keys is true, the keys added have to be internal
+  // keys.  With hash_index the block ends with a hash index over their
+  // user keys; with int_keys a block whose user keys all have the
+  // config::key_format stores them as integers.
+  explicit BlockBuilder(const Options* options, bool hash_index = false,
+                        bool int_keys = false);
 
   // Reset the contents as if the BlockBuilder was just constructed.
   void Reset();
@@ -36,16 +42,32 @@ class BlockBuilder {
 
   // Return true iff no entries have been added since the last Reset()
   bool empty() const {
-    return buffer_.empty();
+    return buffer_.empty() && int_keys_.empty();
   }
 
  private:
+  void AppendHashIndex();
+  bool AddIntKey(const Slice& key, const Slice& value);
+  void LeaveIntKeys();
+  void IntWidths(int* key_width, int* tag_width, int* offset_width) const;
+
   const Options*        options_;
+  const bool            hash_index_;  // Append a hash index on Finish()?
+  const bool            try_int_keys_;
+  bool                  int_format_;  // Entries so far kept as integers?
   std::string           buffer_;      // Destination buffer
   std::vector<uint32_t> restarts_;    // Restart points
   int                   counter_;     // Number of entries emitted since restart
   bool                  finished_;    // Has Finish() been called?
   std::string           last_key_;
+  std::vector<std::pair<uint32_t, uint32_t>> hashes_;  // User key hash, restart
+
+  // Entries in the integer key format; buffer_ holds their values
+  std::vector<uint64_t> int_keys_;
+  std::vector<uint64_t> tags_;
+  std::vector<uint32_t> value_offsets_;
+  uint64_t              min_tag_;
+  uint64_t              max_tag_;
 
   // No copying allowed
   BlockBuilder(const BlockBuilder&);
@@ -0,0 +1,439 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "db/dbformat.h"
+#include "leveldb/comparator.h"
+#include "leveldb/iterator.h"
+#include "leveldb/options.h"
+#include "table/block.h"
+#include "table/block_builder.h"
+#include "table/format.h"
+#include "util/coding.h"
+#include "util/logging.h"
+#include "util/random.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+typedef std::vector<std::pair<std::string, std::string>> Entries;
+
+// The entry a lookup handed to its callback
+struct Found {
+  bool called;
+  std::string key;
+  std::string value;
+
+  Found() : called(false) { }
+};
+
+static void SaveFound(void* arg, const Slice& k, const Slice& v) {
+  Found* found = reinterpret_cast<Found*>(arg);
+  ASSERT_TRUE(!found->called);
+  found->called = true;
+  found->key = k.ToString();
+  found->value = v.ToString();
+}
+
+static std::string Number(uint64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "k%06llu", static_cast<unsigned long long>(i));
+  return buf;
+}
+
+// User key of the config::key_format
+static std::string IntKey(uint64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), config::key_format, static_cast<unsigned long>(i));
+  return buf;
+}
+
+// Internal keys of one to three versions of each of user_keys, newest
+// first, some of them deletions
+static Entries Versions(const std::vector<std::string>& user_keys, Random* rnd) {
+  Entries entries;
+  for (const std::string& user_key : user_keys) {
+    const int versions = 1 + rnd->Uniform(3);
+    SequenceNumber sequence = 1000;
+    for (int i = 0; i < versions; i++) {
+      sequence -= 1 + rnd->Uniform(100);
+      const bool deleted = i == versions - 1 && rnd->OneIn(4);
+      InternalKey key(user_key, sequence, deleted ? kTypeDeletion : kTypeValue);
+      entries.emplace_back(key.Encode().ToString(),
+                           deleted ? std::string() : user_key + std::to_string(sequence));
+    }
+  }
+  return entries;
+}
+
+class BlockTest {
+ public:
+  InternalKeyComparator icmp_;
+  std::string contents_;
+  Block* block_;
+
+  BlockTest() : icmp_(BytewiseComparator()), block_(nullptr) { }
+
+  ~BlockTest() {
+    delete block_;
+  }
+
+  // Builds a block of "entries", which are in the order of cmp
+  void Build(const Comparator* cmp, int restart_interval, const Entries& entries,
+             bool hash_index = false, bool int_keys = false) {
+    Options options;
+    options.comparator = cmp;
+    options.block_restart_interval = restart_interval;
+    BlockBuilder builder(&options, hash_index, int_keys);
+    for (const auto& entry : entries) {
+      builder.Add(entry.first, entry.second);
+    }
+    contents_ = builder.Finish().ToString();
+    BlockContents contents;
+    contents.data = Slice(contents_);
+    contents.cachable = false;
+    contents.heap_allocated = false;
+    delete block_;
+    block_ = new Block(contents);
+  }
+
+  // Last word of the block: restart or entry count and format flags
+  uint32_t Trailer() const {
+    return DecodeFixed32(contents_.data() + contents_.size() - sizeof(uint32_t));
+  }
+
+  // Bucket of user_key in the hash index of the block
+  uint8_t Bucket(const Slice& user_key) const {
+    const char* end = contents_.data() + contents_.size() - 2 * sizeof(uint32_t);
+    const uint32_t num_buckets = DecodeFixed32(end);
+    return static_cast<uint8_t>((end - num_buckets)[BlockHashIndexHash(user_key) % num_buckets]);
+  }
+
+  // Checks that Get(target) hands over the entry Seek(target) finds
+  void CheckGet(const Comparator* cmp, const Slice& target) {
+    Found found;
+    ASSERT_OK(block_->Get(cmp, target, &found, SaveFound));
+    Iterator* iter = block_->NewIterator(cmp);
+    iter->Seek(target);
+    ASSERT_EQ(iter->Valid(), found.called) << EscapeString(target);
+    if (iter->Valid()) {
+      ASSERT_EQ(iter->key().ToString(), found.key);
+      ASSERT_EQ(iter->value().ToString(), found.value);
+    }
+    ASSERT_OK(iter->status());
+    delete iter;
+  }
+};
+
+TEST(BlockTest, Empty) {
+  Build(BytewiseComparator(), 16, Entries());
+  CheckGet(BytewiseComparator(), "");
+  CheckGet(BytewiseComparator(), "k");
+}
+
+TEST(BlockTest, GetMatchesSeek) {
+  const int restart_intervals[] = {1, 2, 16};
+  for (int restart_interval : restart_intervals) {
+    // even numbers only, the odd ones fall between two keys
+    Entries entries;
+    for (int i = 0; i < 500; i += 2) {
+      entries.emplace_back(Number(i), "v" + Number(i));
+    }
+    Build(BytewiseComparator(), restart_interval, entries);
+    CheckGet(BytewiseComparator(), "");
+    CheckGet(BytewiseComparator(), "a");
+    CheckGet(BytewiseComparator(), "k");
+    for (int i = 0; i < 502; i++) {
+      CheckGet(BytewiseComparator(), Number(i));
+    }
+    CheckGet(BytewiseComparator(), "l");
+  }
+}
+
+TEST(BlockTest, RestartBoundary) {
+  const int kInterval = 4;
+  Entries entries;
+  for (int i = 0; i < 40; i++) {
+    entries.emplace_back(Number(2 * i), "v" + Number(2 * i));
+  }
+  Build(BytewiseComparator(), kInterval, entries);
+  for (int i = 0; i < 40; i += kInterval) {
+    // the key of the restart point itself
+    Found found;
+    ASSERT_OK(block_->Get(BytewiseComparator(), Number(2 * i), &found, SaveFound));
+    ASSERT_TRUE(found.called);
+    ASSERT_EQ(Number(2 * i), found.key);
+
+    if (i == 0) {
+      continue;
+    }
+
+    // before it, but after the last key of the previous interval
+    Found next;
+    ASSERT_OK(block_->Get(BytewiseComparator(), Number(2 * i - 1), &next, SaveFound));
+    ASSERT_TRUE(next.called);
+    ASSERT_EQ(Number(2 * i), next.key);
+
+    // the last key of the previous interval
+    Found last;
+    ASSERT_OK(block_->Get(BytewiseComparator(), Number(2 * i - 2), &last, SaveFound));
+    ASSERT_TRUE(last.called);
+    ASSERT_EQ(Number(2 * i - 2), last.key);
+  }
+  // past the last restart interval
+  Found past;
+  ASSERT_OK(block_->Get(BytewiseComparator(), Number(80), &past, SaveFound));
+  ASSERT_TRUE(!past.called);
+}
+
+TEST(BlockTest, SharedPrefixes) {
+  Random rnd(301);
+  for (int round = 0; round < 50; round++) {
+    std::vector<std::string> keys;
+    const int n = 1 + rnd.Uniform(300);
+    for (int i = 0; i < n; i++) {
+      // few letters and long keys share long prefixes
+      std::string key(round % 5 == 0 ? 200 + rnd.Uniform(100) : 1 + rnd.Uniform(20), 'a');
+      for (char& c : key) {
+        c = 'a' + rnd.Uniform(3);
+      }
+      keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    Entries entries;
+    for (const std::string& key : keys) {
+      entries.emplace_back(key, std::string(rnd.Uniform(50), 'v'));
+    }
+    Build(BytewiseComparator(), 1 + round % 20, entries);
+    for (const std::string& key : keys) {
+      CheckGet(BytewiseComparator(), key);
+      CheckGet(BytewiseComparator(), key + "a");
+      CheckGet(BytewiseComparator(), key.substr(0, key.size() - 1));
+    }
+  }
+}
+
+TEST(BlockTest, HashGetMatchesSeek) {
+  Random rnd(301);
+  const int restart_intervals[] = {1, 4, 16};
+  for (int restart_interval : restart_intervals) {
+    std::vector<std::string> user_keys;
+    for (int i = 0; i < 80; i++) {
+      user_keys.push_back(Number(3 * i));
+    }
+    Build(&icmp_, restart_interval, Versions(user_keys, &rnd), true);
+    ASSERT_TRUE((Trailer() & kBlockHashIndexFlag) != 0);
+    for (int i = 0; i < 240; i++) {
+      const std::string user_key = Number(i);
+      const SequenceNumber sequences[] = {0, 950, kMaxSequenceNumber};
+      for (SequenceNumber sequence : sequences) {
+        LookupKey target(user_key, sequence);
+        if (i % 3 == 0) {
+          CheckGet(&icmp_, target.internal_key());
+          continue;
+        }
+        // an absent user key may be skipped, but is never found
+        Found found;
+        ASSERT_OK(block_->Get(&icmp_, target.internal_key(), &found, SaveFound));
+        if (found.called) {
+          ASSERT_TRUE(ExtractUserKey(found.key) != Slice(user_key));
+          ASSERT_GE(icmp_.Compare(found.key, target.internal_key()), 0);
+        }
+      }
+    }
+  }
+}
+
+TEST(BlockTest, HashEmptyBucket) {
+  Random rnd(301);
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < 80; i++) {
+    user_keys.push_back(Number(2 * i));
+  }
+  Build(&icmp_, 16, Versions(user_keys, &rnd), true);
+  int empty = 0;
+  for (int i = 1; i < 1000; i += 2) {
+    if (Bucket(Number(i)) != kBlockHashEmpty) {
+      continue;
+    }
+    empty++;
+    // found absent without a search, even between keys of the block
+    LookupKey target(Number(i), kMaxSequenceNumber);
+    Found found;
+    ASSERT_OK(block_->Get(&icmp_, target.internal_key(), &found, SaveFound));
+    ASSERT_TRUE(!found.called);
+  }
+  ASSERT_GT(empty, 0);
+}
+
+TEST(BlockTest, HashCollision) {
+  Random rnd(301);
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < 150; i++) {
+    user_keys.push_back(Number(i));
+  }
+  Build(&icmp_, 4, Versions(user_keys, &rnd), true);
+  ASSERT_TRUE((Trailer() & kBlockHashIndexFlag) != 0);
+  int collisions = 0;
+  for (const std::string& user_key : user_keys) {
+    if (Bucket(user_key) != kBlockHashCollision) {
+      continue;
+    }
+    collisions++;
+    // falls back to the binary search over all restart points
+    CheckGet(&icmp_, LookupKey(user_key, kMaxSequenceNumber).internal_key());
+    CheckGet(&icmp_, LookupKey(user_key, 0).internal_key());
+  }
+  ASSERT_GT(collisions, 0);
+}
+
+TEST(BlockTest, HashTooManyRestarts) {
+  // more restart intervals than a bucket can name
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < 300; i++) {
+    user_keys.push_back(Number(2 * i));
+  }
+  Entries entries;
+  for (const std::string& user_key : user_keys) {
+    entries.emplace_back(InternalKey(user_key, 100, kTypeValue).Encode().ToString(), user_key);
+  }
+  Build(&icmp_, 1, entries, true);
+  ASSERT_EQ(0, Trailer() & kBlockHashIndexFlag);
+  for (int i = 0; i < 602; i++) {
+    CheckGet(&icmp_, LookupKey(Number(i), kMaxSequenceNumber).internal_key());
+    CheckGet(&icmp_, LookupKey(Number(i), 0).internal_key());
+  }
+}
+
+TEST(BlockTest, IntGetMatchesSeek) {
+  Random rnd(301);
+  std::vector<uint64_t> numbers;
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < 100; i++) {
+    numbers.push_back(1000 + 5 * i);
+    user_keys.push_back(IntKey(numbers.back()));
+  }
+  const Entries entries = Versions(user_keys, &rnd);
+  Build(&icmp_, 16, entries, false, true);
+  ASSERT_TRUE((Trailer() & kBlockIntKeysFlag) != 0);
+
+  Iterator* iter = block_->NewIterator(&icmp_);
+  size_t i = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+    ASSERT_LT(i, entries.size());
+    ASSERT_EQ(entries[i].first, iter->key().ToString());
+    ASSERT_EQ(entries[i].second, iter->value().ToString());
+  }
+  ASSERT_EQ(entries.size(), i);
+  delete iter;
+
+  for (uint64_t n = 990; n < 1510; n++) {
+    const SequenceNumber sequences[] = {0, 950, kMaxSequenceNumber};
+    for (SequenceNumber sequence : sequences) {
+      CheckGet(&icmp_, LookupKey(IntKey(n), sequence).internal_key());
+    }
+  }
+  // targets that are not key_format keys are compared as strings
+  const std::string user_key = IntKey(numbers[50]);
+  const std::string others[] = {
+    "", "0", user_key.substr(0, 19), user_key + "x", user_key.substr(0, 18) + "x",
+    "99999999999999999999x", "a"
+  };
+  for (const std::string& other : others) {
+    CheckGet(&icmp_, LookupKey(other, kMaxSequenceNumber).internal_key());
+  }
+}
+
+TEST(BlockTest, IntWidths) {
+  Random rnd(301);
+  struct {
+    uint64_t base;
+    uint64_t step;
+    size_t value_size;
+    uint32_t key_width;
+    uint32_t offset_width;
+  } cases[] = {
+    {0, 2, 1, 1, 1},
+    {1000, 500, 100, 2, 2},
+    {1ull << 40, 30000000, 1000, 4, 4},
+    {0, 400000000000000000ull, 10, 8, 2},
+  };
+  for (const auto& c : cases) {
+    std::vector<std::string> user_keys;
+    for (int i = 0; i < 40; i++) {
+      user_keys.push_back(IntKey(c.base + i * c.step));
+    }
+    Entries entries = Versions(user_keys, &rnd);
+    for (auto& entry : entries) {
+      entry.second.resize(c.value_size, 'v');
+    }
+    Build(&icmp_, 16, entries, false, true);
+    ASSERT_TRUE((Trailer() & kBlockIntKeysFlag) != 0);
+    const uint32_t widths = DecodeFixed32(contents_.data() + contents_.size() -
+                                          2 * sizeof(uint32_t));
+    ASSERT_EQ(c.key_width, widths & 0xff);
+    ASSERT_EQ(c.offset_width, widths >> 16);
+    for (const auto& entry : entries) {
+      CheckGet(&icmp_, entry.first);
+      CheckGet(&icmp_, LookupKey(ExtractUserKey(entry.first), 0).internal_key());
+    }
+    for (int i = 0; i < 41; i++) {
+      CheckGet(&icmp_, LookupKey(IntKey(c.base + i * c.step + 1), kMaxSequenceNumber)
+                           .internal_key());
+    }
+  }
+}
+
+TEST(BlockTest, IntNonDecimalFallback) {
+  Random rnd(301);
+  std::vector<std::string> user_keys;
+  for (int i = 0; i < 60; i++) {
+    user_keys.push_back(IntKey(100 + i));
+  }
+  // not a key_format key, but in order between its neighbours
+  user_keys[30] += "x";
+  const Entries entries = Versions(user_keys, &rnd);
+  Build(&icmp_, 16, entries);
+  const std::string plain = contents_;
+  Build(&icmp_, 16, entries, false, true);
+  ASSERT_EQ(0, Trailer() & kBlockIntKeysFlag);
+  ASSERT_TRUE(plain == contents_);
+  for (const std::string& user_key : user_keys) {
+    CheckGet(&icmp_, LookupKey(user_key, kMaxSequenceNumber).internal_key());
+    CheckGet(&icmp_, LookupKey(user_key, 0).internal_key());
+  }
+}
+
+TEST(BlockTest, IntSizeEstimate) {
+  Random rnd(301);
+  Options options;
+  options.comparator = &icmp_;
+  BlockBuilder builder(&options, false, true);
+  for (int round = 0; round < 20; round++) {
+    std::vector<std::string> user_keys;
+    uint64_t n = rnd.Uniform(1000);
+    for (int i = 0; i < 1 + round * 10; i++) {
+      n += 1 + rnd.Uniform(1 << (round % 16));
+      user_keys.push_back(IntKey(n));
+    }
+    for (const auto& entry : Versions(user_keys, &rnd)) {
+      builder.Add(entry.first, entry.second);
+    }
+    const size_t estimate = builder.CurrentSizeEstimate();
+    ASSERT_EQ(estimate, builder.Finish().size());
+    builder.Reset();
+    ASSERT_TRUE(builder.empty());
+  }
+}
+
+}  // namespace leveldb
+
+int main() {
+  return leveldb::test::RunAllTests();
+}
@@ -4,6 +4,7 @@
 
 #include "table/format.h"
 
+#include <string.h>
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
@@ -142,4 +143,62 @@ Status ReadBlock(RandomAccessFile* file,
   return Status::OK();
 }
 
+Status ReadRawBlock(RandomAccessFile* file,
+                    const ReadOptions& options,
+                    const BlockHandle& handle,
+                    Slice* contents,
+                    CompressionType* type) {
+  size_t n = static_cast<size_t>(handle.size());
+  Slice raw;
+  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &raw, nullptr);
+  if (!s.ok()) {
+    return s;
+  }
+  if (raw.size() != n + kBlockTrailerSize) {
+    return Status::Corruption("truncated block read");
+  }
+
+  const char* data = raw.data();
+  if (options.verify_checksums) {
+    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
+    const uint32_t actual = crc32c::Value(data, n + 1);
+    if (actual != crc) {
+      return Status::Corruption("block checksum mismatch");
+    }
+  }
+  if (data[n] != kNoCompression && data[n] != kSnappyCompression) {
+    return Status::Corruption("bad block type");
+  }
+  *contents = Slice(data, n);
+  *type = static_cast<CompressionType>(data[n]);
+  return Status::OK();
+}
+
+bool ParseIntUserKey(const Slice& user_key, uint64_t* value) {
+  static const char kMaxKey[] = "18446744073709551615";
+  if (user_key.size() != kIntUserKeySize) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (size_t i = 0; i < kIntUserKeySize; i++) {
+    const char c = user_key[i];
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    v = v * 10 + (c - '0');
+  }
+  if (memcmp(user_key.data(), kMaxKey, kIntUserKeySize) > 0) {
+    return false;  // does not fit, v wrapped around
+  }
+  *value = v;
+  return true;
+}
+
+void FormatIntUserKey(uint64_t value, char* dst) {
+  for (int i = kIntUserKeySize - 1; i >= 0; i--) {
+    dst[i] = '0' + value % 10;
+    value /= 10;
+  }
+}
+
 }  // namespace leveldb
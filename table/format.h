@@ -10,6 +10,7 @@
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 #include "leveldb/table_builder.h"
+#include "util/hash.h"
 
 namespace leveldb {
 
@@ -84,6 +85,31 @@ static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// Set in the restart count of a block that ends with a hash index, see
+// block_builder.cc.  Buckets hold a restart index or one of the markers.
+static const uint32_t kBlockHashIndexFlag = 1u << 31;
+static const uint8_t kBlockHashEmpty = 255;
+static const uint8_t kBlockHashCollision = 254;
+
+// Hash of a user key in the hash index of a block
+inline uint32_t BlockHashIndexHash(const Slice& user_key) {
+  return Hash(user_key.data(), user_key.size(), 0x5bd1e995);
+}
+
+// Set in the entry count of a block whose keys are config::key_format
+// user keys stored as integers, see block_builder.cc
+static const uint32_t kBlockIntKeysFlag = 1u << 30;
+
+// Length of a config::key_format user key
+static const size_t kIntUserKeySize = 20;
+
+// If "user_key" is a config::key_format key, stores its number in *value
+// and returns true.
+extern bool ParseIntUserKey(const Slice& user_key, uint64_t* value);
+
+// Writes the config::key_format key of "value" to dst[0,kIntUserKeySize-1].
+extern void FormatIntUserKey(uint64_t value, char* dst);
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
@@ -97,6 +123,15 @@ extern Status ReadBlock(RandomAccessFile* file,
                         const BlockHandle& handle,
                         BlockContents* result);
 
+// Read the block identified by "handle" from "file" as it is stored,
+// without uncompressing it.  On success "*contents" points into the
+// memory mapped file and "*type" is set from the block trailer.
+extern Status ReadRawBlock(RandomAccessFile* file,
+                           const ReadOptions& options,
+                           const BlockHandle& handle,
+                           Slice* contents,
+                           CompressionType* type);
+
 // Implementation details follow.  Clients should ignore,
 
 inline BlockHandle::BlockHandle()
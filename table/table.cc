@@ -9,6 +9,7 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
@@ -215,88 +216,128 @@ Iterator* Table::BlockReader(void* arg,
   return iter;
 }
 
-Iterator* Table::BlockIterator(const ReadOptions& options,
-                               const BlockHandle& handle) {
+Status Table::LoadBlock(const ReadOptions& options, const BlockHandle& handle,
+                        Cache::Handle** cache_handle, BlockContents* contents) {
   Status s;
   Cache* block_cache = rep_->options.block_cache;
-  Cache::Handle* cache_handle = NULL;
-  Block* block = NULL;
-  BlockContents contents;
-#ifdef PERF_LOG
-  if (block_cache != NULL) {
-    char cache_key_buffer[16];
-    EncodeFixed64(cache_key_buffer, rep_->cache_id);
-    EncodeFixed64(cache_key_buffer+8, handle.offset());
-    Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-    cache_handle = block_cache->Lookup(key);
-    if (cache_handle != NULL) {
-      block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
-    } else {
-      uint64_t start_micros = benchmark::NowMicros();
-      s = ReadBlock(rep_->file, options, handle, &contents);
-      benchmark::LogMicros(benchmark::BLOCK_READ, benchmark::NowMicros() - start_micros);
-      if (s.ok()) {
-        block = new Block(contents);
-        if (contents.cachable && options.fill_cache) {
-          cache_handle = block_cache->Insert(
-            key, block, block->size(), &DeleteCachedBlock);
-        }
-      }
-    }
-  } else {
-    uint64_t start_micros = benchmark::NowMicros();
-    s = ReadBlock(rep_->file, options, handle, &contents);
-    benchmark::LogMicros(benchmark::BLOCK_READ, benchmark::NowMicros() - start_micros);
-    if (s.ok()) {
-      block = new Block(contents);
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  EncodeFixed64(cache_key_buffer+8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  *cache_handle = nullptr;
+  if (block_cache != nullptr) {
+    *cache_handle = block_cache->Lookup(key);
+    if (*cache_handle != nullptr) {
+      return s;
     }
   }
+
+#ifdef PERF_LOG
+  uint64_t start_micros = benchmark::NowMicros();
+  s = ReadBlock(rep_->file, options, handle, contents);
+  benchmark::LogMicros(benchmark::BLOCK_READ, benchmark::NowMicros() - start_micros);
 #else
-  if (block_cache != NULL) {
-    char cache_key_buffer[16];
-    EncodeFixed64(cache_key_buffer, rep_->cache_id);
-    EncodeFixed64(cache_key_buffer+8, handle.offset());
-    Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-    cache_handle = block_cache->Lookup(key);
-    if (cache_handle != NULL) {
-      block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
-    } else {
-      s = ReadBlock(rep_->file, options, handle, &contents);
-      if (s.ok()) {
-        block = new Block(contents);
-        if (contents.cachable && options.fill_cache) {
-          cache_handle = block_cache->Insert(
-            key, block, block->size(), &DeleteCachedBlock);
-        }
-      }
-    }
-  } else {
-    s = ReadBlock(rep_->file, options, handle, &contents);
-    if (s.ok()) {
-      block = new Block(contents);
-    }
-  }
+  s = ReadBlock(rep_->file, options, handle, contents);
 #endif
+  if (s.ok() && block_cache != nullptr && contents->cachable && options.fill_cache) {
+    Block* block = new Block(*contents);
+    *cache_handle = block_cache->Insert(key, block, block->size(), &DeleteCachedBlock);
+  }
+  return s;
+}
+
+Iterator* Table::BlockIterator(const ReadOptions& options,
+                               const BlockHandle& handle) {
+  Cache::Handle* cache_handle;
+  BlockContents contents;
+  Status s = LoadBlock(options, handle, &cache_handle, &contents);
   Iterator* iter;
-  if (block != NULL) {
+  if (cache_handle != NULL) {
+    Cache* block_cache = rep_->options.block_cache;
+    Block* block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
     iter = block->NewIterator(rep_->options.comparator);
-    if (cache_handle == NULL) {
-      iter->RegisterCleanup(&DeleteBlock, block, NULL);
-    } else {
-      iter->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
-    }
+    iter->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
+  } else if (s.ok()) {
+    Block* block = new Block(contents);
+    iter = block->NewIterator(rep_->options.comparator);
+    iter->RegisterCleanup(&DeleteBlock, block, NULL);
   } else {
     iter = NewErrorIterator(s);
   }
   return iter;
 }
 
+Status Table::BlockGet(const ReadOptions& options, const BlockHandle& handle,
+                       const Slice& k, void* arg,
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       PinnableSlice* pinned) {
+  Cache::Handle* cache_handle;
+  BlockContents contents;
+  Status s = LoadBlock(options, handle, &cache_handle, &contents);
+  if (cache_handle != nullptr) {
+    Cache* block_cache = rep_->options.block_cache;
+    s = reinterpret_cast<Block*>(block_cache->Value(cache_handle))->Get(
+        rep_->options.comparator, k, arg, saver);
+    if (pinned != nullptr && pinned->IsPinned()) {
+      pinned->RegisterCleanup(&ReleaseBlock, block_cache, cache_handle);
+    } else {
+      block_cache->Release(cache_handle);
+    }
+  } else if (s.ok()) {
+    // not cached, e.g. pointing into the mapped file: the block is
+    // only needed for this lookup
+    Block block(contents);
+    s = block.Get(rep_->options.comparator, k, arg, saver);
+    if (pinned != nullptr && pinned->IsPinned() && contents.heap_allocated) {
+      pinned->PinSelf(*pinned);
+    }
+  }
+  return s;
+}
+
+void Table::BlockMultiGet(const ReadOptions& options, const BlockHandle& handle, size_t n,
+                          const Slice* keys, void* const* args,
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          Status* statuses) {
+  Cache::Handle* cache_handle;
+  BlockContents contents;
+  Status s = LoadBlock(options, handle, &cache_handle, &contents);
+  if (!s.ok()) {
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = s;
+    }
+    return;
+  }
+  Cache* block_cache = rep_->options.block_cache;
+  if (cache_handle != nullptr) {
+    const Block* block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = block->Get(rep_->options.comparator, keys[i], args[i], saver);
+    }
+    block_cache->Release(cache_handle);
+  } else {
+    Block block(contents);
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = block.Get(rep_->options.comparator, keys[i], args[i], saver);
+    }
+  }
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
   return NewTwoLevelIterator(
       rep_->index_block->NewIterator(rep_->options.comparator),
       &Table::BlockReader, const_cast<Table*>(this), options);
 }
 
+Iterator* Table::NewIndexIterator() const {
+  return rep_->index_block->NewIterator(rep_->options.comparator);
+}
+
+Status Table::ReadRawBlock(const ReadOptions& options, const BlockHandle& handle,
+                           Slice* contents, CompressionType* type) const {
+  return leveldb::ReadRawBlock(rep_->file, options, handle, contents, type);
+}
+
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
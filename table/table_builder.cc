@@ -34,6 +34,7 @@ struct TableBuilder::Rep {
   bool closed;          // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
   Index* index;
+  bool full_keys;       // index needs KeyAndMeta::user_key
   std::shared_ptr<IndexMeta> index_meta;
 
 
@@ -56,16 +57,18 @@ struct TableBuilder::Rep {
         index_block_options(opt),
         file(f),
         offset(0),
-        data_block(&options),
+        data_block(&options, options.block_hash_index,
+                   options.int_key_blocks && !options.index->UsesFullKeys()),
         index_block(&index_block_options),
         num_entries(0),
+        total_size(0),
+        fnumber(number),
         closed(false),
         filter_block(opt.filter_policy == nullptr ? nullptr
                                                   : new FilterBlockBuilder(opt.filter_policy)),
-        pending_index_entry(false),
         index(options.index),
-        fnumber(number),
-        total_size(0) {
+        full_keys(options.index->UsesFullKeys()),
+        pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
 };
@@ -103,13 +106,24 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   Rep* r = rep_;
   assert(!r->closed);
   if (!ok()) return;
-  if (r->num_entries > 0) {
-    assert(r->options.comparator->Compare(key, Slice(r->last_key)) > 0);
-  }
   // create index meta for new block
   if (r->data_block.empty()) {
     r->index_meta = std::make_shared<IndexMeta>(r->offset, 0, r->fnumber);
   }
+  AddKey(key);
+  r->data_block.Add(key, value);
+
+  const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
+  if (estimated_block_size >= r->options.block_size) {
+    Flush();
+  }
+}
+
+void TableBuilder::AddKey(const Slice& key) {
+  Rep* r = rep_;
+  if (r->num_entries > 0) {
+    assert(r->options.comparator->Compare(key, Slice(r->last_key)) > 0);
+  }
 
   if (r->pending_index_entry) {
     assert(r->data_block.empty());
@@ -126,16 +140,37 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
-  r->data_block.Add(key, value);
   // add to index queue block meta 
   KeyAndMeta key_meta;
-  key_meta.key = fast_atoi(ExtractUserKey(key));
+  Slice user_key = ExtractUserKey(key);
+  key_meta.key = r->index->EntryKey(user_key);
+  if (r->full_keys) {
+    key_meta.user_key.assign(user_key.data(), user_key.size());
+  }
   key_meta.meta = r->index_meta;
   r->index_queue.push_back(key_meta);
+}
 
-  const size_t estimated_block_size = r->data_block.CurrentSizeEstimate();
-  if (estimated_block_size >= r->options.block_size) {
-    Flush();
+void TableBuilder::AddBlock(const Slice& contents, CompressionType type, Iterator* entries) {
+  Rep* r = rep_;
+  assert(!r->closed);
+  Flush();
+  if (!ok()) return;
+  r->index_meta = std::make_shared<IndexMeta>(r->offset, 0, r->fnumber);
+
+  for (entries->SeekToFirst(); entries->Valid(); entries->Next()) {
+    AddKey(entries->key());
+  }
+  r->status = entries->status();
+  if (!ok()) return;
+
+  WriteRawBlock(contents, type, &r->pending_handle, true);
+  if (ok()) {
+    r->pending_index_entry = true;
+    r->status = r->file->Flush();
+  }
+  if (r->filter_block != nullptr) {
+    r->filter_block->StartBlock(r->offset);
   }
 }
 
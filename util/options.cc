@@ -22,6 +22,8 @@ Options::Options()
       block_cache(nullptr),
       block_size(4096),
       block_restart_interval(16),
+      block_hash_index(false),
+      int_key_blocks(false),
       max_file_size(2<<20),
       merge_threshold(70),
       forced_compaction_size(5),
@@ -29,7 +31,20 @@ Options::Options()
       reuse_logs(false),
       filter_policy(nullptr),
       disable_recovery_log(true),
-      index(nullptr) {
+      index(nullptr),
+      index_threads(4),
+      index_dram_inner_nodes(false),
+      rebuild_index(true),
+      index_rebuild_threads(4),
+      copy_live_blocks(true),
+      max_subcompactions(4),
+      max_background_merges(2),
+      compaction_rate_limit(0),
+      compaction_rate_limit_auto(false),
+      adaptive_merge_policy(false),
+      min_merge_threshold(30),
+      max_merge_threshold(90),
+      target_write_amplification(4.0) {
 }
 
 }  // namespace leveldb
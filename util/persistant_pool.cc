@@ -10,6 +10,8 @@ namespace nvram {
 static PMEMctopool* pm_pool;
 static bool init = false;
 static uint64_t allocs = 0;
+// without a pool the root only survives a reopen within the process
+static void* heap_root = nullptr;
 
 
 void create_pool(const std::string& dir, const size_t& s) {
@@ -24,6 +26,17 @@ void create_pool(const std::string& dir, const size_t& s) {
   }
 }
 
+bool open_pool(const std::string& dir, const size_t& s) {
+  pm_pool = pmemcto_open(dir.data(), LAYOUT_NAME);
+  if (pm_pool == nullptr) {
+    create_pool(dir, s);
+    return false;
+  }
+  printf("Opened NVM pool %s\n", dir.data());
+  init = true;
+  return true;
+}
+
 void close_pool() {
   if (init) {
     fprintf(stdout, "pmem allocs %lu\n", allocs);
@@ -54,6 +67,18 @@ void* pmalloc(size_t size) {
   return ptr;
 }
 
+void* get_root() {
+  return init ? pmemcto_get_root_pointer(pm_pool) : heap_root;
+}
+
+void set_root(void* root) {
+  if (init) {
+    pmemcto_set_root_pointer(pm_pool, root);
+  } else {
+    heap_root = root;
+  }
+}
+
 void stats() {
 //  char *msg;
 //  pmemcto_stats_print(vmem, msg);
@@ -0,0 +1,77 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/pinnable_slice.h"
+
+namespace leveldb {
+
+PinnableSlice::PinnableSlice() : pinned_(false) {
+  cleanup_.function = nullptr;
+  cleanup_.next = nullptr;
+}
+
+PinnableSlice::~PinnableSlice() {
+  RunCleanups();
+}
+
+void PinnableSlice::RunCleanups() {
+  if (cleanup_.function != nullptr) {
+    (*cleanup_.function)(cleanup_.arg1, cleanup_.arg2);
+    for (Cleanup* c = cleanup_.next; c != nullptr; ) {
+      (*c->function)(c->arg1, c->arg2);
+      Cleanup* next = c->next;
+      delete c;
+      c = next;
+    }
+    cleanup_.function = nullptr;
+    cleanup_.next = nullptr;
+  }
+}
+
+void PinnableSlice::PinSlice(const Slice& s) {
+  assert(!pinned_);
+  Slice::operator=(s);
+  pinned_ = true;
+}
+
+void PinnableSlice::PinSlice(const Slice& s, CleanupFunction function, void* arg1, void* arg2) {
+  PinSlice(s);
+  RegisterCleanup(function, arg1, arg2);
+}
+
+void PinnableSlice::RegisterCleanup(CleanupFunction func, void* arg1, void* arg2) {
+  assert(func != nullptr);
+  Cleanup* c;
+  if (cleanup_.function == nullptr) {
+    c = &cleanup_;
+  } else {
+    c = new Cleanup;
+    c->next = cleanup_.next;
+    cleanup_.next = c;
+  }
+  c->function = func;
+  c->arg1 = arg1;
+  c->arg2 = arg2;
+}
+
+void PinnableSlice::PinSelf(const Slice& s) {
+  // s may point to the memory released below
+  self_.assign(s.data(), s.size());
+  RunCleanups();
+  pinned_ = false;
+  Slice::operator=(self_);
+}
+
+void PinnableSlice::PinSelf() {
+  assert(!pinned_);
+  Slice::operator=(self_);
+}
+
+void PinnableSlice::Reset() {
+  RunCleanups();
+  pinned_ = false;
+  clear();
+}
+
+}  // namespace leveldb
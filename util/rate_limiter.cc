@@ -0,0 +1,151 @@
+#include "util/rate_limiter.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// The bucket holds at most this much time worth of tokens
+static const uint64_t kBurstMicros = 100000;
+
+// A read is taken to overlap table writes if one was appended this recently
+static const uint64_t kBusyMicros = 10000;
+
+// Auto mode looks at the read latencies this often
+static const uint64_t kAdjustMicros = 100000;
+
+// Auto mode never goes below this fraction of the configured rate
+static const uint64_t kMinRateDivisor = 16;
+
+RateLimiter::RateLimiter(Env* env, uint64_t bytes_per_second, bool auto_tune)
+    : env_(env),
+      auto_tune_(auto_tune),
+      last_write_micros_(0),
+      configured_rate_(bytes_per_second),
+      rate_(bytes_per_second),
+      tokens_(0),
+      last_refill_micros_(env->NowMicros()),
+      idle_latency_(0),
+      busy_latency_sum_(0),
+      busy_reads_(0),
+      last_adjust_micros_(last_refill_micros_) {
+}
+
+void RateLimiter::SetBytesPerSecond(uint64_t bytes_per_second) {
+  MutexLock l(&mu_);
+  Refill(env_->NowMicros());
+  configured_rate_ = bytes_per_second;
+  rate_ = bytes_per_second;
+  tokens_ = std::min(tokens_, 0.0);
+}
+
+uint64_t RateLimiter::GetBytesPerSecond() {
+  MutexLock l(&mu_);
+  return configured_rate_;
+}
+
+uint64_t RateLimiter::CurrentBytesPerSecond() {
+  MutexLock l(&mu_);
+  return rate_;
+}
+
+void RateLimiter::SetAutoTune(bool auto_tune) {
+  MutexLock l(&mu_);
+  auto_tune_.store(auto_tune, std::memory_order_relaxed);
+  rate_ = configured_rate_;
+  busy_latency_sum_ = 0;
+  busy_reads_ = 0;
+}
+
+void RateLimiter::Refill(uint64_t now) {
+  if (now > last_refill_micros_ && rate_ > 0) {
+    tokens_ += static_cast<double>(now - last_refill_micros_) * rate_ / 1e6;
+    tokens_ = std::min(tokens_, static_cast<double>(rate_) * kBurstMicros / 1e6);
+  }
+  last_refill_micros_ = now;
+}
+
+void RateLimiter::Request(size_t bytes, bool wait) {
+  uint64_t now = env_->NowMicros();
+  last_write_micros_.store(now, std::memory_order_relaxed);
+  uint64_t wait_micros = 0;
+  {
+    MutexLock l(&mu_);
+    if (rate_ == 0) return;
+    Refill(now);
+    tokens_ -= bytes;
+    if (tokens_ < 0) {
+      wait_micros = static_cast<uint64_t>(-tokens_ * 1e6 / rate_);
+    }
+  }
+  if (wait && wait_micros > 0) {
+    env_->SleepForMicroseconds(static_cast<int>(std::min<uint64_t>(wait_micros, 1 << 30)));
+  }
+}
+
+void RateLimiter::RecordReadLatency(uint64_t micros) {
+  uint64_t now = env_->NowMicros();
+  bool busy = now < last_write_micros_.load(std::memory_order_relaxed) + kBusyMicros;
+  MutexLock l(&mu_);
+  if (busy) {
+    busy_latency_sum_ += micros;
+    busy_reads_++;
+  } else if (idle_latency_ == 0) {
+    idle_latency_ = micros;
+  } else {
+    idle_latency_ += (micros - idle_latency_) / 16;
+  }
+  if (now >= last_adjust_micros_ + kAdjustMicros) {
+    Adjust(now);
+  }
+}
+
+// Backs off by a fifth while the reads overlapping table writes take
+// half again as long as the others, and recovers by a tenth per interval
+// once they do not
+void RateLimiter::Adjust(uint64_t now) {
+  last_adjust_micros_ = now;
+  if (!AutoTune() || configured_rate_ == 0 || idle_latency_ == 0) return;
+  Refill(now);
+  double busy_latency = busy_reads_ > 0
+      ? static_cast<double>(busy_latency_sum_) / busy_reads_ : 0;
+  busy_latency_sum_ = 0;
+  busy_reads_ = 0;
+  uint64_t min_rate = std::max<uint64_t>(configured_rate_ / kMinRateDivisor, 1);
+  if (busy_latency > 1.5 * idle_latency_) {
+    rate_ = std::max(min_rate, rate_ * 4 / 5);
+  } else if (rate_ < configured_rate_) {
+    rate_ = std::min(configured_rate_, rate_ + std::max<uint64_t>(rate_ / 10, 1));
+  }
+}
+
+namespace {
+
+class LimitedFile : public WritableFile {
+ public:
+  LimitedFile(RateLimiter* limiter, WritableFile* file, bool wait)
+      : limiter_(limiter), file_(file), wait_(wait) { }
+  ~LimitedFile() { delete file_; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), wait_);
+    return file_->Append(data);
+  }
+  virtual Status Close() { return file_->Close(); }
+  virtual Status Flush() { return file_->Flush(); }
+  virtual Status Sync() { return file_->Sync(); }
+
+ private:
+  RateLimiter* const limiter_;
+  WritableFile* const file_;
+  const bool wait_;
+};
+
+}  // anonymous namespace
+
+WritableFile* RateLimiter::Wrap(WritableFile* file, bool wait) {
+  return new LimitedFile(this, file, wait);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,80 @@
+#ifndef STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "port/port.h"
+#include "port/thread_annotations.h"
+
+namespace leveldb {
+
+class Env;
+class WritableFile;
+
+// Token bucket shared by the table files written by memtable flushes and
+// merges.  Writers take tokens before each append and may run the bucket
+// into debt, which the next waiting writer sleeps off.  A rate of 0 means
+// no limit.
+//
+// In auto mode the rate follows the read latency reported through
+// RecordReadLatency(): it is cut while reads that overlap table writes are
+// clearly slower than reads that do not, and raised back towards the
+// configured rate otherwise.
+class RateLimiter {
+ public:
+  RateLimiter(Env* env, uint64_t bytes_per_second, bool auto_tune);
+
+  // Changes the configured rate, 0 for no limit.  Resets the rate found
+  // by auto mode.
+  void SetBytesPerSecond(uint64_t bytes_per_second);
+  uint64_t GetBytesPerSecond();
+
+  // The rate writers are held to at the moment, below the configured
+  // rate while auto mode is backing off
+  uint64_t CurrentBytesPerSecond();
+
+  void SetAutoTune(bool auto_tune);
+  bool AutoTune() const { return auto_tune_.load(std::memory_order_relaxed); }
+
+  // Takes bytes tokens.  If wait is set, sleeps until the bucket is out
+  // of debt, otherwise only leaves the debt to the next waiting writer.
+  void Request(size_t bytes, bool wait);
+
+  // Reports the latency of one foreground read, for auto mode
+  void RecordReadLatency(uint64_t micros);
+
+  // Returns a file that forwards to file and calls Request before each
+  // append.  The returned file owns file.
+  WritableFile* Wrap(WritableFile* file, bool wait);
+
+ private:
+  void Refill(uint64_t now) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+  void Adjust(uint64_t now) EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  Env* const env_;
+  std::atomic<bool> auto_tune_;
+  std::atomic<uint64_t> last_write_micros_;
+
+  // State below is protected by mu_
+  port::Mutex mu_;
+  uint64_t configured_rate_;
+  uint64_t rate_;
+  double tokens_;
+  uint64_t last_refill_micros_;
+
+  // Auto mode: average latency of reads with no table writes going on,
+  // and the latencies of reads during writes since the last adjustment
+  double idle_latency_;
+  uint64_t busy_latency_sum_;
+  uint64_t busy_reads_;
+  uint64_t last_adjust_micros_;
+
+  // No copying allowed
+  RateLimiter(const RateLimiter&);
+  void operator=(const RateLimiter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_UTIL_RATE_LIMITER_H_
@@ -0,0 +1,114 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+// Clock that only moves when told to, sleeps included
+class ManualClockEnv : public EnvWrapper {
+ public:
+  uint64_t now_micros;
+  uint64_t slept_micros;
+
+  ManualClockEnv() : EnvWrapper(Env::Default()), now_micros(1000000), slept_micros(0) { }
+
+  virtual uint64_t NowMicros() { return now_micros; }
+
+  virtual void SleepForMicroseconds(int micros) {
+    slept_micros += micros;
+    now_micros += micros;
+  }
+
+  virtual bool IsSchedulerEmpty() { return target()->IsSchedulerEmpty(); }
+};
+
+class RateLimiterTest {
+ public:
+  ManualClockEnv env_;
+};
+
+TEST(RateLimiterTest, Unlimited) {
+  RateLimiter limiter(&env_, 0, false);
+  limiter.Request(1 << 30, true);
+  ASSERT_EQ(0, env_.slept_micros);
+}
+
+TEST(RateLimiterTest, SleepsOffDebt) {
+  RateLimiter limiter(&env_, 1000000, false);
+  // the bucket starts empty
+  limiter.Request(100000, true);
+  ASSERT_EQ(100000, env_.slept_micros);
+
+  // a writer that does not wait leaves its debt to the next one
+  env_.slept_micros = 0;
+  limiter.Request(50000, false);
+  ASSERT_EQ(0, env_.slept_micros);
+  limiter.Request(50000, true);
+  ASSERT_EQ(100000, env_.slept_micros);
+}
+
+TEST(RateLimiterTest, BurstIsCapped) {
+  RateLimiter limiter(&env_, 1000000, false);
+  // a long idle time fills the bucket with 100ms worth of tokens only
+  env_.now_micros += 10000000;
+  limiter.Request(100000, true);
+  ASSERT_EQ(0, env_.slept_micros);
+  limiter.Request(50000, true);
+  ASSERT_EQ(50000, env_.slept_micros);
+}
+
+TEST(RateLimiterTest, SetBytesPerSecond) {
+  RateLimiter limiter(&env_, 1000000, false);
+  env_.now_micros += 50000;
+  limiter.Request(100000, false);
+  // the debt is kept, the rate changes at once
+  limiter.SetBytesPerSecond(2000000);
+  ASSERT_EQ(2000000, limiter.GetBytesPerSecond());
+  ASSERT_EQ(2000000, limiter.CurrentBytesPerSecond());
+  limiter.Request(50000, true);
+  ASSERT_EQ(50000, env_.slept_micros);
+}
+
+TEST(RateLimiterTest, AutoTune) {
+  RateLimiter limiter(&env_, 1600000, true);
+  limiter.RecordReadLatency(100);
+
+  // reads overlapping table writes take twice as long: a fifth off per
+  // interval, down to a sixteenth of the configured rate
+  env_.now_micros += 100000;
+  limiter.Request(1, false);
+  limiter.RecordReadLatency(200);
+  ASSERT_EQ(1280000, limiter.CurrentBytesPerSecond());
+  for (int i = 0; i < 20; i++) {
+    env_.now_micros += 100000;
+    limiter.Request(1, false);
+    limiter.RecordReadLatency(200);
+  }
+  ASSERT_EQ(100000, limiter.CurrentBytesPerSecond());
+
+  // no write overlaps the reads: a tenth back per interval
+  env_.now_micros += 100000;
+  limiter.RecordReadLatency(100);
+  ASSERT_EQ(110000, limiter.CurrentBytesPerSecond());
+
+  // reads slower by less than half do not count as slowed down
+  env_.now_micros += 100000;
+  limiter.Request(1, false);
+  limiter.RecordReadLatency(140);
+  ASSERT_EQ(121000, limiter.CurrentBytesPerSecond());
+
+  limiter.SetAutoTune(false);
+  ASSERT_EQ(1600000, limiter.CurrentBytesPerSecond());
+  ASSERT_EQ(1600000, limiter.GetBytesPerSecond());
+}
+
+}  // namespace leveldb
+
+int main() {
+  return leveldb::test::RunAllTests();
+}